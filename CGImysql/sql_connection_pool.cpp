@@ -2,9 +2,10 @@
 #include <mysql/mysql.h>
 #include <algorithm>
 #include <cstdlib>
-#include <iostream>
 #include <list>
+#include "../log/log.h"
 connection_poll::connection_poll() {
+  max_conn = 0;
   current_conn = 0;
   free_conn = 0;
 }
@@ -18,7 +19,8 @@ connection_poll::~connection_poll() {
 }
 void connection_poll::init(std::string url, std::string user,
                            std::string password, std::string database_name,
-                           int port, int max_conn, int close_log) {
+                           int port, int max_conn, int close_log,
+                           int stmt_cache_size) {
   _url = url;
   _user = user;
   _password = password;
@@ -27,26 +29,29 @@ void connection_poll::init(std::string url, std::string user,
   _close_log = close_log;
 
   for (int i = 0; i < max_conn; i++) {
-    MYSQL *con = nullptr;
-    con = mysql_init(con);
+    // MYSQL 结构由连接池分配，mysql_close 不会释放它，重连时可以原地复用
+    MYSQL *con = new MYSQL;
 
-    if (con == nullptr) {
-      std::cout << "Error: " << mysql_error(con);
-      exit(1);
-    }
-
-    con = mysql_real_connect(con, url.c_str(), user.c_str(), password.c_str(), database_name.c_str(), port, nullptr, 0);
-
-    if (con == nullptr) {
-      std::cout << "Error: " << mysql_error(con);
+    if (!Connect(con)) {
+      LOG_ERROR("MySQL Error: %s", mysql_error(con));
+      Log::get_instance()->flush();
       exit(1);
     }
 
     conn_list.push_back(con);
+    stmt_caches[con] = new sql_stmt_cache(con, stmt_cache_size);
     ++free_conn;
   }
   reserve = sem(free_conn);
-  max_conn = free_conn;
+  this->max_conn = free_conn;
+}
+bool connection_poll::Connect(MYSQL *con) {
+  if (mysql_init(con) == nullptr) {
+    return false;
+  }
+  return mysql_real_connect(con, _url.c_str(), _user.c_str(),
+                            _password.c_str(), _database_name.c_str(), _port,
+                            nullptr, 0) != nullptr;
 }
 MYSQL *connection_poll::GetConnection() {
   MYSQL *con = nullptr;
@@ -67,6 +72,21 @@ MYSQL *connection_poll::GetConnection() {
   lock.unlock();
   return con;
 }
+MYSQL *connection_poll::TryGetConnection() {
+  if (!reserve.trywait()) {
+    return nullptr;
+  }
+  lock.lock();
+
+  MYSQL *con = conn_list.front();
+  conn_list.pop_front();
+
+  --free_conn;
+  ++current_conn;
+
+  lock.unlock();
+  return con;
+}
 bool connection_poll::ReleaseConnection(MYSQL *conn) {
   if (conn == nullptr) {
     return false;
@@ -86,13 +106,42 @@ bool connection_poll::ReleaseConnection(MYSQL *conn) {
 int connection_poll::GetFreeConn() {
   return this->free_conn;
 }
+int connection_poll::GetMaxConn() {
+  return this->max_conn;
+}
+sql_stmt_cache *connection_poll::GetStmtCache(MYSQL *conn) {
+  // stmt_caches 在 init 之后只读，无需加锁
+  std::unordered_map<MYSQL *, sql_stmt_cache *>::iterator it =
+      stmt_caches.find(conn);
+  if (it == stmt_caches.end()) {
+    return nullptr;
+  }
+  return it->second;
+}
+bool connection_poll::Reconnect(MYSQL *conn) {
+  sql_stmt_cache *cache = GetStmtCache(conn);
+  if (cache == nullptr) {
+    return false;
+  }
+  // 旧连接上的语句句柄全部作废，下次使用时重新 prepare
+  cache->Invalidate();
+  mysql_close(conn);
+  return Connect(conn);
+}
 void connection_poll::DestroyPool() {
   lock.lock();
+  // 语句句柄需要在连接关闭之前释放
+  std::unordered_map<MYSQL *, sql_stmt_cache *>::iterator cit;
+  for (cit = stmt_caches.begin(); cit != stmt_caches.end(); ++cit) {
+    delete cit->second;
+  }
+  stmt_caches.clear();
   if (conn_list.size() > 0) {
     std::list<MYSQL *>::iterator it;
     for (it = conn_list.begin(); it != conn_list.end(); ++it) {
       MYSQL *con = *it;
       mysql_close(con);
+      delete con;
     }
     current_conn =0;
     free_conn = 0;
@@ -3,8 +3,10 @@
 
 #include <list>
 #include <string>
+#include <unordered_map>
 #include <mysql/mysql.h>
 #include "../lock/locker.h"
+#include "sql_stmt_cache.h"
 
 /**
  * @class connection_poll
@@ -24,6 +26,16 @@ class connection_poll {
   locker lock;        ///< 互斥锁
   std::list<MYSQL *> conn_list; ///< 连接池列表
   sem reserve;        ///< 信号量，用于指示是否有连接可用
+  /// 每个连接各自的预处理语句缓存，连接对象地址在重连前后保持不变
+  std::unordered_map<MYSQL *, sql_stmt_cache *> stmt_caches;
+
+  /**
+   * @brief 在调用方提供的 MYSQL 结构上建立连接
+   *
+   * @param con 由连接池分配的 MYSQL 结构
+   * @return bool 是否连接成功
+   */
+  bool Connect(MYSQL *con);
  public:
   /**
    * @brief 获取连接池的单例实例
@@ -41,14 +53,21 @@ class connection_poll {
    * @param port 数据库端口
    * @param max_conn 最大连接数
    * @param close_log 是否关闭日志
+   * @param stmt_cache_size 每个连接缓存的预处理语句数量上限
    */
-  void init(std::string url, std::string user, std::string password, std::string database_name, int port, int max_conn, int close_log);
+  void init(std::string url, std::string user, std::string password, std::string database_name, int port, int max_conn, int close_log, int stmt_cache_size = 64);
   /**
    * @brief 从池中获取一个可用连接
    *
    * @return MYSQL* MYSQL连接指针
    */
   MYSQL *GetConnection();
+  /**
+   * @brief 不阻塞地获取连接，供事件循环中的协程使用
+   *
+   * @return MYSQL* 没有空闲连接时返回 nullptr
+   */
+  MYSQL *TryGetConnection();
   /**
    * @brief 释放连接回池中
    *
@@ -62,13 +81,34 @@ class connection_poll {
    * @return int 空闲连接数
    */
   int GetFreeConn();
+  /**
+   * @brief 连接总数，未初始化时为 0
+   *
+   * @return int 连接总数
+   */
+  int GetMaxConn();
+  /**
+   * @brief 获取连接附带的预处理语句缓存
+   *
+   * @param conn 通过 GetConnection 取得的连接
+   * @return sql_stmt_cache* 缓存指针，conn 不属于本池时返回 nullptr
+   */
+  sql_stmt_cache *GetStmtCache(MYSQL *conn);
+  /**
+   * @brief 连接断开后原地重建连接
+   * 连接对象地址保持不变，已缓存的预处理语句会在下次使用时重新 prepare
+   *
+   * @param conn 已断开的连接
+   * @return bool 重连是否成功
+   */
+  bool Reconnect(MYSQL *conn);
   /**
    * @brief 销毁连接池
    */
   void DestroyPool();
 
   std::string _url;           ///< 主机地址
-  std::string _port;          ///< 数据库端口
+  int _port;                  ///< 数据库端口
   std::string _user;          ///< 数据库登陆用户名
   std::string _password;      ///< 数据库登陆密码
   std::string _database_name; ///< 使用的数据库名
@@ -0,0 +1,341 @@
+#include "sql_result_cache.h"
+
+#include <mysql/mysql.h>
+#include <time.h>
+
+#include <string>
+
+// 每个条目除结果数据外的固定开销估算(节点、索引、键)
+static const size_t ENTRY_OVERHEAD = 128;
+
+static long long now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+sql_result_cache::sql_result_cache()
+    : m_pool(nullptr),
+      m_shard_bytes(0),
+      m_hits(0),
+      m_misses(0),
+      m_coalesced(0),
+      m_evictions(0),
+      m_expired(0) {}
+
+sql_result_cache::~sql_result_cache() {
+  for (size_t i = 0; i < m_shards.size(); i++) {
+    delete m_shards[i];
+  }
+}
+
+sql_result_cache *sql_result_cache::GetInstance() {
+  static sql_result_cache cache;
+  return &cache;
+}
+
+void sql_result_cache::init(connection_poll *pool, size_t max_bytes,
+                            int shard_num) {
+  if (shard_num <= 0) {
+    shard_num = 1;
+  }
+  m_pool = pool;
+  for (int i = 0; i < shard_num; i++) {
+    m_shards.push_back(new shard);
+  }
+  m_shard_bytes = max_bytes / shard_num;
+  if (!m_loader) {
+    m_loader = std::bind(&sql_result_cache::LoadFromPool, this,
+                         std::placeholders::_1, std::placeholders::_2);
+  }
+}
+
+void sql_result_cache::SetLoader(const loader_func &loader) {
+  m_loader = loader;
+}
+
+sql_result_cache::shard &sql_result_cache::ShardFor(const std::string &key) {
+  return *m_shards[std::hash<std::string>()(key) % m_shards.size()];
+}
+
+// 调用者需持有分片锁
+void sql_result_cache::Erase(shard &s, entry_list::iterator it) {
+  for (size_t i = 0; i < it->tags.size(); i++) {
+    std::unordered_map<std::string, std::unordered_set<std::string> >::iterator
+        tit = s.tags.find(it->tags[i]);
+    if (tit != s.tags.end()) {
+      tit->second.erase(it->key);
+      if (tit->second.empty()) {
+        s.tags.erase(tit);
+      }
+    }
+  }
+  s.bytes -= it->bytes;
+  s.index.erase(it->key);
+  s.lru.erase(it);
+}
+
+// 调用者需持有分片锁
+bool sql_result_cache::Insert(shard &s, const std::string &key,
+                              const sql_result_ptr &value, int ttl_ms,
+                              const std::vector<std::string> &tags) {
+  size_t bytes = value->bytes + key.size() + ENTRY_OVERHEAD;
+  // 单条结果超过分片上限时不缓存，避免把整个分片清空
+  if (bytes > m_shard_bytes || ttl_ms <= 0) {
+    return false;
+  }
+
+  std::unordered_map<std::string, entry_list::iterator>::iterator it =
+      s.index.find(key);
+  if (it != s.index.end()) {
+    Erase(s, it->second);
+  }
+
+  // 从表尾淘汰最久未使用的条目，直到有足够空间
+  while (!s.lru.empty() && s.bytes + bytes > m_shard_bytes) {
+    Erase(s, --s.lru.end());
+    ++m_evictions;
+  }
+
+  entry e;
+  e.key = key;
+  e.value = value;
+  e.expire_ms = now_ms() + ttl_ms;
+  e.tags = tags;
+  e.bytes = bytes;
+  s.lru.push_front(e);
+  s.index[key] = s.lru.begin();
+  for (size_t i = 0; i < tags.size(); i++) {
+    s.tags[tags[i]].insert(key);
+  }
+  s.bytes += bytes;
+  return true;
+}
+
+// 调用者需持有分片锁，过期的条目顺便删除
+bool sql_result_cache::Find(shard &s, const std::string &key,
+                            sql_result_ptr *value) {
+  std::unordered_map<std::string, entry_list::iterator>::iterator it =
+      s.index.find(key);
+  if (it == s.index.end()) {
+    return false;
+  }
+  if (it->second->expire_ms <= now_ms()) {
+    Erase(s, it->second);
+    ++m_expired;
+    return false;
+  }
+  s.lru.splice(s.lru.begin(), s.lru, it->second);
+  *value = it->second->value;
+  return true;
+}
+
+sql_result_ptr sql_result_cache::Query(const std::string &sql, int ttl_ms,
+                                       const std::vector<std::string> &tags) {
+  sql_result_ptr value;
+  unsigned long long seq = 0;
+  if (m_shards.empty()) {
+    // 尚未 init：不缓存，直接加载
+    std::shared_ptr<sql_result> result = std::make_shared<sql_result>();
+    if (m_loader && m_loader(sql, result.get())) {
+      value = result;
+    }
+    return value;
+  }
+
+  shard &s = ShardFor(sql);
+  s.lock.lock();
+  if (Find(s, sql, &value)) {
+    s.lock.unlock();
+    ++m_hits;
+    return value;
+  }
+
+  // 已有线程在加载同一查询，等待它的结果
+  std::unordered_map<std::string, std::shared_ptr<flight> >::iterator fit =
+      s.flights.find(sql);
+  if (fit != s.flights.end()) {
+    std::shared_ptr<flight> f = fit->second;
+    while (!f->done) {
+      f->done_cond.wait(s.lock.get());
+    }
+    s.lock.unlock();
+    ++m_coalesced;
+    return f->value;
+  }
+
+  // 由当前线程负责加载
+  s.flights[sql] = std::make_shared<flight>();
+  seq = s.invalidate_seq;
+  s.lock.unlock();
+  ++m_misses;
+
+  // 不持锁访问数据库
+  std::shared_ptr<sql_result> result = std::make_shared<sql_result>();
+  if (m_loader && m_loader(sql, result.get())) {
+    value = result;
+  }
+  Fill(sql, value, ttl_ms, tags, seq);
+  return value;
+}
+
+sql_result_cache::lookup_result sql_result_cache::Lookup(
+    const std::string &sql, bool waited, sql_result_ptr *value,
+    unsigned long long *seq) {
+  *seq = 0;
+  if (m_shards.empty()) {
+    return LOOKUP_LOAD;
+  }
+  shard &s = ShardFor(sql);
+  s.lock.lock();
+  if (Find(s, sql, value)) {
+    s.lock.unlock();
+    if (waited) {
+      ++m_coalesced;
+    } else {
+      ++m_hits;
+    }
+    return LOOKUP_HIT;
+  }
+  if (s.flights.count(sql)) {
+    s.lock.unlock();
+    return LOOKUP_WAIT;
+  }
+  s.flights[sql] = std::make_shared<flight>();
+  *seq = s.invalidate_seq;
+  s.lock.unlock();
+  ++m_misses;
+  return LOOKUP_LOAD;
+}
+
+void sql_result_cache::Fill(const std::string &sql, const sql_result_ptr &value,
+                            int ttl_ms, const std::vector<std::string> &tags,
+                            unsigned long long seq) {
+  if (m_shards.empty()) {
+    return;
+  }
+  shard &s = ShardFor(sql);
+  std::shared_ptr<flight> f;
+  s.lock.lock();
+  // 加载期间如果发生过失效，结果仍然返回给等待者，但不写入缓存
+  if (value && seq == s.invalidate_seq) {
+    Insert(s, sql, value, ttl_ms, tags);
+  }
+  std::unordered_map<std::string, std::shared_ptr<flight> >::iterator fit =
+      s.flights.find(sql);
+  if (fit != s.flights.end()) {
+    f = fit->second;
+    f->value = value;
+    f->done = true;
+    s.flights.erase(fit);
+  }
+  s.lock.unlock();
+  if (f) {
+    f->done_cond.broadcast();
+  }
+}
+
+void sql_result_cache::InvalidateTag(const std::string &tag) {
+  for (size_t i = 0; i < m_shards.size(); i++) {
+    shard &s = *m_shards[i];
+    s.lock.lock();
+    ++s.invalidate_seq;
+    std::unordered_map<std::string, std::unordered_set<std::string> >::iterator
+        tit = s.tags.find(tag);
+    if (tit != s.tags.end()) {
+      // Erase 会修改标签索引，先拷贝出键列表
+      std::vector<std::string> keys(tit->second.begin(), tit->second.end());
+      for (size_t k = 0; k < keys.size(); k++) {
+        std::unordered_map<std::string, entry_list::iterator>::iterator it =
+            s.index.find(keys[k]);
+        if (it != s.index.end()) {
+          Erase(s, it->second);
+        }
+      }
+    }
+    s.lock.unlock();
+  }
+}
+
+void sql_result_cache::Clear() {
+  for (size_t i = 0; i < m_shards.size(); i++) {
+    shard &s = *m_shards[i];
+    s.lock.lock();
+    ++s.invalidate_seq;
+    s.lru.clear();
+    s.index.clear();
+    s.tags.clear();
+    s.bytes = 0;
+    s.lock.unlock();
+  }
+}
+
+sql_result_cache_stats sql_result_cache::GetStats() {
+  sql_result_cache_stats stats;
+  stats.hits = m_hits;
+  stats.misses = m_misses;
+  stats.coalesced = m_coalesced;
+  stats.evictions = m_evictions;
+  stats.expired = m_expired;
+  stats.entries = 0;
+  stats.bytes = 0;
+  for (size_t i = 0; i < m_shards.size(); i++) {
+    shard &s = *m_shards[i];
+    s.lock.lock();
+    stats.entries += s.index.size();
+    stats.bytes += s.bytes;
+    s.lock.unlock();
+  }
+  return stats;
+}
+
+/*
+ * 默认加载函数：从连接池取连接执行查询，把结果整体拷贝出来
+ */
+bool sql_result_cache::LoadFromPool(const std::string &sql, sql_result *out) {
+  if (m_pool == nullptr) {
+    return false;
+  }
+  MYSQL *mysql = nullptr;
+  connectionRAII mysqlcon(&mysql, m_pool);
+  if (mysql == nullptr) {
+    return false;
+  }
+  if (mysql_real_query(mysql, sql.c_str(), sql.size()) != 0) {
+    return false;
+  }
+  MYSQL_RES *res = mysql_store_result(mysql);
+  if (res == nullptr) {
+    return false;
+  }
+  CopyResult(res, out);
+  mysql_free_result(res);
+  return true;
+}
+
+void sql_result_cache::CopyResult(MYSQL_RES *res, sql_result *out) {
+  unsigned int num_fields = mysql_num_fields(res);
+  MYSQL_FIELD *fields = mysql_fetch_fields(res);
+  out->columns.reserve(num_fields);
+  for (unsigned int i = 0; i < num_fields; i++) {
+    out->columns.push_back(fields[i].name);
+    out->bytes += out->columns.back().size() + sizeof(std::string);
+  }
+
+  out->rows.reserve(mysql_num_rows(res));
+  MYSQL_ROW row;
+  while ((row = mysql_fetch_row(res)) != nullptr) {
+    unsigned long *lengths = mysql_fetch_lengths(res);
+    out->rows.push_back(std::vector<std::string>());
+    std::vector<std::string> &r = out->rows.back();
+    r.reserve(num_fields);
+    for (unsigned int i = 0; i < num_fields; i++) {
+      if (row[i]) {
+        r.push_back(std::string(row[i], lengths[i]));
+      } else {
+        r.push_back(std::string());
+      }
+      out->bytes += lengths[i] + sizeof(std::string);
+    }
+  }
+}
@@ -0,0 +1,192 @@
+#ifndef SQL_RESULT_CACHE_H
+#define SQL_RESULT_CACHE_H
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "../lock/locker.h"
+#include "sql_connection_pool.h"
+
+/**
+ * @struct sql_result
+ * @brief 缓存的查询结果，所有字段都以字符串形式保存
+ */
+struct sql_result {
+  std::vector<std::string> columns;            ///< 列名
+  std::vector<std::vector<std::string> > rows; ///< 行数据，NULL 保存为空串
+  size_t bytes;                                ///< 估算的内存占用
+
+  sql_result() : bytes(0) {}
+};
+
+typedef std::shared_ptr<const sql_result> sql_result_ptr;
+
+/**
+ * @struct sql_result_cache_stats
+ * @brief 结果缓存的统计信息快照
+ */
+struct sql_result_cache_stats {
+  unsigned long long hits;       ///< 命中次数
+  unsigned long long misses;     ///< 未命中且实际查询数据库的次数
+  unsigned long long coalesced;  ///< 未命中但合并到他人查询上的次数
+  unsigned long long evictions;  ///< 因内存上限被淘汰的条目数
+  unsigned long long expired;    ///< 因 TTL 过期被丢弃的条目数
+  size_t entries;                ///< 当前条目数
+  size_t bytes;                  ///< 当前占用字节数
+
+  /**
+   * @brief 命中率，合并等待的请求也计为命中(它们没有访问数据库)
+   */
+  double HitRatio() const {
+    unsigned long long total = hits + misses + coalesced;
+    return total == 0 ? 0.0 : (double)(hits + coalesced) / total;
+  }
+};
+
+/**
+ * @class sql_result_cache
+ * @brief 位于 connection_poll 之前的读穿透查询结果缓存
+ *
+ * - 按 SQL 文本哈希分片，每个分片独立加锁并独立做 LRU 淘汰
+ * - 总内存有上限，按分片平均分配
+ * - 每条查询可以指定 TTL 以及所依赖的表标签，写表后按标签失效
+ * - 单飞(single-flight)：同一 SQL 的并发未命中只会有一个线程访问数据库，
+ *   其余线程等待该结果
+ *
+ * Query 在未命中时阻塞调用线程；事件循环中的协程改用 Lookup/Fill，
+ * 自己不阻塞地执行查询(见 coro/db.h 的 db_cached_query)。
+ * init 之前不缓存，Query 直接调用加载函数。
+ */
+class sql_result_cache {
+ public:
+  /**
+   * @brief 加载函数：执行 sql 并填充 out，返回是否成功
+   */
+  typedef std::function<bool(const std::string &sql, sql_result *out)>
+      loader_func;
+
+  // Lookup 的结果
+  enum lookup_result {
+    LOOKUP_HIT = 0,  ///< 命中，结果已取出
+    LOOKUP_LOAD,     ///< 未命中，由调用者加载，完成后必须调用 Fill
+    LOOKUP_WAIT      ///< 其他调用者正在加载同一查询，稍后重试
+  };
+
+  static sql_result_cache *GetInstance();
+
+  /**
+   * @brief 初始化缓存
+   *
+   * @param pool 未命中时使用的数据库连接池
+   * @param max_bytes 缓存占用内存上限
+   * @param shard_num 分片数量
+   */
+  void init(connection_poll *pool, size_t max_bytes, int shard_num = 16);
+  /**
+   * @brief 替换默认的加载函数(默认通过连接池执行 mysql_query)
+   */
+  void SetLoader(const loader_func &loader);
+
+  /**
+   * @brief 读穿透查询
+   *
+   * @param sql 查询语句，同时也是缓存键
+   * @param ttl_ms 结果的有效期(毫秒)
+   * @param tags 查询依赖的表标签，用于 InvalidateTag
+   * @return sql_result_ptr 查询结果，数据库出错时返回空指针(不缓存)
+   */
+  sql_result_ptr Query(const std::string &sql, int ttl_ms,
+                       const std::vector<std::string> &tags);
+  /**
+   * @brief 不阻塞的查找
+   *
+   * @param waited 此前已得到过 LOOKUP_WAIT，这次命中计为合并
+   * @param[out] value 命中时的结果
+   * @param[out] seq LOOKUP_LOAD 时的失效序号，原样交给 Fill
+   */
+  lookup_result Lookup(const std::string &sql, bool waited,
+                       sql_result_ptr *value, unsigned long long *seq);
+  /**
+   * @brief 结束 LOOKUP_LOAD 的加载，value 为空表示失败(不缓存)
+   */
+  void Fill(const std::string &sql, const sql_result_ptr &value, int ttl_ms,
+            const std::vector<std::string> &tags, unsigned long long seq);
+  /**
+   * @brief 使依赖某个表标签的全部缓存条目失效
+   * 正在进行中的加载在完成后也不会写入缓存
+   */
+  void InvalidateTag(const std::string &tag);
+  /**
+   * @brief 清空缓存
+   */
+  void Clear();
+  /**
+   * @brief 获取统计信息快照
+   */
+  sql_result_cache_stats GetStats();
+
+  /**
+   * @brief 把结果集整体拷贝到 out 中，不释放 res
+   */
+  static void CopyResult(MYSQL_RES *res, sql_result *out);
+
+ private:
+  sql_result_cache();
+  ~sql_result_cache();
+
+  struct entry {
+    std::string key;
+    sql_result_ptr value;
+    long long expire_ms;
+    std::vector<std::string> tags;
+    size_t bytes;
+  };
+  typedef std::list<entry> entry_list;
+
+  // 一次进行中的加载，等待者在 done_cond 上等待
+  struct flight {
+    cond done_cond;
+    bool done;
+    sql_result_ptr value;
+
+    flight() : done(false) {}
+  };
+
+  struct shard {
+    locker lock;
+    entry_list lru;  ///< 表头为最近使用
+    std::unordered_map<std::string, entry_list::iterator> index;
+    std::unordered_map<std::string, std::unordered_set<std::string> > tags;
+    std::unordered_map<std::string, std::shared_ptr<flight> > flights;
+    size_t bytes;
+    unsigned long long invalidate_seq;  ///< 每次按标签失效时递增
+
+    shard() : bytes(0), invalidate_seq(0) {}
+  };
+
+  shard &ShardFor(const std::string &key);
+  bool Find(shard &s, const std::string &key, sql_result_ptr *value);
+  void Erase(shard &s, entry_list::iterator it);
+  bool Insert(shard &s, const std::string &key, const sql_result_ptr &value,
+              int ttl_ms, const std::vector<std::string> &tags);
+  bool LoadFromPool(const std::string &sql, sql_result *out);
+
+  connection_poll *m_pool;
+  loader_func m_loader;
+  std::vector<shard *> m_shards;
+  size_t m_shard_bytes;  ///< 每个分片的内存上限
+
+  std::atomic<unsigned long long> m_hits;
+  std::atomic<unsigned long long> m_misses;
+  std::atomic<unsigned long long> m_coalesced;
+  std::atomic<unsigned long long> m_evictions;
+  std::atomic<unsigned long long> m_expired;
+};
+
+#endif  // !SQL_RESULT_CACHE_H
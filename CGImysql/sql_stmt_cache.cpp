@@ -0,0 +1,412 @@
+#include "sql_stmt_cache.h"
+
+#include <mysql/errmsg.h>
+#include <mysql/mysql.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "sql_connection_pool.h"
+
+// 服务端不认识语句句柄(例如服务端重启过)，见 mysqld_error.h
+static const unsigned int ER_UNKNOWN_STMT_HANDLER_CODE = 1243;
+// 字符串结果列的初始缓冲区大小，截断时再按实际长度扩大
+static const unsigned long INITIAL_STRING_BUFFER = 256;
+
+// 连接已断开或句柄已失效，需要重连后重新 prepare
+static bool need_reprepare(unsigned int err) {
+  return err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST ||
+         err == ER_UNKNOWN_STMT_HANDLER_CODE;
+}
+
+// ---sql_stmt 类实现 ---
+
+sql_stmt::sql_stmt(MYSQL *conn, const std::string &sql)
+    : m_conn(conn), m_stmt(nullptr), m_sql(sql), m_errno(0), m_stale(true) {}
+
+sql_stmt::~sql_stmt() { CloseHandle(); }
+
+void sql_stmt::CloseHandle() {
+  if (m_stmt) {
+    mysql_stmt_close(m_stmt);
+    m_stmt = nullptr;
+  }
+}
+
+void sql_stmt::SetError() {
+  if (m_stmt) {
+    m_errno = mysql_stmt_errno(m_stmt);
+    m_error = mysql_stmt_error(m_stmt);
+  } else {
+    m_errno = mysql_errno(m_conn);
+    m_error = mysql_error(m_conn);
+  }
+}
+
+bool sql_stmt::Prepare() {
+  CloseHandle();
+  m_stale = true;
+
+  m_stmt = mysql_stmt_init(m_conn);
+  if (m_stmt == nullptr) {
+    SetError();
+    return false;
+  }
+  if (mysql_stmt_prepare(m_stmt, m_sql.c_str(), m_sql.size()) != 0) {
+    SetError();
+    CloseHandle();
+    return false;
+  }
+
+  // 参数个数在重新 prepare 后不会改变，已绑定的值予以保留
+  size_t param_count = mysql_stmt_param_count(m_stmt);
+  if (m_params.size() != param_count) {
+    m_params.assign(param_count, param_buf());
+    for (size_t i = 0; i < param_count; i++) {
+      m_params[i].type = MYSQL_TYPE_NULL;
+      m_params[i].num.i64 = 0;
+      m_params[i].length = 0;
+      m_params[i].is_null = true;
+    }
+    m_param_bind.assign(param_count, MYSQL_BIND());
+  }
+
+  if (!BindResult()) {
+    CloseHandle();
+    return false;
+  }
+  m_stale = false;
+  return true;
+}
+
+/*
+ * 按结果集元数据为每一列分配缓冲区
+ * 整数类列统一以 LONGLONG 接收，浮点类以 DOUBLE 接收，其余按字符串接收
+ */
+bool sql_stmt::BindResult() {
+  MYSQL_RES *meta = mysql_stmt_result_metadata(m_stmt);
+  if (meta == nullptr) {
+    // 非查询语句没有结果集
+    m_fields.clear();
+    m_field_bind.clear();
+    return true;
+  }
+
+  unsigned int count = mysql_num_fields(meta);
+  MYSQL_FIELD *fields = mysql_fetch_fields(meta);
+  m_fields.resize(count);
+  m_field_bind.assign(count, MYSQL_BIND());
+
+  for (unsigned int i = 0; i < count; i++) {
+    field_buf &f = m_fields[i];
+    MYSQL_BIND &b = m_field_bind[i];
+    switch (fields[i].type) {
+      case MYSQL_TYPE_TINY:
+      case MYSQL_TYPE_SHORT:
+      case MYSQL_TYPE_LONG:
+      case MYSQL_TYPE_INT24:
+      case MYSQL_TYPE_LONGLONG:
+      case MYSQL_TYPE_YEAR: {
+        f.type = MYSQL_TYPE_LONGLONG;
+        b.buffer = &f.num.i64;
+        b.buffer_length = sizeof(f.num.i64);
+        break;
+      }
+      case MYSQL_TYPE_FLOAT:
+      case MYSQL_TYPE_DOUBLE: {
+        f.type = MYSQL_TYPE_DOUBLE;
+        b.buffer = &f.num.dbl;
+        b.buffer_length = sizeof(f.num.dbl);
+        break;
+      }
+      default: {
+        f.type = MYSQL_TYPE_STRING;
+        if (f.str.size() < INITIAL_STRING_BUFFER) {
+          f.str.resize(INITIAL_STRING_BUFFER);
+        }
+        b.buffer = f.str.data();
+        b.buffer_length = f.str.size();
+        break;
+      }
+    }
+    b.buffer_type = f.type;
+    b.length = &f.length;
+    b.is_null = &f.is_null;
+    b.error = &f.error;
+  }
+  mysql_free_result(meta);
+
+  if (mysql_stmt_bind_result(m_stmt, m_field_bind.data())) {
+    SetError();
+    return false;
+  }
+  return true;
+}
+
+sql_stmt::param_buf *sql_stmt::Param(int idx) {
+  if (idx < 0 || idx >= (int)m_params.size()) {
+    return nullptr;
+  }
+  return &m_params[idx];
+}
+
+void sql_stmt::BindNull(int idx) {
+  param_buf *p = Param(idx);
+  if (p) {
+    p->type = MYSQL_TYPE_NULL;
+    p->is_null = true;
+  }
+}
+
+void sql_stmt::BindInt(int idx, int value) { BindInt64(idx, value); }
+
+void sql_stmt::BindInt64(int idx, long long value) {
+  param_buf *p = Param(idx);
+  if (p) {
+    p->type = MYSQL_TYPE_LONGLONG;
+    p->num.i64 = value;
+    p->is_null = false;
+  }
+}
+
+void sql_stmt::BindDouble(int idx, double value) {
+  param_buf *p = Param(idx);
+  if (p) {
+    p->type = MYSQL_TYPE_DOUBLE;
+    p->num.dbl = value;
+    p->is_null = false;
+  }
+}
+
+void sql_stmt::BindString(int idx, const std::string &value) {
+  BindString(idx, value.data(), value.size());
+}
+
+void sql_stmt::BindString(int idx, const char *value, size_t len) {
+  param_buf *p = Param(idx);
+  if (p) {
+    p->type = MYSQL_TYPE_STRING;
+    // assign 复用已有容量，重复执行同一语句时不会重新分配
+    p->str.assign(value, len);
+    p->length = len;
+    p->is_null = false;
+  }
+}
+
+bool sql_stmt::ExecuteOnce() {
+  for (size_t i = 0; i < m_params.size(); i++) {
+    param_buf &p = m_params[i];
+    MYSQL_BIND &b = m_param_bind[i];
+    memset(&b, 0, sizeof(b));
+    b.buffer_type = p.type;
+    b.is_null = &p.is_null;
+    if (p.type == MYSQL_TYPE_STRING) {
+      b.buffer = (void *)p.str.data();
+      b.buffer_length = p.length;
+      b.length = &p.length;
+    } else if (p.type != MYSQL_TYPE_NULL) {
+      b.buffer = &p.num;
+    }
+  }
+
+  if (!m_params.empty() && mysql_stmt_bind_param(m_stmt, m_param_bind.data())) {
+    return false;
+  }
+  if (mysql_stmt_execute(m_stmt) != 0) {
+    return false;
+  }
+  // 把结果集一次性取到客户端，避免持有服务端游标
+  if (!m_fields.empty() && mysql_stmt_store_result(m_stmt) != 0) {
+    return false;
+  }
+  return true;
+}
+
+bool sql_stmt::Execute() {
+  // 清除上一次的错误，Fetch 返回 false 时调用者据此区分读完与出错
+  m_errno = 0;
+  m_error.clear();
+  // prepare 也可能因为连接断开而失败，同样交给下面的重连逻辑处理
+  if (!m_stale || Prepare()) {
+    mysql_stmt_free_result(m_stmt);
+    if (ExecuteOnce()) {
+      return true;
+    }
+    SetError();
+  }
+  if (!need_reprepare(m_errno)) {
+    return false;
+  }
+
+  // 连接已断开：原地重建连接后重新 prepare 并重试一次
+  if (!connection_poll::GetInstance()->Reconnect(m_conn)) {
+    CloseHandle();
+    SetError();
+    m_stale = true;
+    return false;
+  }
+  if (!Prepare()) {
+    return false;
+  }
+  if (!ExecuteOnce()) {
+    SetError();
+    return false;
+  }
+  return true;
+}
+
+bool sql_stmt::Fetch() {
+  if (m_stale || m_fields.empty()) {
+    return false;
+  }
+  int ret = mysql_stmt_fetch(m_stmt);
+  if (ret == 1 || ret == MYSQL_NO_DATA) {
+    if (ret == 1) {
+      SetError();
+    }
+    return false;
+  }
+  if (ret == MYSQL_DATA_TRUNCATED) {
+    // 字符串列超过当前缓冲区：扩大缓冲区后只重新读取被截断的列
+    for (size_t i = 0; i < m_fields.size(); i++) {
+      field_buf &f = m_fields[i];
+      MYSQL_BIND &b = m_field_bind[i];
+      if (!f.error || f.type != MYSQL_TYPE_STRING) {
+        continue;
+      }
+      f.str.resize(f.length + 1);
+      b.buffer = f.str.data();
+      b.buffer_length = f.str.size();
+      if (mysql_stmt_fetch_column(m_stmt, &b, i, 0) != 0) {
+        SetError();
+        return false;
+      }
+    }
+    // 缓冲区地址已变化，需要重新绑定，后续执行复用扩大后的缓冲区
+    mysql_stmt_bind_result(m_stmt, m_field_bind.data());
+  }
+  return true;
+}
+
+bool sql_stmt::IsNull(int col) const {
+  if (col < 0 || col >= (int)m_fields.size()) {
+    return true;
+  }
+  return m_fields[col].is_null;
+}
+
+int sql_stmt::GetInt(int col) const { return (int)GetInt64(col); }
+
+long long sql_stmt::GetInt64(int col) const {
+  if (IsNull(col)) {
+    return 0;
+  }
+  const field_buf &f = m_fields[col];
+  switch (f.type) {
+    case MYSQL_TYPE_LONGLONG:
+      return f.num.i64;
+    case MYSQL_TYPE_DOUBLE:
+      return (long long)f.num.dbl;
+    default:
+      return strtoll(GetString(col).c_str(), nullptr, 10);
+  }
+}
+
+double sql_stmt::GetDouble(int col) const {
+  if (IsNull(col)) {
+    return 0;
+  }
+  const field_buf &f = m_fields[col];
+  switch (f.type) {
+    case MYSQL_TYPE_LONGLONG:
+      return (double)f.num.i64;
+    case MYSQL_TYPE_DOUBLE:
+      return f.num.dbl;
+    default:
+      return strtod(GetString(col).c_str(), nullptr);
+  }
+}
+
+std::string sql_stmt::GetString(int col) const {
+  if (IsNull(col)) {
+    return std::string();
+  }
+  const field_buf &f = m_fields[col];
+  switch (f.type) {
+    case MYSQL_TYPE_LONGLONG:
+      return std::to_string(f.num.i64);
+    case MYSQL_TYPE_DOUBLE:
+      return std::to_string(f.num.dbl);
+    default:
+      return std::string(f.str.data(), f.length);
+  }
+}
+
+unsigned long long sql_stmt::AffectedRows() {
+  if (m_stmt == nullptr) {
+    return 0;
+  }
+  return mysql_stmt_affected_rows(m_stmt);
+}
+
+// ---sql_stmt_cache 类实现 ---
+
+sql_stmt_cache::sql_stmt_cache(MYSQL *conn, size_t capacity)
+    : m_conn(conn),
+      m_capacity(capacity > 0 ? capacity : 1),
+      m_thread_id(mysql_thread_id(conn)),
+      m_hits(0),
+      m_misses(0) {}
+
+sql_stmt_cache::~sql_stmt_cache() { Clear(); }
+
+sql_stmt *sql_stmt_cache::Get(const std::string &sql) {
+  // 线程号变化说明连接在别处被重建过，旧句柄全部失效
+  unsigned long thread_id = mysql_thread_id(m_conn);
+  if (thread_id != m_thread_id) {
+    Invalidate();
+    m_thread_id = thread_id;
+  }
+
+  std::unordered_map<std::string, lru_list::iterator>::iterator it =
+      m_index.find(sql);
+  if (it != m_index.end()) {
+    ++m_hits;
+    // 移动到表头
+    m_lru.splice(m_lru.begin(), m_lru, it->second);
+    return *it->second;
+  }
+
+  ++m_misses;
+  sql_stmt *stmt = new sql_stmt(m_conn, sql);
+  if (!stmt->Prepare() && !need_reprepare(stmt->Errno())) {
+    // SQL 本身有错，不放入缓存
+    delete stmt;
+    return nullptr;
+  }
+
+  if (m_lru.size() >= m_capacity) {
+    sql_stmt *victim = m_lru.back();
+    m_index.erase(victim->Sql());
+    m_lru.pop_back();
+    delete victim;
+  }
+  m_lru.push_front(stmt);
+  m_index[sql] = m_lru.begin();
+  return stmt;
+}
+
+void sql_stmt_cache::Invalidate() {
+  for (lru_list::iterator it = m_lru.begin(); it != m_lru.end(); ++it) {
+    (*it)->MarkStale();
+  }
+}
+
+void sql_stmt_cache::Clear() {
+  for (lru_list::iterator it = m_lru.begin(); it != m_lru.end(); ++it) {
+    delete *it;
+  }
+  m_lru.clear();
+  m_index.clear();
+}
@@ -0,0 +1,162 @@
+#ifndef SQL_STMT_CACHE_H
+#define SQL_STMT_CACHE_H
+
+#include <mysql/mysql.h>
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @class sql_stmt
+ * @brief 对 MYSQL_STMT 的封装，提供类型化的参数绑定与结果读取
+ *
+ * 参数与结果缓冲区在 Prepare 时按语句元数据一次性分配，
+ * 之后的每次执行都复用这些缓冲区，不再重复分配。
+ * 执行时若发现连接已断开，会通过 connection_poll 重连并透明地重新 prepare。
+ *
+ * 执行与读取都是阻塞调用(MySQL C API 的 mysql_stmt_* 没有非阻塞版本)，
+ * 只在事件循环以外的线程中使用：启动时读取用户表、sql_write_batcher 的写入线程。
+ * 事件循环中的协程改用文本协议的非阻塞接口，见 coro/db.h。
+ */
+class sql_stmt {
+ public:
+  sql_stmt(MYSQL *conn, const std::string &sql);
+  ~sql_stmt();
+
+  /**
+   * @brief 在当前连接上(重新)准备语句，并按元数据分配参数/结果缓冲区
+   *
+   * @return bool 是否成功
+   */
+  bool Prepare();
+
+  // 参数绑定，idx 从 0 开始，对应 SQL 中第 idx+1 个 '?'
+  void BindNull(int idx);
+  void BindInt(int idx, int value);
+  void BindInt64(int idx, long long value);
+  void BindDouble(int idx, double value);
+  void BindString(int idx, const std::string &value);
+  void BindString(int idx, const char *value, size_t len);
+
+  /**
+   * @brief 执行语句；查询语句会把结果集缓存到客户端，随后用 Fetch 逐行读取
+   *
+   * @return bool 是否成功，失败原因见 Error()
+   */
+  bool Execute();
+  /**
+   * @brief 读取下一行结果到复用的结果缓冲区
+   *
+   * @return bool 有数据返回 true，结果集读完或出错返回 false，出错时 Errno() 不为 0
+   */
+  bool Fetch();
+
+  // 读取当前行的列值，col 从 0 开始；类型不一致时自动转换
+  bool IsNull(int col) const;
+  int GetInt(int col) const;
+  long long GetInt64(int col) const;
+  double GetDouble(int col) const;
+  std::string GetString(int col) const;
+
+  int ParamCount() const { return (int)m_params.size(); }
+  int FieldCount() const { return (int)m_fields.size(); }
+  unsigned long long AffectedRows();
+  const std::string &Sql() const { return m_sql; }
+  const std::string &Error() const { return m_error; }
+  unsigned int Errno() const { return m_errno; }
+
+  /**
+   * @brief 标记语句句柄失效(连接被重建后调用)，下次执行前会重新 prepare
+   */
+  void MarkStale() { m_stale = true; }
+
+ private:
+  // 单个参数的存储，数值直接放在 union 中，字符串复用 std::string 的容量
+  struct param_buf {
+    enum_field_types type;
+    union {
+      long long i64;
+      double dbl;
+    } num;
+    std::string str;
+    unsigned long length;
+    bool is_null;
+  };
+  // 单个结果列的存储，字符串列的缓冲区在遇到截断时按需扩大并保留
+  struct field_buf {
+    enum_field_types type;
+    union {
+      long long i64;
+      double dbl;
+    } num;
+    std::vector<char> str;
+    unsigned long length;
+    bool is_null;
+    bool error;
+  };
+
+  void CloseHandle();
+  bool BindResult();
+  bool ExecuteOnce();
+  void SetError();
+  param_buf *Param(int idx);
+
+  MYSQL *m_conn;                       ///< 所属连接
+  MYSQL_STMT *m_stmt;                  ///< 语句句柄
+  std::string m_sql;                   ///< SQL 文本，同时也是缓存键
+  std::string m_error;                 ///< 最近一次错误信息
+  unsigned int m_errno;                ///< 最近一次错误码
+  bool m_stale;                        ///< 句柄是否需要重新 prepare
+  std::vector<param_buf> m_params;     ///< 参数缓冲区
+  std::vector<MYSQL_BIND> m_param_bind;
+  std::vector<field_buf> m_fields;     ///< 结果缓冲区
+  std::vector<MYSQL_BIND> m_field_bind;
+};
+
+/**
+ * @class sql_stmt_cache
+ * @brief 单个连接上的预处理语句 LRU 缓存，以 SQL 文本为键
+ *
+ * 每个池化连接持有一个缓存，只会被当前持有该连接的线程使用，因此内部不加锁。
+ */
+class sql_stmt_cache {
+ public:
+  sql_stmt_cache(MYSQL *conn, size_t capacity);
+  ~sql_stmt_cache();
+
+  /**
+   * @brief 获取 SQL 对应的预处理语句，未命中时 prepare 并放入缓存
+   *
+   * @param sql SQL 文本
+   * @return sql_stmt* 语句指针，prepare 失败返回 nullptr;
+   *         指针在下一次 Get 之前有效(可能被 LRU 淘汰)
+   */
+  sql_stmt *Get(const std::string &sql);
+  /**
+   * @brief 连接被重建后使所有语句失效，下次使用时透明地重新 prepare
+   */
+  void Invalidate();
+  /**
+   * @brief 关闭并清空所有缓存的语句
+   */
+  void Clear();
+
+  size_t Size() const { return m_lru.size(); }
+  unsigned long long Hits() const { return m_hits; }
+  unsigned long long Misses() const { return m_misses; }
+
+ private:
+  typedef std::list<sql_stmt *> lru_list;
+
+  MYSQL *m_conn;
+  size_t m_capacity;
+  unsigned long m_thread_id;  ///< 准备语句时连接的线程号，变化说明发生过重连
+  lru_list m_lru;             ///< 表头为最近使用
+  std::unordered_map<std::string, lru_list::iterator> m_index;
+  unsigned long long m_hits;
+  unsigned long long m_misses;
+};
+
+#endif  // !SQL_STMT_CACHE_H
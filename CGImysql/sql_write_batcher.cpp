@@ -0,0 +1,329 @@
+#include "sql_write_batcher.h"
+
+#include <mysql/errmsg.h>
+#include <mysql/mysql.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "../coro/scheduler.h"
+#include "../log/log.h"
+#include "../metrics/metrics.h"
+
+sql_write_batcher::sql_write_batcher()
+    : m_pool(nullptr),
+      m_max_rows(1),
+      m_max_delay_ms(0),
+      m_head(nullptr),
+      m_queued(0),
+      m_first_ns(0),
+      m_running(false),
+      m_stop(false) {}
+
+sql_write_batcher *sql_write_batcher::GetInstance() {
+  static sql_write_batcher batcher;
+  return &batcher;
+}
+
+bool sql_write_batcher::init(connection_poll *pool, int max_rows,
+                             int max_delay_ms) {
+  m_pool = pool;
+  m_max_rows = std::max(max_rows, 1);
+  m_max_delay_ms = std::max(max_delay_ms, 0);
+  m_sql.reserve(MAX_STATEMENT_BYTES);
+  if (pthread_create(&m_thread, nullptr, Worker, this) != 0) {
+    LOG_ERROR("sql write batcher: pthread_create failed");
+    return false;
+  }
+  m_running.store(true, std::memory_order_release);
+  return true;
+}
+
+void sql_write_batcher::Stop() {
+  if (!m_running.load(std::memory_order_acquire)) {
+    return;
+  }
+  m_stop.store(true);
+  m_wake.post();
+  pthread_join(m_thread, nullptr);
+  m_running.store(false, std::memory_order_release);
+}
+
+void sql_write_batcher::Push(pending_row *row) {
+  pending_row *head = m_head.load(std::memory_order_relaxed);
+  do {
+    row->next = head;
+  } while (!m_head.compare_exchange_weak(head, row, std::memory_order_release,
+                                         std::memory_order_relaxed));
+  // 计数与栈不是同一个原子操作，写入线程取走时可能暂时偏小，
+  // 只影响是否提前唤醒，写入线程每轮都以栈本身为准
+  int n = m_queued.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (n == 1) {
+    m_first_ns.store(metrics_now_ns(), std::memory_order_relaxed);
+    m_wake.post();
+  } else if (n == m_max_rows) {
+    m_wake.post();
+  }
+}
+
+void sql_write_batcher::TakeAll(std::vector<pending_row *> &rows) {
+  rows.clear();
+  pending_row *row = m_head.exchange(nullptr, std::memory_order_acquire);
+  for (; row != nullptr; row = row->next) {
+    rows.push_back(row);
+  }
+  m_queued.fetch_sub((int)rows.size(), std::memory_order_relaxed);
+  // 栈中后提交的在前
+  std::reverse(rows.begin(), rows.end());
+}
+
+void *sql_write_batcher::Worker(void *arg) {
+  sql_write_batcher *b = (sql_write_batcher *)arg;
+  std::vector<pending_row *> rows;
+  while (true) {
+    if (b->m_head.load(std::memory_order_acquire) == nullptr) {
+      if (b->m_stop.load()) {
+        break;
+      }
+      b->m_wake.wait();
+      continue;
+    }
+    // 等到攒够 max_rows 或最早的一行到期，停止时不再等待
+    uint64_t deadline = b->m_first_ns.load(std::memory_order_relaxed) +
+                        (uint64_t)b->m_max_delay_ms * 1000000;
+    while (!b->m_stop.load() &&
+           b->m_queued.load(std::memory_order_relaxed) < b->m_max_rows) {
+      uint64_t now = metrics_now_ns();
+      if (now >= deadline) {
+        break;
+      }
+      // sem_timedwait 只接受 CLOCK_REALTIME 的绝对时间
+      uint64_t left = deadline - now;
+      struct timespec t;
+      clock_gettime(CLOCK_REALTIME, &t);
+      t.tv_sec += left / 1000000000;
+      t.tv_nsec += left % 1000000000;
+      if (t.tv_nsec >= 1000000000) {
+        t.tv_sec++;
+        t.tv_nsec -= 1000000000;
+      }
+      b->m_wake.timewait(t);
+    }
+    b->TakeAll(rows);
+    b->Flush(rows);
+  }
+  return nullptr;
+}
+
+// MySQL 的 ER_DUP_ENTRY
+static const int DB_DUP_ENTRY = 1062;
+
+static bool connection_lost(int err) {
+  return err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST;
+}
+
+static int Execute(MYSQL *conn, const std::string &sql) {
+  if (mysql_real_query(conn, sql.data(), sql.size()) != 0) {
+    return (int)mysql_errno(conn);
+  }
+  return 0;
+}
+
+/*
+ * 在一个事务中写入 rows，同一条 INSERT 文本的行合并为多行语句；
+ * 只有一行时不开启事务。
+ * 提交(或单行的自动提交)时连接断开，无法知道事务是否已生效，*in_doubt 置为 true
+ */
+int sql_write_batcher::Commit(MYSQL *conn, pending_row *const *rows,
+                              size_t count, bool *in_doubt) {
+  *in_doubt = false;
+  if (count == 1) {
+    m_sql.assign(rows[0]->insert);
+    m_sql += " VALUES ";
+    m_sql += *rows[0]->values;
+    int err = Execute(conn, m_sql);
+    *in_doubt = connection_lost(err);
+    return err;
+  }
+  if (mysql_autocommit(conn, 0)) {
+    return (int)mysql_errno(conn);
+  }
+  int err = 0;
+  std::vector<bool> written(count, false);
+  for (size_t i = 0; i < count && err == 0; i++) {
+    if (written[i]) {
+      continue;
+    }
+    const char *insert = rows[i]->insert;
+    size_t rows_in_sql = 0;
+    for (size_t j = i; j < count && err == 0; j++) {
+      if (written[j] || (rows[j]->insert != insert &&
+                         strcmp(rows[j]->insert, insert) != 0)) {
+        continue;
+      }
+      const std::string &values = *rows[j]->values;
+      if (rows_in_sql > 0 && m_sql.size() + 1 + values.size() >
+                                 MAX_STATEMENT_BYTES) {
+        err = Execute(conn, m_sql);
+        rows_in_sql = 0;
+      }
+      if (rows_in_sql == 0) {
+        m_sql.assign(insert);
+        m_sql += " VALUES ";
+      } else {
+        m_sql += ',';
+      }
+      m_sql += values;
+      rows_in_sql++;
+      written[j] = true;
+    }
+    if (err == 0 && rows_in_sql > 0) {
+      err = Execute(conn, m_sql);
+    }
+  }
+  if (err == 0 && mysql_commit(conn)) {
+    err = (int)mysql_errno(conn);
+    *in_doubt = connection_lost(err);
+  }
+  if (err != 0) {
+    mysql_rollback(conn);
+  }
+  mysql_autocommit(conn, 1);
+  return err;
+}
+
+void sql_write_batcher::Complete(pending_row *row, int result) {
+  row->result = result;
+  // 写入之后提交方随时可能恢复并释放 row，不能再访问
+  int efd = row->efd;
+  uint64_t one = 1;
+  if (write(efd, &one, sizeof(one)) != (ssize_t)sizeof(one)) {
+    LOG_ERROR("sql write batcher: eventfd write failed");
+  }
+}
+
+void sql_write_batcher::Flush(std::vector<pending_row *> &rows) {
+  metrics_shard *stats = metrics::local();
+  // 预处理语句不参与合并，排到 INSERT 之后
+  size_t inserts =
+      std::stable_partition(rows.begin(), rows.end(),
+                            [](const pending_row *row) {
+                              return row->params == nullptr;
+                            }) -
+      rows.begin();
+  for (size_t begin = 0; begin < inserts; begin += m_max_rows) {
+    size_t count = std::min(inserts - begin, (size_t)m_max_rows);
+    pending_row *const *batch = &rows[begin];
+    MYSQL *conn = nullptr;
+    connectionRAII raii(&conn, m_pool);
+    if (conn == nullptr) {
+      for (size_t i = 0; i < count; i++) {
+        Complete(batch[i], -1);
+      }
+      continue;
+    }
+
+    bool in_doubt = false;
+    int err = Commit(conn, batch, count, &in_doubt);
+    // 提交时断开的批次可能已经写入，重试时这些行会违反唯一约束
+    bool retry_in_doubt = false;
+    if (connection_lost(err) && m_pool->Reconnect(conn)) {
+      // 连接已断开：重建后整批重试一次。断开发生在提交之前时事务已回滚，不会重复写入
+      retry_in_doubt = in_doubt;
+      err = Commit(conn, batch, count, &in_doubt);
+    }
+    metrics::inc(stats->db_batches);
+    if (count == 1 && retry_in_doubt && err == DB_DUP_ENTRY) {
+      // 第一次提交已经生效，行是自己写入的
+      LOG_WARN("sql write batcher: commit lost, row already written");
+      err = 0;
+    }
+    if (err == 0 || count == 1) {
+      if (err == 0) {
+        metrics::inc(stats->db_batch_rows, count);
+      }
+      for (size_t i = 0; i < count; i++) {
+        Complete(batch[i], err);
+      }
+      continue;
+    }
+
+    // 整批回滚：逐行单独写入，每行得到自己的结果
+    LOG_WARN("sql write batcher: batch of %zu rows failed (%d), retry by row",
+             count, err);
+    metrics::inc(stats->db_batch_retries);
+    for (size_t i = 0; i < count; i++) {
+      int row_err = Commit(conn, &batch[i], 1, &in_doubt);
+      if (retry_in_doubt && row_err == DB_DUP_ENTRY) {
+        // 整批在第一次提交时已经写入，逐行重试只会得到重复
+        row_err = 0;
+      }
+      if (row_err == 0) {
+        metrics::inc(stats->db_batch_rows);
+      }
+      Complete(batch[i], row_err);
+    }
+  }
+  if (inserts < rows.size()) {
+    RunStatements(&rows[inserts], rows.size() - inserts);
+  }
+}
+
+void sql_write_batcher::RunStatements(pending_row *const *rows,
+                                      size_t count) {
+  MYSQL *conn = nullptr;
+  connectionRAII raii(&conn, m_pool);
+  for (size_t i = 0; i < count; i++) {
+    pending_row *row = rows[i];
+    sql_stmt *stmt =
+        conn ? m_pool->GetStmtCache(conn)->Get(row->insert) : nullptr;
+    if (stmt == nullptr) {
+      Complete(row, -1);
+      continue;
+    }
+    const std::vector<std::string> &params = *row->params;
+    for (size_t p = 0; p < params.size(); p++) {
+      stmt->BindString((int)p, params[p]);
+    }
+    // 连接断开时 Execute 自行重连并重试一次
+    Complete(row, stmt->Execute() ? 0 : (int)stmt->Errno());
+  }
+}
+
+coro::task<int> sql_write_batcher::Submit(pending_row *row) {
+  if (!m_running.load(std::memory_order_acquire)) {
+    co_return -1;
+  }
+  row->result = -1;
+  row->next = nullptr;
+  row->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (row->efd < 0) {
+    co_return -1;
+  }
+  Push(row);
+  // 批次可能在注册之前就已写完，eventfd 保持可读，注册后立即就绪
+  co_await coro::scheduler::local()->wait(row->efd, EPOLLIN, -1);
+  coro::close_fd(row->efd);
+  co_return row->result;
+}
+
+coro::task<int> sql_write_batcher::Insert(const char *insert,
+                                          const std::string &values) {
+  pending_row row;
+  row.insert = insert;
+  row.values = &values;
+  row.params = nullptr;
+  co_return co_await Submit(&row);
+}
+
+coro::task<int> sql_write_batcher::ExecutePrepared(
+    const char *sql, const std::vector<std::string> &params) {
+  pending_row row;
+  row.insert = sql;
+  row.values = nullptr;
+  row.params = &params;
+  co_return co_await Submit(&row);
+}
@@ -0,0 +1,116 @@
+#ifndef SQL_WRITE_BATCHER_H
+#define SQL_WRITE_BATCHER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "../coro/task.h"
+#include "../lock/locker.h"
+#include "sql_connection_pool.h"
+
+/**
+ * @class sql_write_batcher
+ * @brief 位于 connection_poll 之上的 INSERT 组提交
+ *
+ * - 各线程提交的行压入一个无锁栈，提交方不加锁、不占用连接
+ * - 一个写入线程在积累到 max_rows 行，或最早的一行已等待 max_delay_ms 时
+ *   取走全部行，同一张表的行合并为多行 INSERT，一批在一个事务中提交，
+ *   每个事务只占用一次连接、只有一次提交
+ * - 事务失败(例如其中一行违反唯一约束)时回滚，再逐行单独插入，
+ *   每一行得到自己的结果，不会因为同批的其他行失败
+ * - 提交时连接断开，重连后整批重试；第一次提交可能已经生效，
+ *   此时重试中违反唯一约束的行按已写入处理
+ * - 提交方是事件循环中的协程，通过 eventfd 等待所在的批次提交，
+ *   在本事件循环中恢复
+ * - 不能合并的单条写入(如 UPDATE)也交给写入线程，用连接的预处理语句缓存执行，
+ *   事件循环不必拼接与转义 SQL
+ *
+ * 一行最长等待 max_delay_ms 加上前一批与本批各一个事务的时间。
+ */
+class sql_write_batcher {
+ public:
+  // 一条多行 INSERT 的长度上限，超过时拆成多条，远小于 max_allowed_packet
+  static const size_t MAX_STATEMENT_BYTES = 1 << 20;
+
+  static sql_write_batcher *GetInstance();
+
+  /**
+   * @brief 启动写入线程，只调用一次
+   *
+   * @param pool 写入使用的连接池
+   * @param max_rows 一个事务的行数上限，积累到这么多行时立即写入
+   * @param max_delay_ms 一行最长等待多久开始写入，0 表示有行就写
+   */
+  bool init(connection_poll *pool, int max_rows, int max_delay_ms);
+  /**
+   * @brief 写完已提交的行后停止写入线程，在事件循环全部退出后调用
+   */
+  void Stop();
+
+  /**
+   * @brief 提交一行并等待所在的批次写入
+   *
+   * @param insert 语句的前半部分，如 "INSERT INTO user(username, passwd)"，
+   *               须在进程内一直有效(通常是字符串字面量)，相同的文本合并为一条语句
+   * @param values 一行的值，如 "('alice', '...')"，须已转义，co_await 结束之前保持有效
+   * @return int 0 成功；失败时为 mysql_errno，未启动或没有可用连接时为 -1
+   */
+  coro::task<int> Insert(const char *insert, const std::string &values);
+  /**
+   * @brief 在写入线程中执行一条预处理语句并等待结果
+   *
+   * 语句不与 INSERT 合并，在同一轮的 INSERT 之后逐条执行，经所用连接的
+   * sql_stmt_cache 复用。参数按顺序绑定为字符串，不需要转义。
+   *
+   * @param sql 含 '?' 占位符的语句，如 "UPDATE user SET passwd=? WHERE username=?"，
+   *            须在进程内一直有效
+   * @param params 参数，co_await 结束之前保持有效
+   * @return int 0 成功；失败时为 mysql_errno，未启动或没有可用连接时为 -1
+   */
+  coro::task<int> ExecutePrepared(const char *sql,
+                                  const std::vector<std::string> &params);
+
+ private:
+  // 一行待写入的数据，在提交方的协程帧或栈上
+  struct pending_row {
+    const char *insert;  ///< INSERT 的前半部分，或预处理语句的 SQL
+    const std::string *values;
+    const std::vector<std::string> *params;  ///< 不为空时是预处理语句
+    int result;
+    int efd;            ///< 写入结果后通知
+    pending_row *next;  ///< 无锁栈中的下一项
+  };
+
+  sql_write_batcher();
+
+  static void *Worker(void *arg);
+  void Push(pending_row *row);
+  // 取走全部行，按提交顺序排列
+  void TakeAll(std::vector<pending_row *> &rows);
+  void Flush(std::vector<pending_row *> &rows);
+  void RunStatements(pending_row *const *rows, size_t count);
+  // 交给写入线程并等待结果
+  coro::task<int> Submit(pending_row *row);
+  int Commit(MYSQL *conn, pending_row *const *rows, size_t count,
+             bool *in_doubt);
+  void Complete(pending_row *row, int result);
+
+  connection_poll *m_pool;
+  int m_max_rows;
+  int m_max_delay_ms;
+
+  std::atomic<pending_row *> m_head;  ///< 无锁栈，后提交的在前
+  std::atomic<int> m_queued;          ///< 栈中的行数，只用于判断是否攒够
+  std::atomic<uint64_t> m_first_ns;   ///< 栈由空变为非空的时间
+  sem m_wake;                         ///< 栈由空变为非空或攒够 max_rows 时通知
+  std::atomic<bool> m_running;
+  std::atomic<bool> m_stop;
+  pthread_t m_thread;
+  std::string m_sql;  ///< 写入线程拼接语句用，保留容量
+};
+
+#endif  // !SQL_WRITE_BATCHER_H
@@ -0,0 +1,177 @@
+#include "affinity.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+
+bool parse_cpu_list(const std::string& text, std::vector<int>& cpus) {
+  cpus.clear();
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t comma = text.find(',', pos);
+    std::string item = text.substr(
+        pos, comma == std::string::npos ? std::string::npos : comma - pos);
+    pos = comma == std::string::npos ? text.size() : comma + 1;
+    if (item.empty()) {
+      continue;
+    }
+    char* end = nullptr;
+    long first = strtol(item.c_str(), &end, 10);
+    long last = first;
+    if (*end == '-') {
+      last = strtol(end + 1, &end, 10);
+    }
+    if (end == item.c_str() || *end != '\0' || first < 0 || last < first ||
+        last >= CPU_SETSIZE) {
+      return false;
+    }
+    for (long cpu = first; cpu <= last; cpu++) {
+      cpus.push_back((int)cpu);
+    }
+  }
+  return !cpus.empty();
+}
+
+bool topology_load(cpu_topology& topo) {
+  topo = cpu_topology();
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+    return false;
+  }
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &allowed)) {
+      topo.cpus.push_back(cpu);
+    }
+  }
+  if (topo.cpus.empty()) {
+    return false;
+  }
+  topo.node_of.assign(topo.cpus.back() + 1, -1);
+  for (size_t i = 0; i < topo.cpus.size(); i++) {
+    topo.node_of[topo.cpus[i]] = 0;
+  }
+
+  // 各节点的 CPU 列表；没有 NUMA 支持时目录不存在，全部视为节点 0
+  DIR* dir = opendir("/sys/devices/system/node");
+  if (dir == nullptr) {
+    return true;
+  }
+  int max_node = 0;
+  struct dirent* ent;
+  while ((ent = readdir(dir)) != nullptr) {
+    if (strncmp(ent->d_name, "node", 4) != 0 || ent->d_name[4] < '0' ||
+        ent->d_name[4] > '9') {
+      continue;
+    }
+    int node = atoi(ent->d_name + 4);
+    std::ifstream in(std::string("/sys/devices/system/node/") + ent->d_name +
+                     "/cpulist");
+    std::string line;
+    std::vector<int> cpus;
+    if (!std::getline(in, line) || !parse_cpu_list(line, cpus)) {
+      continue;
+    }
+    for (size_t i = 0; i < cpus.size(); i++) {
+      if (cpus[i] < (int)topo.node_of.size() && topo.node_of[cpus[i]] >= 0) {
+        topo.node_of[cpus[i]] = node;
+        max_node = std::max(max_node, node);
+      }
+    }
+  }
+  closedir(dir);
+  topo.nodes = max_node + 1;
+  return true;
+}
+
+bool parse_affinity_policy(const std::string& text, affinity_policy& policy) {
+  if (text == "none") {
+    policy = AFFINITY_NONE;
+  } else if (text == "compact") {
+    policy = AFFINITY_COMPACT;
+  } else if (text == "scatter") {
+    policy = AFFINITY_SCATTER;
+  } else if (text == "list") {
+    policy = AFFINITY_LIST;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char* affinity_policy_name(affinity_policy policy) {
+  switch (policy) {
+    case AFFINITY_COMPACT:
+      return "compact";
+    case AFFINITY_SCATTER:
+      return "scatter";
+    case AFFINITY_LIST:
+      return "list";
+    default:
+      return "none";
+  }
+}
+
+std::vector<int> affinity_plan(affinity_policy policy,
+                               const std::vector<int>& list,
+                               const cpu_topology& topo, int n) {
+  std::vector<int> plan(n, -1);
+  if (policy == AFFINITY_NONE || topo.cpus.empty() || n <= 0) {
+    return plan;
+  }
+  if (policy == AFFINITY_LIST) {
+    for (int i = 0; i < n && !list.empty(); i++) {
+      int cpu = list[i % list.size()];
+      plan[i] = topo.node(cpu) >= 0 ? cpu : -1;
+    }
+    return plan;
+  }
+
+  // 按节点分组，组内按 CPU 编号升序
+  std::vector<std::vector<int> > by_node(topo.nodes);
+  for (size_t i = 0; i < topo.cpus.size(); i++) {
+    int node = topo.node(topo.cpus[i]);
+    by_node[node < 0 ? 0 : node].push_back(topo.cpus[i]);
+  }
+  std::vector<int> order;
+  if (policy == AFFINITY_COMPACT) {
+    for (size_t node = 0; node < by_node.size(); node++) {
+      order.insert(order.end(), by_node[node].begin(), by_node[node].end());
+    }
+  } else {
+    // 轮流从每个节点取一个 CPU
+    for (size_t round = 0; order.size() < topo.cpus.size(); round++) {
+      for (size_t node = 0; node < by_node.size(); node++) {
+        if (round < by_node[node].size()) {
+          order.push_back(by_node[node][round]);
+        }
+      }
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    plan[i] = order[i % order.size()];
+  }
+  return plan;
+}
+
+bool affinity_pin(int cpu) { return affinity_set(std::vector<int>(1, cpu)); }
+
+bool affinity_set(const std::vector<int>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (size_t i = 0; i < cpus.size(); i++) {
+    if (cpus[i] < 0 || cpus[i] >= CPU_SETSIZE) {
+      return false;
+    }
+    CPU_SET(cpus[i], &set);
+  }
+  if (CPU_COUNT(&set) == 0) {
+    return false;
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
@@ -0,0 +1,85 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <string>
+#include <vector>
+
+/*
+ * 事件循环线程的绑核与 NUMA 拓扑
+ * 拓扑从 /sys/devices/system/node 读取，只考虑进程允许使用的 CPU
+ * (sched_getaffinity，taskset/cgroup 的限制会被遵守)；没有 NUMA 信息时视为单节点。
+ * 线程绑核后再分配并首次写入自己的内存，内核按 first-touch 把页放在本地节点上。
+ */
+
+// 绑核策略
+enum affinity_policy {
+  AFFINITY_NONE = 0,  // 不绑核，由调度器决定
+  AFFINITY_COMPACT,   // 依次占满一个节点的 CPU 再用下一个节点
+  AFFINITY_SCATTER,   // 轮流使用各节点的 CPU
+  AFFINITY_LIST,      // 按 cpu_list 指定的顺序
+};
+
+/**
+ * @struct cpu_topology
+ * @brief 进程可用的 CPU 与所属 NUMA 节点
+ */
+struct cpu_topology {
+  std::vector<int> cpus;     ///< 可用的 CPU，升序
+  std::vector<int> node_of;  ///< 按 CPU 编号索引的节点号，不可用的 CPU 为 -1
+  int nodes;                 ///< 节点数
+
+  cpu_topology() : nodes(1) {}
+  int node(int cpu) const {
+    return cpu >= 0 && cpu < (int)node_of.size() ? node_of[cpu] : -1;
+  }
+};
+
+/**
+ * @brief 读取当前进程的 CPU 拓扑
+ *
+ * @param[out] topo 拓扑
+ * @return bool 是否成功，失败时 topo 为空
+ */
+bool topology_load(cpu_topology& topo);
+
+/**
+ * @brief 解析 "0,2,4-7" 形式的 CPU 列表
+ *
+ * @param text 列表
+ * @param[out] cpus 按出现顺序展开的 CPU
+ * @return bool 格式是否正确
+ */
+bool parse_cpu_list(const std::string& text, std::vector<int>& cpus);
+
+/**
+ * @brief 解析绑核策略名称：none, compact, scatter, list
+ */
+bool parse_affinity_policy(const std::string& text, affinity_policy& policy);
+const char* affinity_policy_name(affinity_policy policy);
+
+/**
+ * @brief 为 n 个线程选择 CPU
+ * 线程数多于可选的 CPU 时循环使用；list 中不可用的 CPU 对应的线程不绑核
+ *
+ * @param policy 策略
+ * @param list AFFINITY_LIST 时使用的 CPU 列表
+ * @param topo 拓扑
+ * @param n 线程数
+ * @return std::vector<int> 每个线程的 CPU，-1 表示不绑核
+ */
+std::vector<int> affinity_plan(affinity_policy policy,
+                               const std::vector<int>& list,
+                               const cpu_topology& topo, int n);
+
+/**
+ * @brief 把当前线程绑定到一个 CPU
+ */
+bool affinity_pin(int cpu);
+
+/**
+ * @brief 允许当前线程在一组 CPU 上运行
+ * fork 出的进程继承调用线程的设置，热升级前用它恢复进程原本可用的 CPU
+ */
+bool affinity_set(const std::vector<int>& cpus);
+
+#endif  // !AFFINITY_H
@@ -0,0 +1,250 @@
+#include "auth_routes.h"
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "../CGImysql/sql_result_cache.h"
+#include "../CGImysql/sql_write_batcher.h"
+#include "../coro/db.h"
+#include "../coro/handler.h"
+#include "../http/http_conn.h"
+#include "../http/page_template.h"
+#include "../log/log.h"
+#include "../metrics/metrics.h"
+#include "credential_store.h"
+#include "password.h"
+
+// MySQL 的 ER_DUP_ENTRY，用户名已被其他进程写入
+static const int DB_DUP_ENTRY = 1062;
+static const size_t MAX_USER_LEN = 64;
+static const size_t MAX_PASSWORD_LEN = 1024;
+// 用户列表页的模板与查询，最多列出 1000 个用户。结果缓存在
+// sql_result_cache 中，本进程注册或重新散列后按 "user" 标签失效，
+// TTL 只限制其他进程写入后的延迟
+static const char USER_PAGE_TEMPLATE[] = "/users.tpl";
+static const std::string USER_PAGE_SQL =
+    "SELECT username FROM user ORDER BY username LIMIT 1000";
+static const int USER_PAGE_TTL_MS = 5000;
+static const char USER_TAG[] = "user";
+static const std::vector<std::string> USER_PAGE_TAGS(1, USER_TAG);
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+// 取出表单字段 name 的值并解码，不存在或编码错误时返回 false
+static bool form_value(const std::string& body, const char* name,
+                       std::string& out) {
+  size_t name_len = strlen(name);
+  size_t pos = 0;
+  while (pos < body.size()) {
+    size_t end = body.find('&', pos);
+    if (end == std::string::npos) {
+      end = body.size();
+    }
+    if (end - pos > name_len && body[pos + name_len] == '=' &&
+        body.compare(pos, name_len, name) == 0) {
+      out.clear();
+      for (size_t i = pos + name_len + 1; i < end; i++) {
+        char c = body[i];
+        if (c == '+') {
+          c = ' ';
+        } else if (c == '%') {
+          int hi = i + 2 < end ? hex_value(body[i + 1]) : -1;
+          int lo = hi >= 0 ? hex_value(body[i + 2]) : -1;
+          if (lo < 0) {
+            return false;
+          }
+          c = (char)(hi * 16 + lo);
+          i += 2;
+        }
+        out += c;
+      }
+      return true;
+    }
+    pos = end + 1;
+  }
+  return false;
+}
+
+static bool valid_user(const std::string& user) {
+  if (user.empty() || user.size() > MAX_USER_LEN) {
+    return false;
+  }
+  for (size_t i = 0; i < user.size(); i++) {
+    char c = user[i];
+    if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+          (c >= '0' && c <= '9') || c == '_' || c == '.' || c == '-')) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void reply(coro::async_request& req, int status, const char* json) {
+  req.status = status;
+  req.content_type.assign("application/json");
+  req.response.assign(json);
+}
+
+// 检查方法并取出用户名与口令，不合法时填好响应并返回 false
+static bool read_credentials(coro::async_request& req, std::string& user,
+                             std::string& password) {
+  if (req.method != http_conn::POST) {
+    reply(req, 405, "{\"error\":\"method not allowed\"}");
+    req.headers.assign("Allow: POST\r\n");
+    return false;
+  }
+  if (!form_value(req.body, "user", user) || !valid_user(user) ||
+      !form_value(req.body, "password", password) || password.empty() ||
+      password.size() > MAX_PASSWORD_LEN) {
+    reply(req, 400, "{\"error\":\"invalid user or password\"}");
+    return false;
+  }
+  return true;
+}
+
+// 登录成功后按当前参数重新散列，先写数据库再替换内存中的散列
+static coro::task<void> upgrade_hash(std::string user, std::string password,
+                                     std::string old_hash) {
+  std::string hash;
+  if (!co_await password_hasher::get_instance()->async_hash(password, hash)) {
+    co_return;
+  }
+  // 预处理语句在写入线程中执行，参数不需要拼接与转义
+  std::vector<std::string> params;
+  params.push_back(hash);
+  params.push_back(user);
+  int err = co_await sql_write_batcher::GetInstance()->ExecutePrepared(
+      "UPDATE user SET passwd=? WHERE username=?", params);
+  if (err != 0) {
+    LOG_WARN("auth: rehash of %s failed: %d", user.c_str(), err);
+    co_return;
+  }
+  sql_result_cache::GetInstance()->InvalidateTag(USER_TAG);
+  credential_store::get_instance()->replace(user, old_hash, hash);
+}
+
+static coro::task<void> handle_login(coro::async_request& req) {
+  std::string user, password;
+  if (!read_credentials(req, user, password)) {
+    co_return;
+  }
+  // 不存在的用户也计算一次散列，响应时间不暴露用户是否存在
+  std::string stored;
+  credential_store::get_instance()->lookup(user, stored);
+  password_hasher* hasher = password_hasher::get_instance();
+  int ok = co_await hasher->async_verify(password, stored);
+  if (ok < 0) {
+    reply(req, 503, "{\"error\":\"busy\"}");
+    co_return;
+  }
+  if (ok == 0) {
+    metrics::inc(metrics::local()->auth_login_failed);
+    reply(req, 401, "{\"error\":\"wrong user or password\"}");
+    co_return;
+  }
+  metrics::inc(metrics::local()->auth_login_ok);
+  reply(req, 200, "{\"ok\":true}");
+  if (hasher->needs_rehash(stored)) {
+    // 不等升级完成，响应照常发送
+    coro::spawn(upgrade_hash(user, password, stored));
+  }
+}
+
+static coro::task<void> handle_register(coro::async_request& req) {
+  std::string user, password;
+  if (!read_credentials(req, user, password)) {
+    co_return;
+  }
+  credential_store* store = credential_store::get_instance();
+  if (!store->reserve(user)) {
+    metrics::inc(metrics::local()->auth_register_failed);
+    reply(req, 409, "{\"error\":\"user exists\"}");
+    co_return;
+  }
+  std::string hash;
+  if (!co_await password_hasher::get_instance()->async_hash(password, hash)) {
+    store->remove(user);
+    metrics::inc(metrics::local()->auth_register_failed);
+    reply(req, 503, "{\"error\":\"busy\"}");
+    co_return;
+  }
+  // 散列只含 base64 字符与 '$'，用户名已检查过字符集。
+  // 同时进行的注册由 sql_write_batcher 合并为一个事务写入
+  std::string values = "('" + user + "', '" + hash + "')";
+  int err = co_await sql_write_batcher::GetInstance()->Insert(
+      "INSERT INTO user(username, passwd)", values);
+  if (err != 0) {
+    store->remove(user);
+    metrics::inc(metrics::local()->auth_register_failed);
+    if (err == DB_DUP_ENTRY) {
+      reply(req, 409, "{\"error\":\"user exists\"}");
+    } else {
+      LOG_ERROR("auth: register %s failed: %d", user.c_str(), err);
+      reply(req, 503, "{\"error\":\"database unavailable\"}");
+    }
+    co_return;
+  }
+  store->commit(user, hash);
+  sql_result_cache::GetInstance()->InvalidateTag(USER_TAG);
+  metrics::inc(metrics::local()->auth_register_ok);
+  reply(req, 201, "{\"ok\":true}");
+}
+
+coro::task<void> handle_user_page(coro::async_request& req) {
+  if (req.method != http_conn::GET) {
+    reply(req, 405, "{\"error\":\"method not allowed\"}");
+    req.headers.assign("Allow: GET\r\n");
+    co_return;
+  }
+  // 启动时没有这个模板或编译失败，查询之前先确认
+  page_template_ptr page =
+      template_cache::get_instance()->find(USER_PAGE_TEMPLATE);
+  if (!page) {
+    LOG_ERROR("auth: template %s not found", USER_PAGE_TEMPLATE);
+    req.status = 500;
+    req.response.assign("template not found\n");
+    co_return;
+  }
+  sql_result_ptr result =
+      co_await coro::db_cached_query(USER_PAGE_SQL, USER_PAGE_TTL_MS,
+                                     USER_PAGE_TAGS);
+  if (!result) {
+    LOG_WARN("auth: user list query failed");
+    req.status = 503;
+    req.response.assign("database unavailable\n");
+    co_return;
+  }
+  template_data data;
+  data.set("title", "Users");
+  template_rows& rows = data.rows("users");
+  rows.columns.push_back("username");
+  for (size_t i = 0; i < result->rows.size(); i++) {
+    const std::string& name = result->rows[i][0];
+    const char* cell = name.data();
+    unsigned long len = name.size();
+    rows.add_row(&cell, &len);
+  }
+  data.set("count", std::to_string(rows.count()));
+  // 单元格指向缓存的结果，渲染时已复制
+  page->render(data, req.response, req.response_iov);
+  req.response_owner = page;
+}
+
+void register_auth_routes() {
+  coro::async_routes* routes = coro::async_routes::get_instance();
+  routes->add("/auth/login", handle_login);
+  routes->add("/auth/register", handle_register);
+}
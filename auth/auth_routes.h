@@ -0,0 +1,33 @@
+#ifndef AUTH_ROUTES_H
+#define AUTH_ROUTES_H
+
+#include "../coro/handler.h"
+
+/*
+ * 登录与注册接口
+ *   POST /auth/login     user=...&password=...  200 成功，401 用户名或口令错误
+ *   POST /auth/register  user=...&password=...  201 成功，409 用户名已存在
+ * 请求体为 application/x-www-form-urlencoded，响应为 JSON。参数不合法时返回 400，
+ * 散列线程忙或数据库不可用时返回 503。
+ *
+ * 用户列表页只挂在管理端口上，见 handle_user_page。
+ *
+ * 登录只查 credential_store，不访问数据库；注册经 sql_write_batcher 写入 user 表，
+ * 成功后才可以登录。
+ * 用户名限为 1 到 64 个字母、数字与 "_.-"，直接拼入 SQL 不需要转义。
+ */
+
+/**
+ * @brief 注册两个接口的异步处理函数，在事件循环启动前调用
+ */
+void register_auth_routes();
+
+/**
+ * @brief GET /auth/users 用户列表页，注册在管理端口上，不对外提供
+ *
+ * 从 user 表查询后渲染文档根目录下的 /users.tpl，查询结果经 sql_result_cache
+ * 缓存。模板不存在时返回 500，数据库不可用时返回 503。
+ */
+coro::task<void> handle_user_page(coro::async_request& req);
+
+#endif  // !AUTH_ROUTES_H
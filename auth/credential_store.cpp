@@ -0,0 +1,111 @@
+#include "credential_store.h"
+
+#include <mysql/mysql.h>
+
+#include "../CGImysql/sql_connection_pool.h"
+#include "../log/log.h"
+
+credential_store* credential_store::get_instance() {
+  static credential_store store;
+  return &store;
+}
+
+bool credential_store::load(connection_poll* pool) {
+  if (pool->GetMaxConn() == 0) {
+    return false;
+  }
+  MYSQL* mysql = nullptr;
+  connectionRAII raii(&mysql, pool);
+  // 启动时在主线程中执行，用连接自带的预处理语句缓存，
+  // 结果按列读入复用的缓冲区
+  sql_stmt* stmt =
+      pool->GetStmtCache(mysql)->Get("SELECT username, passwd FROM user");
+  if (stmt == nullptr || !stmt->Execute()) {
+    LOG_ERROR("credential store: %s",
+              stmt ? stmt->Error().c_str() : mysql_error(mysql));
+    return false;
+  }
+  size_t count = 0;
+  while (stmt->Fetch()) {
+    if (stmt->IsNull(0) || stmt->IsNull(1)) {
+      continue;
+    }
+    std::string user = stmt->GetString(0);
+    shard& s = shard_of(user);
+    entry& e = s.users[user];
+    e.hash = stmt->GetString(1);
+    e.pending = false;
+    count++;
+  }
+  bool ok = stmt->Errno() == 0;
+  if (!ok) {
+    LOG_ERROR("credential store: %s", stmt->Error().c_str());
+  }
+  LOG_INFO("credential store: %zu users loaded", count);
+  return ok;
+}
+
+bool credential_store::lookup(const std::string& user, std::string& hash) {
+  shard& s = shard_of(user);
+  s.lock.lock();
+  std::unordered_map<std::string, entry>::const_iterator it =
+      s.users.find(user);
+  bool found = it != s.users.end() && !it->second.pending;
+  if (found) {
+    hash = it->second.hash;
+  }
+  s.lock.unlock();
+  return found;
+}
+
+bool credential_store::reserve(const std::string& user) {
+  shard& s = shard_of(user);
+  s.lock.lock();
+  entry e;
+  e.pending = true;
+  bool inserted = s.users.insert(std::make_pair(user, e)).second;
+  s.lock.unlock();
+  return inserted;
+}
+
+void credential_store::commit(const std::string& user,
+                              const std::string& hash) {
+  shard& s = shard_of(user);
+  s.lock.lock();
+  entry& e = s.users[user];
+  e.hash = hash;
+  e.pending = false;
+  s.lock.unlock();
+}
+
+void credential_store::remove(const std::string& user) {
+  shard& s = shard_of(user);
+  s.lock.lock();
+  s.users.erase(user);
+  s.lock.unlock();
+}
+
+bool credential_store::replace(const std::string& user,
+                               const std::string& old_hash,
+                               const std::string& new_hash) {
+  shard& s = shard_of(user);
+  s.lock.lock();
+  std::unordered_map<std::string, entry>::iterator it = s.users.find(user);
+  bool replaced = it != s.users.end() && !it->second.pending &&
+                  it->second.hash == old_hash;
+  if (replaced) {
+    it->second.hash = new_hash;
+  }
+  s.lock.unlock();
+  return replaced;
+}
+
+size_t credential_store::size() {
+  size_t n = 0;
+  for (int i = 0; i < SHARD_COUNT; i++) {
+    m_shards[i].lock.lock();
+    n += m_shards[i].users.size();
+    m_shards[i].lock.unlock();
+  }
+  return n;
+}
@@ -0,0 +1,87 @@
+#ifndef AUTH_CREDENTIAL_STORE_H
+#define AUTH_CREDENTIAL_STORE_H
+
+#include <string>
+#include <unordered_map>
+
+#include "../lock/locker.h"
+
+class connection_poll;
+
+/*
+ * 用户口令散列的内存副本
+ * 启动时从 user 表读入全部用户，之后登录只查这张表，不访问数据库；
+ * 注册先在表中占住用户名，写入数据库成功后再填入散列，失败时删除。
+ * 表按用户名的哈希分为多个分片，每个分片一把锁，锁只保护一次查找或插入，
+ * 不跨越散列计算与数据库写入，大量注册同时进行时分散在各分片上。
+ *
+ * 表只反映本进程的写入，其他程序直接修改 user 表后需要重启才能看到。
+ */
+
+/**
+ * @class credential_store
+ * @brief 用户名到口令散列的分片表(单例)
+ */
+class credential_store {
+ public:
+  static const int SHARD_COUNT = 64;
+
+  static credential_store* get_instance();
+
+  /**
+   * @brief 从 user 表读入全部用户，在事件循环启动前调用
+   *
+   * @return bool 连接池未初始化或查询失败时为 false
+   */
+  bool load(connection_poll* pool);
+
+  /**
+   * @brief 查找已注册用户的散列，正在注册的用户视为不存在
+   */
+  bool lookup(const std::string& user, std::string& hash);
+
+  /**
+   * @brief 为注册占住用户名
+   *
+   * @return bool 用户名已存在或正在注册时为 false
+   */
+  bool reserve(const std::string& user);
+
+  /**
+   * @brief 注册已写入数据库，填入散列
+   */
+  void commit(const std::string& user, const std::string& hash);
+
+  /**
+   * @brief 注册失败，释放占住的用户名
+   */
+  void remove(const std::string& user);
+
+  /**
+   * @brief 散列仍为 old_hash 时替换为 new_hash，用于登录时升级散列
+   */
+  bool replace(const std::string& user, const std::string& old_hash,
+               const std::string& new_hash);
+
+  size_t size();
+
+ private:
+  struct entry {
+    std::string hash;
+    bool pending;  ///< 正在注册，尚未写入数据库
+  };
+  struct alignas(64) shard {
+    locker lock;
+    std::unordered_map<std::string, entry> users;
+  };
+
+  credential_store() {}
+
+  shard& shard_of(const std::string& user) {
+    return m_shards[std::hash<std::string>()(user) % SHARD_COUNT];
+  }
+
+  shard m_shards[SHARD_COUNT];
+};
+
+#endif  // !AUTH_CREDENTIAL_STORE_H
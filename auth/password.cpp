@@ -0,0 +1,293 @@
+#include "password.h"
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "../coro/scheduler.h"
+#include "../log/log.h"
+
+// 保存格式的前缀
+static const char HASH_PREFIX[] = "pbkdf2_sha256$";
+static const size_t HASH_PREFIX_LEN = sizeof(HASH_PREFIX) - 1;
+static const int SALT_BYTES = 16;
+static const int KEY_BYTES = 32;
+// 解析保存的散列时接受的迭代次数上限，避免损坏的记录占住散列线程
+static const long MAX_ITERATIONS = 10000000;
+
+password_hasher* password_hasher::get_instance() {
+  static password_hasher hasher;
+  return &hasher;
+}
+
+password_hasher::password_hasher() : m_iterations(100000), m_stop(false) {}
+
+static void base64_append(std::string& out, const unsigned char* data,
+                          int len) {
+  unsigned char buf[((KEY_BYTES + 2) / 3) * 4 + 1];
+  int n = EVP_EncodeBlock(buf, data, len);
+  out.append((const char*)buf, n);
+}
+
+// 解码 base64，返回字节数，格式错误或超过 max 时返回 -1
+static int base64_decode(const char* text, size_t len, unsigned char* out,
+                         int max) {
+  if (len == 0 || len % 4 != 0 || (int)(len / 4 * 3) > max) {
+    return -1;
+  }
+  int n = EVP_DecodeBlock(out, (const unsigned char*)text, (int)len);
+  if (n < 0) {
+    return -1;
+  }
+  // EVP_DecodeBlock 把填充也算作输出
+  if (text[len - 1] == '=') {
+    n--;
+  }
+  if (text[len - 2] == '=') {
+    n--;
+  }
+  return n;
+}
+
+static bool derive(const std::string& password, const unsigned char* salt,
+                   int salt_len, int iterations, unsigned char* key) {
+  return PKCS5_PBKDF2_HMAC(password.data(), (int)password.size(), salt,
+                           salt_len, iterations, EVP_sha256(), KEY_BYTES,
+                           key) == 1;
+}
+
+// 拆分保存格式，不是这个格式时返回 false
+static bool parse_hash(const std::string& stored, long& iterations,
+                       unsigned char* salt, int& salt_len,
+                       unsigned char* key) {
+  if (stored.compare(0, HASH_PREFIX_LEN, HASH_PREFIX) != 0) {
+    return false;
+  }
+  const char* p = stored.c_str() + HASH_PREFIX_LEN;
+  char* end = nullptr;
+  iterations = strtol(p, &end, 10);
+  if (end == p || *end != '$' || iterations < 1 ||
+      iterations > MAX_ITERATIONS) {
+    return false;
+  }
+  const char* s = end + 1;
+  const char* sep = strchr(s, '$');
+  if (sep == nullptr) {
+    return false;
+  }
+  salt_len = base64_decode(s, sep - s, salt, SALT_BYTES * 4);
+  const char* k = sep + 1;
+  unsigned char buf[KEY_BYTES + 3];
+  int key_len = base64_decode(k, strlen(k), buf, sizeof(buf));
+  if (salt_len <= 0 || key_len != KEY_BYTES) {
+    return false;
+  }
+  memcpy(key, buf, KEY_BYTES);
+  return true;
+}
+
+// 拼出保存格式
+static std::string format_hash(int iterations, const unsigned char* salt,
+                               const unsigned char* key) {
+  std::string out(HASH_PREFIX);
+  out += std::to_string(iterations);
+  out += '$';
+  base64_append(out, salt, SALT_BYTES);
+  out += '$';
+  base64_append(out, key, KEY_BYTES);
+  return out;
+}
+
+bool password_hasher::init(int threads, int iterations) {
+  if (threads < 1) {
+    LOG_ERROR("password hasher: at least one thread is required");
+    return false;
+  }
+  if (!set_iterations(iterations)) {
+    LOG_ERROR("password hasher: no random source");
+    return false;
+  }
+  m_stop = false;
+  for (int i = 0; i < threads; i++) {
+    pthread_t tid;
+    if (pthread_create(&tid, nullptr, worker, this) != 0) {
+      LOG_ERROR("password hasher: pthread_create failed");
+      stop();
+      return false;
+    }
+    m_threads.push_back(tid);
+  }
+  return true;
+}
+
+void password_hasher::stop() {
+  m_mutex.lock();
+  m_stop = true;
+  m_mutex.unlock();
+  for (size_t i = 0; i < m_threads.size(); i++) {
+    m_queued.post();
+  }
+  for (size_t i = 0; i < m_threads.size(); i++) {
+    pthread_join(m_threads[i], nullptr);
+  }
+  m_threads.clear();
+}
+
+bool password_hasher::set_iterations(int iterations) {
+  if (iterations < 1) {
+    iterations = 1;
+  }
+  // 不存在的用户与真实用户走同样次数的 PBKDF2，验证时间才没有差别；
+  // 散列值永远不会被匹配，只需随机盐与当前的迭代次数，不必真的计算
+  unsigned char salt[SALT_BYTES];
+  unsigned char key[KEY_BYTES] = {0};
+  if (RAND_bytes(salt, SALT_BYTES) != 1) {
+    return false;
+  }
+  std::shared_ptr<const std::string> dummy =
+      std::make_shared<const std::string>(format_hash(iterations, salt, key));
+  m_mutex.lock();
+  m_dummy.swap(dummy);
+  m_mutex.unlock();
+  m_iterations.store(iterations, std::memory_order_relaxed);
+  return true;
+}
+
+std::string password_hasher::hash(const std::string& password) const {
+  unsigned char salt[SALT_BYTES];
+  unsigned char key[KEY_BYTES];
+  int iterations = this->iterations();
+  if (RAND_bytes(salt, SALT_BYTES) != 1 ||
+      !derive(password, salt, SALT_BYTES, iterations, key)) {
+    return std::string();
+  }
+  return format_hash(iterations, salt, key);
+}
+
+bool password_hasher::verify(const std::string& password,
+                             const std::string& stored) const {
+  long iterations = 0;
+  unsigned char salt[SALT_BYTES * 4];
+  int salt_len = 0;
+  unsigned char expected[KEY_BYTES];
+  if (parse_hash(stored, iterations, salt, salt_len, expected)) {
+    unsigned char key[KEY_BYTES];
+    return derive(password, salt, salt_len, (int)iterations, key) &&
+           CRYPTO_memcmp(key, expected, KEY_BYTES) == 0;
+  }
+  if (stored.empty()) {
+    return false;
+  }
+  // 旧版明文口令：比较两者的摘要，比较时间与长度无关
+  unsigned char a[EVP_MAX_MD_SIZE];
+  unsigned char b[EVP_MAX_MD_SIZE];
+  unsigned int a_len = 0, b_len = 0;
+  if (EVP_Digest(password.data(), password.size(), a, &a_len, EVP_sha256(),
+                 nullptr) != 1 ||
+      EVP_Digest(stored.data(), stored.size(), b, &b_len, EVP_sha256(),
+                 nullptr) != 1) {
+    return false;
+  }
+  return CRYPTO_memcmp(a, b, a_len) == 0;
+}
+
+bool password_hasher::needs_rehash(const std::string& stored) const {
+  if (stored.compare(0, HASH_PREFIX_LEN, HASH_PREFIX) != 0) {
+    return true;
+  }
+  return atol(stored.c_str() + HASH_PREFIX_LEN) != iterations();
+}
+
+void password_hasher::run(job* j) const {
+  if (j->kind == JOB_HASH) {
+    j->result = hash(*j->password);
+  } else {
+    j->ok = verify(*j->password, *j->stored);
+  }
+}
+
+void* password_hasher::worker(void* arg) {
+  password_hasher* hasher = (password_hasher*)arg;
+  while (hasher->m_queued.wait()) {
+    hasher->m_mutex.lock();
+    if (hasher->m_queue.empty()) {
+      bool stop = hasher->m_stop;
+      hasher->m_mutex.unlock();
+      if (stop) {
+        break;
+      }
+      continue;
+    }
+    job* j = hasher->m_queue.front();
+    hasher->m_queue.pop_front();
+    hasher->m_mutex.unlock();
+
+    hasher->run(j);
+    // 写入之后发起任务的协程随时可能恢复并释放 j，不能再访问
+    int efd = j->efd;
+    uint64_t one = 1;
+    if (write(efd, &one, sizeof(one)) != (ssize_t)sizeof(one)) {
+      LOG_ERROR("password hasher: eventfd write failed");
+    }
+  }
+  return nullptr;
+}
+
+coro::task<bool> password_hasher::submit(job* j) {
+  j->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (j->efd < 0) {
+    co_return false;
+  }
+  m_mutex.lock();
+  if (m_queue.size() >= (size_t)MAX_QUEUED) {
+    m_mutex.unlock();
+    close(j->efd);
+    co_return false;
+  }
+  m_queue.push_back(j);
+  m_mutex.unlock();
+  m_queued.post();
+
+  // 任务可能在注册之前就已完成，eventfd 保持可读，注册后立即就绪
+  co_await coro::scheduler::local()->wait(j->efd, EPOLLIN, -1);
+  coro::close_fd(j->efd);
+  co_return true;
+}
+
+coro::task<bool> password_hasher::async_hash(const std::string& password,
+                                             std::string& out) {
+  job j;
+  j.kind = JOB_HASH;
+  j.password = &password;
+  j.stored = nullptr;
+  j.ok = false;
+  j.efd = -1;
+  if (!co_await submit(&j) || j.result.empty()) {
+    co_return false;
+  }
+  out.swap(j.result);
+  co_return true;
+}
+
+coro::task<int> password_hasher::async_verify(const std::string& password,
+                                              const std::string& stored) {
+  // 持有一份引用，等待期间 set_iterations 换掉它也不影响本次验证
+  m_mutex.lock();
+  std::shared_ptr<const std::string> dummy = m_dummy;
+  m_mutex.unlock();
+  job j;
+  j.kind = JOB_VERIFY;
+  j.password = &password;
+  j.stored = stored.empty() ? dummy.get() : &stored;
+  j.ok = false;
+  j.efd = -1;
+  if (!co_await submit(&j)) {
+    co_return -1;
+  }
+  co_return j.ok && !stored.empty() ? 1 : 0;
+}
@@ -0,0 +1,128 @@
+#ifndef AUTH_PASSWORD_H
+#define AUTH_PASSWORD_H
+
+#include <pthread.h>
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../coro/task.h"
+#include "../lock/locker.h"
+
+/*
+ * 口令散列
+ * 口令用 PBKDF2-HMAC-SHA256 散列，每个口令一个 16 字节的随机盐，保存为
+ *   pbkdf2_sha256$<迭代次数>$<盐 base64>$<散列 base64>
+ * 迭代次数随散列一起保存，调整 auth_hash_iterations 后旧散列仍能验证，
+ * 登录成功时按新参数重新散列。不是这个格式的值按旧版 user 表中的明文口令处理，
+ * 同样在登录成功时升级。
+ *
+ * 一次散列需要几十毫秒的 CPU，不能在事件循环中计算：协程把任务交给散列线程，
+ * 用一个 eventfd 等待结果，等待期间事件循环照常处理其他连接，因此至少要有
+ * 一个散列线程。
+ */
+
+/**
+ * @class password_hasher
+ * @brief 口令散列与验证(单例)
+ */
+class password_hasher {
+ public:
+  // 散列线程的任务队列上限，超过时拒绝新任务，调用方返回 503
+  static const int MAX_QUEUED = 1024;
+
+  static password_hasher* get_instance();
+
+  /**
+   * @brief 启动散列线程，只在事件循环启动前调用一次
+   *
+   * @param threads 散列线程数，至少为 1
+   * @param iterations PBKDF2 迭代次数
+   */
+  bool init(int threads, int iterations);
+
+  /**
+   * @brief 通知散列线程退出并等待
+   */
+  void stop();
+
+  /**
+   * @brief 设置新散列使用的迭代次数，可以在运行中修改
+   *
+   * 同时换掉不存在的用户用来比较的散列，使其验证耗时跟上新的迭代次数。
+   * @return bool 随机数不可用时为 false，迭代次数不变
+   */
+  bool set_iterations(int iterations);
+  int iterations() const { return m_iterations.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief 用新的随机盐散列口令，在当前线程中计算
+   *
+   * @return std::string 保存格式的散列，随机数不可用时为空
+   */
+  std::string hash(const std::string& password) const;
+
+  /**
+   * @brief 口令是否与保存的散列(或旧版明文)一致，在当前线程中计算
+   */
+  bool verify(const std::string& password, const std::string& stored) const;
+
+  /**
+   * @brief 保存的值是否应该按当前参数重新散列
+   */
+  bool needs_rehash(const std::string& stored) const;
+
+  /**
+   * @brief 在散列线程中散列口令
+   *
+   * @param[out] out 保存格式的散列
+   * @return bool 任务队列已满或散列失败时为 false
+   */
+  coro::task<bool> async_hash(const std::string& password, std::string& out);
+
+  /**
+   * @brief 在散列线程中验证口令
+   *
+   * @param stored 为空时与一个固定的散列比较，结果总是不一致，
+   *               用于不存在的用户，使响应时间与存在的用户相同
+   * @return int 1 一致，0 不一致，-1 任务队列已满
+   */
+  coro::task<int> async_verify(const std::string& password,
+                               const std::string& stored);
+
+ private:
+  enum job_kind { JOB_HASH = 0, JOB_VERIFY };
+
+  // 一个散列任务，在发起任务的协程帧中，结果写入后通知 efd
+  struct job {
+    int kind;
+    const std::string* password;
+    const std::string* stored;
+    std::string result;  ///< JOB_HASH 的结果
+    bool ok;             ///< JOB_VERIFY 的结果
+    int efd;
+  };
+
+  password_hasher();
+
+  static void* worker(void* arg);
+  void run(job* j) const;
+  // 把任务交给散列线程并等待完成，队列已满时返回 false
+  coro::task<bool> submit(job* j);
+
+  std::atomic<int> m_iterations;
+  // 不存在的用户用来比较的散列，受 m_mutex 保护
+  std::shared_ptr<const std::string> m_dummy;
+
+  // 以下由散列线程共享
+  locker m_mutex;
+  sem m_queued;  ///< 队列中的任务数
+  std::deque<job*> m_queue;
+  bool m_stop;
+  std::vector<pthread_t> m_threads;
+};
+
+#endif  // !AUTH_PASSWORD_H
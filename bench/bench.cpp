@@ -0,0 +1,205 @@
+/**
+ * @file
+ * @brief 微基准测试入口
+ *
+ * 用法: bench [-f filter] [-r reps] [-t ms] [-c corpus_dir] [-j]
+ *   -f  只运行名称包含 filter 的用例
+ *   -r  每个用例重复的轮数(默认 5)，输出取中位数
+ *   -t  每轮的目标耗时，单位毫秒(默认 100)
+ *   -c  请求样本目录(默认为源码中的 bench/corpus)
+ *   -j  每个用例输出一行 JSON，便于不同构建之间比较
+ */
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <vector>
+
+#ifndef BENCH_CORPUS_DIR
+#define BENCH_CORPUS_DIR "bench/corpus"
+#endif
+
+// --- 分配计数 ---
+// 替换全局 operator new，所有线程的分配都累加到同一个计数器
+static std::atomic<uint64_t> g_allocs(0);
+
+void* operator new(size_t size) {
+  g_allocs.fetch_add(1, std::memory_order_relaxed);
+  void* p = malloc(size ? size : 1);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void operator delete(void* p) noexcept { free(p); }
+
+void operator delete[](void* p) noexcept { free(p); }
+
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+static std::vector<bench_case>& cases() {
+  static std::vector<bench_case> all;
+  return all;
+}
+
+void bench_register(const std::string& name,
+                    const std::function<void(uint64_t)>& run,
+                    const std::function<void()>& setup,
+                    const std::function<void()>& teardown) {
+  bench_case c;
+  c.name = name;
+  c.run = run;
+  c.setup = setup;
+  c.teardown = teardown;
+  cases().push_back(c);
+}
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct bench_result {
+  double ns_median;
+  double ns_min;
+  double allocs;
+  uint64_t iters;
+};
+
+// 执行一轮，返回耗时(纳秒)并累计分配次数
+static uint64_t run_once(const bench_case& c, uint64_t n, uint64_t& allocs) {
+  if (c.setup) {
+    c.setup();
+  }
+  uint64_t a0 = g_allocs.load(std::memory_order_relaxed);
+  uint64_t t0 = now_ns();
+  c.run(n);
+  uint64_t t1 = now_ns();
+  allocs += g_allocs.load(std::memory_order_relaxed) - a0;
+  if (c.teardown) {
+    c.teardown();
+  }
+  return t1 - t0;
+}
+
+static bench_result measure(const bench_case& c, int reps, uint64_t target_ns) {
+  // 预热并估算迭代次数：从 1 次开始倍增，直到单轮耗时达到目标的 1/10
+  uint64_t n = 1;
+  uint64_t ignored = 0;
+  while (true) {
+    uint64_t elapsed = run_once(c, n, ignored);
+    if (elapsed >= target_ns / 10 || n >= (1ull << 40)) {
+      double per_op = (double)elapsed / n;
+      n = per_op > 0 ? (uint64_t)(target_ns / per_op) : n * 10;
+      break;
+    }
+    n *= 2;
+  }
+  if (n == 0) {
+    n = 1;
+  }
+
+  std::vector<double> samples;
+  uint64_t allocs = 0;
+  for (int r = 0; r < reps; r++) {
+    samples.push_back((double)run_once(c, n, allocs) / n);
+  }
+  std::sort(samples.begin(), samples.end());
+
+  bench_result res;
+  res.ns_median = samples[samples.size() / 2];
+  res.ns_min = samples[0];
+  res.allocs = (double)allocs / ((double)n * reps);
+  res.iters = n;
+  return res;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: bench [-f filter] [-r reps] [-t ms] [-c corpus_dir] [-j]\n");
+}
+
+int main(int argc, char* argv[]) {
+  std::string filter;
+  std::string corpus = BENCH_CORPUS_DIR;
+  int reps = 5;
+  int target_ms = 100;
+  bool json = false;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "f:r:t:c:jh")) != -1) {
+    switch (opt) {
+      case 'f':
+        filter = optarg;
+        break;
+      case 'r':
+        reps = std::max(1, atoi(optarg));
+        break;
+      case 't':
+        target_ms = std::max(1, atoi(optarg));
+        break;
+      case 'c':
+        corpus = optarg;
+        break;
+      case 'j':
+        json = true;
+        break;
+      default:
+        usage();
+        return 1;
+    }
+  }
+
+#if defined(__SANITIZE_ADDRESS__)
+  fprintf(stderr,
+          "warning: built with AddressSanitizer, numbers are not "
+          "representative\n");
+#endif
+
+  register_http_benches(corpus);
+  register_timer_benches();
+  register_pool_benches();
+  register_log_benches();
+  register_ratelimit_benches();
+  register_asset_benches(corpus);
+  register_coro_benches();
+  register_template_benches();
+  register_batcher_benches();
+
+  if (!json) {
+    printf("%-40s %12s %12s %10s %12s\n", "benchmark", "ns/op", "min ns/op",
+           "allocs/op", "iterations");
+  }
+  const std::vector<bench_case>& all = cases();
+  for (size_t i = 0; i < all.size(); i++) {
+    const bench_case& c = all[i];
+    if (!filter.empty() && c.name.find(filter) == std::string::npos) {
+      continue;
+    }
+    bench_result r = measure(c, reps, (uint64_t)target_ms * 1000000);
+    if (json) {
+      printf("{\"name\":\"%s\",\"ns_per_op\":%.2f,\"min_ns_per_op\":%.2f,"
+             "\"allocs_per_op\":%.3f,\"iterations\":%llu,\"reps\":%d}\n",
+             c.name.c_str(), r.ns_median, r.ns_min, r.allocs,
+             (unsigned long long)r.iters, reps);
+    } else {
+      printf("%-40s %12.1f %12.1f %10.3f %12llu\n", c.name.c_str(),
+             r.ns_median, r.ns_min, r.allocs, (unsigned long long)r.iters);
+    }
+    fflush(stdout);
+  }
+  return 0;
+}
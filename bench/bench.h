@@ -0,0 +1,48 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+#include <functional>
+#include <string>
+
+/*
+ * 微基准测试框架
+ * 每个用例提供 run(n)：执行 n 次被测操作。框架负责预热、
+ * 估算每轮的迭代次数、多轮重复，并统计 ns/op 与 allocs/op。
+ * setup/teardown 在计时范围之外，每轮各调用一次。
+ */
+
+struct bench_case {
+  std::string name;
+  std::function<void(uint64_t n)> run;
+  std::function<void()> setup;
+  std::function<void()> teardown;
+};
+
+/**
+ * @brief 注册一个用例
+ */
+void bench_register(const std::string& name,
+                    const std::function<void(uint64_t)>& run,
+                    const std::function<void()>& setup = nullptr,
+                    const std::function<void()>& teardown = nullptr);
+
+// 阻止编译器把被测结果优化掉
+template <typename T>
+inline void bench_keep(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// 各模块的用例注册函数
+void register_http_benches(const std::string& corpus_dir);
+void register_timer_benches();
+void register_pool_benches();
+void register_log_benches();
+void register_ratelimit_benches();
+void register_asset_benches(const std::string& corpus_dir);
+void register_coro_benches();
+void register_template_benches();
+void register_batcher_benches();
+
+#endif  // !BENCH_H
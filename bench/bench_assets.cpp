@@ -0,0 +1,65 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "http/asset_snapshot.h"
+
+/*
+ * 资源快照的查找与按文件查找的对比
+ * 快照按不同的路径数分别测量，完美哈希的查找代价应当与路径数无关；
+ * 按文件查找重复 lookup_file 的系统调用序列 stat/open/mmap/close/munmap。
+ */
+
+static const int PATH_COUNTS[] = {1000, 10000, 100000};
+
+void register_asset_benches(const std::string& corpus_dir) {
+  for (size_t c = 0; c < sizeof(PATH_COUNTS) / sizeof(PATH_COUNTS[0]); c++) {
+    int count = PATH_COUNTS[c];
+    std::vector<asset_source> files(count);
+    std::vector<std::string> urls(count);
+    for (int i = 0; i < count; i++) {
+      files[i].path = "/static/" + std::to_string(i) + "/app.js";
+      files[i].data = "x";
+      urls[i] = files[i].path;
+    }
+    std::string blob, error;
+    asset_pack_stats stats;
+    std::shared_ptr<asset_snapshot> assets(new asset_snapshot);
+    if (!pack_assets(files, -1, blob, stats, error) ||
+        !assets->attach(blob, error)) {
+      fprintf(stderr, "assets: %s\n", error.c_str());
+      continue;
+    }
+    bench_register("assets/find/" + std::to_string(count),
+                   [assets, urls](uint64_t n) {
+                     static size_t next = 0;
+                     for (uint64_t i = 0; i < n; i++) {
+                       // 乘以奇数打散访问顺序
+                       size_t k = (next++ * 2654435761u) % urls.size();
+                       bench_keep(assets->find(urls[k].c_str()));
+                     }
+                   });
+  }
+
+  std::string file = corpus_dir + "/curl.http";
+  bench_register("assets/filesystem", [file](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      struct stat st;
+      if (stat(file.c_str(), &st) < 0) {
+        continue;
+      }
+      int fd = open(file.c_str(), O_RDONLY);
+      void* addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+      bench_keep(addr);
+      munmap(addr, st.st_size);
+    }
+  });
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+
+#include "CGImysql/sql_connection_pool.h"
+#include "CGImysql/sql_write_batcher.h"
+#include "bench.h"
+#include "coro/scheduler.h"
+#include "coro/task.h"
+
+/*
+ * 组提交的写入吞吐
+ * 需要一个可写的 MySQL，由环境变量 MWS_BENCH_DB=host:port:user:password:db
+ * 指定，没有设置时不注册这组用例。写入 mws_bench_batch 表(不存在时创建)。
+ *
+ * 一次操作是一行 INSERT 经 sql_write_batcher 写入并等到提交，ns/op 的倒数即
+ * 每秒行数。batcher/insert/1 只有一个写入者，每个事务一行，相当于不合并；
+ * batcher/insert/64 有 64 个协程同时写入，同一轮的行合并到一个事务中。
+ * 两者之比就是组提交在当前数据库提交时延下的收益。
+ */
+
+static const char BENCH_INSERT[] = "INSERT INTO mws_bench_batch(k, v)";
+static const int BENCH_BATCH_ROWS = 256;
+static const int BENCH_DB_CONNS = 4;
+
+struct batcher_fixture {
+  coro::scheduler sched;
+  int epollfd;
+  unsigned long long next_key;  ///< 主键序号，各轮之间不重复
+  uint64_t next_row;            ///< 本轮下一个待写的行
+  uint64_t rows;                ///< 本轮的行数
+  int running;                  ///< 未结束的写入协程
+  int failed;                   ///< 本轮失败的行数
+
+  batcher_fixture() : next_key(0), next_row(0), rows(0), running(0), failed(0) {
+    epollfd = epoll_create1(0);
+    sched.init(epollfd);
+  }
+  ~batcher_fixture() { close(epollfd); }
+};
+
+static coro::task<void> writer(batcher_fixture* f) {
+  std::string values;
+  while (f->next_row < f->rows) {
+    f->next_row++;
+    char buf[96];
+    snprintf(buf, sizeof(buf), "('%d-%llu', 'v')", (int)getpid(),
+             f->next_key++);
+    values.assign(buf);
+    if (co_await sql_write_batcher::GetInstance()->Insert(BENCH_INSERT,
+                                                          values) != 0) {
+      f->failed++;
+    }
+  }
+  f->running--;
+}
+
+// 启动 writers 个写入协程写 n 行，驱动事件循环直到全部提交
+static void run_writers(batcher_fixture* f, int writers, uint64_t n) {
+  f->next_row = 0;
+  f->rows = n;
+  f->failed = 0;
+  f->running = writers;
+  for (int i = 0; i < writers; i++) {
+    coro::spawn(writer(f));
+  }
+  epoll_event events[64];
+  while (f->running > 0) {
+    int count = epoll_wait(f->epollfd, events, 64, f->sched.next_timeout(-1));
+    for (int i = 0; i < count; i++) {
+      f->sched.handle_event(events[i]);
+    }
+    f->sched.run_timers();
+  }
+  if (f->failed > 0) {
+    fprintf(stderr, "batcher: %d rows failed\n", f->failed);
+  }
+}
+
+// 解析 MWS_BENCH_DB，连接数据库并启动写入线程
+static bool init_db(const char* spec) {
+  std::string s(spec);
+  std::string parts[5];
+  size_t pos = 0;
+  for (int i = 0; i < 5; i++) {
+    size_t end = i < 4 ? s.find(':', pos) : s.size();
+    if (end == std::string::npos) {
+      fprintf(stderr, "MWS_BENCH_DB: expected host:port:user:password:db\n");
+      return false;
+    }
+    parts[i] = s.substr(pos, end - pos);
+    pos = end + 1;
+  }
+  connection_poll* pool = connection_poll::GetInstance();
+  pool->init(parts[0], parts[2], parts[3], parts[4], atoi(parts[1].c_str()),
+             BENCH_DB_CONNS, 1);
+  {
+    MYSQL* mysql = nullptr;
+    connectionRAII raii(&mysql, pool);
+    mysql_query(mysql,
+                "CREATE TABLE IF NOT EXISTS mws_bench_batch "
+                "(k VARCHAR(64) PRIMARY KEY, v VARCHAR(16))");
+  }
+  // 不等待攒批：只有一个写入者时每个事务正好一行
+  return sql_write_batcher::GetInstance()->init(pool, BENCH_BATCH_ROWS, 0);
+}
+
+void register_batcher_benches() {
+  const char* spec = getenv("MWS_BENCH_DB");
+  if (spec == nullptr || !init_db(spec)) {
+    return;
+  }
+  // 调度器绑定在注册所在的线程，用例也在这个线程中运行
+  std::shared_ptr<batcher_fixture> f(new batcher_fixture);
+  bench_register("batcher/insert/1",
+                 [f](uint64_t n) { run_writers(f.get(), 1, n); });
+  bench_register("batcher/insert/64",
+                 [f](uint64_t n) { run_writers(f.get(), 64, n); });
+}
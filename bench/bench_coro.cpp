@@ -0,0 +1,90 @@
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <memory>
+
+#include "bench.h"
+#include "coro/scheduler.h"
+#include "coro/task.h"
+
+/*
+ * 协程的创建、嵌套等待与唤醒
+ * coro/task 启动一个处理函数并等待一个返回值的子任务，帧来自线程的帧池，
+ * 稳定后 allocs/op 应为 0；coro/wakeup 在 socketpair 上挂起读，
+ * 写入一个字节后经 epoll_wait 与 scheduler 恢复，对应一次 fd 等待的完整路径。
+ */
+
+static coro::task<int> child(int x) { co_return x + 1; }
+
+static coro::task<void> parent(int* out) { *out = co_await child(*out); }
+
+static coro::task<void> reader(int fd, int* got) {
+  char c;
+  ssize_t n = co_await coro::async_read(fd, &c, 1);
+  *got += (int)n;
+}
+
+// 帧池与 operator new 对比所用的帧大小
+static const size_t FRAME_SIZE = 256;
+
+struct wakeup_fixture {
+  coro::scheduler sched;
+  int epollfd;
+  int fds[2];
+
+  wakeup_fixture() {
+    epollfd = epoll_create1(0);
+    socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+    sched.init(epollfd);
+  }
+  ~wakeup_fixture() {
+    sched.forget(fds[0]);
+    close(fds[0]);
+    close(fds[1]);
+    close(epollfd);
+  }
+};
+
+void register_coro_benches() {
+  bench_register("coro/task", [](uint64_t n) {
+    int value = 0;
+    for (uint64_t i = 0; i < n; i++) {
+      coro::spawn(parent(&value));
+    }
+    bench_keep(value);
+  });
+
+  bench_register("coro/frame_pool", [](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      void* p = coro::frame_alloc(FRAME_SIZE);
+      bench_keep(p);
+      coro::frame_free(p, FRAME_SIZE);
+    }
+  });
+  bench_register("coro/frame_new", [](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      void* p = ::operator new(FRAME_SIZE);
+      bench_keep(p);
+      ::operator delete(p);
+    }
+  });
+
+  // 调度器绑定在注册所在的线程，用例也在这个线程中运行
+  std::shared_ptr<wakeup_fixture> f(new wakeup_fixture);
+  bench_register("coro/wakeup", [f](uint64_t n) {
+    int got = 0;
+    epoll_event ev;
+    for (uint64_t i = 0; i < n; i++) {
+      coro::spawn(reader(f->fds[0], &got));
+      char c = 'x';
+      if (write(f->fds[1], &c, 1) != 1 ||
+          epoll_wait(f->epollfd, &ev, 1, -1) != 1) {
+        abort();
+      }
+      f->sched.handle_event(ev);
+    }
+    bench_keep(got);
+  });
+}
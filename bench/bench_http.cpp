@@ -0,0 +1,168 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "http/http_conn.h"
+
+/*
+ * 请求样本放在 bench/corpus 下的 .http 文件，每个文件一个完整请求。
+ * 文件以 LF 换行保存，加载时统一转换为 CRLF。
+ */
+
+struct http_sample {
+  std::string name;
+  std::string data;
+};
+
+static std::string to_crlf(const std::string& in) {
+  if (in.find("\r\n") != std::string::npos) {
+    return in;
+  }
+  std::string out;
+  out.reserve(in.size() + in.size() / 16);
+  for (size_t i = 0; i < in.size(); i++) {
+    if (in[i] == '\n') {
+      out += '\r';
+    }
+    out += in[i];
+  }
+  return out;
+}
+
+static std::vector<http_sample> load_corpus(const std::string& dir) {
+  std::vector<http_sample> samples;
+  DIR* d = opendir(dir.c_str());
+  if (d == nullptr) {
+    fprintf(stderr, "bench: cannot open corpus directory %s\n", dir.c_str());
+    return samples;
+  }
+  struct dirent* ent;
+  while ((ent = readdir(d)) != nullptr) {
+    std::string file = ent->d_name;
+    if (file.size() <= 5 || file.compare(file.size() - 5, 5, ".http") != 0) {
+      continue;
+    }
+    FILE* fp = fopen((dir + "/" + file).c_str(), "rb");
+    if (fp == nullptr) {
+      continue;
+    }
+    std::string data;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+      data.append(buf, n);
+    }
+    fclose(fp);
+
+    http_sample s;
+    s.name = file.substr(0, file.size() - 5);
+    s.data = to_crlf(data);
+    if (s.data.size() >= (size_t)http_conn::READ_BUFFER_SIZE) {
+      fprintf(stderr, "bench: %s is larger than the read buffer, skipped\n",
+              file.c_str());
+      continue;
+    }
+    samples.push_back(s);
+  }
+  closedir(d);
+  std::sort(samples.begin(), samples.end(),
+            [](const http_sample& a, const http_sample& b) {
+              return a.name < b.name;
+            });
+  return samples;
+}
+
+/**
+ * @struct http_conn_bench
+ * @brief http_conn 的友元，绕过 socket 直接操作读写缓冲区
+ */
+struct http_conn_bench {
+  // 模拟 read_once 读入一个完整请求
+  static void feed(http_conn& c, const std::string& req) {
+    c.init();
+    memcpy(c.m_buf->read_buf, req.data(), req.size());
+    c.m_read_idx = req.size();
+  }
+
+  // 只跑从状态机，统计切出的行数
+  static int split_lines(http_conn& c, const std::string& req) {
+    memcpy(c.m_buf->read_buf, req.data(), req.size());
+    c.m_read_idx = req.size();
+    c.m_checked_idx = 0;
+    int lines = 0;
+    while (c.parse_line() == http_conn::LINE_OK) {
+      lines++;
+    }
+    return lines;
+  }
+
+  static http_conn::HTTP_CODE parse(http_conn& c) {
+    http_conn::HTTP_CODE ret = c.process_read();
+    c.unmap();
+    return ret;
+  }
+
+  static void reset_write(http_conn& c) { c.m_write_idx = 0; }
+
+  // 与 process_write 中 FILE_REQUEST 分支相同的响应头
+  static bool build_headers(http_conn& c, int content_length) {
+    c.add_status_line(200, "OK");
+    return c.add_headers(content_length);
+  }
+
+  static void init(http_conn& c) { c.init(); }
+
+  // 服务器在 read_once 中挂载缓冲区，这里创建后直接挂载并一直持有
+  static http_conn* create() {
+    http_conn* c = new http_conn;
+    c->m_buf = nullptr;
+    c->m_half_open = false;
+    c->init();
+    c->attach_buffers();
+    return c;
+  }
+};
+
+void register_http_benches(const std::string& corpus_dir) {
+  // 连接与挂载的缓冲区在所有用例间共享
+  static std::unique_ptr<http_conn> conn(http_conn_bench::create());
+  http_conn* c = conn.get();
+
+  bench_register("http/init", [c](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      http_conn_bench::init(*c);
+      bench_keep(c);
+    }
+  });
+
+  std::vector<http_sample> samples = load_corpus(corpus_dir);
+  for (size_t i = 0; i < samples.size(); i++) {
+    std::string req = samples[i].data;
+    bench_register("http/parse_line/" + samples[i].name, [c, req](uint64_t n) {
+      for (uint64_t k = 0; k < n; k++) {
+        bench_keep(http_conn_bench::split_lines(*c, req));
+      }
+    });
+    // 包含 init 与 do_request 中的文件查找，与服务器处理一个请求的路径一致
+    bench_register("http/process_read/" + samples[i].name,
+                   [c, req](uint64_t n) {
+                     for (uint64_t k = 0; k < n; k++) {
+                       http_conn_bench::feed(*c, req);
+                       bench_keep(http_conn_bench::parse(*c));
+                     }
+                   });
+  }
+
+  bench_register("http/add_response/headers", [c](uint64_t n) {
+    for (uint64_t i = 0; i < n; i++) {
+      http_conn_bench::reset_write(*c);
+      bench_keep(http_conn_bench::build_headers(*c, 1048576));
+    }
+  });
+}
@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <time.h>
+
+#include <string>
+
+#include "bench.h"
+#include "log/log.h"
+
+/*
+ * 异步日志的写入端：格式化到本线程的环形缓冲区，由后台线程刷盘。
+ * log/write 不限速地连续写，测量单条日志的开销；
+ * log/paced/1M 按每秒一百万条的速率写，衡量刷盘线程能否跟上，
+ * 某一轮有日志因环满被丢弃时，在标准错误输出丢弃的条数。
+ * 日志写到 /tmp 下，文件名带日期前缀。
+ */
+
+static const char* BENCH_LOG_FILE = "/tmp/mws_bench.log";
+static const uint64_t PACED_INTERVAL_NS = 1000;
+
+static unsigned long long g_dropped_before = 0;
+
+static uint64_t clock_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void log_setup() {
+  Log* log = Log::get_instance();
+  // 第一次调用时启动刷盘线程，之后 init 直接返回
+  log->init(BENCH_LOG_FILE, 0);
+  g_dropped_before = log->dropped();
+}
+
+static void log_report() {
+  Log* log = Log::get_instance();
+  log->flush();
+  unsigned long long dropped = log->dropped() - g_dropped_before;
+  if (dropped > 0) {
+    fprintf(stderr, "log/paced/1M: %llu lines dropped\n", dropped);
+  }
+}
+
+void register_log_benches() {
+  bench_register(
+      "log/write",
+      [](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          LOG_INFO("bench: request %llu took %d us", (unsigned long long)i,
+                   42);
+        }
+      },
+      log_setup, []() { Log::get_instance()->flush(); });
+
+  // 忙等到每条的计划时间再写，ns/op 接近 1000 说明写入端没有拖慢节奏
+  bench_register(
+      "log/paced/1M",
+      [](uint64_t n) {
+        uint64_t next = clock_ns();
+        for (uint64_t i = 0; i < n; i++) {
+          while (clock_ns() < next) {
+          }
+          LOG_INFO("bench: request %llu took %d us", (unsigned long long)i,
+                   42);
+          next += PACED_INTERVAL_NS;
+        }
+      },
+      log_setup, log_report);
+}
@@ -0,0 +1,69 @@
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+
+#include "CGImysql/sql_connection_pool.h"
+#include "bench.h"
+
+/*
+ * 连接池的获取与归还只涉及信号量、互斥锁与链表，不会访问 MYSQL 结构本身，
+ * 因此用伪造的指针填充连接池即可在没有数据库的机器上测量。
+ * 每轮结束时取回全部伪连接，避免进程退出时 DestroyPool 关闭它们。
+ */
+
+static const int FAKE_CONNS = 8;
+static const int THREAD_COUNTS[] = {1, 2, 4, 8};
+
+static char g_fake[FAKE_CONNS];
+
+static void seed_pool() {
+  connection_poll* pool = connection_poll::GetInstance();
+  for (int i = 0; i < FAKE_CONNS; i++) {
+    pool->ReleaseConnection(reinterpret_cast<MYSQL*>(&g_fake[i]));
+  }
+}
+
+static void drain_pool() {
+  connection_poll* pool = connection_poll::GetInstance();
+  for (int i = 0; i < FAKE_CONNS; i++) {
+    pool->GetConnection();
+  }
+}
+
+struct pool_worker_arg {
+  uint64_t ops;
+};
+
+static void* pool_worker(void* arg) {
+  pool_worker_arg* a = (pool_worker_arg*)arg;
+  connection_poll* pool = connection_poll::GetInstance();
+  for (uint64_t i = 0; i < a->ops; i++) {
+    MYSQL* con = nullptr;
+    connectionRAII guard(&con, pool);
+    bench_keep(con);
+  }
+  return nullptr;
+}
+
+void register_pool_benches() {
+  for (size_t t = 0; t < sizeof(THREAD_COUNTS) / sizeof(THREAD_COUNTS[0]);
+       t++) {
+    int threads = THREAD_COUNTS[t];
+    // 结果为所有线程合计的单次获取+归还耗时，线程数超过伪连接数时包含等待
+    bench_register(
+        "pool/acquire_release/threads=" + std::to_string(threads),
+        [threads](uint64_t n) {
+          std::vector<pthread_t> tids(threads);
+          std::vector<pool_worker_arg> args(threads);
+          for (int i = 0; i < threads; i++) {
+            args[i].ops = n / threads + (i < (int)(n % threads) ? 1 : 0);
+            pthread_create(&tids[i], nullptr, pool_worker, &args[i]);
+          }
+          for (int i = 0; i < threads; i++) {
+            pthread_join(tids[i], nullptr);
+          }
+        },
+        seed_pool, drain_pool);
+  }
+}
@@ -0,0 +1,34 @@
+#include <string>
+
+#include "bench.h"
+#include "http/rate_limit.h"
+
+/*
+ * 限流表的查找只检查固定大小的窗口，代价应当与不同 IP 的数量无关。
+ * 按不同的 IP 数分别测量，最大的一组超过表的容量，会触发替换。
+ */
+
+static const int TABLE_ENTRIES = 1 << 22;
+static const int CLIENT_COUNTS[] = {1000, 100000, 1000000, 8000000};
+
+void register_ratelimit_benches() {
+  rate_limit_config config;
+  config.request.rate = 1000000;
+  config.entries = TABLE_ENTRIES;
+  rate_limiter::get_instance()->init(config);
+
+  for (size_t c = 0; c < sizeof(CLIENT_COUNTS) / sizeof(CLIENT_COUNTS[0]);
+       c++) {
+    uint32_t clients = CLIENT_COUNTS[c];
+    bench_register("ratelimit/request/" + std::to_string(clients),
+                   [clients](uint64_t n) {
+                     static uint32_t next = 0;
+                     rate_limiter* limiter = rate_limiter::get_instance();
+                     for (uint64_t i = 0; i < n; i++) {
+                       // 乘以奇数打散访问顺序，避免连续的 IP 落在相邻槽位
+                       uint32_t addr = (next++ % clients) * 2654435761u;
+                       bench_keep(limiter->allow_request(addr, "/index.html"));
+                     }
+                   });
+  }
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "bench.h"
+#include "http/page_template.h"
+
+/*
+ * 页面模板与字符串拼接的对比
+ * 两者生成同一个页面：约 2KB 的页头页尾与一张按行数变化的三列表格，值都做 HTML 转义。
+ * template/render 输出 iovec，静态部分只引用不复制；template/concat 用 std::string
+ * 逐段拼接，输出字符串复用容量。两者稳定后 allocs/op 都应为 0。
+ */
+
+static const int ROW_COUNTS[] = {10, 100, 1000};
+
+static const char PAGE[] =
+    "<!DOCTYPE html>\n<html>\n<head>\n<meta charset=\"utf-8\">\n"
+    "<title>{{title}}</title>\n<link rel=\"stylesheet\" href=\"/site.css\">\n"
+    "</head>\n<body>\n<header><nav><a href=\"/\">Home</a> "
+    "<a href=\"/users\">Users</a> <a href=\"/about\">About</a></nav></header>\n"
+    "<main>\n<h1>{{title}}</h1>\n<table>\n"
+    "<tr><th>ID</th><th>Name</th><th>Email</th></tr>\n"
+    "{{#users}}<tr><td>{{id}}</td><td>{{name}}</td><td>{{email}}</td></tr>\n"
+    "{{/users}}{{^users}}<tr><td colspan=\"3\">No users</td></tr>\n{{/users}}"
+    "</table>\n</main>\n<footer>\n";
+
+// 页尾加长到与常见页面的脚本与版权信息相当
+static std::string page_text() {
+  std::string text = PAGE;
+  for (int i = 0; i < 24; i++) {
+    text += "<p class=\"legal\">Lorem ipsum dolor sit amet, consectetur.</p>\n";
+  }
+  text += "</footer>\n</body>\n</html>\n";
+  return text;
+}
+
+struct page_rows {
+  std::vector<std::string> cells;  // 每行 id, name, email
+};
+
+static void escape_append(std::string& out, const std::string& s) {
+  for (size_t i = 0; i < s.size(); i++) {
+    switch (s[i]) {
+      case '&': out += "&amp;"; break;
+      case '<': out += "&lt;"; break;
+      case '>': out += "&gt;"; break;
+      case '"': out += "&quot;"; break;
+      case '\'': out += "&#39;"; break;
+      default: out += s[i]; break;
+    }
+  }
+}
+
+void register_template_benches() {
+  std::string text = page_text();
+  std::string error;
+  page_template_ptr tpl = page_template::compile(text, error);
+  if (!tpl) {
+    fprintf(stderr, "template: %s\n", error.c_str());
+    return;
+  }
+  // 拼接版本使用与模板相同的静态片段
+  std::shared_ptr<std::vector<std::string> > parts(
+      new std::vector<std::string>);
+  size_t pos = 0;
+  while (pos < text.size()) {
+    size_t b = text.find("{{", pos);
+    if (b == std::string::npos) {
+      parts->push_back(text.substr(pos));
+      break;
+    }
+    parts->push_back(text.substr(pos, b - pos));
+    pos = text.find("}}", b) + 2;
+  }
+
+  for (size_t c = 0; c < sizeof(ROW_COUNTS) / sizeof(ROW_COUNTS[0]); c++) {
+    int count = ROW_COUNTS[c];
+    std::shared_ptr<page_rows> rows(new page_rows);
+    for (int i = 0; i < count; i++) {
+      rows->cells.push_back(std::to_string(i + 1));
+      rows->cells.push_back("user" + std::to_string(i) + " <admin>");
+      rows->cells.push_back("user" + std::to_string(i) + "@example.com");
+    }
+
+    bench_register("template/render/" + std::to_string(count),
+                   [tpl, rows](uint64_t n) {
+                     static template_data data;
+                     static std::string out;
+                     static std::vector<struct iovec> iov;
+                     std::vector<const char*> row(3);
+                     std::vector<unsigned long> lens(3);
+                     for (uint64_t i = 0; i < n; i++) {
+                       data.clear();
+                       data.set("title", "Users");
+                       template_rows& users = data.rows("users");
+                       users.columns.assign({"id", "name", "email"});
+                       for (size_t r = 0; r < rows->cells.size(); r += 3) {
+                         for (int k = 0; k < 3; k++) {
+                           row[k] = rows->cells[r + k].data();
+                           lens[k] = rows->cells[r + k].size();
+                         }
+                         users.add_row(row.data(), lens.data());
+                       }
+                       out.clear();
+                       iov.clear();
+                       bench_keep(tpl->render(data, out, iov));
+                     }
+                   });
+
+    bench_register("template/concat/" + std::to_string(count),
+                   [parts, rows](uint64_t n) {
+                     static std::string out;
+                     const std::vector<std::string>& p = *parts;
+                     std::string title = "Users";
+                     for (uint64_t i = 0; i < n; i++) {
+                       out.clear();
+                       out += p[0];
+                       escape_append(out, title);
+                       out += p[1];
+                       escape_append(out, title);
+                       out += p[2];
+                       for (size_t r = 0; r < rows->cells.size(); r += 3) {
+                         out += p[3];
+                         escape_append(out, rows->cells[r]);
+                         out += p[4];
+                         escape_append(out, rows->cells[r + 1]);
+                         out += p[5];
+                         escape_append(out, rows->cells[r + 2]);
+                         out += p[6];
+                       }
+                       if (rows->cells.empty()) {
+                         out += p[8];
+                       }
+                       out += p[9];
+                       bench_keep(out.size());
+                     }
+                   });
+  }
+}
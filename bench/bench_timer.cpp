@@ -0,0 +1,105 @@
+#include <memory>
+#include <string>
+
+#include "bench.h"
+#include "timer/lst_timer.h"
+
+/*
+ * 定时器链表按超时时间升序排列，插入与调整都需要从头遍历，
+ * 代价随链表长度线性增长，所以按不同的连接数分别测量。
+ */
+
+static const int LIST_SIZES[] = {100, 1000, 10000};
+
+static client_data g_user;
+
+static void noop_cb(client_data*) {}
+
+static util_timer* make_timer(time_t expire) {
+  util_timer* t = new util_timer;
+  t->expire = expire;
+  t->cb_func = noop_cb;
+  t->user_data = &g_user;
+  return t;
+}
+
+// 定时器链表与其中最大的超时时间
+struct timer_fixture {
+  std::unique_ptr<sort_timer_lst> lst;
+  util_timer* first;  ///< 最早超时的定时器
+  time_t max_expire;
+
+  // 建立 size 个定时器，超时时间为 base+1 .. base+size
+  // 按降序插入，每次都落在链表头部，建表是线性的
+  void build(int size, time_t base = 0) {
+    lst.reset(new sort_timer_lst);
+    first = nullptr;
+    max_expire = base + size;
+    for (int i = size; i > 0; i--) {
+      first = make_timer(base + i);
+      lst->add_timer(first);
+    }
+  }
+};
+
+void register_timer_benches() {
+  static timer_fixture fx;
+
+  for (size_t s = 0; s < sizeof(LIST_SIZES) / sizeof(LIST_SIZES[0]); s++) {
+    int size = LIST_SIZES[s];
+    std::string suffix = "/" + std::to_string(size);
+
+    // 新连接：超时时间最大，插到尾部，随后删除以保持链表长度不变
+    bench_register(
+        "timer/add_del" + suffix,
+        [](uint64_t n) {
+          for (uint64_t i = 0; i < n; i++) {
+            util_timer* t = make_timer(fx.max_expire + 1);
+            fx.lst->add_timer(t);
+            fx.lst->del_timer(t);
+          }
+        },
+        [size]() { fx.build(size); }, []() { fx.lst.reset(); });
+
+    // 收到数据：把当前最早超时的定时器延期到最后，对应 adjust_timer 的常见路径
+    bench_register(
+        "timer/adjust" + suffix,
+        [](uint64_t n) {
+          util_timer* t = fx.first;
+          for (uint64_t i = 0; i < n; i++) {
+            util_timer* next = t->next;
+            t->expire = ++fx.max_expire;
+            fx.lst->adjust_timer(t);
+            t = next ? next : t;
+          }
+          fx.first = t;
+        },
+        [size]() { fx.build(size); }, []() { fx.lst.reset(); });
+  }
+
+  // 到期处理：每批插入 1000 个已过期的定时器再 tick，结果为单个定时器的开销
+  // 超时时间递减，插入都落在头部，测到的主要是 tick 本身
+  bench_register(
+      "timer/tick_expire",
+      [](uint64_t n) {
+        const uint64_t batch = 1000;
+        for (uint64_t done = 0; done < n; done += batch) {
+          uint64_t count = n - done < batch ? n - done : batch;
+          for (uint64_t i = 0; i < count; i++) {
+            fx.lst->add_timer(make_timer(-(time_t)i));
+          }
+          fx.lst->tick();
+        }
+      },
+      []() { fx.lst.reset(new sort_timer_lst); }, []() { fx.lst.reset(); });
+
+  // 没有到期的定时器时 tick 的开销
+  bench_register(
+      "timer/tick_idle/1000",
+      [](uint64_t n) {
+        for (uint64_t i = 0; i < n; i++) {
+          fx.lst->tick();
+        }
+      },
+      []() { fx.build(1000, time(nullptr) + 3600); }, []() { fx.lst.reset(); });
+}
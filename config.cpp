@@ -0,0 +1,450 @@
+#include "config.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+
+#include "http/http_conn.h"
+
+server_config::server_config()
+    : port(9006),
+      admin_port(0),
+      admin_addr("127.0.0.1"),
+      metrics_path("/metrics"),
+      backlog(1024),
+      listen_trig(1),
+      conn_trig(1),
+      threads(1),
+      cpu_affinity(AFFINITY_NONE),
+      incoming_cpu(0),
+      spin_us(0),
+      busy_poll_us(0),
+      prefer_busy_poll(0),
+      io_read_budget(65536),
+      io_write_budget(262144),
+      accept_budget(64),
+      read_buffer(http_conn::READ_BUFFER_SIZE),
+      write_buffer(http_conn::WRITE_BUFFER_SIZE),
+      buffer_pool(256),
+      timeslot(5),
+      header_timeout(10),
+      body_timeout(10),
+      body_min_rate(1024),
+      keepalive_timeout(15),
+      write_timeout(60),
+      conn_timeout(15),
+      half_open_per_ip(0),
+      drain_timeout(30),
+      asset_gzip_min(256),
+      close_log(0),
+      log_ring(16384),
+      trace_events(0),
+      capture_limit_mb(1024),
+      db_host("localhost"),
+      db_port(3306),
+      db_user("root"),
+      db_name("webserver"),
+      db_conns(0),
+      db_cache_mb(16),
+      db_batch_rows(256),
+      db_batch_delay_ms(2),
+      auth_hash_iterations(100000),
+      auth_hash_threads(2) {}
+
+// 去掉首尾空白
+static std::string trim(const std::string& s) {
+  size_t begin = s.find_first_not_of(" \t\r\n");
+  if (begin == std::string::npos) {
+    return "";
+  }
+  size_t end = s.find_last_not_of(" \t\r\n");
+  return s.substr(begin, end - begin + 1);
+}
+
+// 解析 [min, max] 范围内的整数
+static bool set_int(const std::string& key, const std::string& value, int min,
+                    int max, int& out, std::string& error) {
+  char* end = nullptr;
+  errno = 0;
+  long v = strtol(value.c_str(), &end, 10);
+  if (value.empty() || *end != '\0' || errno != 0 || v < min || v > max) {
+    error = key + ": expected an integer in [" + std::to_string(min) + ", " +
+            std::to_string(max) + "], got '" + value + "'";
+    return false;
+  }
+  out = (int)v;
+  return true;
+}
+
+// 触发模式，接受 lt/et 或 0/1
+static bool set_trig(const std::string& key, const std::string& value,
+                     int& out, std::string& error) {
+  if (value == "lt" || value == "LT" || value == "0") {
+    out = 0;
+  } else if (value == "et" || value == "ET" || value == "1") {
+    out = 1;
+  } else {
+    error = key + ": expected lt or et, got '" + value + "'";
+    return false;
+  }
+  return true;
+}
+
+bool config_set(server_config& c, const std::string& key,
+                const std::string& value, std::string& error) {
+  if (key == "port") {
+    return set_int(key, value, 1, 65535, c.port, error);
+  } else if (key == "admin_port") {
+    return set_int(key, value, 0, 65535, c.admin_port, error);
+  } else if (key == "admin_addr") {
+    struct in_addr addr;
+    if (inet_pton(AF_INET, value.c_str(), &addr) != 1) {
+      error = key + ": must be a dotted IPv4 address";
+      return false;
+    }
+    c.admin_addr = value;
+    return true;
+  } else if (key == "metrics_path") {
+    if (value.empty() || value[0] != '/') {
+      error = key + ": must start with '/'";
+      return false;
+    }
+    c.metrics_path = value;
+    return true;
+  } else if (key == "backlog") {
+    return set_int(key, value, 1, INT_MAX, c.backlog, error);
+  } else if (key == "listen_trig") {
+    return set_trig(key, value, c.listen_trig, error);
+  } else if (key == "conn_trig") {
+    return set_trig(key, value, c.conn_trig, error);
+  } else if (key == "threads") {
+    return set_int(key, value, 1, 64, c.threads, error);
+  } else if (key == "cpu_affinity") {
+    if (!parse_affinity_policy(value, c.cpu_affinity)) {
+      error = key + ": expected none, compact, scatter or list, got '" +
+              value + "'";
+      return false;
+    }
+    return true;
+  } else if (key == "cpu_list") {
+    std::vector<int> cpus;
+    if (!value.empty() && !parse_cpu_list(value, cpus)) {
+      error = key + ": expected a list like 0,2,4-7, got '" + value + "'";
+      return false;
+    }
+    c.cpu_list = value;
+    return true;
+  } else if (key == "incoming_cpu") {
+    return set_int(key, value, 0, 1, c.incoming_cpu, error);
+  } else if (key == "spin_us") {
+    return set_int(key, value, 0, 1000000, c.spin_us, error);
+  } else if (key == "busy_poll_us") {
+    return set_int(key, value, 0, 1000000, c.busy_poll_us, error);
+  } else if (key == "prefer_busy_poll") {
+    return set_int(key, value, 0, 1, c.prefer_busy_poll, error);
+  } else if (key == "io_read_budget") {
+    return set_int(key, value, 0, INT_MAX, c.io_read_budget, error);
+  } else if (key == "io_write_budget") {
+    return set_int(key, value, 0, INT_MAX, c.io_write_budget, error);
+  } else if (key == "accept_budget") {
+    return set_int(key, value, 0, 1000000, c.accept_budget, error);
+  } else if (key == "read_buffer") {
+    return set_int(key, value, 512, 1 << 20, c.read_buffer, error);
+  } else if (key == "write_buffer") {
+    return set_int(key, value, 512, 1 << 20, c.write_buffer, error);
+  } else if (key == "buffer_pool") {
+    return set_int(key, value, 0, 1 << 20, c.buffer_pool, error);
+  } else if (key == "timeslot") {
+    return set_int(key, value, 1, 3600, c.timeslot, error);
+  } else if (key == "header_timeout") {
+    return set_int(key, value, 1, 86400, c.header_timeout, error);
+  } else if (key == "body_timeout") {
+    return set_int(key, value, 1, 86400, c.body_timeout, error);
+  } else if (key == "body_min_rate") {
+    return set_int(key, value, 0, INT_MAX, c.body_min_rate, error);
+  } else if (key == "keepalive_timeout") {
+    return set_int(key, value, 1, 86400, c.keepalive_timeout, error);
+  } else if (key == "write_timeout") {
+    return set_int(key, value, 1, 86400, c.write_timeout, error);
+  } else if (key == "conn_timeout") {
+    return set_int(key, value, 1, 86400, c.conn_timeout, error);
+  } else if (key == "half_open_per_ip") {
+    return set_int(key, value, 0, 1 << 20, c.half_open_per_ip, error);
+  } else if (key == "drain_timeout") {
+    return set_int(key, value, 0, 86400, c.drain_timeout, error);
+  } else if (key == "close_log") {
+    return set_int(key, value, 0, 1, c.close_log, error);
+  } else if (key == "log_ring") {
+    if (!set_int(key, value, 64, 1 << 24, c.log_ring, error)) {
+      return false;
+    }
+    if ((c.log_ring & (c.log_ring - 1)) != 0) {
+      error = key + ": must be a power of two";
+      return false;
+    }
+    return true;
+  } else if (key == "access_log_dir") {
+    c.access_log_dir = value;
+    return true;
+  } else if (key == "trace_events") {
+    return set_int(key, value, 0, 1 << 24, c.trace_events, error);
+  } else if (key == "capture_dir") {
+    c.capture_dir = value;
+    return true;
+  } else if (key == "capture_limit_mb") {
+    return set_int(key, value, 1, 1 << 20, c.capture_limit_mb, error);
+  } else if (key == "db_host") {
+    c.db_host = value;
+    return true;
+  } else if (key == "db_port") {
+    return set_int(key, value, 1, 65535, c.db_port, error);
+  } else if (key == "db_user") {
+    c.db_user = value;
+    return true;
+  } else if (key == "db_password") {
+    c.db_password = value;
+    return true;
+  } else if (key == "db_name") {
+    c.db_name = value;
+    return true;
+  } else if (key == "db_conns") {
+    return set_int(key, value, 0, 1024, c.db_conns, error);
+  } else if (key == "db_cache_mb") {
+    return set_int(key, value, 0, 65536, c.db_cache_mb, error);
+  } else if (key == "db_batch_rows") {
+    return set_int(key, value, 1, 100000, c.db_batch_rows, error);
+  } else if (key == "db_batch_delay_ms") {
+    return set_int(key, value, 0, 10000, c.db_batch_delay_ms, error);
+  } else if (key == "auth_hash_iterations") {
+    return set_int(key, value, 1000, 10000000, c.auth_hash_iterations, error);
+  } else if (key == "auth_hash_threads") {
+    return set_int(key, value, 1, 256, c.auth_hash_threads, error);
+  } else if (key == "admission_target_ms") {
+    return set_int(key, value, 0, 60000, c.admission.target_ms, error);
+  } else if (key == "admission_interval_ms") {
+    return set_int(key, value, 1, 60000, c.admission.interval_ms, error);
+  } else if (key == "admission_stop_accept_ms") {
+    return set_int(key, value, 0, 600000, c.admission.stop_accept_ms, error);
+  } else if (key == "admission_retry_after_s") {
+    return set_int(key, value, 0, 86400, c.admission.retry_after_s, error);
+  } else if (key == "admission_idle_close_batch") {
+    return set_int(key, value, 0, INT_MAX, c.admission.idle_close_batch,
+                   error);
+  } else if (key == "ratelimit_conn_rate") {
+    return set_int(key, value, 0, 1000000, c.ratelimit.conn.rate, error);
+  } else if (key == "ratelimit_conn_burst") {
+    return set_int(key, value, 0, 1000000, c.ratelimit.conn.burst, error);
+  } else if (key == "ratelimit_req_rate") {
+    return set_int(key, value, 0, 1000000, c.ratelimit.request.rate, error);
+  } else if (key == "ratelimit_req_burst") {
+    return set_int(key, value, 0, 1000000, c.ratelimit.request.burst, error);
+  } else if (key == "ratelimit_path") {
+    // "前缀 每秒放行数 [突发数]"，可以出现多次
+    rate_limit_rule rule;
+    char prefix[256];
+    int n = sscanf(value.c_str(), "%255s %d %d", prefix, &rule.rate,
+                   &rule.burst);
+    if (n < 2 || prefix[0] != '/' || rule.rate <= 0 || rule.burst < 0 ||
+        c.ratelimit.paths.size() >= 64) {
+      error = key + ": expected '/prefix rate [burst]', got '" + value + "'";
+      return false;
+    }
+    rule.prefix = prefix;
+    c.ratelimit.paths.push_back(rule);
+    return true;
+  } else if (key == "ratelimit_entries") {
+    return set_int(key, value, 1024, 1 << 26, c.ratelimit.entries, error);
+  } else if (key == "ratelimit_retry_after_s") {
+    return set_int(key, value, 0, 86400, c.ratelimit.retry_after_s, error);
+  } else if (key == "proxy_pass") {
+    // "前缀 host:port[,host:port...] [round_robin|least_conn]"，可以出现多次
+    proxy_route_config route;
+    if (c.proxy.routes.size() >= 64) {
+      error = key + ": at most 64 routes";
+      return false;
+    }
+    if (!parse_proxy_route(value, route, error)) {
+      error = key + ": " + error;
+      return false;
+    }
+    c.proxy.routes.push_back(route);
+    return true;
+  } else if (key == "proxy_pool_size") {
+    return set_int(key, value, 0, 65536, c.proxy.pool_size, error);
+  } else if (key == "proxy_connect_timeout") {
+    return set_int(key, value, 1, 3600, c.proxy.connect_timeout, error);
+  } else if (key == "proxy_timeout") {
+    return set_int(key, value, 1, 86400, c.proxy.timeout, error);
+  } else if (key == "proxy_max_fails") {
+    return set_int(key, value, 1, 1000, c.proxy.max_fails, error);
+  } else if (key == "proxy_fail_timeout") {
+    return set_int(key, value, 0, 86400, c.proxy.fail_timeout, error);
+  } else if (key == "asset_snapshot") {
+    c.asset_snapshot = value;
+    return true;
+  } else if (key == "asset_gzip_min") {
+    return set_int(key, value, -1, INT_MAX, c.asset_gzip_min, error);
+  }
+  error = "unknown option '" + key + "'";
+  return false;
+}
+
+// 短选项与配置项的对应关系，-e 与 -o 单独处理
+static const struct {
+  char opt;
+  const char* key;
+} short_options[] = {
+    {'p', "port"},
+    {'c', "close_log"},
+    {'a', "access_log_dir"},
+    {'m', "admin_port"},
+    {'M', "metrics_path"},
+    {'b', "backlog"},
+    {'t', "threads"},
+    {'s', "spin_us"},
+    {'T', "trace_events"},
+    {'L', "admission_target_ms"},
+    {'I', "admission_interval_ms"},
+    {'A', "admission_stop_accept_ms"},
+    {'R', "admission_retry_after_s"},
+    {'D', "drain_timeout"},
+};
+
+static void usage(const char* prog) {
+  fprintf(stderr,
+          "usage: %s [-f config_file] [-o key=value]... [-p port] "
+          "[-e trig_mode] [-t threads] [-s spin_us]\n"
+          "          [-b backlog] [-c close_log] [-a access_log_dir] "
+          "[-m admin_port]\n"
+          "          [-M metrics_path] [-T trace_events] [-L target_ms] "
+          "[-I interval_ms]\n"
+          "          [-A stop_accept_ms] [-R retry_after_s] "
+          "[-D drain_timeout]\n",
+          prog);
+}
+
+Config::Config() {}
+
+bool Config::parse_arg(int argc, char* argv[]) {
+  // -f 配置文件，-o key=value 设置任意一项
+  // -p 端口, -c 关闭日志(1 关闭), -a 二进制访问日志目录
+  // -m 管理端口(0 关闭), -M 指标路径, -b listen 队列长度, -t 事件循环线程数
+  // -s 阻塞等待前轮询 epoll 的时长(微秒，0 关闭)
+  // -e 触发模式：0 LT+LT, 1 LT+ET, 2 ET+LT, 3 ET+ET(监听+连接，默认)
+  // -T 每个线程保留的请求追踪记录数(0 关闭)，SIGUSR1 或 /debug/trace 导出
+  // -L 准入控制的目标排队时延(毫秒，0 关闭), -I 观察窗口(毫秒)
+  // -A 暂停 accept 的排队时延(毫秒), -R 503 响应的 Retry-After(秒)
+  // -D SIGTERM 与热升级(SIGUSR2)后排空连接的最长时间(秒，0 表示立即退出)
+  int opt;
+  const char* optstring = "f:o:e:p:c:a:m:M:b:t:s:T:L:I:A:R:D:";
+  while ((opt = getopt(argc, argv, optstring)) != -1) {
+    switch (opt) {
+      case 'f':
+        m_file = optarg;
+        break;
+      case 'o': {
+        std::string kv = optarg;
+        size_t eq = kv.find('=');
+        if (eq == std::string::npos) {
+          fprintf(stderr, "-o expects key=value, got '%s'\n", optarg);
+          return false;
+        }
+        m_overrides.push_back(
+            std::make_pair(trim(kv.substr(0, eq)), trim(kv.substr(eq + 1))));
+        break;
+      }
+      case 'e': {
+        int mode = atoi(optarg);
+        if (mode < 0 || mode > 3) {
+          fprintf(stderr, "-e expects 0-3, got '%s'\n", optarg);
+          return false;
+        }
+        m_overrides.push_back(
+            std::make_pair("listen_trig", (mode & 2) ? "et" : "lt"));
+        m_overrides.push_back(
+            std::make_pair("conn_trig", (mode & 1) ? "et" : "lt"));
+        break;
+      }
+      case '?':
+        usage(argv[0]);
+        return false;
+      default:
+        for (size_t i = 0; i < sizeof(short_options) / sizeof(short_options[0]);
+             i++) {
+          if (short_options[i].opt == opt) {
+            m_overrides.push_back(
+                std::make_pair(short_options[i].key, std::string(optarg)));
+            break;
+          }
+        }
+        break;
+    }
+  }
+
+  std::string error;
+  if (!load(m_config, error)) {
+    fprintf(stderr, "config: %s\n", error.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool Config::reload(server_config& config, std::string& error) const {
+  server_config next;
+  if (!load(next, error)) {
+    return false;
+  }
+  config = next;
+  return true;
+}
+
+bool Config::load(server_config& config, std::string& error) const {
+  server_config c;
+  if (!m_file.empty()) {
+    std::ifstream in(m_file.c_str());
+    if (!in) {
+      error = m_file + ": cannot open";
+      return false;
+    }
+    std::string line;
+    int lineno = 0;
+    while (std::getline(in, line)) {
+      lineno++;
+      size_t hash = line.find('#');
+      if (hash != std::string::npos) {
+        line.erase(hash);
+      }
+      line = trim(line);
+      if (line.empty()) {
+        continue;
+      }
+      size_t eq = line.find('=');
+      if (eq == std::string::npos) {
+        error = m_file + ":" + std::to_string(lineno) + ": expected key = value";
+        return false;
+      }
+      if (!config_set(c, trim(line.substr(0, eq)), trim(line.substr(eq + 1)),
+                      error)) {
+        error = m_file + ":" + std::to_string(lineno) + ": " + error;
+        return false;
+      }
+    }
+  }
+  for (size_t i = 0; i < m_overrides.size(); i++) {
+    if (!config_set(c, m_overrides[i].first, m_overrides[i].second, error)) {
+      error = "command line: " + error;
+      return false;
+    }
+  }
+  if (c.cpu_affinity == AFFINITY_LIST && c.cpu_list.empty()) {
+    error = "cpu_affinity = list requires cpu_list";
+    return false;
+  }
+  config = c;
+  return true;
+}
@@ -0,0 +1,143 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "affinity/affinity.h"
+#include "http/admission.h"
+#include "http/rate_limit.h"
+#include "proxy/upstream.h"
+
+/*
+ * 服务器配置
+ * 配置文件每行一项 "key = value"，# 之后为注释，示例见 server.conf；
+ * 命令行选项覆盖配置文件中的同名项，-o key=value 可以设置任意一项。
+ * 收到 SIGHUP 时重新读取配置文件并套用同样的命令行选项，
+ * 只有运行期间可以安全修改的部分会立即生效，见 WebServer::reload_config
+ */
+
+/**
+ * @struct server_config
+ * @brief 全部配置项，构造时为默认值
+ */
+struct server_config {
+  // 监听
+  int port;                  ///< 对外服务端口
+  int admin_port;            ///< 内部管理端口，0 表示关闭
+  std::string admin_addr;    ///< 管理端口的监听地址
+  std::string metrics_path;  ///< 指标路径
+  int backlog;               ///< listen 的连接队列长度
+  int listen_trig;           ///< 监听 socket 的触发模式：0 LT，1 ET
+  int conn_trig;             ///< 连接 socket 的触发模式：0 LT，1 ET
+
+  // 事件循环
+  int threads;                   ///< 事件循环线程数，每个线程有自己的监听 socket
+  affinity_policy cpu_affinity;  ///< 事件循环线程的绑核策略
+  std::string cpu_list;          ///< cpu_affinity 为 list 时使用的 CPU，如 0,2,4-7
+  int incoming_cpu;  ///< 监听 socket 设置 SO_INCOMING_CPU，由收包的 CPU 上的线程 accept
+  int spin_us;           ///< 阻塞等待前不阻塞轮询 epoll 的时长(微秒)，0 表示关闭
+  int busy_poll_us;      ///< socket 与 epoll 的内核 busy poll 时长(微秒)，0 表示关闭
+  int prefer_busy_poll;  ///< 设置 SO_PREFER_BUSY_POLL
+  int io_read_budget;    ///< ET 模式下一个连接每轮最多读取的字节数，0 表示不限制
+  int io_write_budget;   ///< 一个连接每轮最多发送的字节数，0 表示不限制
+  int accept_budget;     ///< ET 模式下每轮最多 accept 的连接数，0 表示不限制
+
+  // 连接
+  int read_buffer;    ///< 每个请求的读缓冲区大小(字节)
+  int write_buffer;   ///< 每个请求的写缓冲区大小(字节)
+  int buffer_pool;    ///< 池中保留的空闲缓冲区数
+  int timeslot;       ///< 定时器周期(秒)
+  int header_timeout;     ///< 请求头必须收完的时间(秒)，从连接建立或请求首字节起
+  int body_timeout;       ///< 请求体的宽限时间(秒)
+  int body_min_rate;      ///< 宽限之外请求体的最低速率(字节/秒)，0 表示不按速率延长
+  int keepalive_timeout;  ///< 长连接两个请求之间的最长空闲(秒)
+  int write_timeout;      ///< 一个响应从开始发送到发完的最长时间(秒)
+  int conn_timeout;   ///< 转发或异步处理期间没有活动后关闭的时间(秒)
+  int half_open_per_ip;   ///< 每个 IP 同时进行中的半开请求上限，0 表示不限制
+  int drain_timeout;  ///< 排空的最长时间(秒)，0 表示收到 SIGTERM 立即退出
+
+  // 静态资源
+  // 资源快照：为空表示按文件查找，build 表示启动时从文档根目录生成，
+  // 其他值为 packassets 生成的快照文件
+  std::string asset_snapshot;
+  int asset_gzip_min;  ///< 启动时生成快照，小于该字节数的文件不压缩，-1 表示都不压缩
+
+  // 日志与观测
+  int close_log;               ///< 是否关闭日志
+  int log_ring;                ///< 每个线程的日志环形缓冲区条数，必须是 2 的幂
+  std::string access_log_dir;  ///< 二进制访问日志目录，为空表示关闭
+  int trace_events;            ///< 每个线程保留的追踪记录数，0 表示关闭
+  std::string capture_dir;     ///< 流量录制目录，为空表示关闭
+  int capture_limit_mb;        ///< 流量录制的总大小上限(MB)
+
+  // 数据库与登录
+  std::string db_host;       ///< MySQL 地址
+  int db_port;               ///< MySQL 端口
+  std::string db_user;       ///< MySQL 用户名
+  std::string db_password;   ///< MySQL 口令
+  std::string db_name;       ///< 数据库名
+  int db_conns;              ///< 连接池的连接数，0 表示不连接数据库，登录与注册接口关闭
+  int db_cache_mb;           ///< 查询结果缓存的内存上限(MB)，0 表示不缓存
+  int db_batch_rows;         ///< 组提交一个事务的行数上限
+  int db_batch_delay_ms;     ///< 组提交中一行最长等待多久开始写入(毫秒)
+  int auth_hash_iterations;  ///< 口令散列 PBKDF2 的迭代次数
+  int auth_hash_threads;     ///< 口令散列线程数
+
+  admission_config admission;  ///< 准入控制
+  rate_limit_config ratelimit;  ///< 按客户端 IP 限流
+  proxy_config proxy;           ///< 反向代理
+
+  server_config();
+};
+
+/**
+ * @brief 设置一项配置
+ *
+ * @param config 被修改的配置
+ * @param key 配置项名称
+ * @param value 字符串形式的值
+ * @param[out] error 失败原因
+ * @return bool 名称未知或值不合法时返回 false
+ */
+bool config_set(server_config& config, const std::string& key,
+                const std::string& value, std::string& error);
+
+/**
+ * @class Config
+ * @brief 保存配置来源(配置文件路径与命令行选项)，可以重新加载
+ */
+class Config {
+ public:
+  Config();
+
+  /**
+   * @brief 解析命令行并加载配置
+   * 出错时在标准错误输出原因与用法
+   *
+   * @return bool 是否成功
+   */
+  bool parse_arg(int argc, char* argv[]);
+
+  /**
+   * @brief 重新读取配置文件并套用命令行选项
+   *
+   * @param[out] config 成功时写入新的配置，失败时不变
+   * @param[out] error 失败原因
+   * @return bool 是否成功
+   */
+  bool reload(server_config& config, std::string& error) const;
+
+  const server_config& get() const { return m_config; }
+  const std::string& file() const { return m_file; }
+
+ private:
+  bool load(server_config& config, std::string& error) const;
+
+  std::string m_file;  ///< 配置文件，为空表示只用默认值与命令行
+  std::vector<std::pair<std::string, std::string> > m_overrides;  ///< 命令行选项，按出现顺序
+  server_config m_config;  ///< 启动时加载的配置
+};
+
+#endif  // !CONFIG_H
@@ -0,0 +1,104 @@
+#include "db.h"
+
+#include <mysql/errmsg.h>
+
+#include <algorithm>
+
+#include "../CGImysql/sql_connection_pool.h"
+#include "scheduler.h"
+
+namespace coro {
+
+// 取连接的退避间隔上限
+static const int DB_BACKOFF_MAX_MS = 16;
+
+// 取得空闲连接，超时或连接池未初始化时返回空
+static task<MYSQL*> acquire(connection_poll* pool) {
+  int waited = 0;
+  int backoff = 1;
+  while (true) {
+    MYSQL* conn = pool->TryGetConnection();
+    if (conn || pool->GetMaxConn() == 0 || waited >= DB_ACQUIRE_TIMEOUT_MS) {
+      co_return conn;
+    }
+    co_await sleep_ms(backoff);
+    waited += backoff;
+    backoff = std::min(backoff * 2, DB_BACKOFF_MAX_MS);
+  }
+}
+
+task<int> db_query(const std::string& sql, MYSQL_RES** result) {
+  *result = nullptr;
+  connection_poll* pool = connection_poll::GetInstance();
+  MYSQL* conn = co_await acquire(pool);
+  if (!conn) {
+    co_return -1;
+  }
+
+  scheduler* sched = scheduler::local();
+  int fd = conn->net.fd;
+  net_async_status status;
+  while ((status = mysql_real_query_nonblocking(conn, sql.data(),
+                                                sql.size())) ==
+         NET_ASYNC_NOT_READY) {
+    co_await sched->wait(fd, EPOLLIN, -1);
+  }
+  if (status != NET_ASYNC_ERROR && mysql_field_count(conn) > 0) {
+    while ((status = mysql_store_result_nonblocking(conn, result)) ==
+           NET_ASYNC_NOT_READY) {
+      co_await sched->wait(fd, EPOLLIN, -1);
+    }
+  }
+  // 连接可能被其他线程取走，还给连接池之前从本线程的 epoll 中删除
+  sched->forget(fd);
+
+  int err = status == NET_ASYNC_ERROR ? (int)mysql_errno(conn) : 0;
+  if (err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST) {
+    // 连接已断开：原地重建，只在出错之后发生
+    pool->Reconnect(conn);
+  }
+  pool->ReleaseConnection(conn);
+  co_return err;
+}
+
+task<sql_result_ptr> db_cached_query(const std::string& sql, int ttl_ms,
+                                     const std::vector<std::string>& tags) {
+  sql_result_cache* cache = sql_result_cache::GetInstance();
+  sql_result_ptr value;
+  unsigned long long seq = 0;
+  int waited = 0;
+  int backoff = 1;
+  while (true) {
+    sql_result_cache::lookup_result state =
+        cache->Lookup(sql, waited > 0, &value, &seq);
+    if (state == sql_result_cache::LOOKUP_HIT) {
+      co_return value;
+    }
+    if (state == sql_result_cache::LOOKUP_LOAD) {
+      break;
+    }
+    // 加载者迟迟不结束(如数据库卡住)时放弃，与等待空闲连接的上限相同
+    if (waited >= DB_ACQUIRE_TIMEOUT_MS) {
+      co_return nullptr;
+    }
+    co_await sleep_ms(backoff);
+    waited += backoff;
+    backoff = std::min(backoff * 2, DB_BACKOFF_MAX_MS);
+  }
+
+  MYSQL_RES* res = nullptr;
+  int err = co_await db_query(sql, &res);
+  if (err == 0 && res != nullptr) {
+    std::shared_ptr<sql_result> result = std::make_shared<sql_result>();
+    sql_result_cache::CopyResult(res, result.get());
+    value = result;
+  }
+  if (res != nullptr) {
+    mysql_free_result(res);
+  }
+  // 失败时也要结束加载，等待者随后自己查询
+  cache->Fill(sql, value, ttl_ms, tags, seq);
+  co_return value;
+}
+
+}  // namespace coro
@@ -0,0 +1,48 @@
+#ifndef CORO_DB_H
+#define CORO_DB_H
+
+#include <mysql/mysql.h>
+
+#include <string>
+#include <vector>
+
+#include "../CGImysql/sql_result_cache.h"
+#include "task.h"
+
+/*
+ * 协程中的数据库查询
+ * 从 connection_poll 不阻塞地取连接，池中没有空闲连接时按定时器退避重试；
+ * 查询用 MySQL 8 的非阻塞接口发送，等待结果时把连接的 socket 注册到
+ * 本事件循环的 epoll 中，查询结束后删除注册再把连接还给连接池。
+ *
+ * 等待结果时只关注可读事件，SQL 文本须能一次写入 socket 发送缓冲区。
+ */
+
+namespace coro {
+
+// 等待空闲连接的上限
+const int DB_ACQUIRE_TIMEOUT_MS = 1000;
+
+/**
+ * @brief 执行一条 SQL
+ *
+ * @param sql 在 co_await 结束之前须保持有效
+ * @param[out] result 结果集，由调用方 mysql_free_result；没有结果集的语句为空
+ * @return int 0 成功；失败时为 mysql_errno，没有可用连接时为 -1
+ */
+task<int> db_query(const std::string& sql, MYSQL_RES** result);
+
+/**
+ * @brief 经过 sql_result_cache 的查询
+ *
+ * 未命中时用 db_query 加载；同一查询已有其他请求在加载时按定时器退避，
+ * 等待它写入缓存，不再访问数据库。参数含义同 sql_result_cache::Query。
+ *
+ * @return sql_result_ptr 查询结果，失败或没有可用连接时为空
+ */
+task<sql_result_ptr> db_cached_query(const std::string& sql, int ttl_ms,
+                                     const std::vector<std::string>& tags);
+
+}  // namespace coro
+
+#endif  // !CORO_DB_H
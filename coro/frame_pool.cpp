@@ -0,0 +1,68 @@
+#include "frame_pool.h"
+
+#include <new>
+
+#include "../metrics/metrics.h"
+
+namespace coro {
+
+static const size_t FRAME_GRAIN = 64;
+static const int FRAME_CLASSES = FRAME_MAX_POOLED / FRAME_GRAIN;
+
+// 空闲帧的开头用作链表指针
+struct free_frame {
+  free_frame* next;
+};
+
+static __thread free_frame* t_free[FRAME_CLASSES];
+static __thread int t_free_count[FRAME_CLASSES];
+
+static inline int size_class(size_t size) {
+  return (int)((size + FRAME_GRAIN - 1) / FRAME_GRAIN) - 1;
+}
+
+void* frame_alloc(size_t size) {
+  if (size > FRAME_MAX_POOLED) {
+    metrics::inc(metrics::local()->coro_frame_heap);
+    return ::operator new(size);
+  }
+  int c = size_class(size);
+  free_frame* f = t_free[c];
+  if (f) {
+    t_free[c] = f->next;
+    t_free_count[c]--;
+    return f;
+  }
+  // 按所在级别的上限分配，释放后可以给同一级的任何帧使用
+  metrics::inc(metrics::local()->coro_frame_heap);
+  return ::operator new((c + 1) * FRAME_GRAIN);
+}
+
+void frame_free(void* p, size_t size) {
+  if (size > FRAME_MAX_POOLED) {
+    ::operator delete(p);
+    return;
+  }
+  int c = size_class(size);
+  if (t_free_count[c] >= FRAME_POOL_LIMIT) {
+    ::operator delete(p);
+    return;
+  }
+  free_frame* f = (free_frame*)p;
+  f->next = t_free[c];
+  t_free[c] = f;
+  t_free_count[c]++;
+}
+
+void frame_pool_trim() {
+  for (int c = 0; c < FRAME_CLASSES; c++) {
+    while (t_free[c]) {
+      free_frame* next = t_free[c]->next;
+      ::operator delete(t_free[c]);
+      t_free[c] = next;
+    }
+    t_free_count[c] = 0;
+  }
+}
+
+}  // namespace coro
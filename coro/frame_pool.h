@@ -0,0 +1,31 @@
+#ifndef CORO_FRAME_POOL_H
+#define CORO_FRAME_POOL_H
+
+#include <stddef.h>
+
+/*
+ * 协程帧分配器
+ * 协程只在创建它的事件循环线程中恢复与销毁，帧按线程池化：
+ * 按 64 字节分级，每级一条空闲链表，分配与释放都不加锁。
+ * 稳定运行时处理函数与其中 co_await 的子任务的帧都从链表中取，不访问堆；
+ * 超过最大一级的帧直接使用 operator new。
+ */
+
+namespace coro {
+
+// 池化的最大帧，更大的帧直接从堆分配
+const size_t FRAME_MAX_POOLED = 4096;
+// 每一级保留的空闲帧上限，突发过后多余的帧被释放
+const int FRAME_POOL_LIMIT = 1024;
+
+void* frame_alloc(size_t size);
+void frame_free(void* p, size_t size);
+
+/**
+ * @brief 释放本线程空闲链表中的帧，事件循环线程退出前调用
+ */
+void frame_pool_trim();
+
+}  // namespace coro
+
+#endif  // !CORO_FRAME_POOL_H
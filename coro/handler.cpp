@@ -0,0 +1,106 @@
+#include "handler.h"
+
+#include <string.h>
+
+#include "../http/http_conn.h"
+#include "../metrics/metrics.h"
+
+namespace coro {
+
+// 池中保留的空闲对象上限，与读写缓冲区池一致
+static const int ASYNC_CALL_POOL_LIMIT = 256;
+
+static __thread async_call* t_free_calls = nullptr;
+static __thread int t_free_count = 0;
+
+async_routes* async_routes::get_instance() {
+  static async_routes routes;
+  return &routes;
+}
+
+void async_routes::add(const std::string& prefix, async_handler handler) {
+  m_routes.push_back(std::make_pair(prefix, handler));
+}
+
+int async_routes::match(const char* url) const {
+  for (size_t i = 0; i < m_routes.size(); i++) {
+    const std::string& prefix = m_routes[i].first;
+    if (strncmp(url, prefix.data(), prefix.size()) == 0) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+async_call* async_call::alloc(http_conn* conn) {
+  async_call* call = t_free_calls;
+  if (call) {
+    t_free_calls = call->next;
+    t_free_count--;
+  } else {
+    call = new async_call;
+  }
+  call->conn = conn;
+  call->done = false;
+  call->next = nullptr;
+  call->req.status = 200;
+  call->req.content_type.assign("text/html");
+  call->req.headers.clear();
+  call->req.response.clear();
+  call->req.response_iov.clear();
+  return call;
+}
+
+static void recycle(async_call* call) {
+  call->req.response_owner.reset();
+  if (t_free_count >= ASYNC_CALL_POOL_LIMIT) {
+    delete call;
+    return;
+  }
+  call->next = t_free_calls;
+  t_free_calls = call;
+  t_free_count++;
+}
+
+// 运行处理函数，异常视为内部错误
+static task<void> run(async_call* call, async_handler handler) {
+  try {
+    co_await handler(call->req);
+  } catch (...) {
+    call->req.status = 500;
+    call->req.headers.clear();
+    call->req.response.clear();
+    call->req.response_iov.clear();
+  }
+  call->done = true;
+  if (call->conn) {
+    call->conn->async_done();
+  } else {
+    metrics::inc(metrics::local()->async_abandoned);
+    recycle(call);
+  }
+}
+
+void async_call::start(int route) {
+  metrics::inc(metrics::local()->async_started);
+  spawn(run(this, async_routes::get_instance()->m_routes[route].second));
+}
+
+void async_call::release() {
+  if (done) {
+    recycle(this);
+  } else {
+    conn = nullptr;
+  }
+}
+
+void async_call::free_pool() {
+  while (t_free_calls) {
+    async_call* next = t_free_calls->next;
+    delete t_free_calls;
+    t_free_calls = next;
+  }
+  t_free_count = 0;
+}
+
+}  // namespace coro
@@ -0,0 +1,112 @@
+#ifndef CORO_HANDLER_H
+#define CORO_HANDLER_H
+
+#include <sys/uio.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "task.h"
+
+/*
+ * 异步请求处理函数
+ * 按路径前缀注册返回 task<void> 的处理函数，处理函数中可以 co_await
+ * socket 读写、定时器与数据库查询(见 scheduler.h、db.h)。
+ *
+ * 匹配的请求读完请求体后，方法、路径与请求体复制到 async_request 中，
+ * 处理函数在本事件循环中启动；处理函数填写状态码与响应体，
+ * 结束后由 http_conn 发送响应。处理期间客户端连接只关注关闭事件，
+ * 客户端先关闭时处理函数照常运行到结束，结果被丢弃。
+ * 处理函数仍受连接超时(conn_timeout)限制。
+ *
+ * async_request 按线程池化复用，字符串保留容量，稳定运行时不再分配内存。
+ */
+
+class http_conn;
+
+namespace coro {
+
+/**
+ * @struct async_request
+ * @brief 处理函数的输入与输出
+ */
+struct async_request {
+  // 请求
+  int method;        ///< http_conn::METHOD
+  std::string path;  ///< 含查询串
+  std::string body;
+
+  // 响应，处理函数开始前为 200、text/html 与空响应体
+  int status;
+  std::string content_type;
+  std::string headers;   ///< 额外的响应头，每行以 "\r\n" 结尾
+  std::string response;  ///< 响应体
+  // 分段响应体，不为空时代替 response 发送，其中的段可以指向 response，
+  // 见 page_template::render
+  std::vector<struct iovec> response_iov;
+  // 分段所指内存的持有者(如编译后的模板)，响应发送完之前保持有效
+  std::shared_ptr<const void> response_owner;
+};
+
+typedef task<void> (*async_handler)(async_request& req);
+
+/**
+ * @class async_routes
+ * @brief 路径前缀到处理函数的映射，在事件循环启动之前注册
+ */
+class async_routes {
+ public:
+  static async_routes* get_instance();
+
+  void add(const std::string& prefix, async_handler handler);
+  bool enabled() const { return !m_routes.empty(); }
+
+  /**
+   * @brief 第一个匹配的前缀
+   *
+   * @return int 路由序号，没有匹配时为 -1
+   */
+  int match(const char* url) const;
+
+ private:
+  friend struct async_call;
+
+  std::vector<std::pair<std::string, async_handler> > m_routes;
+};
+
+/**
+ * @struct async_call
+ * @brief 一次正在处理或等待发送响应的异步请求，按线程池化
+ */
+struct async_call {
+  async_request req;
+  http_conn* conn;   ///< 客户端连接，客户端已关闭时为空
+  bool done;         ///< 处理函数已结束
+  async_call* next;  ///< 池中的空闲链表
+
+  /**
+   * @brief 从本线程的池中取出并重置
+   */
+  static async_call* alloc(http_conn* conn);
+
+  /**
+   * @brief 启动 route 对应的处理函数，结束后调用 conn->async_done()
+   */
+  void start(int route);
+
+  /**
+   * @brief 连接不再需要结果：已结束的放回池中，仍在处理的在结束时放回
+   */
+  void release();
+
+  /**
+   * @brief 释放本线程池中的空闲对象，事件循环线程退出前调用
+   */
+  static void free_pool();
+};
+
+}  // namespace coro
+
+#endif  // !CORO_HANDLER_H
@@ -0,0 +1,232 @@
+#include "scheduler.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "../metrics/metrics.h"
+
+namespace coro {
+
+__thread scheduler* scheduler::t_current = nullptr;
+
+scheduler::scheduler()
+    : m_epollfd(-1), m_gen(0), m_pending(0), m_free_timers(nullptr) {}
+
+scheduler::~scheduler() {
+  // 仍在等待的协程随进程退出，不再恢复
+  for (size_t i = 0; i < m_timers.size(); i++) {
+    delete m_timers[i];
+  }
+  while (m_free_timers) {
+    timer_node* next = m_free_timers->next;
+    delete m_free_timers;
+    m_free_timers = next;
+  }
+}
+
+void scheduler::init(int epollfd) {
+  m_epollfd = epollfd;
+  t_current = this;
+}
+
+/*
+ * 登记一次等待
+ * fd 的注册带 EPOLLONESHOT，每次等待都重新设定关注的事件与注册序号，
+ * 超时或被唤醒后内核中遗留的注册不会再产生有效事件
+ */
+bool scheduler::arm(waiter* w, uint32_t events, int timeout_ms) {
+  if (w->fd >= 0) {
+    if ((size_t)w->fd >= m_slots.size()) {
+      slot empty = {nullptr, 0, false};
+      m_slots.resize(w->fd + 1, empty);
+    }
+    slot& s = m_slots[w->fd];
+    s.gen = ++m_gen & 0x3fffffff;
+    epoll_event ev = {};
+    ev.events = events | EPOLLONESHOT;
+    ev.data.u64 = EVENT_TAG | ((uint64_t)s.gen << 32) | (uint32_t)w->fd;
+    int op = s.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(m_epollfd, op, w->fd, &ev) < 0) {
+      w->revents = EPOLLERR;
+      return false;
+    }
+    s.registered = true;
+    s.w = w;
+  }
+  if (timeout_ms >= 0) {
+    timer_node* t = m_free_timers;
+    if (t) {
+      m_free_timers = t->next;
+    } else {
+      t = new timer_node;
+    }
+    t->deadline = metrics_now_ns() + (uint64_t)timeout_ms * 1000000;
+    t->w = w;
+    w->timer = t;
+    m_timers.push_back(t);
+    std::push_heap(m_timers.begin(), m_timers.end(), later());
+  }
+  m_pending++;
+  return true;
+}
+
+void scheduler::resume(waiter* w, uint32_t revents) {
+  w->revents = revents;
+  if (w->timer) {
+    // 定时器留在堆中，到期时丢弃
+    w->timer->w = nullptr;
+    w->timer = nullptr;
+  }
+  if (w->fd >= 0) {
+    m_slots[w->fd].w = nullptr;
+  }
+  m_pending--;
+  w->h.resume();
+}
+
+void scheduler::handle_event(const epoll_event& ev) {
+  int fd = (int)(uint32_t)ev.data.u64;
+  uint32_t gen = (uint32_t)(ev.data.u64 >> 32) & 0x3fffffff;
+  if ((size_t)fd >= m_slots.size()) {
+    return;
+  }
+  slot& s = m_slots[fd];
+  // 等待已超时，或者同一批事件中 fd 已被重新注册
+  if (s.gen != gen || s.w == nullptr) {
+    return;
+  }
+  resume(s.w, ev.events);
+}
+
+void scheduler::forget(int fd) {
+  if (fd < 0 || (size_t)fd >= m_slots.size()) {
+    return;
+  }
+  slot& s = m_slots[fd];
+  if (s.registered) {
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, fd, 0);
+    s.registered = false;
+  }
+  s.w = nullptr;
+}
+
+int scheduler::next_timeout(int wait_ms) {
+  // 丢弃堆顶已被唤醒的定时器
+  while (!m_timers.empty() && m_timers.front()->w == nullptr) {
+    std::pop_heap(m_timers.begin(), m_timers.end(), later());
+    timer_node* t = m_timers.back();
+    m_timers.pop_back();
+    t->next = m_free_timers;
+    m_free_timers = t;
+  }
+  if (m_timers.empty()) {
+    return wait_ms;
+  }
+  uint64_t now = metrics_now_ns();
+  uint64_t deadline = m_timers.front()->deadline;
+  int ms = deadline <= now ? 0 : (int)((deadline - now + 999999) / 1000000);
+  return wait_ms < 0 ? ms : std::min(ms, wait_ms);
+}
+
+void scheduler::run_timers() {
+  if (m_timers.empty()) {
+    return;
+  }
+  // 先取出本轮到期的定时器再恢复协程，协程中新设的定时器留到下一轮
+  uint64_t now = metrics_now_ns();
+  while (!m_timers.empty() && m_timers.front()->deadline <= now) {
+    std::pop_heap(m_timers.begin(), m_timers.end(), later());
+    m_expired.push_back(m_timers.back());
+    m_timers.pop_back();
+  }
+  for (size_t i = 0; i < m_expired.size(); i++) {
+    timer_node* t = m_expired[i];
+    waiter* w = t->w;
+    t->next = m_free_timers;
+    m_free_timers = t;
+    // 前面恢复的协程可能已经让这个等待被事件唤醒
+    if (w == nullptr) {
+      continue;
+    }
+    w->timer = nullptr;
+    resume(w, 0);
+  }
+  m_expired.clear();
+}
+
+task<ssize_t> async_read(int fd, void* buf, size_t len, int timeout_ms) {
+  while (true) {
+    ssize_t n = read(fd, buf, len);
+    if (n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      co_return n;
+    }
+    uint32_t revents =
+        co_await scheduler::local()->wait(fd, EPOLLIN, timeout_ms);
+    if (revents == 0) {
+      errno = ETIMEDOUT;
+      co_return -1;
+    }
+  }
+}
+
+task<ssize_t> async_write(int fd, const void* buf, size_t len,
+                          int timeout_ms) {
+  uint64_t deadline =
+      timeout_ms < 0 ? 0 : metrics_now_ns() + (uint64_t)timeout_ms * 1000000;
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = write(fd, (const char*)buf + done, len - done);
+    if (n > 0) {
+      done += n;
+      continue;
+    }
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      co_return -1;
+    }
+    int wait_ms = -1;
+    if (deadline) {
+      uint64_t now = metrics_now_ns();
+      wait_ms = deadline <= now ? 0 : (int)((deadline - now) / 1000000);
+    }
+    uint32_t revents =
+        co_await scheduler::local()->wait(fd, EPOLLOUT, wait_ms);
+    if (revents == 0) {
+      errno = ETIMEDOUT;
+      co_return -1;
+    }
+  }
+  co_return (ssize_t)len;
+}
+
+task<int> async_connect(int fd, const sockaddr* addr, socklen_t addrlen,
+                        int timeout_ms) {
+  if (connect(fd, addr, addrlen) == 0) {
+    co_return 0;
+  }
+  if (errno != EINPROGRESS) {
+    co_return -1;
+  }
+  uint32_t revents =
+      co_await scheduler::local()->wait(fd, EPOLLOUT, timeout_ms);
+  if (revents == 0) {
+    errno = ETIMEDOUT;
+    co_return -1;
+  }
+  int err = 0;
+  socklen_t err_len = sizeof(err);
+  getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len);
+  if (err != 0) {
+    errno = err;
+    co_return -1;
+  }
+  co_return 0;
+}
+
+void close_fd(int fd) {
+  scheduler::local()->forget(fd);
+  close(fd);
+}
+
+}  // namespace coro
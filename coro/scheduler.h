@@ -0,0 +1,203 @@
+#ifndef CORO_SCHEDULER_H
+#define CORO_SCHEDULER_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <coroutine>
+#include <vector>
+
+#include "task.h"
+
+/*
+ * 协程调度，每个事件循环一个实例
+ * 协程等待的 fd 注册在事件循环自己的 epoll 中(EPOLLONESHOT，每次等待重新设定)，
+ * 定时器保存在一个按截止时间排列的最小堆中，事件循环的 epoll_wait 超时不超过
+ * 最近的截止时间。事件或定时器到期时在事件循环中直接恢复等待的协程，
+ * 协程因此总在创建它的线程中运行，不需要跨线程投递。
+ *
+ * 一个 fd 同一时间只能有一个协程在等待。协程不再使用某个 fd 时，
+ * 关闭之前须调用 forget(或用 close_fd)把它从 epoll 中删除。
+ * 等待被事件唤醒后定时器不会立即从堆中删除，只做标记，到期时丢弃。
+ */
+
+namespace coro {
+
+class scheduler {
+ public:
+  // 协程等待的 fd 的 epoll 事件在 data.u64 中带有这一位与注册序号，
+  // 不带 proxy::EVENT_TAG；事件循环先检查 proxy 的标记
+  static const uint64_t EVENT_TAG = 1ULL << 62;
+
+ private:
+  struct timer_node;
+
+  // 一次等待，位于等待中的协程帧内
+  struct waiter {
+    std::coroutine_handle<> h;
+    int fd;             ///< 等待的 fd，只等待定时器时为 -1
+    uint32_t revents;   ///< 就绪的事件，超时为 0
+    timer_node* timer;  ///< 超时定时器，没有时为空
+  };
+
+ public:
+  /**
+   * @class wait_op
+   * @brief co_await 的结果为就绪的 epoll 事件，超时为 0
+   */
+  class wait_op {
+   public:
+    wait_op(scheduler* s, int fd, uint32_t events, int timeout_ms)
+        : m_sched(s), m_events(events), m_timeout_ms(timeout_ms) {
+      m_waiter.fd = fd;
+      m_waiter.revents = 0;
+      m_waiter.timer = nullptr;
+    }
+    bool await_ready() noexcept { return false; }
+    // 注册失败时不挂起，结果为 EPOLLERR
+    bool await_suspend(std::coroutine_handle<> h) {
+      m_waiter.h = h;
+      return m_sched->arm(&m_waiter, m_events, m_timeout_ms);
+    }
+    uint32_t await_resume() noexcept { return m_waiter.revents; }
+
+   private:
+    scheduler* m_sched;
+    uint32_t m_events;
+    int m_timeout_ms;
+    waiter m_waiter;
+  };
+
+  scheduler();
+  ~scheduler();
+
+  /**
+   * @brief 绑定事件循环的 epoll 实例，在事件循环线程中调用
+   */
+  void init(int epollfd);
+
+  /**
+   * @brief 当前线程的调度器，事件循环以外的线程为空
+   */
+  static scheduler* local() { return t_current; }
+
+  /**
+   * @brief 事件是否属于协程等待的 fd
+   */
+  static bool owns_event(const epoll_event& ev) {
+    return (ev.data.u64 >> 62) == 1;
+  }
+
+  /**
+   * @brief 恢复等待该事件的协程
+   */
+  void handle_event(const epoll_event& ev);
+
+  /**
+   * @brief 等待 fd 就绪
+   *
+   * @param events EPOLLIN 和/或 EPOLLOUT
+   * @param timeout_ms 超时，-1 表示不超时
+   */
+  wait_op wait(int fd, uint32_t events, int timeout_ms) {
+    return wait_op(this, fd, events, timeout_ms);
+  }
+  /**
+   * @brief 等待 ms 毫秒，0 表示让出到本轮事件处理结束
+   */
+  wait_op sleep(int ms) { return wait_op(this, -1, 0, ms); }
+
+  /**
+   * @brief 把 fd 从 epoll 中删除，关闭协程使用过的 fd 之前调用
+   */
+  void forget(int fd);
+
+  /**
+   * @brief 考虑定时器后的 epoll_wait 超时
+   *
+   * @param wait_ms 事件循环原本的超时，-1 表示无限等待
+   */
+  int next_timeout(int wait_ms);
+
+  /**
+   * @brief 恢复定时器已到期的协程，每轮事件处理完后调用
+   */
+  void run_timers();
+
+  // 正在等待的协程数
+  int pending() const { return m_pending; }
+
+ private:
+  struct timer_node {
+    uint64_t deadline;  ///< 单调时钟纳秒
+    waiter* w;          ///< 等待已被事件唤醒时为空
+    timer_node* next;   ///< 空闲链表
+  };
+
+  // 每个 fd 的登记信息，按 fd 索引
+  struct slot {
+    waiter* w;        ///< 正在等待的协程，没有时为空
+    uint32_t gen;     ///< 注册序号，与事件中的序号一致才有效
+    bool registered;  ///< 是否在 epoll 中
+  };
+
+  struct later {
+    bool operator()(const timer_node* a, const timer_node* b) const {
+      return a->deadline > b->deadline;
+    }
+  };
+
+  bool arm(waiter* w, uint32_t events, int timeout_ms);
+  void resume(waiter* w, uint32_t revents);
+
+  static __thread scheduler* t_current;
+
+  int m_epollfd;
+  uint32_t m_gen;
+  int m_pending;
+  std::vector<slot> m_slots;
+  std::vector<timer_node*> m_timers;   ///< 按截止时间的最小堆
+  std::vector<timer_node*> m_expired;  ///< run_timers 中本轮到期的定时器
+  timer_node* m_free_timers;
+};
+
+/**
+ * @brief 等待 ms 毫秒
+ */
+inline scheduler::wait_op sleep_ms(int ms) {
+  return scheduler::local()->sleep(ms);
+}
+
+/**
+ * @brief 读到数据、对方关闭或出错时返回
+ *
+ * @return ssize_t 同 read；超时返回 -1，errno 为 ETIMEDOUT
+ */
+task<ssize_t> async_read(int fd, void* buf, size_t len, int timeout_ms = -1);
+
+/**
+ * @brief 写完全部数据、出错或超时时返回，超时从开始写算起
+ *
+ * @return ssize_t 写完时为 len；否则为 -1，errno 说明原因
+ */
+task<ssize_t> async_write(int fd, const void* buf, size_t len,
+                          int timeout_ms = -1);
+
+/**
+ * @brief 在非阻塞 socket 上建立连接
+ *
+ * @return int 0 成功；-1 失败，errno 说明原因
+ */
+task<int> async_connect(int fd, const sockaddr* addr, socklen_t addrlen,
+                        int timeout_ms = -1);
+
+/**
+ * @brief 把 fd 从本线程的 epoll 中删除并关闭
+ */
+void close_fd(int fd);
+
+}  // namespace coro
+
+#endif  // !CORO_SCHEDULER_H
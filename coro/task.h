@@ -0,0 +1,153 @@
+#ifndef CORO_TASK_H
+#define CORO_TASK_H
+
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+#include "frame_pool.h"
+
+/*
+ * 协程任务类型
+ * task<T> 是惰性的：创建后不运行，被 co_await 时才开始，结束时通过对称转移
+ * 直接恢复等待它的协程，嵌套调用不增加栈深度，也不经过事件循环。
+ * 最外层的任务由 spawn 启动，之后每次挂起都在等待本事件循环 epoll 中的
+ * 某个 fd 或定时器(见 scheduler.h)，所以协程总是在创建它的线程中恢复。
+ *
+ * 帧由 frame_pool 按线程分配；task 中抛出的异常在 co_await 处重新抛出。
+ */
+
+namespace coro {
+
+/**
+ * @struct pooled_frame
+ * @brief 协程帧从本线程的帧池分配
+ */
+struct pooled_frame {
+  static void* operator new(size_t size) { return frame_alloc(size); }
+  static void operator delete(void* p, size_t size) { frame_free(p, size); }
+};
+
+/**
+ * @struct promise_base
+ * @brief task 的公共部分：惰性启动，结束时恢复等待者
+ */
+struct promise_base : pooled_frame {
+  struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<P> h) noexcept {
+      std::coroutine_handle<> next = h.promise().continuation;
+      return next ? next : std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  final_awaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() { exception = std::current_exception(); }
+
+  std::coroutine_handle<> continuation;  ///< 等待本任务的协程
+  std::exception_ptr exception;
+};
+
+template <typename T>
+class task;
+
+template <typename T>
+struct task_promise : promise_base {
+  task<T> get_return_object();
+  void return_value(T v) { value = std::move(v); }
+  T value{};
+};
+
+template <>
+struct task_promise<void> : promise_base {
+  task<void> get_return_object();
+  void return_void() {}
+};
+
+/**
+ * @class task
+ * @brief 惰性协程，返回 T，只能移动
+ */
+template <typename T = void>
+class task {
+ public:
+  typedef task_promise<T> promise_type;
+  typedef std::coroutine_handle<promise_type> handle;
+
+  explicit task(handle h) : m_handle(h) {}
+  task(task&& other) noexcept : m_handle(other.m_handle) {
+    other.m_handle = nullptr;
+  }
+  task(const task&) = delete;
+  task& operator=(const task&) = delete;
+  ~task() {
+    if (m_handle) {
+      m_handle.destroy();
+    }
+  }
+
+  struct awaiter {
+    handle h;
+
+    bool await_ready() noexcept { return false; }
+    // 记下等待者后直接转去运行任务
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<> caller) noexcept {
+      h.promise().continuation = caller;
+      return h;
+    }
+    T await_resume() {
+      if (h.promise().exception) {
+        std::rethrow_exception(h.promise().exception);
+      }
+      if constexpr (!std::is_void<T>::value) {
+        return std::move(h.promise().value);
+      }
+    }
+  };
+
+  awaiter operator co_await() noexcept { return awaiter{m_handle}; }
+
+ private:
+  handle m_handle;
+};
+
+template <typename T>
+task<T> task_promise<T>::get_return_object() {
+  return task<T>(std::coroutine_handle<task_promise<T> >::from_promise(*this));
+}
+
+inline task<void> task_promise<void>::get_return_object() {
+  return task<void>(
+      std::coroutine_handle<task_promise<void> >::from_promise(*this));
+}
+
+/**
+ * @struct detached
+ * @brief spawn 使用的协程：立即运行，结束时自行销毁帧
+ */
+struct detached {
+  struct promise_type : pooled_frame {
+    detached get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    // 没有等待者可以接收异常
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+/**
+ * @brief 在当前线程启动任务，运行到第一次挂起时返回
+ * @details 任务不能抛出异常，需要时在任务内部捕获
+ */
+inline detached spawn(task<void> t) { co_await t; }
+
+}  // namespace coro
+
+#endif  // !CORO_TASK_H
@@ -0,0 +1,84 @@
+#include "admission.h"
+
+#include <stdio.h>
+
+#include "../log/log.h"
+
+static const uint64_t NS_PER_MS = 1000000;
+
+static const char busy_body[] =
+    "The server is overloaded, please retry later.\n";
+
+admission::admission()
+    : m_target_ns(0),
+      m_interval_ns(0),
+      m_stop_accept_ns(0),
+      m_idle_close_batch(0),
+      m_window_end(0),
+      m_min_delay(UINT64_MAX),
+      m_overloaded(false),
+      m_stop_accept(false),
+      m_busy_len(0) {
+  m_busy[0] = '\0';
+}
+
+void admission::init(const admission_config& config) {
+  // 响应在启动时生成一次，过载时只需要拷贝；连接数已满时也使用它
+  m_busy_len = snprintf(m_busy, sizeof(m_busy),
+                        "HTTP/1.1 503 Service Unavailable\r\n"
+                        "Retry-After: %d\r\n"
+                        "Content-Length: %d\r\n"
+                        "Connection: close\r\n"
+                        "\r\n"
+                        "%s",
+                        config.retry_after_s, (int)sizeof(busy_body) - 1,
+                        busy_body);
+  if (config.target_ms <= 0) {
+    return;
+  }
+  m_target_ns = config.target_ms * NS_PER_MS;
+  m_interval_ns =
+      (config.interval_ms > 0 ? config.interval_ms : 100) * NS_PER_MS;
+  m_stop_accept_ns = (config.stop_accept_ms > 0 ? config.stop_accept_ms
+                                                : config.target_ms * 10) *
+                     NS_PER_MS;
+  m_idle_close_batch = config.idle_close_batch;
+
+  LOG_INFO("admission control enabled, target %dms, interval %dms",
+           config.target_ms, (int)(m_interval_ns / NS_PER_MS));
+}
+
+bool admission::observe(uint64_t delay_ns, uint64_t now_ns) {
+  if (delay_ns < m_min_delay) {
+    m_min_delay = delay_ns;
+  }
+  if (m_window_end == 0) {
+    m_window_end = now_ns + m_interval_ns;
+    return false;
+  }
+  if (now_ns < m_window_end) {
+    return false;
+  }
+
+  // 整个窗口内队列都没有排空过
+  bool overloaded = m_min_delay > m_target_ns;
+  if (overloaded != m_overloaded) {
+    LOG_WARN("admission: %s, min queueing delay %.1fms",
+             overloaded ? "overloaded" : "recovered", m_min_delay / 1e6);
+  }
+  m_overloaded = overloaded;
+  m_stop_accept = m_min_delay > m_stop_accept_ns;
+  m_min_delay = UINT64_MAX;
+  m_window_end = now_ns + m_interval_ns;
+  return true;
+}
+
+void admission::drained(uint64_t now_ns) {
+  if (m_overloaded) {
+    LOG_WARN("%s", "admission: recovered, ready queue drained");
+  }
+  m_overloaded = false;
+  m_stop_accept = false;
+  m_min_delay = UINT64_MAX;
+  m_window_end = now_ns + m_interval_ns;
+}
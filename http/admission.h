@@ -0,0 +1,89 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdint.h>
+
+/*
+ * 自适应准入控制
+ * 按 CoDel 的思路用排队时延而不是连接数判断过载：
+ * 事件从就绪到被事件循环处理之间等待的时间即为排队时延，
+ * 如果一个观察窗口(interval)内的最小排队时延都超过目标值(target)，
+ * 说明队列一直没有排空，处于过载状态。
+ *
+ * 过载时按代价从低到高依次采取措施：
+ *   1. 关闭空闲的长连接
+ *   2. 新连接直接返回预先生成的 503 + Retry-After
+ *   3. 排队超过目标值的请求返回 503 并关闭连接，而不是继续排队
+ *   4. 最小排队时延超过 stop_accept 阈值时暂停 accept，让内核的监听队列承担压力
+ * 未过载时只丢弃排队超过一个 interval 的请求，这样的请求客户端多半已经放弃。
+ */
+
+/**
+ * @struct admission_config
+ * @brief 准入控制参数，时间单位为毫秒
+ */
+struct admission_config {
+  int target_ms;        ///< 目标排队时延，0 表示关闭准入控制
+  int interval_ms;      ///< 观察窗口
+  int stop_accept_ms;   ///< 暂停 accept 的排队时延阈值，0 表示 10 倍目标值
+  int retry_after_s;    ///< 503 响应中的 Retry-After
+  int idle_close_batch; ///< 每个窗口最多关闭的空闲长连接数
+
+  admission_config()
+      : target_ms(0),
+        interval_ms(100),
+        stop_accept_ms(0),
+        retry_after_s(1),
+        idle_close_batch(64) {}
+};
+
+/**
+ * @class admission
+ * @brief 单个事件循环(reactor)的准入控制器，只由所属线程访问
+ */
+class admission {
+ public:
+  admission();
+
+  void init(const admission_config& config);
+  bool enabled() const { return m_target_ns != 0; }
+
+  /**
+   * @brief 记录一个事件的排队时延，窗口结束时更新过载状态
+   *
+   * @param delay_ns 排队时延
+   * @param now_ns 当前时间
+   * @return true 本次调用结束了一个窗口，过载状态可能已更新
+   */
+  bool observe(uint64_t delay_ns, uint64_t now_ns);
+  // 就绪队列已排空，立即退出过载状态
+  void drained(uint64_t now_ns);
+
+  // 排队 delay_ns 的请求是否还值得处理
+  bool admit(uint64_t delay_ns) const {
+    return delay_ns <= (m_overloaded ? m_target_ns : m_interval_ns);
+  }
+  bool overloaded() const { return m_overloaded; }
+  bool stop_accepting() const { return m_stop_accept; }
+  int idle_close_batch() const { return m_idle_close_batch; }
+
+  // 预先生成的 503 响应
+  const char* busy_response() const { return m_busy; }
+  int busy_response_len() const { return m_busy_len; }
+
+ private:
+  uint64_t m_target_ns;
+  uint64_t m_interval_ns;
+  uint64_t m_stop_accept_ns;
+  int m_idle_close_batch;
+
+  uint64_t m_window_end;  ///< 当前窗口结束时间，0 表示尚未开始
+  uint64_t m_min_delay;   ///< 当前窗口内的最小排队时延
+  bool m_overloaded;
+  bool m_stop_accept;
+
+  char m_busy[256];
+  int m_busy_len;
+};
+
+#endif  // !ADMISSION_H
@@ -0,0 +1,532 @@
+#include "asset_snapshot.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+
+#include "hash.h"
+#include "page_template.h"
+
+static const char ASSET_MAGIC[8] = {'M', 'W', 'S', 'A', 'S', 'S', 'E', 'T'};
+static const uint32_t ASSET_VERSION = 1;
+// 平均每个桶的路径数，越大位移表越小，打包时寻找位移值越慢
+static const uint32_t BUCKET_LOAD = 3;
+// 一个桶尝试的位移值上限，超过时换一个种子重新打包
+static const uint32_t MAX_DISPLACEMENT = 1u << 20;
+static const uint32_t MAX_SEEDS = 16;
+
+static uint64_t path_hash(const char* path, size_t len, uint32_t seed) {
+  uint64_t h = 14695981039346656037ULL ^ seed;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)path[i];
+    h *= 1099511628211ULL;
+  }
+  return fmix64(h);
+}
+
+static uint32_t bucket_of(uint64_t h, uint32_t buckets) {
+  return (uint32_t)((h >> 32) % buckets);
+}
+
+static uint32_t slot_of(uint64_t h, uint32_t disp, uint32_t count) {
+  return (uint32_t)(fmix64(h + disp * 0x9e3779b97f4a7c15ULL) % count);
+}
+
+static uint64_t align8(uint64_t n) { return (n + 7) & ~(uint64_t)7; }
+
+static bool in_range(uint64_t off, uint64_t len, uint64_t size) {
+  return off <= size && len <= size - off;
+}
+
+// ---- 打包 ----
+
+static bool collect_dir(const std::string& root, const std::string& prefix,
+                        std::vector<asset_source>& files, std::string& error) {
+  std::string dir = root + prefix;
+  DIR* d = opendir(dir.c_str());
+  if (d == nullptr) {
+    error = "cannot open directory " + dir + ": " + strerror(errno);
+    return false;
+  }
+  bool ok = true;
+  struct dirent* ent;
+  while (ok && (ent = readdir(d)) != nullptr) {
+    if (ent->d_name[0] == '.') {
+      continue;
+    }
+    std::string path = prefix + "/" + ent->d_name;
+    std::string real = root + path;
+    struct stat st;
+    if (stat(real.c_str(), &st) < 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      ok = collect_dir(root, path, files, error);
+      continue;
+    }
+    // 与按文件查找时一样，其他人不可读的文件与模板文件不对外提供
+    if (!S_ISREG(st.st_mode) || !(st.st_mode & S_IROTH) ||
+        is_template_path(path.c_str())) {
+      continue;
+    }
+    asset_source src;
+    src.path = path;
+    src.data.resize(st.st_size);
+    FILE* fp = fopen(real.c_str(), "rb");
+    if (fp == nullptr ||
+        fread(&src.data[0], 1, src.data.size(), fp) != src.data.size()) {
+      error = "cannot read " + real;
+      ok = false;
+    } else {
+      files.push_back(src);
+    }
+    if (fp) {
+      fclose(fp);
+    }
+  }
+  closedir(d);
+  return ok;
+}
+
+bool collect_assets(const std::string& root, std::vector<asset_source>& files,
+                    std::string& error) {
+  std::string base = root;
+  while (base.size() > 1 && base[base.size() - 1] == '/') {
+    base.erase(base.size() - 1);
+  }
+  if (!collect_dir(base, "", files, error)) {
+    return false;
+  }
+  // 按路径排序，同样的目录总是打包出同样的快照
+  std::sort(files.begin(), files.end(),
+            [](const asset_source& a, const asset_source& b) {
+              return a.path < b.path;
+            });
+  return true;
+}
+
+static const char* content_type(const std::string& path, bool& compressible) {
+  static const struct {
+    const char* ext;
+    const char* type;
+    bool compressible;
+  } types[] = {
+      {".html", "text/html", true},
+      {".htm", "text/html", true},
+      {".css", "text/css", true},
+      {".js", "application/javascript", true},
+      {".mjs", "application/javascript", true},
+      {".json", "application/json", true},
+      {".txt", "text/plain", true},
+      {".xml", "application/xml", true},
+      {".svg", "image/svg+xml", true},
+      {".wasm", "application/wasm", true},
+      {".png", "image/png", false},
+      {".jpg", "image/jpeg", false},
+      {".jpeg", "image/jpeg", false},
+      {".gif", "image/gif", false},
+      {".webp", "image/webp", false},
+      {".ico", "image/x-icon", false},
+      {".woff", "font/woff", false},
+      {".woff2", "font/woff2", false},
+      {".pdf", "application/pdf", false},
+      {".mp4", "video/mp4", false},
+  };
+  size_t dot = path.rfind('.');
+  if (dot != std::string::npos && path.find('/', dot) == std::string::npos) {
+    const char* ext = path.c_str() + dot;
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+      if (strcasecmp(ext, types[i].ext) == 0) {
+        compressible = types[i].compressible;
+        return types[i].type;
+      }
+    }
+  }
+  compressible = false;
+  return "application/octet-stream";
+}
+
+static bool gzip_compress(const std::string& in, std::string& out) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  // windowBits 加 16 生成 gzip 格式
+  if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  out.resize(deflateBound(&zs, in.size()) + 32);
+  zs.next_in = (Bytef*)in.data();
+  zs.avail_in = in.size();
+  zs.next_out = (Bytef*)&out[0];
+  zs.avail_out = out.size();
+  int ret = deflate(&zs, Z_FINISH);
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return ret == Z_STREAM_END;
+}
+
+// 一个文件的数据在数据区中的位置，目录别名与文件共用
+struct packed_file {
+  uint32_t gzip;
+  uint64_t body_off[2];
+  uint64_t body_len[2];
+  uint64_t head_off[ASSET_HEAD_COUNT][2];
+  uint32_t head_len[ASSET_HEAD_COUNT][2];
+  char etag[24];
+};
+
+static uint64_t append(std::string& data, uint64_t base, const std::string& s) {
+  uint64_t off = base + data.size();
+  data += s;
+  return off;
+}
+
+static void pack_file(const asset_source& src, int gzip_min, uint64_t base,
+                      std::string& data, packed_file& pf,
+                      asset_pack_stats& stats) {
+  bool compressible;
+  const char* type = content_type(src.path, compressible);
+  std::string gz;
+  pf.gzip = 0;
+  if (compressible && gzip_min >= 0 && src.data.size() >= (size_t)gzip_min &&
+      gzip_compress(src.data, gz) && gz.size() < src.data.size() / 8 * 7) {
+    pf.gzip = 1;
+    stats.gzipped++;
+    stats.gzip_bytes += gz.size();
+  }
+  stats.raw_bytes += src.data.size();
+
+  snprintf(pf.etag, sizeof(pf.etag), "%016llx",
+           (unsigned long long)path_hash(src.data.data(), src.data.size(), 0));
+
+  pf.body_off[0] = append(data, base, src.data);
+  pf.body_len[0] = src.data.size();
+  pf.body_off[1] = pf.gzip ? append(data, base, gz) : 0;
+  pf.body_len[1] = pf.gzip ? gz.size() : 0;
+
+  const char* vary = pf.gzip ? "Vary: Accept-Encoding\r\n" : "";
+  char buf[512];
+  for (int kind = 0; kind < ASSET_HEAD_COUNT; kind++) {
+    bool gzip = kind == ASSET_HEAD_GZIP || kind == ASSET_HEAD_NOT_MODIFIED_GZIP;
+    bool not_modified = kind >= ASSET_HEAD_NOT_MODIFIED;
+    for (int linger = 0; linger < 2; linger++) {
+      pf.head_off[kind][linger] = 0;
+      pf.head_len[kind][linger] = 0;
+      if (gzip && !pf.gzip) {
+        continue;
+      }
+      // gzip 版本是不同的表示，ETag 加上后缀区分
+      const char* suffix = gzip ? "-gz" : "";
+      const char* connection = linger ? "keep-alive" : "close";
+      int len;
+      if (not_modified) {
+        len = snprintf(buf, sizeof(buf),
+                       "HTTP/1.1 304 Not Modified\r\n"
+                       "ETag: \"%s%s\"\r\n%sConnection: %s\r\n\r\n",
+                       pf.etag, suffix, vary, connection);
+      } else {
+        len = snprintf(buf, sizeof(buf),
+                       "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n"
+                       "Content-Length: %llu\r\nETag: \"%s%s\"\r\n%s%s"
+                       "Connection: %s\r\n\r\n",
+                       type, (unsigned long long)pf.body_len[gzip ? 1 : 0],
+                       pf.etag, suffix,
+                       gzip ? "Content-Encoding: gzip\r\n" : "", vary,
+                       connection);
+      }
+      pf.head_off[kind][linger] = append(data, base, std::string(buf, len));
+      pf.head_len[kind][linger] = len;
+    }
+  }
+}
+
+/*
+ * 为每个桶寻找位移值
+ * 桶按大小从大到小处理，大桶在空槽位多时更容易放下
+ */
+static bool place_buckets(const std::vector<uint64_t>& hashes, uint32_t buckets,
+                          std::vector<uint32_t>& disp,
+                          std::vector<uint32_t>& slot_path) {
+  uint32_t count = hashes.size();
+  std::vector<std::vector<uint32_t> > members(buckets);
+  for (uint32_t i = 0; i < count; i++) {
+    members[bucket_of(hashes[i], buckets)].push_back(i);
+  }
+  std::vector<uint32_t> order(buckets);
+  for (uint32_t b = 0; b < buckets; b++) {
+    order[b] = b;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    return members[a].size() > members[b].size();
+  });
+
+  disp.assign(buckets, 0);
+  slot_path.assign(count, UINT32_MAX);
+  std::vector<uint32_t> slots;
+  for (uint32_t k = 0; k < buckets; k++) {
+    const std::vector<uint32_t>& m = members[order[k]];
+    if (m.empty()) {
+      break;
+    }
+    uint32_t d = 0;
+    for (; d < MAX_DISPLACEMENT; d++) {
+      slots.clear();
+      bool ok = true;
+      for (size_t i = 0; i < m.size() && ok; i++) {
+        uint32_t s = slot_of(hashes[m[i]], d, count);
+        ok = slot_path[s] == UINT32_MAX &&
+             std::find(slots.begin(), slots.end(), s) == slots.end();
+        slots.push_back(s);
+      }
+      if (ok) {
+        break;
+      }
+    }
+    if (d == MAX_DISPLACEMENT) {
+      return false;
+    }
+    disp[order[k]] = d;
+    for (size_t i = 0; i < m.size(); i++) {
+      slot_path[slots[i]] = m[i];
+    }
+  }
+  return true;
+}
+
+bool pack_assets(const std::vector<asset_source>& files, int gzip_min,
+                 std::string& blob, asset_pack_stats& stats,
+                 std::string& error) {
+  memset(&stats, 0, sizeof(stats));
+  // 路径与所属文件，目录的 index.html 另加一条 "目录/" 的别名
+  std::vector<std::pair<std::string, uint32_t> > paths;
+  for (uint32_t i = 0; i < files.size(); i++) {
+    const std::string& path = files[i].path;
+    if (path.empty() || path[0] != '/') {
+      error = "asset path must start with '/': " + path;
+      return false;
+    }
+    paths.push_back(std::make_pair(path, i));
+    static const std::string index = "/index.html";
+    if (path.size() >= index.size() &&
+        path.compare(path.size() - index.size(), index.size(), index) == 0) {
+      paths.push_back(
+          std::make_pair(path.substr(0, path.size() - index.size() + 1), i));
+    }
+  }
+  std::sort(paths.begin(), paths.end());
+  for (size_t i = 1; i < paths.size(); i++) {
+    if (paths[i].first == paths[i - 1].first) {
+      error = "duplicate asset path " + paths[i].first;
+      return false;
+    }
+  }
+
+  uint32_t count = paths.size();
+  uint32_t buckets = count / BUCKET_LOAD + 1;
+  std::vector<uint32_t> disp;
+  std::vector<uint32_t> slot_path;
+  std::vector<uint64_t> hashes(count);
+  uint32_t seed = 0;
+  for (; seed < MAX_SEEDS; seed++) {
+    for (uint32_t i = 0; i < count; i++) {
+      hashes[i] = path_hash(paths[i].first.data(), paths[i].first.size(), seed);
+    }
+    if (count == 0 || place_buckets(hashes, buckets, disp, slot_path)) {
+      break;
+    }
+  }
+  if (seed == MAX_SEEDS) {
+    error = "cannot build perfect hash";
+    return false;
+  }
+  if (count == 0) {
+    disp.assign(buckets, 0);
+  }
+
+  asset_snapshot_header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, ASSET_MAGIC, sizeof(header.magic));
+  header.version = ASSET_VERSION;
+  header.count = count;
+  header.buckets = buckets;
+  header.seed = seed;
+  header.disp_off = align8(sizeof(header));
+  header.entry_off = align8(header.disp_off + buckets * sizeof(uint32_t));
+  uint64_t data_off = header.entry_off + (uint64_t)count * sizeof(asset_entry);
+
+  // 先写数据区，再按槽位填表项
+  std::string data;
+  std::vector<packed_file> packed(files.size());
+  for (size_t i = 0; i < files.size(); i++) {
+    pack_file(files[i], gzip_min, data_off, data, packed[i], stats);
+  }
+  std::vector<asset_entry> entries(count);
+  for (uint32_t s = 0; s < count; s++) {
+    const std::pair<std::string, uint32_t>& p = paths[slot_path[s]];
+    const packed_file& pf = packed[p.second];
+    asset_entry& e = entries[s];
+    memset(&e, 0, sizeof(e));
+    e.path_off = append(data, data_off, p.first);
+    e.path_len = p.first.size();
+    e.gzip = pf.gzip;
+    memcpy(e.body_off, pf.body_off, sizeof(e.body_off));
+    memcpy(e.body_len, pf.body_len, sizeof(e.body_len));
+    memcpy(e.head_off, pf.head_off, sizeof(e.head_off));
+    memcpy(e.head_len, pf.head_len, sizeof(e.head_len));
+    memcpy(e.etag, pf.etag, sizeof(e.etag));
+  }
+  header.size = data_off + data.size();
+
+  blob.assign(header.size, '\0');
+  memcpy(&blob[0], &header, sizeof(header));
+  memcpy(&blob[header.disp_off], disp.data(), buckets * sizeof(uint32_t));
+  if (count) {
+    memcpy(&blob[header.entry_off], entries.data(),
+           count * sizeof(asset_entry));
+  }
+  memcpy(&blob[data_off], data.data(), data.size());
+
+  stats.files = files.size();
+  stats.paths = count;
+  stats.size = header.size;
+  return true;
+}
+
+// ---- 加载与查找 ----
+
+asset_snapshot::asset_snapshot()
+    : m_base(nullptr),
+      m_header(nullptr),
+      m_disp(nullptr),
+      m_entries(nullptr),
+      m_map_len(0) {}
+
+asset_snapshot::~asset_snapshot() { reset(); }
+
+asset_snapshot* asset_snapshot::get_instance() {
+  static asset_snapshot instance;
+  return &instance;
+}
+
+void asset_snapshot::reset() {
+  if (m_map_len) {
+    munmap((void*)m_base, m_map_len);
+  }
+  m_base = nullptr;
+  m_header = nullptr;
+  m_disp = nullptr;
+  m_entries = nullptr;
+  m_map_len = 0;
+  std::string().swap(m_owned);
+}
+
+bool asset_snapshot::build(const std::string& root, int gzip_min,
+                           std::string& error) {
+  std::vector<asset_source> files;
+  if (!collect_assets(root, files, error)) {
+    return false;
+  }
+  std::string blob;
+  asset_pack_stats stats;
+  if (!pack_assets(files, gzip_min, blob, stats, error)) {
+    return false;
+  }
+  return attach(blob, error);
+}
+
+bool asset_snapshot::load(const std::string& file, std::string& error) {
+  reset();
+  int fd = open(file.c_str(), O_RDONLY);
+  if (fd < 0) {
+    error = "cannot open " + file + ": " + strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(asset_snapshot_header)) {
+    close(fd);
+    error = file + " is not an asset snapshot";
+    return false;
+  }
+  // 一次性读入页面，之后处理请求时不会再发生缺页
+  void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+                    fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    error = "cannot map " + file + ": " + strerror(errno);
+    return false;
+  }
+  m_base = (const char*)addr;
+  m_map_len = st.st_size;
+  return validate(error);
+}
+
+bool asset_snapshot::attach(std::string& blob, std::string& error) {
+  reset();
+  m_owned.swap(blob);
+  m_base = m_owned.data();
+  return validate(error);
+}
+
+/*
+ * 检查快照中的所有偏移都在范围内
+ * 之后处理请求时不再做边界检查
+ */
+bool asset_snapshot::validate(std::string& error) {
+  uint64_t size = m_map_len ? m_map_len : m_owned.size();
+  const asset_snapshot_header* h = (const asset_snapshot_header*)m_base;
+  bool ok = size >= sizeof(*h) &&
+            memcmp(h->magic, ASSET_MAGIC, sizeof(h->magic)) == 0 &&
+            h->version == ASSET_VERSION && h->size == size &&
+            h->buckets > 0 && h->disp_off % 8 == 0 && h->entry_off % 8 == 0 &&
+            in_range(h->disp_off, (uint64_t)h->buckets * sizeof(uint32_t),
+                     size) &&
+            in_range(h->entry_off, (uint64_t)h->count * sizeof(asset_entry),
+                     size);
+  const asset_entry* entries =
+      ok ? (const asset_entry*)(m_base + h->entry_off) : nullptr;
+  for (uint32_t i = 0; ok && i < h->count; i++) {
+    const asset_entry& e = entries[i];
+    ok = in_range(e.path_off, e.path_len, size) &&
+         memchr(e.etag, '\0', sizeof(e.etag)) != nullptr;
+    for (int v = 0; ok && v < 2; v++) {
+      ok = in_range(e.body_off[v], e.body_len[v], size);
+    }
+    for (int k = 0; ok && k < ASSET_HEAD_COUNT; k++) {
+      for (int l = 0; ok && l < 2; l++) {
+        ok = in_range(e.head_off[k][l], e.head_len[k][l], size);
+      }
+    }
+  }
+  if (!ok) {
+    reset();
+    error = "invalid or incompatible asset snapshot";
+    return false;
+  }
+  m_header = h;
+  m_disp = (const uint32_t*)(m_base + h->disp_off);
+  m_entries = entries;
+  return true;
+}
+
+const asset_entry* asset_snapshot::find(const char* url) const {
+  if (m_header->count == 0) {
+    return nullptr;
+  }
+  size_t len = strcspn(url, "?");
+  uint64_t h = path_hash(url, len, m_header->seed);
+  uint32_t disp = m_disp[bucket_of(h, m_header->buckets)];
+  const asset_entry* e = &m_entries[slot_of(h, disp, m_header->count)];
+  if (e->path_len != len || memcmp(m_base + e->path_off, url, len) != 0) {
+    return nullptr;
+  }
+  return e;
+}
@@ -0,0 +1,162 @@
+#ifndef ASSET_SNAPSHOT_H
+#define ASSET_SNAPSHOT_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/*
+ * 静态资源快照
+ * 发布部署时文档根目录不会变化，快照把其中所有文件打包成一块只读内存：
+ * 文件内容、gzip 压缩版本、ETag 以及完整的响应头都预先生成好，
+ * 按 URL 路径建立最小完美哈希。处理请求只需一次哈希探测与一次路径比较，
+ * 不再 stat/open/mmap/munmap，每个请求只剩发送响应的系统调用。
+ *
+ * 快照可以在启动时从文档根目录生成，也可以用 packassets 离线打包成文件，
+ * 启动时整体 mmap(MAP_POPULATE)，多个事件循环共享同一份只读内存。
+ *
+ * 布局(所有整数为本机字节序，偏移从快照开头算起，8 字节对齐)：
+ *   asset_snapshot_header
+ *   uint32_t disp[buckets]        每个桶的位移值
+ *   asset_entry entries[count]    按槽位排列，槽位即哈希结果
+ *   数据区                        路径、响应头、文件内容
+ *
+ * 完美哈希采用 hash-and-displace：路径的 64 位哈希先决定所在的桶，
+ * 再与桶的位移值混合后对 count 取模得到槽位。打包时按桶从大到小依次
+ * 为每个桶寻找使其所有路径都落在空槽位上的位移值。
+ * 不在快照中的路径也会落到某个槽位上，需要再比较一次路径。
+ *
+ * 包含 index.html 的目录同时以 "目录/" 的路径加入快照，指向同一份数据。
+ */
+
+// 响应头的种类，每种分别为长连接与短连接各生成一份
+enum asset_head {
+  ASSET_HEAD_IDENTITY = 0,       ///< 200，原始内容
+  ASSET_HEAD_GZIP,               ///< 200，gzip 内容
+  ASSET_HEAD_NOT_MODIFIED,       ///< 304，对应原始内容
+  ASSET_HEAD_NOT_MODIFIED_GZIP,  ///< 304，对应 gzip 内容
+  ASSET_HEAD_COUNT
+};
+
+/**
+ * @struct asset_snapshot_header
+ * @brief 快照文件头
+ */
+struct asset_snapshot_header {
+  char magic[8];       ///< "MWSASSET"
+  uint32_t version;    ///< 布局版本，不一致时拒绝加载
+  uint32_t count;      ///< 路径数，也是槽位数
+  uint32_t buckets;    ///< 桶数
+  uint32_t seed;       ///< 哈希种子
+  uint64_t disp_off;   ///< 位移表偏移
+  uint64_t entry_off;  ///< 表项数组偏移
+  uint64_t size;       ///< 快照总字节数
+};
+
+/**
+ * @struct asset_entry
+ * @brief 一个路径对应的资源
+ */
+struct asset_entry {
+  uint64_t path_off;
+  uint32_t path_len;
+  uint32_t gzip;                                ///< 是否有 gzip 版本
+  uint64_t body_off[2];                         ///< 原始与 gzip 内容
+  uint64_t body_len[2];
+  uint64_t head_off[ASSET_HEAD_COUNT][2];       ///< [种类][是否长连接]
+  uint32_t head_len[ASSET_HEAD_COUNT][2];
+  char etag[24];                                ///< 原始内容的 ETag，不带引号，以 '\0' 结尾
+};
+
+/**
+ * @struct asset_source
+ * @brief 打包的输入：一个 URL 路径及其文件内容
+ */
+struct asset_source {
+  std::string path;  ///< 以 '/' 开头
+  std::string data;
+};
+
+/**
+ * @struct asset_pack_stats
+ * @brief 打包结果统计
+ */
+struct asset_pack_stats {
+  uint32_t files;       ///< 文件数
+  uint32_t paths;       ///< 路径数(包含目录别名)
+  uint32_t gzipped;     ///< 有 gzip 版本的文件数
+  uint64_t raw_bytes;   ///< 原始内容总字节数
+  uint64_t gzip_bytes;  ///< gzip 版本总字节数
+  uint64_t size;        ///< 快照总字节数
+};
+
+/**
+ * @brief 递归读取目录下的所有文件，跳过以 '.' 开头的文件与其他人不可读的文件
+ *
+ * @param[out] error 失败原因
+ */
+bool collect_assets(const std::string& root, std::vector<asset_source>& files,
+                    std::string& error);
+
+/**
+ * @brief 把文件打包为快照
+ *
+ * @param gzip_min 小于该字节数的文件不生成 gzip 版本，-1 表示都不生成
+ * @param[out] blob 快照内容
+ */
+bool pack_assets(const std::vector<asset_source>& files, int gzip_min,
+                 std::string& blob, asset_pack_stats& stats,
+                 std::string& error);
+
+/**
+ * @class asset_snapshot
+ * @brief 只读的资源快照，加载后由所有事件循环共享
+ */
+class asset_snapshot {
+ public:
+  asset_snapshot();
+  ~asset_snapshot();
+
+  // 服务器使用的全局快照
+  static asset_snapshot* get_instance();
+
+  /**
+   * @brief 从文档根目录生成快照
+   */
+  bool build(const std::string& root, int gzip_min, std::string& error);
+  /**
+   * @brief 加载 packassets 生成的快照文件
+   */
+  bool load(const std::string& file, std::string& error);
+  /**
+   * @brief 接管内存中的快照，blob 被清空
+   */
+  bool attach(std::string& blob, std::string& error);
+
+  bool enabled() const { return m_base != nullptr; }
+  uint32_t count() const { return m_header->count; }
+  uint64_t size() const { return m_header->size; }
+
+  /**
+   * @brief 查找路径，忽略 '?' 之后的查询串
+   *
+   * @return const asset_entry* 不存在时返回空
+   */
+  const asset_entry* find(const char* url) const;
+
+  const char* data(uint64_t off) const { return m_base + off; }
+
+ private:
+  bool validate(std::string& error);
+  void reset();
+
+  const char* m_base;
+  const asset_snapshot_header* m_header;
+  const uint32_t* m_disp;
+  const asset_entry* m_entries;
+  size_t m_map_len;     ///< mmap 的长度，快照在堆上时为 0
+  std::string m_owned;  ///< 在内存中生成的快照
+};
+
+#endif  // !ASSET_SNAPSHOT_H
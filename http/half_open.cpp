@@ -0,0 +1,38 @@
+#include "half_open.h"
+
+#include <unistd.h>
+
+#include "../metrics/metrics.h"
+#include "hash.h"
+
+half_open_table* half_open_table::get_instance() {
+  static half_open_table instance;
+  return &instance;
+}
+
+half_open_table::half_open_table() : m_limit(0) {
+  m_seed = fmix64(metrics_now_ns() ^ ((uint64_t)getpid() << 32));
+}
+
+bool half_open_table::acquire(uint32_t addr) {
+  // 上限可能刚被改为 0，仍然计入，保证与 release 成对
+  int limit = m_limit.load(std::memory_order_relaxed);
+  // 两行分别取哈希值的低位与高位
+  uint64_t h = fmix64(addr ^ m_seed);
+  std::atomic<uint32_t>& a = m_rows[0][h & (ROW_SIZE - 1)];
+  std::atomic<uint32_t>& b = m_rows[1][(h >> 32) & (ROW_SIZE - 1)];
+  uint32_t ca = a.fetch_add(1, std::memory_order_relaxed) + 1;
+  uint32_t cb = b.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (limit > 0 && (ca < cb ? ca : cb) > (uint32_t)limit) {
+    a.fetch_sub(1, std::memory_order_relaxed);
+    b.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+void half_open_table::release(uint32_t addr) {
+  uint64_t h = fmix64(addr ^ m_seed);
+  m_rows[0][h & (ROW_SIZE - 1)].fetch_sub(1, std::memory_order_relaxed);
+  m_rows[1][(h >> 32) & (ROW_SIZE - 1)].fetch_sub(1, std::memory_order_relaxed);
+}
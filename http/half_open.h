@@ -0,0 +1,60 @@
+#ifndef HALF_OPEN_H
+#define HALF_OPEN_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+/*
+ * 每个客户端 IP 同时进行中的半开请求数
+ * 半开请求指还没有收完请求头或请求体的连接：新连接从 accept 开始计入，
+ * 长连接从下一个请求的首字节开始计入，请求收完或连接关闭时扣除。
+ * 慢速客户端(slowloris)用很少的带宽就能让大量连接停在这个阶段，
+ * 限制每个 IP 的半开数之后，它们占不满连接表，也不影响其他客户端。
+ *
+ * 计数保存在两行按不同哈希索引的原子计数器中(count-min)，所有事件循环共享，
+ * 不加锁、不分配内存；取两行中较小的值作为该 IP 的计数。
+ * 不同 IP 冲突只会让计数偏大，两行同时冲突的概率很小。
+ */
+
+/**
+ * @class half_open_table
+ * @brief 按 IP 统计半开请求数(单例)，各事件循环线程共享
+ */
+class half_open_table {
+ public:
+  static half_open_table* get_instance();
+
+  /**
+   * @brief 设置每个 IP 的上限，0 表示不限制，可以在运行期间修改
+   */
+  void set_limit(int limit) {
+    m_limit.store(limit, std::memory_order_relaxed);
+  }
+  bool enabled() const { return m_limit.load(std::memory_order_relaxed) > 0; }
+
+  /**
+   * @brief 计入一个半开请求，调用方先用 enabled() 判断是否需要统计
+   *
+   * @param addr 客户端 IPv4 地址(网络字节序)
+   * @return bool 已达到上限时返回 false，此时不计入
+   */
+  bool acquire(uint32_t addr);
+
+  /**
+   * @brief 扣除一个 acquire 成功计入的半开请求
+   */
+  void release(uint32_t addr);
+
+ private:
+  half_open_table();
+
+  static const int ROW_BITS = 16;
+  static const int ROW_SIZE = 1 << ROW_BITS;
+
+  std::atomic<int> m_limit;
+  uint64_t m_seed;  ///< 哈希种子，避免客户端构造冲突
+  std::atomic<uint32_t> m_rows[2][ROW_SIZE];
+};
+
+#endif  // !HALF_OPEN_H
@@ -0,0 +1,19 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stdint.h>
+
+/*
+ * 64 位整数的混合函数(MurmurHash3 的 fmix64)
+ * 输入的每一位都会影响输出的所有位，用于把 IP、带种子的键等分散到哈希表中
+ */
+inline uint64_t fmix64(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+#endif  // !HASH_H
@@ -1,15 +1,30 @@
 #include "http_conn.h"
 
 #include <fcntl.h>
+#include <limits.h>
 #include <strings.h>
 #include <sys/mman.h>
+#include <sys/time.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstdarg>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+
+#include "../coro/handler.h"
+#include "../log/access_log.h"
+#include "../log/capture.h"
+#include "../log/log.h"
+#include "../metrics/metrics.h"
+#include "../metrics/trace.h"
+#include "../proxy/proxy.h"
+#include "asset_snapshot.h"
+#include "half_open.h"
+#include "page_template.h"
+#include "rate_limit.h"
 // 定义 HTTP 响应的一些状态信息
 const char* ok_200_title = "OK";
 const char* error_400_title = "Bad Request";
@@ -24,10 +39,54 @@ const char* error_404_form =
 const char* error_500_title = "Internal Error";
 const char* error_500_form =
     "There was an unusual problem serving the request file.\n";
+const char* error_502_title = "Bad Gateway";
+const char* error_502_form =
+    "The upstream server is unavailable or sent an invalid response.\n";
+const char* error_504_title = "Gateway Timeout";
+const char* error_504_form =
+    "The upstream server did not respond in time.\n";
+
+// 异步处理函数可以返回任意状态码
+static const char* status_title(int status) {
+  switch (status) {
+    case 200: return ok_200_title;
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 303: return "See Other";
+    case 304: return "Not Modified";
+    case 400: return error_400_title;
+    case 401: return "Unauthorized";
+    case 403: return error_403_title;
+    case 404: return error_404_title;
+    case 405: return "Method Not Allowed";
+    case 409: return "Conflict";
+    case 429: return "Too Many Requests";
+    case 500: return error_500_title;
+    case 502: return error_502_title;
+    case 503: return "Service Unavailable";
+    case 504: return error_504_title;
+    default: return "Unknown";
+  }
+}
 
 // 初始化静态成员变量
-int http_conn::m_epollfd = -1;
-int http_conn::m_user_count = 0;
+__thread int http_conn::m_epollfd = -1;
+__thread int http_conn::m_user_count = 0;
+__thread bool http_conn::m_draining = false;
+__thread int http_conn::m_conn_trig = 1;
+// 突发过后池中多余的缓冲区被释放，内存可以回落
+__thread int http_conn::m_buffer_pool_limit = 256;
+__thread int http_conn::m_read_budget = 0;
+__thread int http_conn::m_write_budget = 0;
+__thread proxy* http_conn::m_proxy = nullptr;
+__thread http_conn::timeouts http_conn::m_timeouts = {10, 10, 1024, 15, 60, 15};
+int http_conn::m_read_buffer_size = http_conn::READ_BUFFER_SIZE;
+int http_conn::m_write_buffer_size = http_conn::WRITE_BUFFER_SIZE;
+
+static __thread http_conn::buffers* t_free_buffers = nullptr;
+static __thread int t_free_count = 0;
 
 // --- Epoll 工具函数 ---
 
@@ -40,14 +99,17 @@ static int setnonblocking(int fd) {
 }
 
 /*
- * 将内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
+ * 将内核事件表注册读事件，按 m_conn_trig 选择 LT/ET 模式，选择开启EPOLLONESHOT
  * ONESHOT保证操作系统最多触发一次事件，除非我们手动重置
  */
 static void addfd(int epollfd, int fd, bool one_shot) {
-  epoll_event event;
+  epoll_event event = {};
   event.data.fd = fd;
   // EPOLLRDHUB:对方关闭连接
-  event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+  event.events = EPOLLIN | EPOLLRDHUP;
+  if (http_conn::m_conn_trig == 1) {
+    event.events |= EPOLLET;
+  }
   if (one_shot) {
     event.events |= EPOLLONESHOT;
   }
@@ -64,9 +126,12 @@ static void removefd(int epollfd, int fd) {
 // 重置 EPOLLONESHOT
 // 处理完一次请求以后，再次把socket设为可读，以便下次接收数据
 static void modfd(int epollfd, int fd, int ev) {
-  epoll_event event;
+  epoll_event event = {};
   event.data.fd = fd;
-  event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+  event.events = ev | EPOLLONESHOT | EPOLLRDHUP;
+  if (http_conn::m_conn_trig == 1) {
+    event.events |= EPOLLET;
+  }
   epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
@@ -76,15 +141,26 @@ static void modfd(int epollfd, int fd, int ev) {
 void http_conn::close_conn(bool real_close) {
   if (real_close && (m_sockfd != -1)) {
     removefd(m_epollfd, m_sockfd);
+    release_buffers();
     m_sockfd = -1;
     m_user_count--;
+    metrics::inc(metrics::local()->closed);
   }
 }
 
 // 初始化（对外接口）
-void http_conn::init(int sockfd, const sockaddr_in& addr) {
+void http_conn::init(int sockfd, const sockaddr_in& addr, bool half_open) {
   m_sockfd = sockfd;
   m_address = addr;
+  m_buf = nullptr;
+  m_exchange = nullptr;
+  m_call = nullptr;
+  m_half_open = half_open;
+  m_responses = 0;
+  m_capture_session = 0;
+  if (capture::get_instance()->enabled()) {
+    m_capture_session = capture::get_instance()->open_session();
+  }
 
   // 端口复用
   int reuse = 1;
@@ -95,6 +171,12 @@ void http_conn::init(int sockfd, const sockaddr_in& addr) {
   m_user_count++;
 
   init();
+  // 第一个请求的请求头从连接建立开始计时
+  set_stage(STAGE_HEADER);
+  // 从连接建立开始等待第一个请求
+  if (TRACE_ON()) {
+    m_trace_mark = tracer::now();
+  }
 }
 
 // 初始化连接（内部接口）
@@ -105,43 +187,163 @@ void http_conn::init() {
   m_url = 0;
   m_version = 0;
   m_content_length = 0;
+  m_proxy_route = -1;
+  m_async_route = -1;
+  m_accept_gzip = false;
+  m_if_none_match = 0;
   m_host = 0;
   m_start_line = 0;
   m_checked_idx = 0;
   m_read_idx = 0;
   m_write_idx = 0;
+  m_start_us = 0;
+  m_status = 0;
+  m_response_bytes = 0;
+  m_bytes_have_send = 0;
+  m_file_address = 0;
+  m_asset = nullptr;
+  m_iov = m_iv;
+  m_trace_mark = 0;
+  m_trace_wait_write = false;
+  m_resume_ev = 0;
+  m_read_more = false;
+}
+
+void http_conn::attach_buffers() {
+  if (m_buf) {
+    return;
+  }
+  // 缓冲区不需要清零：解析只访问 m_read_idx 之前的数据，
+  // 写缓冲区按 m_write_idx 追加
+  if (t_free_buffers) {
+    m_buf = t_free_buffers;
+    t_free_buffers = m_buf->next;
+    t_free_count--;
+  } else {
+    m_buf = (buffers*)malloc(sizeof(buffers) + m_read_buffer_size +
+                             m_write_buffer_size);
+    m_buf->read_buf = (char*)(m_buf + 1);
+    m_buf->write_buf = m_buf->read_buf + m_read_buffer_size;
+  }
+}
+
+void http_conn::release_buffers() {
+  // 连接关闭的各条路径都经过这里，半开的请求在此扣除，
+  // 就绪列表中的连接也在此失效
+  m_resume_ev = 0;
+  if (m_half_open) {
+    half_open_table::get_instance()->release(m_address.sin_addr.s_addr);
+    m_half_open = false;
+  }
+  // 连接在转发途中关闭，上游连接的状态未知，直接关闭
+  if (m_exchange) {
+    m_proxy->abort(this);
+  }
+  if (!m_buf) {
+    return;
+  }
+  // 文件长度保存在缓冲区中，映射要在归还前解除
+  unmap();
+  if (t_free_count < m_buffer_pool_limit) {
+    m_buf->next = t_free_buffers;
+    t_free_buffers = m_buf;
+    t_free_count++;
+  } else {
+    free(m_buf);
+  }
+  m_buf = nullptr;
+}
 
-  memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-  memset(m_write_buffer, '\0', WRITE_BUFFER_SIZE);
-  memset(m_real_file, '\0', FILE_REQUEST);
+void http_conn::free_buffer_pool() {
+  while (t_free_buffers) {
+    buffers* next = t_free_buffers->next;
+    free(t_free_buffers);
+    t_free_buffers = next;
+  }
+  t_free_count = 0;
 }
 
 /*
- * 循环读取客户数据，直到无数据可读
- * 必须一次性读完
+ * 读取客户数据
+ * LT 模式读一次，没读完的数据会再次触发事件；
+ * ET 模式循环读取直到无数据可读，必须一次性读完。
+ * 读到 m_read_budget 时提前停止，由 process 把连接留给下一轮继续读
  */
 bool http_conn::read_once() {
-  if (m_read_idx >= READ_BUFFER_SIZE) {
+  if (m_read_idx >= m_read_buffer_size) {
     return false;
   }
+  attach_buffers();
+
+  // 新请求的第一次读取，记录请求开始时间
+  if (m_read_idx == 0 && access_log::get_instance()->enabled()) {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    m_start_us = (unsigned long long)now.tv_sec * 1000000 + now.tv_usec;
+  }
+
+  int read_start = m_read_idx;
+  uint64_t trace_begin = 0;
+  if (TRACE_ON()) {
+    trace_begin = tracer::now();
+    if (m_trace_mark) {
+      tracer::record(TRACE_WAIT_READ, m_sockfd, m_trace_mark, trace_begin);
+      m_trace_mark = 0;
+    }
+  }
 
   int bytes_read = 0;
-  while (true) {
-    // 从 socket 读数据到 m_read_buf + m_read_idx
-    bytes_read = recv(m_sockfd, m_read_buf + m_read_idx,
-                      READ_BUFFER_SIZE - m_read_idx, 0);
-
-    if (bytes_read == -1) {
-      // EAGAIN 或 EWOULDBLOCK 说明缓冲区空了，读完了
-      if (errno == EAGAIN || errno == EWOULDBLOCK) {
-        break;
-      }
+  m_resume_ev = 0;
+  m_read_more = false;
+  if (m_conn_trig == 0) {
+    bytes_read = recv(m_sockfd, m_buf->read_buf + m_read_idx,
+                      m_read_buffer_size - m_read_idx, 0);
+    if (bytes_read == 0 ||
+        (bytes_read < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
       return false;
-    } else if (bytes_read == 0) {
-      return false;  // 对方关闭连接
     }
+    if (bytes_read > 0) {
+      m_read_idx += bytes_read;
+    }
+  } else {
+    while (true) {
+      // 从 socket 读数据到 m_buf->read_buf + m_read_idx，一次不超过剩余的预算
+      int len = m_read_buffer_size - m_read_idx;
+      if (m_read_budget > 0) {
+        len = std::min(len, m_read_budget - (m_read_idx - read_start));
+      }
+      bytes_read = recv(m_sockfd, m_buf->read_buf + m_read_idx, len, 0);
+
+      if (bytes_read == -1) {
+        // EAGAIN 或 EWOULDBLOCK 说明缓冲区空了，读完了
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          break;
+        }
+        return false;
+      } else if (bytes_read == 0) {
+        return false;  // 对方关闭连接
+      }
 
-    m_read_idx += bytes_read;
+      m_read_idx += bytes_read;
+      if (m_read_budget > 0 && m_read_idx - read_start >= m_read_budget) {
+        m_read_more = true;
+        metrics::inc(metrics::local()->budget_read);
+        break;
+      }
+    }
+  }
+  if (TRACE_ON()) {
+    tracer::record(TRACE_READ, m_sockfd, trace_begin, tracer::now());
+  }
+  // 解析会改写读缓冲区，在这之前录制原始字节
+  if (capture::get_instance()->enabled() && m_read_idx > read_start) {
+    capture::get_instance()->append(m_capture_session, m_responses,
+                                    m_buf->read_buf + read_start,
+                                    m_read_idx - read_start);
+  }
+  // 空闲的长连接收到下一个请求的首字节
+  if (m_stage == STAGE_IDLE && m_read_idx > 0) {
+    return begin_request();
   }
   return true;
 }
@@ -149,30 +351,66 @@ bool http_conn::read_once() {
 /*
  * 写 HTTP 响应
  * 这是一个分散写的操作，因为有两部分数据：
- * 1. 响应头（在 m_write_buffer中）
+ * 1. 响应头（在 m_buf->write_buf中）
  * 2. 文件内容（nmap 映射的内存 m_file_address 中
- * writev 可以一次性把这两块不连续的内存发出去
+ * writev 可以一次性把这两块不连续的内存发出去。
+ * 一次调用最多发送 m_write_budget 字节，没发完的由事件循环的就绪列表在下一轮继续
  */
 bool http_conn::write() {
   int tmp = 0;
+  int sent = 0;
+  m_resume_ev = 0;
 
-  // 如果没有数据要发（bytes_to_send == 0）
-  // 这里的逻辑后续在 process_write 完善时会补充计算 bytes_to_send
-  // 先写基础逻辑
-  if (m_write_idx == 0) {
+  // 没有数据要发
+  if (m_response_bytes == 0) {
     modfd(m_epollfd, m_sockfd, EPOLLIN);
     init();
+    release_buffers();
+    set_stage(STAGE_IDLE);
     return true;
   }
 
+  if (TRACE_ON() && m_trace_wait_write) {
+    tracer::record(TRACE_WAIT_WRITE, m_sockfd, m_trace_mark, tracer::now());
+    m_trace_wait_write = false;
+  }
+
   // 核心循环
   while (1) {
     // writev 分散写
-    tmp = writev(m_sockfd, m_iv, m_iv_count);
+    uint64_t start_ns = metrics_now_ns();
+    uint64_t trace_begin = TRACE_ON() ? tracer::now() : 0;
+    int count = m_iv_count < IOV_MAX ? m_iv_count : IOV_MAX;
+    // 一次不超过剩余的预算：截短用到的最后一个 iovec，发送后恢复
+    int cut = -1;
+    size_t cut_len = 0;
+    if (m_write_budget > 0) {
+      size_t left = m_write_budget - sent;
+      for (int i = 0; i < count; i++) {
+        if (m_iov[i].iov_len >= left) {
+          cut = i;
+          cut_len = m_iov[i].iov_len;
+          m_iov[i].iov_len = left;
+          count = i + 1;
+          break;
+        }
+        left -= m_iov[i].iov_len;
+      }
+    }
+    tmp = writev(m_sockfd, m_iov, count);
+    if (cut >= 0) {
+      m_iov[cut].iov_len = cut_len;
+    }
+    metrics::record_phase(PHASE_WRITE, metrics_now_ns() - start_ns);
+    if (TRACE_ON()) {
+      m_trace_mark = tracer::now();
+      tracer::record(TRACE_WRITE, m_sockfd, trace_begin, m_trace_mark);
+    }
 
     if (tmp <= -1) {
       // 如果 TCP 写缓冲区满了，等待下一轮 EPOLLOUT 事件
       if (errno == EAGAIN) {
+        m_trace_wait_write = true;
         modfd(m_epollfd, m_sockfd, EPOLLOUT);
         return true;
       }
@@ -180,17 +418,33 @@ bool http_conn::write() {
       return false;
     }
 
-    // 这里需要处理“数据发送了一部分”的逻辑（滑动处理 iovec）
-    // 为了简化 MIlestone 2,我们暂且假设一次性能发送完
-    // 标准的mark server这里有复杂的 bytes_have_send 计算
+    // 只发送了一部分：跳过已发完的 iovec，滑动发送了一部分的那个，继续发送剩余数据
+    m_bytes_have_send += tmp;
+    sent += tmp;
+    if (m_bytes_have_send < m_response_bytes) {
+      while ((size_t)tmp >= m_iov->iov_len) {
+        tmp -= m_iov->iov_len;
+        m_iov++;
+        m_iv_count--;
+      }
+      m_iov->iov_base = (char*)m_iov->iov_base + tmp;
+      m_iov->iov_len -= tmp;
+      // 本轮发够了，把 CPU 让给其他连接，下一轮由就绪列表继续发送
+      if (m_write_budget > 0 && sent >= m_write_budget) {
+        m_resume_ev = EPOLLOUT;
+        metrics::inc(metrics::local()->budget_write);
+        return true;
+      }
+      continue;
+    }
 
-    // 简单处理：假设发送成功
     unmap();
+    metrics::record_response(m_status, m_response_bytes);
+    m_responses++;
+    log_access();
     if (m_linger) {
-      // 如果是长连接，重置状态，继续监听读
-      init();
-      modfd(m_epollfd, m_sockfd, EPOLLIN);
-      return true;
+      // 如果是长连接，重置状态后继续处理已读入的流水线请求
+      return keep_alive();
     } else {
       // 短连接，发完就关
       modfd(m_epollfd, m_sockfd, EPOLLIN);
@@ -199,32 +453,55 @@ bool http_conn::write() {
   }
 }
 
+/*
+ * 过载时拒绝已读入的请求
+ * 响应在启动时已经生成好，直接拷贝到写缓冲区后走正常的发送流程，
+ * 发送完毕返回 false，由调用方关闭连接
+ */
+bool http_conn::shed(const char* response, int len) {
+  if (len > m_write_buffer_size) {
+    return false;
+  }
+  attach_buffers();
+  memcpy(m_buf->write_buf, response, len);
+  m_write_idx = len;
+  m_iv[0].iov_base = m_buf->write_buf;
+  m_iv[0].iov_len = m_write_idx;
+  m_iv_count = 1;
+  m_response_bytes = m_write_idx;
+  m_bytes_have_send = 0;
+  m_status = 503;
+  m_linger = false;
+  set_stage(STAGE_WRITE);
+  return write();
+}
+
 // --- 定义网站根目录 ---
 // 指向resource
 const char* doc_root = "./resources";
 
 // --- 从状态机：解析一行 ---
-// 从m_read_buf中找到\r\n,并将其转化为\0\0
+// 从m_buf->read_buf中找到\r\n,并将其转化为\0\0
 http_conn::LINE_STATUS http_conn::parse_line() {
   char temp;
   for (; m_checked_idx < m_read_idx; ++m_checked_idx) {
-    temp = m_read_buf[m_checked_idx];
+    temp = m_buf->read_buf[m_checked_idx];
     if (temp == '\r') {
       // 如果\r是最后一个字符，说明这行还没有收全
       if ((m_checked_idx + 1) == m_read_idx) {
         return LINE_OPEN;
-      } else if (m_read_buf[m_checked_idx + 1] == '\n') {
+      } else if (m_buf->read_buf[m_checked_idx + 1] == '\n') {
         // 如果下一个字符是\n,说明找到了一行的末尾
-        m_read_buf[m_checked_idx++] = '\0';
-        m_read_buf[m_checked_idx++] = '\0';
+        m_buf->read_buf[m_checked_idx++] = '\0';
+        m_buf->read_buf[m_checked_idx++] = '\0';
         return LINE_OK;
       }
       return LINE_BAD;
     } else if (temp == '\n') {
       //  处理上次只读到\r没有读到\n的情况
-      if ((m_checked_idx > 1) && (m_read_buf[m_checked_idx - 1] == '\r')) {
-        m_read_buf[m_checked_idx - 1] = '\0';
-        m_read_buf[m_checked_idx++] = '\0';
+      if ((m_checked_idx > 1) && (m_buf->read_buf[m_checked_idx - 1] == '\r')) {
+        m_buf->read_buf[m_checked_idx - 1] = '\0';
+        m_buf->read_buf[m_checked_idx++] = '\0';
         return LINE_OK;
       }
       return LINE_BAD;
@@ -241,9 +518,26 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
   }
   *m_url++ = '\0';
 
+  // 静态文件只支持 GET，其余方法只能用于 proxy_pass 转发的请求
+  // 与异步处理函数，在 do_request 中按路由检查
   char* method = text;
   if (strcasecmp(method, "GET") == 0) {
     m_method = GET;
+  } else if (!upstream_table::get_instance()->enabled() &&
+             !coro::async_routes::get_instance()->enabled()) {
+    return BAD_REQUEST;
+  } else if (strcasecmp(method, "POST") == 0) {
+    m_method = POST;
+  } else if (strcasecmp(method, "HEAD") == 0) {
+    m_method = HEAD;
+  } else if (strcasecmp(method, "PUT") == 0) {
+    m_method = PUT;
+  } else if (strcasecmp(method, "DELETE") == 0) {
+    m_method = DELETE;
+  } else if (strcasecmp(method, "OPTIONS") == 0) {
+    m_method = OPTIONS;
+  } else if (strcasecmp(method, "PATCH") == 0) {
+    m_method = PATCH;
   } else {
     return BAD_REQUEST;
   }
@@ -271,6 +565,7 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
   if (!m_url || m_url[0] != '/') {
     return BAD_REQUEST;
   }
+  LOG_DEBUG("request: %s %s", method, m_url);
 
   // 状态转移:请求行解析完毕，开始解析头部
   m_check_state = CHECK_STATE_HEADER;
@@ -282,6 +577,19 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
 http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
   // 遇到空行，说明头部解析完毕
   if (text[0] == '\0') {
+    // 转发的请求不必等请求体完整读入缓冲区，其余部分由 proxy 直接转发
+    upstream_table* upstreams = upstream_table::get_instance();
+    if (upstreams->enabled()) {
+      m_proxy_route = upstreams->match(m_url);
+      if (m_proxy_route >= 0) {
+        return GET_REQUEST;
+      }
+    }
+    // 异步处理函数需要完整的请求体，与其他请求一样继续读取
+    coro::async_routes* routes = coro::async_routes::get_instance();
+    if (routes->enabled()) {
+      m_async_route = routes->match(m_url);
+    }
     // 如果是POST请求，还需要继续读取Content-Length长度的内容
     if (m_content_length != 0) {
       m_check_state = CHECK_STATE_CONTENT;
@@ -291,7 +599,7 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
     return GET_REQUEST;
   }
   // 解析Connection头部
-  else if (strncasecmp(text, "Connection:", 11)) {
+  else if (strncasecmp(text, "Connection:", 11) == 0) {
     text += 11;
     text += strspn(text, " \t");
     if (strcasecmp(text, "keep-alive") == 0) {
@@ -299,7 +607,7 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
     }
   }
   // 解析Content-Length头部
-  else if (strncasecmp(text, "Content-Length", 15) == 0) {
+  else if (strncasecmp(text, "Content-Length:", 15) == 0) {
     text += 15;
     text += strspn(text, " \t");
     m_content_length = atol(text);
@@ -309,6 +617,14 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
     text += 5;
     text += strspn(text, " \t");
     m_host = text;
+  }
+  // 资源快照使用的条件请求与压缩协商
+  else if (strncasecmp(text, "Accept-Encoding:", 16) == 0) {
+    m_accept_gzip = strstr(text + 16, "gzip") != nullptr;
+  } else if (strncasecmp(text, "If-None-Match:", 14) == 0) {
+    text += 14;
+    text += strspn(text, " \t");
+    m_if_none_match = text;
   } else {
     //
   }
@@ -316,9 +632,10 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
 }
 
 // 解析HTTP请求体
-http_conn::HTTP_CODE http_conn::parse_content(char* text) {
+// 请求体按 m_content_length 使用，不在末尾写 '\0'：
+// 后面可能紧跟着流水线中的下一个请求，也可能正好到读缓冲区末尾
+http_conn::HTTP_CODE http_conn::parse_content() {
   if (m_read_idx >= (m_content_length + m_checked_idx)) {
-    text[m_content_length] = '\0';
     return GET_REQUEST;
   }
   return NO_REQUEST;
@@ -359,12 +676,13 @@ http_conn::HTTP_CODE http_conn::process_read() {
         break;
       }
       case CHECK_STATE_CONTENT: {
-        ret = parse_content(text);
+        ret = parse_content();
         if (ret == GET_REQUEST) {
           return do_request();
         }
-        line_status = LINE_OPEN;
-        break;
+        // 直接返回：继续循环会用 parse_line 扫描请求体，把 m_checked_idx
+        // 移出请求体的起点，之后分几次到达的请求体永远凑不够长度
+        return NO_REQUEST;
       }
       default: {
         return INTERNAL_ERROR;
@@ -375,62 +693,130 @@ http_conn::HTTP_CODE http_conn::process_read() {
 }
 
 // 处理最终请求
-// 分析目标文件是否存在，如果存在则mmap到内存
+// 记录文件查找阶段的耗时
 http_conn::HTTP_CODE http_conn::do_request() {
+  // 限流在查找文件之前检查
+  rate_limiter* limiter = rate_limiter::get_instance();
+  if (limiter->request_limited() &&
+      !limiter->allow_request(m_address.sin_addr.s_addr, m_url)) {
+    metrics::inc(metrics::local()->ratelimit_req);
+    return TOO_MANY_REQUESTS;
+  }
+  if (m_proxy_route >= 0) {
+    return PROXY_REQUEST;
+  }
+  if (m_async_route >= 0) {
+    return ASYNC_REQUEST;
+  }
+  if (m_method != GET) {
+    return BAD_REQUEST;
+  }
+  uint64_t start_ns = metrics_now_ns();
+  uint64_t trace_begin = TRACE_ON() ? tracer::now() : 0;
+  HTTP_CODE ret = asset_snapshot::get_instance()->enabled() ? lookup_asset()
+                                                            : lookup_file();
+  m_lookup_ns = metrics_now_ns() - start_ns;
+  metrics::record_phase(PHASE_LOOKUP, m_lookup_ns);
+  if (TRACE_ON()) {
+    tracer::record(TRACE_LOOKUP, m_sockfd, trace_begin, tracer::now());
+  }
+  return ret;
+}
+
+// 分析目标文件是否存在，如果存在则mmap到内存
+http_conn::HTTP_CODE http_conn::lookup_file() {
   // 构造绝对路径
-  strcpy(m_real_file, doc_root);
+  strcpy(m_buf->real_file, doc_root);
   int len = strlen(doc_root);
-  strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
+  strncpy(m_buf->real_file + len, m_url, FILENAME_LEN - len - 1);
+  m_buf->real_file[FILENAME_LEN - 1] = '\0';
 
-  // 获取文件状态
-  if (stat(m_real_file, &m_file_stat) < 0) {
+  // 获取文件状态，模板文件不对外提供
+  if (is_template_path(m_buf->real_file) ||
+      stat(m_buf->real_file, &m_buf->file_stat) < 0) {
     return NO_RESOURCE;
   }
 
   // 权限判断(S_IROTH:其他人可读)
-  if (!(m_file_stat.st_mode & S_IROTH)) {
+  if (!(m_buf->file_stat.st_mode & S_IROTH)) {
     return FORBIDEN_REQUEST;
   }
 
   //  判断是否是目录
-  if (S_ISDIR(m_file_stat.st_mode)) {
+  if (S_ISDIR(m_buf->file_stat.st_mode)) {
     return BAD_REQUEST;
   }
 
   // 以只读方式打开文件
-  int fd = open(m_real_file, O_RDONLY);
+  int fd = open(m_buf->real_file, O_RDONLY);
 
   // 创建内存映射
   // 将磁盘文件直接映射到进程内存，避免内核到用户的拷贝
-  m_file_address =
-      (char*)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  m_file_address = (char*)mmap(0, m_buf->file_stat.st_size, PROT_READ,
+                               MAP_PRIVATE, fd, 0);
 
   close(fd);
   return FILE_REQUEST;  // 成功
 }
 
+/*
+ * 在资源快照中查找
+ * 快照是文档根目录的完整副本，不在快照中的路径直接返回 404
+ */
+http_conn::HTTP_CODE http_conn::lookup_asset() {
+  const asset_entry* e = asset_snapshot::get_instance()->find(m_url);
+  if (!e) {
+    metrics::inc(metrics::local()->asset_miss);
+    return NO_RESOURCE;
+  }
+  bool gzip = e->gzip && m_accept_gzip;
+  m_asset = e;
+  m_asset_head = gzip ? ASSET_HEAD_GZIP : ASSET_HEAD_IDENTITY;
+  // 弱比较：原始与 gzip 版本的 ETag 只差一个后缀，都视为匹配
+  if (m_if_none_match &&
+      (strstr(m_if_none_match, e->etag) || strcmp(m_if_none_match, "*") == 0)) {
+    m_asset_head += ASSET_HEAD_NOT_MODIFIED;
+    metrics::inc(metrics::local()->asset_not_modified);
+  } else if (gzip) {
+    metrics::inc(metrics::local()->asset_gzip);
+  } else {
+    metrics::inc(metrics::local()->asset_identity);
+  }
+  return ASSET_REQUEST;
+}
+
 // 响应模块
 //
 // 解除内存映射
 void http_conn::unmap() {
+  // 异步请求的响应体在 async_call 中，处理函数仍在运行时由它在结束时归还
+  if (m_call) {
+    m_call->release();
+    m_call = nullptr;
+    m_file_address = 0;
+    return;
+  }
   if (m_file_address) {
-    munmap(m_file_address, m_file_stat.st_size);
+    // 快照由所有连接共享，不解除映射
+    if (!m_asset) {
+      munmap(m_file_address, m_buf->file_stat.st_size);
+    }
     m_file_address = 0;
   }
 }
 
 // 往写缓冲中写入待发送的数据
 bool http_conn::add_response(const char* format, ...) {
-  if (m_write_idx >= WRITE_BUFFER_SIZE) {
+  if (m_write_idx >= m_write_buffer_size) {
     return false;
   }
   va_list arg_list;
   va_start(arg_list, format);
 
   // vsnprintf 将格式化字符串写入缓冲区
-  int len = vsnprintf(m_write_buffer + m_write_idx,
-                      WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list);
-  if (len >= (WRITE_BUFFER_SIZE - 1 - m_write_idx)) {
+  int len = vsnprintf(m_buf->write_buf + m_write_idx,
+                      m_write_buffer_size - 1 - m_write_idx, format, arg_list);
+  if (len >= (m_write_buffer_size - 1 - m_write_idx)) {
     return false;
   }
   m_write_idx += len;
@@ -444,6 +830,7 @@ bool http_conn::add_content(const char* content) {
 
 // 添加状态行
 bool http_conn::add_status_line(int status, const char* title) {
+  m_status = status;
   return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
 
@@ -504,29 +891,111 @@ bool http_conn::process_write(HTTP_CODE ret) {
       }
       break;
     }
+    case BAD_GATEWAY: {
+      add_status_line(502, error_502_title);
+      add_headers(strlen(error_502_form));
+      if (!add_content(error_502_form)) {
+        return false;
+      }
+      break;
+    }
+    case GATEWAY_TIMEOUT: {
+      add_status_line(504, error_504_title);
+      add_headers(strlen(error_504_form));
+      if (!add_content(error_504_form)) {
+        return false;
+      }
+      break;
+    }
+    case TOO_MANY_REQUESTS: {
+      // 启动时生成好的 429，发送完毕后关闭连接
+      rate_limiter* limiter = rate_limiter::get_instance();
+      if (limiter->response_len() > m_write_buffer_size) {
+        return false;
+      }
+      memcpy(m_buf->write_buf, limiter->response(), limiter->response_len());
+      m_write_idx = limiter->response_len();
+      m_status = 429;
+      m_linger = false;
+      break;
+    }
+    case ASSET_REQUEST: {
+      // 响应头预先生成在快照中，按是否长连接取一份
+      asset_snapshot* assets = asset_snapshot::get_instance();
+      int linger = m_linger ? 1 : 0;
+      int head_len = m_asset->head_len[m_asset_head][linger];
+      if (head_len > m_write_buffer_size) {
+        return false;
+      }
+      memcpy(m_buf->write_buf,
+             assets->data(m_asset->head_off[m_asset_head][linger]), head_len);
+      m_write_idx = head_len;
+      if (m_asset_head >= ASSET_HEAD_NOT_MODIFIED) {
+        m_status = 304;
+        break;
+      }
+      int variant = m_asset_head == ASSET_HEAD_GZIP ? 1 : 0;
+      m_status = 200;
+      m_file_address = (char*)assets->data(m_asset->body_off[variant]);
+      m_iv[0].iov_base = m_buf->write_buf;
+      m_iv[0].iov_len = m_write_idx;
+      m_iv[1].iov_base = m_file_address;
+      m_iv[1].iov_len = m_asset->body_len[variant];
+      m_iv_count = 2;
+      m_response_bytes = m_write_idx + m_asset->body_len[variant];
+      return true;
+    }
+    case ASYNC_REQUEST: {
+      // 响应体留在 async_call 中，直到发送完毕
+      coro::async_request& req = m_call->req;
+      int body_len = req.response.size();
+      if (!req.response_iov.empty()) {
+        body_len = 0;
+        for (size_t i = 0; i < req.response_iov.size(); i++) {
+          body_len += req.response_iov[i].iov_len;
+        }
+      }
+      if (!add_status_line(req.status, status_title(req.status)) ||
+          !add_response("Content-Type: %s\r\n", req.content_type.c_str()) ||
+          !add_response("%s", req.headers.c_str()) ||
+          !add_content_length(body_len) || !add_linger() ||
+          !add_blank_line()) {
+        return false;
+      }
+      if (!req.response_iov.empty()) {
+        // 分段响应体：响应头作为第一段，一次 writev 发出
+        struct iovec head = {m_buf->write_buf, (size_t)m_write_idx};
+        req.response_iov.insert(req.response_iov.begin(), head);
+        m_iov = req.response_iov.data();
+        m_iv_count = req.response_iov.size();
+        m_response_bytes = m_write_idx + body_len;
+        return true;
+      }
+      m_file_address = (char*)req.response.data();
+      m_iv[0].iov_base = m_buf->write_buf;
+      m_iv[0].iov_len = m_write_idx;
+      m_iv[1].iov_base = m_file_address;
+      m_iv[1].iov_len = req.response.size();
+      m_iv_count = 2;
+      m_response_bytes = m_write_idx + req.response.size();
+      return true;
+    }
     case FILE_REQUEST: {
       // 请求成功
       add_status_line(200, ok_200_title);
-      if (m_content_length != 0) {
-        // 如果有请求体长度
-        add_content_length(m_content_length);
-        add_linger();
-        add_blank_line();
-      } else {
-        // 设置响应头
-        add_headers(m_file_stat.st_size);
-      }
+      add_headers(m_buf->file_stat.st_size);
 
       // 配置 writev 的 iovec
-      // iov[0] 指向 m_write_buffer
-      m_iv[0].iov_base = m_write_buffer;
+      // iov[0] 指向 m_buf->write_buf
+      m_iv[0].iov_base = m_buf->write_buf;
       m_iv[0].iov_len = m_write_idx;
 
       // iov[1] 指向 m_file_address
       m_iv[1].iov_base = m_file_address;
-      m_iv[1].iov_len = m_file_stat.st_size;
+      m_iv[1].iov_len = m_buf->file_stat.st_size;
 
       m_iv_count = 2;
+      m_response_bytes = m_write_idx + m_buf->file_stat.st_size;
       return true;
     }
     default:
@@ -534,25 +1003,213 @@ bool http_conn::process_write(HTTP_CODE ret) {
   }
 
   // 对于非 FILE_REQUEST 的情况，只发送 HEADER 部分
-  m_iv[0].iov_base = m_write_buffer;
+  m_iov = m_iv;
+  m_iv[0].iov_base = m_buf->write_buf;
   m_iv[0].iov_len = m_write_idx;
   m_iv_count = 1;
+  m_response_bytes = m_write_idx;
+  return true;
+}
+
+/*
+ * 长连接上一个响应发送完毕
+ * 客户端可能已经把后续请求(流水线)一起发了过来，这部分数据已在读缓冲区中，
+ * ET 模式下不会再触发读事件，需要保留下来直接处理
+ */
+bool http_conn::keep_alive() {
+  int next = m_checked_idx;
+  if (m_check_state == CHECK_STATE_CONTENT) {
+    next += m_content_length;
+  }
+  int remain = m_read_idx > next ? m_read_idx - next : 0;
+
+  init();
+  if (remain == 0) {
+    // 等待下一个请求期间不占用缓冲区
+    release_buffers();
+    set_stage(STAGE_IDLE);
+    if (TRACE_ON()) {
+      m_trace_mark = tracer::now();
+    }
+    modfd(m_epollfd, m_sockfd, EPOLLIN);
+    return true;
+  }
+  memmove(m_buf->read_buf, m_buf->read_buf + next, remain);
+  m_read_idx = remain;
+  if (!begin_request()) {
+    return false;
+  }
+  if (access_log::get_instance()->enabled()) {
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    m_start_us = (unsigned long long)now.tv_sec * 1000000 + now.tv_usec;
+  }
+  return process();
+}
+
+void http_conn::wait_for(int ev) { modfd(m_epollfd, m_sockfd, ev); }
+
+/*
+ * 转发在向客户端发送响应之前失败
+ * 请求体可能还没有读完，响应之后关闭连接
+ */
+void http_conn::proxy_error(HTTP_CODE code) {
+  // 写缓冲区至少 512 字节，放得下错误页
+  m_linger = false;
+  process_write(code);
+  set_stage(STAGE_WRITE);
+  modfd(m_epollfd, m_sockfd, EPOLLOUT);
+}
+
+/*
+ * 交给异步处理函数
+ * 请求体复制到 async_request 中，读缓冲区中的后续请求(流水线)保留到响应发送完毕。
+ * 处理期间只关注客户端关闭，处理函数可能在 start 返回之前就已结束
+ */
+bool http_conn::start_async() {
+  m_call = coro::async_call::alloc(this);
+  coro::async_request& req = m_call->req;
+  req.method = m_method;
+  req.path.assign(m_url);
+  req.body.assign(m_buf->read_buf + m_checked_idx, m_content_length);
+  wait_for(0);
+  m_call->start(m_async_route);
   return true;
 }
-void http_conn::process() {
+
+void http_conn::async_done() {
+  if (m_draining) {
+    m_linger = false;
+  }
+  // 响应头放不下写缓冲区时改为 500，写缓冲区至少 512 字节，放得下错误页
+  if (!process_write(ASYNC_REQUEST)) {
+    m_write_idx = 0;
+    m_linger = false;
+    process_write(INTERNAL_ERROR);
+  }
+  set_stage(STAGE_WRITE);
+  modfd(m_epollfd, m_sockfd, EPOLLOUT);
+}
+
+void http_conn::set_stage(conn_stage stage) {
+  if (m_half_open && stage != STAGE_HEADER && stage != STAGE_BODY) {
+    half_open_table::get_instance()->release(m_address.sin_addr.s_addr);
+    m_half_open = false;
+  }
+  m_stage = stage;
+  m_stage_start = time(nullptr);
+}
+
+bool http_conn::begin_request() {
+  half_open_table* table = half_open_table::get_instance();
+  if (table->enabled()) {
+    if (!table->acquire(m_address.sin_addr.s_addr)) {
+      metrics::inc(metrics::local()->half_open_rejected);
+      return false;
+    }
+    m_half_open = true;
+  }
+  set_stage(STAGE_HEADER);
+  return true;
+}
+
+time_t http_conn::deadline(time_t now) const {
+  switch (m_stage) {
+    case STAGE_HEADER:
+      return m_stage_start + m_timeouts.header;
+    case STAGE_BODY: {
+      // 每收到 body_rate 字节多给一秒，平均速率低于 body_rate 的请求体终会超时
+      time_t end = m_stage_start + m_timeouts.body;
+      if (m_timeouts.body_rate > 0) {
+        end += (m_read_idx - m_checked_idx) / m_timeouts.body_rate;
+      }
+      return end;
+    }
+    case STAGE_WRITE:
+      return m_stage_start + m_timeouts.write;
+    case STAGE_IDLE:
+      return m_stage_start + m_timeouts.keepalive;
+    default:
+      return now + m_timeouts.busy;
+  }
+}
+
+void http_conn::log_access() {
+  if (!access_log::get_instance()->enabled() || m_start_us == 0) {
+    return;
+  }
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  unsigned long long end_us =
+      (unsigned long long)now.tv_sec * 1000000 + now.tv_usec;
+
+  access_record rec;
+  rec.timestamp_us = m_start_us;
+  rec.client_addr = m_address.sin_addr.s_addr;
+  rec.client_port = m_address.sin_port;
+  rec.method = (uint8_t)m_method;
+  rec.flags = 0;
+  rec.path_hash = m_url ? access_path_hash(m_url, strlen(m_url)) : 0;
+  rec.status = (uint16_t)m_status;
+  rec.reserved = 0;
+  rec.bytes = (uint32_t)m_response_bytes;
+  rec.latency_us = end_us > m_start_us ? (uint32_t)(end_us - m_start_us) : 0;
+  access_log::get_instance()->append(rec);
+}
+bool http_conn::process() {
   // 1. 解析 HTTP 请求
+  m_lookup_ns = 0;
+  uint64_t start_ns = metrics_now_ns();
+  uint64_t trace_begin = TRACE_ON() ? tracer::now() : 0;
   HTTP_CODE read_ret = process_read();
+  if (TRACE_ON()) {
+    uint64_t trace_end = tracer::now();
+    tracer::record(TRACE_PARSE, m_sockfd, trace_begin, trace_end);
+    trace_begin = trace_end;
+    // 请求不完整，继续等待数据
+    m_trace_mark = read_ret == NO_REQUEST ? trace_end : 0;
+  }
   if (read_ret == NO_REQUEST) {
+    // 请求头已收完，开始等待请求体
+    if (m_check_state == CHECK_STATE_CONTENT && m_stage == STAGE_HEADER) {
+      set_stage(STAGE_BODY);
+    }
+    // socket 中还有数据：不重置 EPOLLONESHOT，下一轮直接继续读
+    if (m_read_more) {
+      m_read_more = false;
+      m_resume_ev = EPOLLIN;
+      return true;
+    }
     modfd(m_epollfd, m_sockfd, EPOLLIN);
-    return;
+    return true;
+  }
+  // 解析耗时不含 do_request 中的文件查找
+  metrics::record_phase(PHASE_PARSE,
+                        metrics_now_ns() - start_ns - m_lookup_ns);
+  if (m_draining) {
+    m_linger = false;
+  }
+  if (read_ret == PROXY_REQUEST) {
+    // 转发给上游，响应由 proxy 直接写给客户端
+    set_stage(STAGE_BUSY);
+    return m_proxy->start(this);
+  }
+  if (read_ret == ASYNC_REQUEST) {
+    set_stage(STAGE_BUSY);
+    return start_async();
   }
 
   // 2. 生成响应
   bool write_ret = process_write(read_ret);
+  if (TRACE_ON()) {
+    tracer::record(TRACE_RESPOND, m_sockfd, trace_begin, tracer::now());
+  }
   if (!write_ret) {
-    close_conn();
+    return false;
   }
+  set_stage(STAGE_WRITE);
 
   // 3. 注册写事件，等待内核发送
   modfd(m_epollfd, m_sockfd, EPOLLOUT);
+  return true;
 }
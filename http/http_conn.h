@@ -18,17 +18,33 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "../lock/locker.h"
 
+class proxy;
+struct proxy_exchange;
+struct asset_entry;
+namespace coro {
+struct async_call;
+}
+
+// 文档根目录
+extern const char* doc_root;
+
 class http_conn {
+    // 微基准测试直接驱动解析与响应构造，见 bench/bench_http.cpp
+    friend struct http_conn_bench;
+    // 反向代理直接使用已解析的请求，并在转发结束后接着处理下一个请求
+    friend class proxy;
+
 public:
-    // 设置读取文件的名称 m_real_file 大小
+    // 设置读取文件的名称 real_file 大小
     static const int FILENAME_LEN = 200;
-    // 读缓冲区大小
+    // 读缓冲区默认大小，可通过配置项 read_buffer 修改
     static const int READ_BUFFER_SIZE = 2048;
-    // 写缓冲区大小
+    // 写缓冲区默认大小，可通过配置项 write_buffer 修改
     static const int WRITE_BUFFER_SIZE = 1024;
 
     // HTTP请求方法
@@ -50,6 +66,12 @@ public:
         FORBIDEN_REQUEST,  // 客户对资源没有访问权限
         FILE_REQUEST,      // 请求文件资源
         INTERNAL_ERROR,    // 服务器内部错误
+        TOO_MANY_REQUESTS, // 客户端超过限流规则
+        PROXY_REQUEST,     // 请求匹配 proxy_pass，转发给上游
+        BAD_GATEWAY,       // 上游不可用或响应无效
+        GATEWAY_TIMEOUT,   // 上游超时
+        ASSET_REQUEST,     // 请求命中资源快照
+        ASYNC_REQUEST,     // 请求匹配异步处理函数
         CLOSED_CONNECTION  // 客户端关闭连接
     };
 
@@ -60,25 +82,86 @@ public:
         LINE_OPEN     // 行数据不完整
     };
 
+    // 连接所处的阶段，每个阶段有各自的超时，见 deadline()
+    enum conn_stage {
+        STAGE_HEADER = 0,  // 等待请求头收完，新连接从这里开始
+        STAGE_BODY,        // 等待请求体收完
+        STAGE_BUSY,        // 请求正在转发或由异步处理函数处理
+        STAGE_WRITE,       // 正在发送响应
+        STAGE_IDLE,        // 长连接等待下一个请求
+        STAGE_COUNT
+    };
+
+    // 各阶段的超时(秒)，由配置项设置
+    struct timeouts {
+        int header;     // 从连接建立或请求首字节起，请求头必须在这个时间内收完
+        int body;       // 请求体的宽限时间
+        int body_rate;  // 宽限之外请求体至少达到的速率(字节/秒)，0 表示不按速率延长
+        int keepalive;  // 长连接两个请求之间的最长空闲
+        int write;      // 从开始发送起，响应必须在这个时间内发完
+        int busy;       // 转发或异步处理期间没有活动后关闭
+    };
+
+    // 只在请求处理期间需要的缓冲区与冷数据
+    // 连接空闲时归还到池中，空闲的长连接只占用 http_conn 本身；
+    // 读写缓冲区的大小在启动时确定，与结构体分配在同一块内存中，紧跟在结构体之后
+    struct buffers {
+        char* read_buf;   // 读缓冲区，m_read_buffer_size 字节
+        char* write_buf;  // 写缓冲区，m_write_buffer_size 字节
+        // 客户请求的目标文件的完整路径，其内容等于 doc_root + m_url
+        char real_file[FILENAME_LEN];
+        // 目标文件的状态.可以判断文件是否存在/为目录/可读，获取文件大小
+        struct stat file_stat;
+        buffers* next;  // 池中的空闲链表
+    };
+
 public:
+    // 连接表按 fd 预分配且不做构造初始化，未使用的表项不占物理内存；
+    // m_buf 在 init(sockfd, addr) 中置空，连接关闭的各条路径都会归还缓冲区
     http_conn() {}
     ~http_conn() {}
 
 public:
-    // 初始化新接受的连接
-    void init(int sockfd, const sockaddr_in& addr);
+    // 初始化新接受的连接，half_open 表示 accept 时已计入半开计数
+    void init(int sockfd, const sockaddr_in& addr, bool half_open);
     // 关闭连接
     void close_conn(bool real_close = true);
-    // 处理客户端请求
-    void process();
+    // 处理客户端请求，返回 false 时调用方需关闭连接
+    bool process();
     // 非阻塞读操作
     bool read_once();
     // 非阻塞写操作
     bool write();
+    // 准入控制拒绝本次请求：发送预先生成的响应后关闭连接
+    bool shed(const char* response, int len);
+    // 正在等待新请求，读缓冲区与待发送的响应都为空
+    bool idle() const { return m_read_idx == 0 && m_response_bytes == 0; }
+    // 请求正在转发给上游，连接上的事件交给 proxy 处理
+    bool proxying() const { return m_exchange != nullptr; }
+    conn_stage stage() const { return m_stage; }
+    /*
+     * 本轮用完了读写预算、需要在下一轮继续的事件(EPOLLIN 或 EPOLLOUT)，0 表示没有。
+     * 此时 EPOLLONESHOT 没有重置，epoll 不会再报告它，由事件循环的就绪列表恢复
+     */
+    int resume_events() const { return m_resume_ev; }
+    /*
+     * 按当前阶段计算的关闭时间
+     * 请求头、请求体、长连接空闲与发送响应从进入阶段时开始计时，收到数据不会延长，
+     * 请求体按已收字节数与 body_rate 延长；转发与异步处理按最近一次活动计时
+     */
+    time_t deadline(time_t now) const;
+    // 异步处理函数结束，发送它生成的响应
+    void async_done();
+    // 解除文件映射并把缓冲区归还到池中，连接空闲或被关闭时调用
+    void release_buffers();
+    // 释放本线程池中的空闲缓冲区，事件循环线程退出前调用
+    static void free_buffer_pool();
 
 private:
     // 初始化连接其余信息
     void init();
+    // 开始处理请求前从池中取出缓冲区
+    void attach_buffers();
     // 解析HTTP请求
     HTTP_CODE process_read();
     // 填充HTTP应答
@@ -87,9 +170,11 @@ private:
     // 下面这一组函数被process_read调用以分析HTTP请求
     HTTP_CODE parse_request_line(char* text);
     HTTP_CODE parse_headers(char* text);
-    HTTP_CODE parse_content(char* text);
+    HTTP_CODE parse_content();
     HTTP_CODE do_request();
-    char* get_line() { return m_read_buf + m_start_line; }
+    HTTP_CODE lookup_file();
+    HTTP_CODE lookup_asset();
+    char* get_line() { return m_buf->read_buf + m_start_line; }
     LINE_STATUS parse_line();
 
     // 下面这一组函数被process_write调用以填充HTTP应答
@@ -102,21 +187,52 @@ private:
     bool add_content_length(int content_length);
     bool add_linger();
     bool add_blank_line();
+    // 响应发送完毕后写一条二进制访问日志
+    void log_access();
+    // 长连接响应发送完毕，准备处理下一个请求，返回 false 时调用方需关闭连接
+    bool keep_alive();
+    // 重置 EPOLLONESHOT，关注 ev 与 EPOLLRDHUP
+    void wait_for(int ev);
+    // 转发失败，返回 502/504 后关闭连接
+    void proxy_error(HTTP_CODE code);
+    // 把请求交给匹配的异步处理函数
+    bool start_async();
+    // 进入新的阶段并开始计时，离开请求头与请求体阶段时扣除半开计数
+    void set_stage(conn_stage stage);
+    // 长连接的下一个请求开始，计入半开计数，超过每个 IP 的上限时返回 false
+    bool begin_request();
 
 public:
-    // 所有socket上的事件都被注册到同一个epoll内核事件表中
-    // 所以将epollfd设置为静态的
-    static int m_epollfd;
-    // 统计用户数量
-    static int m_user_count;
+    // 连接只在 accept 它的事件循环线程中处理，一个线程的所有 socket
+    // 注册在同一个 epoll 内核事件表中，所以下面几项按线程保存
+    static __thread int m_epollfd;
+    // 统计本线程的用户数量
+    static __thread int m_user_count;
+    // 正在排空：响应一律带 Connection: close，发送完毕后关闭连接
+    static __thread bool m_draining;
+    // 连接 socket 的触发模式：0 LT，1 ET
+    static __thread int m_conn_trig;
+    // 池中保留的空闲缓冲区上限，超出部分直接释放
+    static __thread int m_buffer_pool_limit;
+    // 一个连接每轮最多读取(ET 模式)与发送的字节数，0 表示不限制
+    static __thread int m_read_budget;
+    static __thread int m_write_budget;
+    // 本线程的反向代理，没有配置 proxy_pass 时不会用到
+    static __thread proxy* m_proxy;
+    // 各阶段的超时
+    static __thread timeouts m_timeouts;
+    // 读写缓冲区大小，只能在事件循环启动之前修改
+    static int m_read_buffer_size;
+    static int m_write_buffer_size;
 
 private:
     // 该HTTP连接的socket和对方的socket地址
     int m_sockfd;
     sockaddr_in m_address;
 
-    // 读缓冲区
-    char m_read_buf[READ_BUFFER_SIZE];
+    // 请求处理期间挂载的缓冲区，空闲时为空
+    buffers* m_buf;
+
     // 标识读缓冲中已经读入的客户数据的最后一个字节的下一个位置
     int m_read_idx;
     // 当前正在分析的字符在读缓冲区中的位置
@@ -124,8 +240,6 @@ private:
     // 当前正在解析的行的起始位置
     int m_start_line;
 
-    // 写缓冲区
-    char m_write_buffer[WRITE_BUFFER_SIZE];
     // 写缓冲区中待发送的字节数
     int m_write_idx;
 
@@ -134,21 +248,52 @@ private:
     // 请求方法
     METHOD m_method;
 
-    // 客户请求的目标文件的完整路径，其内容等于 dco_root + m_url, doc_root是网站根目录
-    char m_real_file[FILENAME_LEN];
     char* m_url;
     char* m_version;
     char* m_host;
     int m_content_length;
     bool m_linger;  // 是否保持连接
+    int m_proxy_route;  // 匹配的 proxy_pass 路由，-1 表示不转发
+    int m_async_route;  // 匹配的异步处理函数，-1 表示没有
+    bool m_accept_gzip;         // 请求带有 Accept-Encoding: gzip
+    char* m_if_none_match;      // If-None-Match 的值，没有时为空
+
+    conn_stage m_stage;
+    time_t m_stage_start;  // 进入当前阶段的时间
+    bool m_half_open;      // 计入了半开计数，见 half_open_table
+    int m_resume_ev;       // 见 resume_events
+    bool m_read_more;      // 上一次 read_once 读到预算上限，socket 中可能还有数据
+
+    // 正在进行的转发，空闲或不转发时为空
+    proxy_exchange* m_exchange;
+    // 正在处理或正在发送响应的异步请求，响应体在其中，发送完毕后归还
+    coro::async_call* m_call;
 
     // 客户请求的目标文件被mmap到内存中的起始位置
     char* m_file_address;
-    // 目标文件的状态.可以判断文件是否存在/为目录/可读，获取文件大小
-    struct stat m_file_stat;
+    // 命中的快照资源，此时 m_file_address 指向快照中的内容，不需要解除映射
+    const asset_entry* m_asset;
+    int m_asset_head;  // 使用的响应头种类，见 asset_head
     // 采用writev来执行写操作，所以定义如下成员
     struct iovec m_iv[2];
+    // 正在发送的 iovec 数组，通常指向 m_iv，分段的异步响应指向 async_request::response_iov
+    struct iovec* m_iov;
     int m_iv_count;
+
+    // 访问日志所需的请求信息
+    unsigned long long m_start_us;  // 读到请求首字节的时间(微秒)
+    int m_status;                   // 响应状态码
+    int m_response_bytes;           // 响应总字节数
+    int m_bytes_have_send;          // 已发送的响应字节数
+    unsigned long long m_lookup_ns; // 本次 process 中文件查找的耗时
+
+    // 流量录制：连接编号与已发送完的响应数，见 capture
+    unsigned long long m_capture_session;
+    unsigned int m_responses;
+
+    // 请求阶段追踪
+    unsigned long long m_trace_mark; // 开始等待 EPOLLIN/EPOLLOUT 的 TSC，0 表示没有在等待
+    bool m_trace_wait_write;         // 正在等待 EPOLLOUT
 };
 
 #endif
@@ -0,0 +1,617 @@
+#include "page_template.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../log/log.h"
+
+// ---- 输入 ----
+
+void template_rows::clear() {
+  columns.clear();
+  cells.clear();
+  lengths.clear();
+}
+
+void template_rows::add_row(const char* const* row, const unsigned long* lens) {
+  for (size_t i = 0; i < columns.size(); i++) {
+    // NULL 按空串输出
+    cells.push_back(row[i] ? row[i] : "");
+    lengths.push_back(row[i] ? (uint32_t)lens[i] : 0);
+  }
+}
+
+void template_data::clear() {
+  m_values_used = 0;
+  m_rowsets_used = 0;
+}
+
+void template_data::set(const char* name, const std::string& value) {
+  set(name, value.data(), value.size());
+}
+
+void template_data::set(const char* name, const char* value, size_t len) {
+  if (m_values_used == m_values.size()) {
+    m_values.push_back(template_data::value());
+  }
+  template_data::value& v = m_values[m_values_used++];
+  v.name.assign(name);
+  v.data.assign(value, len);
+}
+
+template_rows& template_data::rows(const char* name) {
+  if (m_rowsets_used == m_rowsets.size()) {
+    m_rowsets.push_back(rowset());
+  }
+  rowset& r = m_rowsets[m_rowsets_used++];
+  r.name.assign(name);
+  r.rows.clear();
+  return r.rows;
+}
+
+// ---- 编译 ----
+
+static std::string trim(const std::string& s) {
+  size_t b = s.find_first_not_of(" \t\r\n");
+  if (b == std::string::npos) {
+    return std::string();
+  }
+  size_t e = s.find_last_not_of(" \t\r\n");
+  return s.substr(b, e - b + 1);
+}
+
+static int line_of(const std::string& text, size_t pos) {
+  int line = 1;
+  for (size_t i = 0; i < pos; i++) {
+    if (text[i] == '\n') {
+      line++;
+    }
+  }
+  return line;
+}
+
+int page_template::name_slot(const std::string& name, int section) {
+  for (size_t i = 0; i < m_names.size(); i++) {
+    if (m_names[i].section == section && m_names[i].name == name) {
+      return (int)i;
+    }
+  }
+  name_ref ref;
+  ref.name = name;
+  ref.section = section;
+  m_names.push_back(ref);
+  return (int)m_names.size() - 1;
+}
+
+int page_template::section_slot(const std::string& name) {
+  for (size_t i = 0; i < m_sections.size(); i++) {
+    if (m_sections[i] == name) {
+      return (int)i;
+    }
+  }
+  m_sections.push_back(name);
+  return (int)m_sections.size() - 1;
+}
+
+std::shared_ptr<const page_template> page_template::compile(
+    const std::string& text, std::string& error) {
+  std::shared_ptr<page_template> t(new page_template);
+  int open_section = -1;  // 正在编译的区块序号
+  size_t open_op = 0;     // 区块开始指令的位置
+  size_t pos = 0;
+
+  // 追加静态片段，与前一个静态片段相邻时合并(注释两侧)
+  auto add_text = [&t](const std::string& src, size_t b, size_t e) {
+    if (b >= e) {
+      return;
+    }
+    if (!t->m_ops.empty() && t->m_ops.back().code == OP_TEXT) {
+      t->m_ops.back().len += e - b;
+    } else {
+      op o = {OP_TEXT, 0, (uint32_t)t->m_text.size(), (uint32_t)(e - b)};
+      t->m_ops.push_back(o);
+    }
+    t->m_text.append(src, b, e - b);
+  };
+
+  while (pos < text.size()) {
+    size_t b = text.find("{{", pos);
+    if (b == std::string::npos) {
+      add_text(text, pos, text.size());
+      break;
+    }
+    add_text(text, pos, b);
+
+    bool triple = text.compare(b, 3, "{{{") == 0;
+    const char* close = triple ? "}}}" : "}}";
+    size_t start = b + (triple ? 3 : 2);
+    size_t e = text.find(close, start);
+    if (e == std::string::npos) {
+      error = "line " + std::to_string(line_of(text, b)) + ": unclosed tag";
+      return nullptr;
+    }
+    std::string tag = trim(text.substr(start, e - start));
+    pos = e + strlen(close);
+
+    char kind = triple ? '&' : (tag.empty() ? 0 : tag[0]);
+    if (kind == '!') {
+      continue;
+    }
+    if (!triple && (kind == '&' || kind == '#' || kind == '^' || kind == '/')) {
+      tag = trim(tag.substr(1));
+    }
+    if (tag.empty()) {
+      error = "line " + std::to_string(line_of(text, b)) + ": empty tag";
+      return nullptr;
+    }
+
+    op o = {OP_VALUE, 0, 0, 0};
+    switch (kind) {
+      case '#':
+      case '^':
+        if (open_section >= 0) {
+          error = "line " + std::to_string(line_of(text, b)) +
+                  ": nested section " + tag;
+          return nullptr;
+        }
+        open_section = t->section_slot(tag);
+        open_op = t->m_ops.size();
+        o.code = kind == '#' ? OP_SECTION : OP_INVERTED;
+        o.arg = open_section;
+        break;
+      case '/':
+        if (open_section < 0 || t->m_sections[open_section] != tag) {
+          error = "line " + std::to_string(line_of(text, b)) +
+                  ": unexpected close " + tag;
+          return nullptr;
+        }
+        o.code = OP_END;
+        o.arg = open_op;
+        t->m_ops[open_op].len = t->m_ops.size();
+        open_section = -1;
+        break;
+      case '&':
+        o.code = OP_RAW;
+        o.arg = t->name_slot(tag, open_section);
+        break;
+      default:
+        o.arg = t->name_slot(tag, open_section);
+        break;
+    }
+    t->m_ops.push_back(o);
+  }
+  if (open_section >= 0) {
+    error = "unclosed section " + t->m_sections[open_section];
+    return nullptr;
+  }
+  for (size_t i = 0; i < t->m_ops.size(); i++) {
+    op& o = t->m_ops[i];
+    if (o.code == OP_TEXT && o.len < TEMPLATE_INLINE_TEXT) {
+      o.copy = 1;
+    }
+  }
+  return t;
+}
+
+// ---- 渲染 ----
+
+// 名字绑定的值：column >= 0 时取区块当前行的这一列
+struct template_binding {
+  const char* data;
+  size_t len;
+  int column;
+};
+
+struct template_section_binding {
+  const template_rows* rows;
+  size_t count;
+};
+
+// 需要转义的字符，其余字符为 0
+static const struct html_escape_table {
+  char needs[256];
+  html_escape_table() {
+    memset(needs, 0, sizeof(needs));
+    needs[(unsigned char)'&'] = 1;
+    needs[(unsigned char)'<'] = 1;
+    needs[(unsigned char)'>'] = 1;
+    needs[(unsigned char)'"'] = 1;
+    needs[(unsigned char)'\''] = 1;
+  }
+} html_escape;
+
+static const char* html_entity(char c) {
+  switch (c) {
+    case '&': return "&amp;";
+    case '<': return "&lt;";
+    case '>': return "&gt;";
+    case '"': return "&quot;";
+    default: return "&#39;";
+  }
+}
+
+/*
+ * 渲染输出
+ * 直接写入 out 的内存，只在容量不够时扩大一次，比逐段 append 少了每次的长度检查与调用；
+ * 扩大时按两倍增长，复用 out 时只有第一次渲染需要扩大
+ */
+struct template_writer {
+  std::string& out;
+  size_t len;
+
+  explicit template_writer(std::string& s) : out(s), len(s.size()) {}
+
+  char* reserve(size_t n) {
+    if (len + n > out.size()) {
+      size_t size = out.size() * 2;
+      if (size < out.capacity()) {
+        size = out.capacity();
+      }
+      out.resize(size > len + n ? size : len + n);
+    }
+    return &out[len];
+  }
+  void append(const char* p, size_t n) {
+    memcpy(reserve(n), p, n);
+    len += n;
+  }
+  // 最坏情况下每个字符转义为 6 个字节
+  void append_escaped(const char* p, size_t n) {
+    char* dst = reserve(n * 6);
+    char* begin = dst;
+    for (size_t i = 0; i < n; i++) {
+      if (!html_escape.needs[(unsigned char)p[i]]) {
+        *dst++ = p[i];
+        continue;
+      }
+      const char* entity = html_entity(p[i]);
+      size_t k = strlen(entity);
+      memcpy(dst, entity, k);
+      dst += k;
+    }
+    len += dst - begin;
+  }
+  void finish() { out.resize(len); }
+};
+
+size_t page_template::render(const template_data& data, std::string& out,
+                             std::vector<struct iovec>& iov) const {
+  // 绑定表按线程复用，先取得引用，循环中不再经过线程局部变量的访问函数
+  static thread_local std::vector<template_binding> t_names;
+  static thread_local std::vector<template_section_binding> t_sections;
+  std::vector<template_binding>& names = t_names;
+  std::vector<template_section_binding>& sections = t_sections;
+
+  sections.resize(m_sections.size());
+  for (size_t i = 0; i < m_sections.size(); i++) {
+    template_section_binding& s = sections[i];
+    s.rows = nullptr;
+    s.count = 0;
+    for (size_t j = 0; j < data.m_rowsets_used; j++) {
+      if (data.m_rowsets[j].name == m_sections[i]) {
+        s.rows = &data.m_rowsets[j].rows;
+        s.count = s.rows->count();
+        break;
+      }
+    }
+    if (s.rows) {
+      continue;
+    }
+    for (size_t j = 0; j < data.m_values_used; j++) {
+      if (data.m_values[j].name == m_sections[i]) {
+        s.count = data.m_values[j].data.empty() ? 0 : 1;
+        break;
+      }
+    }
+  }
+  names.resize(m_names.size());
+  for (size_t i = 0; i < m_names.size(); i++) {
+    template_binding& b = names[i];
+    b.data = "";
+    b.len = 0;
+    b.column = -1;
+    const name_ref& ref = m_names[i];
+    const template_rows* rows =
+        ref.section >= 0 ? sections[ref.section].rows : nullptr;
+    if (rows) {
+      for (size_t c = 0; c < rows->columns.size(); c++) {
+        if (rows->columns[c] == ref.name) {
+          b.column = (int)c;
+          break;
+        }
+      }
+      if (b.column >= 0) {
+        continue;
+      }
+    }
+    for (size_t j = 0; j < data.m_values_used; j++) {
+      if (data.m_values[j].name == ref.name) {
+        b.data = data.m_values[j].data.data();
+        b.len = data.m_values[j].data.size();
+        break;
+      }
+    }
+  }
+
+  // 复制的内容暂时以 iov_base 为空的项记录长度，全部写完后再指向 out，
+  // 渲染过程中 out 可能重新分配；相邻的复制内容合并到同一项
+  size_t first = iov.size();
+  size_t start = out.size();
+  size_t total = 0;
+  bool copying = false;  // 最后一项是复制的内容
+  const char* text = m_text.data();
+  template_writer w(out);
+
+  // 当前区块的行，cells/lengths 指向当前行的第一列
+  const template_section_binding* section = nullptr;
+  const char* const* cells = nullptr;
+  const uint32_t* lengths = nullptr;
+  size_t width = 0;
+  size_t row = 0;
+
+  for (size_t pc = 0; pc < m_ops.size(); pc++) {
+    const op& o = m_ops[pc];
+    switch (o.code) {
+      case OP_TEXT:
+        if (!o.copy) {
+          struct iovec v = {(void*)(text + o.arg), o.len};
+          iov.push_back(v);
+          copying = false;
+          total += o.len;
+          break;
+        }
+        w.append(text + o.arg, o.len);
+        if (copying) {
+          iov.back().iov_len += o.len;
+        } else {
+          struct iovec v = {nullptr, o.len};
+          iov.push_back(v);
+          copying = true;
+        }
+        total += o.len;
+        break;
+      case OP_VALUE:
+      case OP_RAW: {
+        const template_binding& b = names[o.arg];
+        const char* p = b.data;
+        size_t n = b.len;
+        if (b.column >= 0) {
+          p = cells[b.column];
+          n = lengths[b.column];
+        }
+        if (n == 0) {
+          break;
+        }
+        size_t before = w.len;
+        if (o.code == OP_VALUE) {
+          w.append_escaped(p, n);
+        } else {
+          w.append(p, n);
+        }
+        n = w.len - before;
+        if (copying) {
+          iov.back().iov_len += n;
+        } else {
+          struct iovec v = {nullptr, n};
+          iov.push_back(v);
+          copying = true;
+        }
+        total += n;
+        break;
+      }
+      case OP_SECTION:
+        section = &sections[o.arg];
+        if (section->count == 0) {
+          pc = o.len;
+        } else if (section->rows) {
+          width = section->rows->columns.size();
+          cells = section->rows->cells.data();
+          lengths = section->rows->lengths.data();
+          row = 0;
+        }
+        break;
+      case OP_INVERTED:
+        if (sections[o.arg].count != 0) {
+          pc = o.len;
+        }
+        break;
+      case OP_END:
+        if (m_ops[o.arg].code == OP_SECTION && ++row < section->count) {
+          cells += width;
+          lengths += width;
+          pc = o.arg;
+        }
+        break;
+    }
+  }
+
+  w.finish();
+  size_t off = start;
+  for (size_t i = first; i < iov.size(); i++) {
+    if (iov[i].iov_base == nullptr) {
+      iov[i].iov_base = &out[off];
+      off += iov[i].iov_len;
+    }
+  }
+  return total;
+}
+
+// ---- 模板表 ----
+
+template_cache* template_cache::get_instance() {
+  static template_cache cache;
+  return &cache;
+}
+
+static void collect_templates(const std::string& root,
+                              const std::string& prefix,
+                              std::map<std::string, std::string>& files) {
+  std::string dir = root + prefix;
+  DIR* d = opendir(dir.c_str());
+  if (d == nullptr) {
+    return;
+  }
+  struct dirent* ent;
+  while ((ent = readdir(d)) != nullptr) {
+    if (ent->d_name[0] == '.') {
+      continue;
+    }
+    std::string path = prefix + "/" + ent->d_name;
+    std::string real = root + path;
+    struct stat st;
+    if (stat(real.c_str(), &st) < 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      collect_templates(root, path, files);
+    } else if (S_ISREG(st.st_mode) && is_template_path(path.c_str())) {
+      files[path] = real;
+    }
+  }
+  closedir(d);
+}
+
+page_template_ptr template_cache::compile_file(const std::string& path,
+                                               const source& src) {
+  FILE* fp = fopen(src.file.c_str(), "rb");
+  if (fp == nullptr) {
+    LOG_ERROR("template %s: open failed, errno is:%d", path.c_str(), errno);
+    return nullptr;
+  }
+  std::string text;
+  char buf[8192];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    text.append(buf, n);
+  }
+  fclose(fp);
+
+  std::string error;
+  page_template_ptr t = page_template::compile(text, error);
+  if (!t) {
+    LOG_ERROR("template %s: %s", path.c_str(), error.c_str());
+  }
+  return t;
+}
+
+void template_cache::publish(const table& next) {
+  std::shared_ptr<const table> t(new table(next));
+  m_mutex.lock();
+  m_current = t;
+  m_version.fetch_add(1, std::memory_order_release);
+  m_mutex.unlock();
+}
+
+void template_cache::load(const std::string& root) {
+  m_root = root;
+  while (m_root.size() > 1 && m_root[m_root.size() - 1] == '/') {
+    m_root.erase(m_root.size() - 1);
+  }
+  std::map<std::string, std::string> files;
+  collect_templates(m_root, "", files);
+
+  m_mutex.lock();
+  std::shared_ptr<const table> cur = m_current;
+  m_mutex.unlock();
+
+  table next;
+  std::map<std::string, source> sources;
+  int compiled = 0;
+  for (std::map<std::string, std::string>::iterator it = files.begin();
+       it != files.end(); ++it) {
+    source src;
+    src.file = it->second;
+    struct stat st;
+    if (stat(src.file.c_str(), &st) < 0) {
+      continue;
+    }
+    src.mtime = st.st_mtime;
+    src.size = st.st_size;
+    sources[it->first] = src;
+
+    // 文件没有变化的沿用之前的编译结果，编译失败的也保留之前的
+    page_template_ptr prev;
+    if (cur) {
+      table::const_iterator found = cur->find(it->first);
+      if (found != cur->end()) {
+        prev = found->second;
+      }
+    }
+    std::map<std::string, source>::iterator old = m_sources.find(it->first);
+    page_template_ptr t;
+    if (prev && old != m_sources.end() && old->second.mtime == src.mtime &&
+        old->second.size == src.size) {
+      t = prev;
+    } else {
+      t = compile_file(it->first, src);
+      compiled += t ? 1 : 0;
+    }
+    if (!t) {
+      t = prev;
+    }
+    if (t) {
+      next[it->first] = t;
+    }
+  }
+  m_sources.swap(sources);
+  publish(next);
+  if (!next.empty() || compiled > 0) {
+    LOG_INFO("templates: %d compiled, %d total, from %s", compiled,
+             (int)next.size(), m_root.c_str());
+  }
+}
+
+void template_cache::refresh() {
+  if (m_sources.empty()) {
+    return;
+  }
+  m_mutex.lock();
+  std::shared_ptr<const table> cur = m_current;
+  m_mutex.unlock();
+
+  table next = cur ? *cur : table();
+  bool changed = false;
+  for (std::map<std::string, source>::iterator it = m_sources.begin();
+       it != m_sources.end(); ++it) {
+    source& src = it->second;
+    struct stat st;
+    if (stat(src.file.c_str(), &st) < 0 ||
+        (st.st_mtime == src.mtime && st.st_size == src.size)) {
+      continue;
+    }
+    // 无论成败都记下新的修改时间，编译失败时不再重复报错
+    src.mtime = st.st_mtime;
+    src.size = st.st_size;
+    page_template_ptr t = compile_file(it->first, src);
+    if (t) {
+      next[it->first] = t;
+      changed = true;
+      LOG_INFO("template %s: recompiled, %d ops", it->first.c_str(),
+               (int)t->op_count());
+    }
+  }
+  if (changed) {
+    publish(next);
+  }
+}
+
+page_template_ptr template_cache::find(const std::string& path) {
+  // 各线程保留一份表的引用，表替换之后才加锁重新取得
+  static thread_local std::shared_ptr<const table> t_table;
+  static __thread uint64_t t_version = 0;
+  uint64_t version = m_version.load(std::memory_order_acquire);
+  if (version != t_version) {
+    m_mutex.lock();
+    t_table = m_current;
+    t_version = m_version.load(std::memory_order_relaxed);
+    m_mutex.unlock();
+  }
+  if (!t_table) {
+    return nullptr;
+  }
+  table::const_iterator it = t_table->find(path);
+  return it == t_table->end() ? nullptr : it->second;
+}
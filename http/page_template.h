@@ -0,0 +1,216 @@
+#ifndef PAGE_TEMPLATE_H
+#define PAGE_TEMPLATE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../lock/locker.h"
+
+/*
+ * 预编译页面模板
+ * 文档根目录下的 .tpl 文件在启动时编译成一张扁平的指令表，之后只读，
+ * 渲染时按顺序执行指令，不再解析模板文本。语法是 mustache 的子集：
+ *   {{name}}              输出值，HTML 转义
+ *   {{{name}}} {{&name}}  输出值，不转义
+ *   {{#name}}...{{/name}} name 为行集时每行渲染一次，其中的名字先按列名查找；
+ *                         name 为值时非空渲染一次
+ *   {{^name}}...{{/name}} name 为空行集、空值或不存在时渲染一次
+ *   {{!comment}}          注释
+ * 区块不能嵌套，名字在模板编译时就确定，每次渲染只绑定一次，不会逐行查找。
+ *
+ * 渲染结果是一组 iovec：模板的静态部分直接指向编译结果中的文本，不复制；
+ * 值与较短的静态片段复制到调用方提供的字符串中，相邻的合并成一段，
+ * 避免每个单元格都占用一个 iovec。
+ * 渲染结果引用模板的内存，发送完之前须持有模板的 shared_ptr。
+ */
+
+class page_template;
+
+// 复制而不引用的静态片段长度上限，更短的片段复制比多一个 iovec 更省
+const uint32_t TEMPLATE_INLINE_TEXT = 64;
+
+/**
+ * @struct template_rows
+ * @brief 区块的输入：一个查询结果
+ * 单元格指向结果集中的内存，渲染结束之前结果集不能释放
+ */
+struct template_rows {
+  std::vector<std::string> columns;
+  std::vector<const char*> cells;     ///< 按行存放，每行 columns.size() 个
+  std::vector<uint32_t> lengths;
+
+  size_t count() const {
+    return columns.empty() ? 0 : cells.size() / columns.size();
+  }
+  void clear();
+  void add_row(const char* const* row, const unsigned long* lens);
+};
+
+/**
+ * @class template_data
+ * @brief 一次渲染的输入，按线程复用时先 clear()，容量保留
+ */
+class template_data {
+ public:
+  template_data() : m_values_used(0), m_rowsets_used(0) {}
+
+  void clear();
+  // 值复制到 template_data 中
+  void set(const char* name, const std::string& value);
+  void set(const char* name, const char* value, size_t len);
+  // 取得或新建名为 name 的行集，须先设置 columns 再 add_row
+  template_rows& rows(const char* name);
+
+ private:
+  friend class page_template;
+
+  struct value {
+    std::string name;
+    std::string data;
+  };
+  struct rowset {
+    std::string name;
+    template_rows rows;
+  };
+
+  // 只使用前 used 项，之后的保留容量供下次使用
+  std::vector<value> m_values;
+  size_t m_values_used;
+  std::vector<rowset> m_rowsets;
+  size_t m_rowsets_used;
+};
+
+/**
+ * @class page_template
+ * @brief 编译后的模板，只读，可以在多个线程中同时渲染
+ */
+class page_template {
+ public:
+  /**
+   * @brief 编译模板文本
+   *
+   * @param[out] error 语法错误及其行号
+   * @return nullptr 编译失败
+   */
+  static std::shared_ptr<const page_template> compile(const std::string& text,
+                                                      std::string& error);
+  page_template() {}
+
+  /**
+   * @brief 渲染
+   *
+   * @param[out] out 复制的内容追加在其后
+   * @param[out] iov 追加渲染结果，其中复制的部分指向 out
+   * @return size_t 渲染结果的总字节数
+   */
+  size_t render(const template_data& data, std::string& out,
+                std::vector<struct iovec>& iov) const;
+
+  size_t op_count() const { return m_ops.size(); }
+
+ private:
+  enum op_code {
+    OP_TEXT = 0,   ///< 静态片段，arg 为偏移，len 为长度
+    OP_VALUE,      ///< 转义输出，arg 为名字序号
+    OP_RAW,        ///< 不转义输出
+    OP_SECTION,    ///< 区块开始，arg 为区块序号，len 为对应 OP_END 的位置
+    OP_INVERTED,   ///< 反向区块开始
+    OP_END,        ///< 区块结束，arg 为区块开始的位置
+  };
+
+  struct op {
+    uint8_t code;
+    uint8_t copy;  ///< OP_TEXT：复制到输出
+    uint32_t arg;
+    uint32_t len;
+  };
+
+  // 模板中出现的名字，section 为所在区块的序号，不在区块中为 -1
+  struct name_ref {
+    std::string name;
+    int section;
+  };
+
+  int name_slot(const std::string& name, int section);
+  int section_slot(const std::string& name);
+
+  std::string m_text;  ///< 静态片段，OP_TEXT 指向其中
+  std::vector<op> m_ops;
+  std::vector<name_ref> m_names;
+  std::vector<std::string> m_sections;
+};
+
+typedef std::shared_ptr<const page_template> page_template_ptr;
+
+/**
+ * @brief 以 .tpl 结尾的是模板文件，不作为静态文件对外提供
+ */
+inline bool is_template_path(const char* path) {
+  size_t len = strlen(path);
+  return len >= 4 && strcmp(path + len - 4, ".tpl") == 0;
+}
+
+/**
+ * @class template_cache
+ * @brief 文档根目录下所有模板的编译结果(单例)
+ *
+ * 编译结果整体保存在一张只读的表中，模板变化时生成新表再整体替换；
+ * 各线程保留自己取得的表与其版本号，版本号不变时查找不加锁。
+ * 0 号事件循环在定时器中检查已知模板的修改时间，收到 SIGHUP 时重新扫描目录。
+ */
+class template_cache {
+ public:
+  static template_cache* get_instance();
+
+  /**
+   * @brief 扫描 root 并编译其中所有模板，启动时与 SIGHUP 时调用
+   * 编译失败的模板记录错误日志，保留之前的编译结果
+   */
+  void load(const std::string& root);
+
+  /**
+   * @brief 重新编译文件有变化的模板
+   */
+  void refresh();
+
+  /**
+   * @brief 按 URL 路径查找，例如 "/users.tpl"
+   *
+   * @return nullptr 没有这个模板
+   */
+  page_template_ptr find(const std::string& path);
+
+ private:
+  typedef std::unordered_map<std::string, page_template_ptr> table;
+
+  struct source {
+    std::string file;
+    time_t mtime;
+    off_t size;
+  };
+
+  template_cache() : m_version(0) {}
+
+  page_template_ptr compile_file(const std::string& path, const source& src);
+  void publish(const table& next);
+
+  // 以下两项只由启动过程与 0 号事件循环访问
+  std::string m_root;
+  std::map<std::string, source> m_sources;  ///< URL 路径到模板文件
+
+  locker m_mutex;  ///< 保护 m_current
+  std::shared_ptr<const table> m_current;
+  std::atomic<uint64_t> m_version;
+};
+
+#endif  // !PAGE_TEMPLATE_H
@@ -0,0 +1,191 @@
+#include "rate_limit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../log/log.h"
+#include "../metrics/metrics.h"
+#include "hash.h"
+
+// 分片数，取哈希值的高位选择分片
+static const int SHARD_BITS = 6;
+static const int SHARD_COUNT = 1 << SHARD_BITS;
+// 查找窗口：从哈希位置起连续检查的槽位数，两个缓存行
+static const int PROBE_WINDOW = 8;
+// evict_stale 每次持有分片锁时最多检查的槽位数
+static const uint32_t EVICT_CHUNK = 1024;
+
+static const char limited_body[] = "Too many requests, please retry later.\n";
+
+rate_limiter* rate_limiter::get_instance() {
+  static rate_limiter instance;
+  return &instance;
+}
+
+rate_limiter::rate_limiter()
+    : m_shards(nullptr),
+      m_shard_slots(0),
+      m_seed(0),
+      m_cursor(0),
+      m_response_len(0) {
+  m_conn.interval_us = 0;
+  m_conn.tolerance_us = 0;
+  m_request = m_conn;
+  m_response[0] = '\0';
+}
+
+rate_limiter::~rate_limiter() {
+  if (m_shards == nullptr) {
+    return;
+  }
+  for (int i = 0; i < SHARD_COUNT; i++) {
+    free(m_shards[i].slots);
+  }
+  delete[] m_shards;
+}
+
+rate_limiter::limit rate_limiter::make_limit(const rate_limit_rule& rule) {
+  limit l;
+  l.prefix = rule.prefix;
+  l.interval_us = 0;
+  l.tolerance_us = 0;
+  if (rule.rate > 0) {
+    uint64_t burst = rule.burst > 0 ? rule.burst : rule.rate;
+    l.interval_us = 1000000 / rule.rate;
+    if (l.interval_us == 0) {
+      l.interval_us = 1;
+    }
+    l.tolerance_us = l.interval_us * (burst - 1);
+  }
+  return l;
+}
+
+void rate_limiter::init(const rate_limit_config& config) {
+  m_response_len = snprintf(m_response, sizeof(m_response),
+                            "HTTP/1.1 429 Too Many Requests\r\n"
+                            "Retry-After: %d\r\n"
+                            "Content-Length: %d\r\n"
+                            "Connection: close\r\n"
+                            "\r\n"
+                            "%s",
+                            config.retry_after_s,
+                            (int)sizeof(limited_body) - 1, limited_body);
+  if (!config.enabled() || m_shards != nullptr) {
+    return;
+  }
+  m_conn = make_limit(config.conn);
+  m_request = make_limit(config.request);
+  for (size_t i = 0; i < config.paths.size(); i++) {
+    m_paths.push_back(make_limit(config.paths[i]));
+  }
+
+  m_shard_slots = PROBE_WINDOW;
+  while ((uint64_t)m_shard_slots * SHARD_COUNT < (uint64_t)config.entries) {
+    m_shard_slots <<= 1;
+  }
+  // calloc 的大块内存来自 mmap，只有写入过的页占用物理内存
+  m_shards = new shard[SHARD_COUNT];
+  for (int i = 0; i < SHARD_COUNT; i++) {
+    m_shards[i].slots = (entry*)calloc(m_shard_slots, sizeof(entry));
+  }
+  m_seed = fmix64(metrics_now_ns() ^ ((uint64_t)getpid() << 32));
+
+  LOG_INFO("rate limit enabled, conn %d/s, request %d/s, %d path rules, "
+           "%llu entries",
+           config.conn.rate, config.request.rate, (int)config.paths.size(),
+           (unsigned long long)m_shard_slots * SHARD_COUNT);
+}
+
+bool rate_limiter::check(uint32_t addr, int rule, const limit& l,
+                         uint64_t now_us) {
+  uint64_t key = ((uint64_t)addr << 16) | (uint64_t)(rule + 1);
+  uint64_t h = fmix64(key ^ m_seed);
+  shard& s = m_shards[h >> (64 - SHARD_BITS)];
+  uint32_t mask = m_shard_slots - 1;
+  uint32_t base = (uint32_t)h & mask;
+
+  s.lock.lock();
+  entry* victim = nullptr;
+  for (int i = 0; i < PROBE_WINDOW; i++) {
+    entry* e = &s.slots[(base + i) & mask];
+    if (e->key == key) {
+      uint64_t tat = e->tat > now_us ? e->tat : now_us;
+      bool allow = tat - now_us <= l.tolerance_us;
+      if (allow) {
+        e->tat = tat + l.interval_us;
+      }
+      s.lock.unlock();
+      return allow;
+    }
+    // 优先使用空位，否则替换 tat 最早的一项
+    if (e->key == 0) {
+      if (victim == nullptr || victim->key != 0) {
+        victim = e;
+      }
+    } else if (victim == nullptr ||
+               (victim->key != 0 && e->tat < victim->tat)) {
+      victim = e;
+    }
+  }
+  // 被替换的项还没有过期，说明表太小，该客户端的限流状态被重置
+  bool evicted = victim->key != 0 && victim->tat > now_us;
+  victim->key = key;
+  victim->tat = now_us + l.interval_us;
+  s.lock.unlock();
+  if (evicted) {
+    metrics::inc(metrics::local()->ratelimit_evicted);
+  }
+  return true;
+}
+
+bool rate_limiter::allow_connection(uint32_t addr) {
+  return check(addr, 0, m_conn, metrics_now_ns() / 1000);
+}
+
+bool rate_limiter::allow_request(uint32_t addr, const char* url) {
+  uint64_t now_us = metrics_now_ns() / 1000;
+  if (m_request.interval_us != 0 && !check(addr, 1, m_request, now_us)) {
+    return false;
+  }
+  for (size_t i = 0; i < m_paths.size(); i++) {
+    const std::string& prefix = m_paths[i].prefix;
+    if (strncmp(url, prefix.c_str(), prefix.size()) == 0) {
+      return check(addr, 2 + (int)i, m_paths[i], now_us);
+    }
+  }
+  return true;
+}
+
+int rate_limiter::evict_stale(int max_slots) {
+  if (m_shards == nullptr) {
+    return 0;
+  }
+  uint64_t total = (uint64_t)m_shard_slots * SHARD_COUNT;
+  uint64_t now_us = metrics_now_ns() / 1000;
+  int evicted = 0;
+  while (max_slots > 0) {
+    shard& s = m_shards[m_cursor / m_shard_slots];
+    uint32_t begin = (uint32_t)(m_cursor % m_shard_slots);
+    uint32_t n = m_shard_slots - begin;
+    if (n > EVICT_CHUNK) {
+      n = EVICT_CHUNK;
+    }
+    if (n > (uint32_t)max_slots) {
+      n = (uint32_t)max_slots;
+    }
+    s.lock.lock();
+    for (uint32_t i = begin; i < begin + n; i++) {
+      // tat 已经过去的桶是满的，与没有这一项等价
+      if (s.slots[i].key != 0 && s.slots[i].tat <= now_us) {
+        s.slots[i].key = 0;
+        evicted++;
+      }
+    }
+    s.lock.unlock();
+    m_cursor = (m_cursor + n) % total;
+    max_slots -= (int)n;
+  }
+  return evicted;
+}
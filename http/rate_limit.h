@@ -0,0 +1,140 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "../lock/locker.h"
+
+/*
+ * 按客户端 IP 限流
+ * 每个 (IP, 规则) 对应一个令牌桶，以 GCRA 的形式保存：只记录理论到达时间 tat，
+ * 每次放行把 tat 推后一个发放间隔，tat 领先当前时间超过 (burst - 1) 个间隔时拒绝，
+ * 与按速率补充令牌、容量为 burst 的令牌桶等价，每项只需 16 字节。
+ *
+ * 规则分三类，分别在不同位置检查：
+ *   1. 新连接：accept 之后、分配连接表项之前，超限的连接直接返回 429 并关闭
+ *   2. 请求：请求解析完成、查找文件之前
+ *   3. 路径前缀：同样在请求解析完成后检查，按配置顺序取第一个匹配的前缀
+ * 拒绝时发送启动时生成好的 429 响应并关闭连接。
+ *
+ * 表由所有事件循环共享(同一客户端的连接会被 SO_REUSEPORT 分到不同线程)，
+ * 分为多个分片，每个分片一把锁、一块开放寻址数组。查找只检查哈希位置起的一个
+ * 固定窗口，窗口满时替换其中 tat 最早的一项：tat 已经过去的项与不存在等价，
+ * 替换它不影响限流结果。因此无论有多少不同的 IP，查找的代价都是常数，
+ * 内存也固定为 entries * 16 字节(按需分页)。定时器每次到期时增量扫描一部分表，
+ * 清除已经过期的项，让窗口中尽量留有空位。
+ */
+
+/**
+ * @struct rate_limit_rule
+ * @brief 一条限流规则，rate 为每秒放行数，burst 为允许的突发数
+ */
+struct rate_limit_rule {
+  std::string prefix;  ///< 路径前缀，只用于路径规则
+  int rate;            ///< 每秒放行数，0 表示不限
+  int burst;           ///< 突发数，0 表示与 rate 相同
+
+  rate_limit_rule() : rate(0), burst(0) {}
+};
+
+/**
+ * @struct rate_limit_config
+ * @brief 限流参数
+ */
+struct rate_limit_config {
+  rate_limit_rule conn;                 ///< 每个 IP 的新连接
+  rate_limit_rule request;              ///< 每个 IP 的请求
+  std::vector<rate_limit_rule> paths;   ///< 每个 IP 在各路径前缀下的请求
+  int entries;        ///< 表的容量，向上取整为 2 的幂
+  int retry_after_s;  ///< 429 响应中的 Retry-After
+
+  rate_limit_config() : entries(1 << 20), retry_after_s(1) {}
+  bool enabled() const {
+    return conn.rate > 0 || request.rate > 0 || !paths.empty();
+  }
+};
+
+/**
+ * @class rate_limiter
+ * @brief 全局限流表(单例)，各事件循环线程共享
+ */
+class rate_limiter {
+ public:
+  static rate_limiter* get_instance();
+
+  /**
+   * @brief 按配置分配表，只在事件循环启动前调用一次
+   */
+  void init(const rate_limit_config& config);
+
+  bool conn_limited() const { return m_conn.interval_us != 0; }
+  bool request_limited() const {
+    return m_request.interval_us != 0 || !m_paths.empty();
+  }
+
+  /**
+   * @brief 新连接是否放行
+   *
+   * @param addr 客户端 IPv4 地址(网络字节序)
+   */
+  bool allow_connection(uint32_t addr);
+
+  /**
+   * @brief 请求是否放行，请求规则与第一个匹配的路径规则都要放行
+   *
+   * @param addr 客户端 IPv4 地址(网络字节序)
+   * @param url 请求路径
+   */
+  bool allow_request(uint32_t addr, const char* url);
+
+  /**
+   * @brief 从上次停下的位置继续扫描，清除已过期的项
+   *
+   * @param max_slots 本次最多检查的槽位数
+   * @return int 清除的项数
+   */
+  int evict_stale(int max_slots);
+
+  // 预先生成的 429 响应
+  const char* response() const { return m_response; }
+  int response_len() const { return m_response_len; }
+
+ private:
+  rate_limiter();
+  ~rate_limiter();
+
+  // 一条规则换算后的参数，interval_us 为 0 表示不限
+  struct limit {
+    std::string prefix;
+    uint64_t interval_us;   ///< 两次放行之间的间隔
+    uint64_t tolerance_us;  ///< tat 允许领先当前时间的最大值
+  };
+  struct entry {
+    uint64_t key;  ///< (IP << 16) | (规则编号 + 1)，0 表示空位
+    uint64_t tat;  ///< 理论到达时间(微秒)
+  };
+  struct shard {
+    locker lock;
+    entry* slots;
+  };
+
+  static limit make_limit(const rate_limit_rule& rule);
+  bool check(uint32_t addr, int rule, const limit& l, uint64_t now_us);
+
+  limit m_conn;
+  limit m_request;
+  std::vector<limit> m_paths;
+
+  shard* m_shards;
+  uint32_t m_shard_slots;  ///< 每个分片的槽位数，2 的幂
+  uint64_t m_seed;         ///< 哈希种子，避免客户端构造冲突
+  uint64_t m_cursor;       ///< evict_stale 的扫描位置，只由 0 号事件循环访问
+
+  char m_response[256];
+  int m_response_len;
+};
+
+#endif  // !RATE_LIMIT_H
@@ -5,6 +5,7 @@
 #include <exception>
 #include <pthread.h>
 #include <semaphore.h>
+#include <time.h>
 
 // 信号量封装
 class sem {
@@ -26,6 +27,10 @@ public:
     ~sem() { sem_destroy(&m_sem); }
     // 等待信号量
     bool wait() { return sem_wait(&m_sem) == 0; }
+    // 不阻塞地等待信号量，计数为 0 时返回 false
+    bool trywait() { return sem_trywait(&m_sem) == 0; }
+    // 等待信号量直到绝对时间 t (CLOCK_REALTIME)，超时返回 false
+    bool timewait(struct timespec t) { return sem_timedwait(&m_sem, &t) == 0; }
     // 增加信号量
     bool post() { return sem_post(&m_sem) == 0; }
 
@@ -74,10 +79,11 @@ public:
         return ret == 0;
     }
 
-    bool timewait(pthread_mutex_t* m_mutex)
+    // 等待条件变量直到绝对时间 t (CLOCK_REALTIME)，超时返回 false
+    bool timewait(pthread_mutex_t* m_mutex, struct timespec t)
     {
         int ret = 0;
-        ret = pthread_cond_wait(&m_cond, m_mutex);
+        ret = pthread_cond_timedwait(&m_cond, m_mutex, &t);
         return ret == 0;
     }
     // 唤醒一个等待线程
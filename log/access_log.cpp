@@ -0,0 +1,62 @@
+#include "access_log.h"
+
+#include <string.h>
+
+static void init_header(char* base, const segment_writer::segment& seg,
+                        size_t segment_bytes) {
+  access_segment_header* hdr = (access_segment_header*)base;
+  memcpy(hdr->magic, ACCESS_LOG_MAGIC, sizeof(hdr->magic));
+  hdr->version = ACCESS_LOG_VERSION;
+  hdr->record_size = sizeof(access_record);
+  hdr->created_us = seg.created_us;
+  hdr->capacity = (segment_bytes - sizeof(access_segment_header)) /
+                  sizeof(access_record);
+  hdr->count = 0;
+}
+
+// 正常关闭时写入记录数，解码时不必按 timestamp 扫描
+static void finish_header(char* base, size_t used) {
+  ((access_segment_header*)base)->count =
+      (used - sizeof(access_segment_header)) / sizeof(access_record);
+}
+
+access_log::access_log() : m_enabled(false) {}
+
+access_log::~access_log() { close(); }
+
+access_log* access_log::get_instance() {
+  static access_log instance;
+  return &instance;
+}
+
+bool access_log::init(const std::string& dir, size_t segment_bytes) {
+  if (dir.empty() || m_enabled) {
+    return true;
+  }
+  if (segment_bytes < sizeof(access_segment_header) + sizeof(access_record)) {
+    segment_bytes = 64 << 20;
+  }
+  m_writer.init(dir, "access", segment_bytes, sizeof(access_segment_header), 0,
+                init_header, finish_header);
+  m_enabled = true;
+  return true;
+}
+
+void access_log::append(const access_record& rec) {
+  segment_writer::segment* seg = m_writer.local();
+  // 分段打开失败时(已记录错误日志)本线程不再写访问日志
+  char* slot = m_writer.reserve(seg, sizeof(access_record));
+  if (slot == nullptr) {
+    return;
+  }
+  *(access_record*)slot = rec;
+  seg->used += sizeof(access_record);
+}
+
+void access_log::close() {
+  if (!m_enabled) {
+    return;
+  }
+  m_enabled = false;
+  m_writer.close();
+}
@@ -0,0 +1,103 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "segment_writer.h"
+
+/*
+ * 二进制访问日志
+ * 每个请求记录为一条定长记录，直接写入 mmap 映射的分段文件，热路径上没有任何格式化。
+ * 文本化、CSV 导出以及分位数统计由离线工具 logdecode 完成。
+ */
+
+// 分段文件魔数与版本
+#define ACCESS_LOG_MAGIC "MWSACC01"
+#define ACCESS_LOG_VERSION 1
+
+/**
+ * @struct access_record
+ * @brief 单个请求的定长访问记录(32 字节)
+ * timestamp_us 为 0 表示该槽位尚未写入
+ */
+struct access_record {
+  uint64_t timestamp_us;  ///< 请求开始时间(UNIX 微秒)
+  uint32_t client_addr;   ///< 客户端 IPv4 地址(网络字节序)
+  uint16_t client_port;   ///< 客户端端口(网络字节序)
+  uint8_t method;         ///< http_conn::METHOD
+  uint8_t flags;          ///< 保留
+  uint32_t path_hash;     ///< URL 路径的 FNV-1a 哈希，见 access_path_hash
+  uint16_t status;        ///< 响应状态码
+  uint16_t reserved;
+  uint32_t bytes;         ///< 响应字节数
+  uint32_t latency_us;    ///< 从读到首字节到响应发送完毕的耗时
+};
+
+/**
+ * @struct access_segment_header
+ * @brief 分段文件头，记录紧随其后
+ */
+struct access_segment_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t created_us;  ///< 分段创建时间
+  uint64_t capacity;    ///< 分段可容纳的记录数
+  uint64_t count;       ///< 正常关闭时写入的记录数，崩溃时为 0，需按 timestamp 扫描
+  char reserved[24];
+};
+
+/**
+ * @brief URL 路径的 32 位 FNV-1a 哈希
+ * logdecode 遍历网站根目录用同样的函数把哈希还原为路径
+ */
+inline uint32_t access_path_hash(const char* path, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)path[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/**
+ * @class access_log
+ * @brief 二进制访问日志写入器
+ *
+ * 记录写入 segment_writer 管理的按线程分段文件，追加记录只是一次定长拷贝。
+ */
+class access_log {
+ public:
+  static access_log* get_instance();
+
+  /**
+   * @brief 初始化访问日志
+   *
+   * @param dir 分段文件所在目录，为空时关闭访问日志
+   * @param segment_bytes 单个分段文件的大小
+   * @return bool 是否初始化成功
+   */
+  bool init(const std::string& dir, size_t segment_bytes = 64 << 20);
+  /**
+   * @brief 追加一条记录到当前线程的分段
+   */
+  void append(const access_record& rec);
+  /**
+   * @brief 停止记录，各线程的分段写入记录数后关闭
+   */
+  void close();
+
+  bool enabled() const { return m_enabled; }
+
+ private:
+  access_log();
+  ~access_log();
+
+  bool m_enabled;
+  segment_writer m_writer;
+};
+
+#endif  // !ACCESS_LOG_H
@@ -0,0 +1,99 @@
+#include "capture.h"
+
+#include <string.h>
+
+#include "../metrics/metrics.h"
+#include "log.h"
+
+// 本线程分配的连接编号，高 16 位为线程序号
+static __thread uint64_t t_next_session = 0;
+
+static void init_header(char* base, const segment_writer::segment& seg,
+                        size_t) {
+  capture_segment_header* hdr = (capture_segment_header*)base;
+  memcpy(hdr->magic, CAPTURE_MAGIC, sizeof(hdr->magic));
+  hdr->version = CAPTURE_VERSION;
+  hdr->thread_index = seg.thread_index;
+  hdr->created_us = seg.created_us;
+  hdr->bytes = 0;
+}
+
+// 正常关闭时写入总长度，replay 不必按 time_ns 扫描
+static void finish_header(char* base, size_t used) {
+  ((capture_segment_header*)base)->bytes = used;
+}
+
+capture::capture() : m_enabled(false) {}
+
+capture::~capture() { close(); }
+
+capture* capture::get_instance() {
+  static capture instance;
+  return &instance;
+}
+
+bool capture::init(const std::string& dir, uint64_t limit_bytes,
+                   size_t segment_bytes) {
+  if (dir.empty() || m_enabled) {
+    return true;
+  }
+  if (segment_bytes > limit_bytes) {
+    segment_bytes = limit_bytes;
+  }
+  if (segment_bytes < sizeof(capture_segment_header) + 4096) {
+    segment_bytes = sizeof(capture_segment_header) + 4096;
+  }
+  m_writer.init(dir, "capture", segment_bytes, sizeof(capture_segment_header),
+                limit_bytes, init_header, finish_header);
+  m_enabled = true;
+  LOG_INFO("capture: recording requests to %s, limit %llu MB", dir.c_str(),
+           (unsigned long long)(limit_bytes >> 20));
+  return true;
+}
+
+void capture::write_record(segment_writer::segment* seg, uint64_t session,
+                           uint32_t responses, uint16_t kind, const char* data,
+                           uint32_t len) {
+  size_t size = capture_record_size(len);
+  capture_record* rec = (capture_record*)m_writer.reserve(seg, size);
+  if (rec == nullptr) {
+    return;
+  }
+  rec->session = session;
+  rec->responses = responses;
+  rec->kind = kind;
+  rec->reserved = 0;
+  rec->len = len;
+  rec->reserved2 = 0;
+  if (len > 0) {
+    memcpy(rec + 1, data, len);
+  }
+  rec->time_ns = metrics_now_ns();
+  seg->used += size;
+}
+
+uint64_t capture::open_session() {
+  segment_writer::segment* seg = m_writer.local();
+  uint64_t session = ((uint64_t)seg->thread_index << 48) | ++t_next_session;
+  write_record(seg, session, 0, CAPTURE_OPEN, nullptr, 0);
+  return session;
+}
+
+void capture::append(uint64_t session, uint32_t responses, const char* data,
+                     uint32_t len) {
+  write_record(m_writer.local(), session, responses, CAPTURE_DATA, data, len);
+}
+
+void capture::mark_spliced(uint64_t session, uint32_t responses,
+                           uint64_t bytes) {
+  write_record(m_writer.local(), session, responses, CAPTURE_SPLICED,
+               (const char*)&bytes, sizeof(bytes));
+}
+
+void capture::close() {
+  if (!m_enabled) {
+    return;
+  }
+  m_enabled = false;
+  m_writer.close();
+}
@@ -0,0 +1,118 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "segment_writer.h"
+
+/*
+ * 流量录制
+ * 把 read_once 读到的原始请求字节连同到达时间写入 mmap 映射的分段文件，
+ * 离线工具 replay 按原来的连接与流水线结构把它们重新发给服务器。
+ * 与二进制访问日志一样由 segment_writer 按线程写分段，追加一条记录只是一次 memcpy；
+ * 所有线程写入的总量达到上限后不再录制。
+ *
+ * 由 proxy 直接从客户端 socket 转发的请求体不经过 read_once，不在录制中；
+ * 这时写一条 CAPTURE_SPLICED 记录，replay 跳过这样的连接，
+ * 否则回放的请求缺少请求体，服务器会一直等待。
+ */
+
+// 分段文件魔数与版本
+#define CAPTURE_MAGIC "MWSCAP01"
+#define CAPTURE_VERSION 1
+
+enum capture_kind {
+  CAPTURE_OPEN = 1,     ///< 连接建立，没有数据
+  CAPTURE_DATA = 2,     ///< 一次 read_once 读到的数据
+  CAPTURE_SPLICED = 3,  ///< 之后的请求体由 proxy 直接转发，数据为 8 字节的字节数
+};
+
+/**
+ * @struct capture_record
+ * @brief 记录头(32 字节)，数据紧随其后，按 8 字节对齐
+ * time_ns 为 0 表示之后没有记录
+ */
+struct capture_record {
+  uint64_t time_ns;    ///< 到达时间(CLOCK_MONOTONIC 纳秒)，各线程的分段可以直接合并
+  uint64_t session;    ///< 连接编号，高 16 位为线程序号
+  uint32_t responses;  ///< 读到这些数据之前，这个连接已经发送完的响应数
+  uint16_t kind;       ///< capture_kind
+  uint16_t reserved;
+  uint32_t len;        ///< 数据长度
+  uint32_t reserved2;
+};
+
+/**
+ * @struct capture_segment_header
+ * @brief 录制分段的文件头(64 字节)，之后是一条接一条的 capture_record
+ */
+struct capture_segment_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t thread_index;
+  uint64_t created_us;  ///< 分段创建时间(UNIX 微秒)
+  uint64_t bytes;       ///< 正常关闭时记录的总长度，崩溃时为 0，需按 time_ns 扫描
+  char reserved[32];
+};
+
+inline size_t capture_record_size(uint32_t len) {
+  return sizeof(capture_record) + ((len + 7) & ~(size_t)7);
+}
+
+/**
+ * @class capture
+ * @brief 流量录制写入器(单例)
+ */
+class capture {
+ public:
+  static capture* get_instance();
+
+  /**
+   * @brief 开始录制
+   *
+   * @param dir 分段文件所在目录，为空时不录制
+   * @param limit_bytes 所有线程的分段总大小上限
+   * @param segment_bytes 单个分段文件的大小
+   */
+  bool init(const std::string& dir, uint64_t limit_bytes,
+            size_t segment_bytes = 64 << 20);
+
+  /**
+   * @brief 新连接，返回连接编号并写入 CAPTURE_OPEN 记录
+   */
+  uint64_t open_session();
+
+  /**
+   * @brief 写入一条 CAPTURE_DATA 记录
+   */
+  void append(uint64_t session, uint32_t responses, const char* data,
+              uint32_t len);
+
+  /**
+   * @brief 写入一条 CAPTURE_SPLICED 记录，bytes 为不会被录制的请求体字节数
+   */
+  void mark_spliced(uint64_t session, uint32_t responses, uint64_t bytes);
+
+  /**
+   * @brief 停止录制，已写入的分段写好总长度后保留在目录中
+   */
+  void close();
+
+  bool enabled() const { return m_enabled; }
+
+ private:
+  capture();
+  ~capture();
+
+  void write_record(segment_writer::segment* seg, uint64_t session,
+                    uint32_t responses, uint16_t kind, const char* data,
+                    uint32_t len);
+
+  bool m_enabled;
+  segment_writer m_writer;
+};
+
+#endif  // !CAPTURE_H
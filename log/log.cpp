@@ -0,0 +1,299 @@
+#include "log.h"
+
+#include <stdarg.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+// 日志级别前缀，与 LOG_LEVEL_* 一一对应
+static const char* level_tag[] = {"[debug]: ", "[info]:  ", "[warn]:  ",
+                                  "[erro]:  "};
+
+// 单次 fwrite 的批量上限，超过后先写出再继续收集
+static const size_t MAX_BATCH_BYTES = 1 << 20;
+
+Log::log_ring::log_ring(unsigned int size)
+    : head(0), tail(0), mask(size - 1), cached_sec(0) {
+  slots = new char[(size_t)size * LOG_LINE_SIZE];
+  cached_prefix[0] = '\0';
+}
+
+Log::log_ring::~log_ring() { delete[] slots; }
+
+Log::Log()
+    : m_enabled(false),
+      m_stop(false),
+      m_ring_size(0),
+      m_split_bytes(0),
+      m_flush_interval_ms(0),
+      m_fp(nullptr),
+      m_today(0),
+      m_split_index(0),
+      m_file_bytes(0),
+      m_thread(0),
+      m_dropped(0),
+      m_reported_dropped(0),
+      m_written(0) {}
+
+Log::~Log() {
+  stop();
+  for (size_t i = 0; i < m_rings.size(); i++) {
+    m_rings[i]->~log_ring();
+    free(m_rings[i]);
+  }
+}
+
+Log* Log::get_instance() {
+  static Log instance;
+  return &instance;
+}
+
+bool Log::init(const char* file_name, int close_log, int ring_size,
+               long long split_bytes, int flush_interval_ms) {
+  if (close_log || m_enabled) {
+    return true;
+  }
+
+  // 槽位数向上取整为 2 的幂，下标用掩码计算
+  unsigned int size = 2;
+  while (size < (unsigned int)ring_size) {
+    size <<= 1;
+  }
+  m_ring_size = size;
+  m_split_bytes = split_bytes;
+  m_flush_interval_ms = flush_interval_ms > 0 ? flush_interval_ms : 100;
+
+  const char* p = strrchr(file_name, '/');
+  if (p == nullptr) {
+    m_dir_name.clear();
+    m_log_name = file_name;
+  } else {
+    m_dir_name.assign(file_name, p - file_name + 1);
+    m_log_name = p + 1;
+  }
+
+  time_t t = time(nullptr);
+  struct tm now;
+  localtime_r(&t, &now);
+  m_batch.reserve(MAX_BATCH_BYTES + LOG_LINE_SIZE);
+  if (!open_file(now)) {
+    return false;
+  }
+
+  m_stop = false;
+  if (pthread_create(&m_thread, nullptr, flush_worker, this) != 0) {
+    fclose(m_fp);
+    m_fp = nullptr;
+    return false;
+  }
+  m_enabled.store(true, std::memory_order_release);
+  return true;
+}
+
+bool Log::open_file(const struct tm& now) {
+  char full_name[512];
+  if (m_split_index == 0) {
+    snprintf(full_name, sizeof(full_name), "%s%d_%02d_%02d_%s",
+             m_dir_name.c_str(), now.tm_year + 1900, now.tm_mon + 1,
+             now.tm_mday, m_log_name.c_str());
+  } else {
+    snprintf(full_name, sizeof(full_name), "%s%d_%02d_%02d_%s.%d",
+             m_dir_name.c_str(), now.tm_year + 1900, now.tm_mon + 1,
+             now.tm_mday, m_log_name.c_str(), m_split_index);
+  }
+
+  FILE* fp = fopen(full_name, "a");
+  if (fp == nullptr) {
+    return false;
+  }
+  if (m_fp) {
+    fclose(m_fp);
+  }
+  m_fp = fp;
+  m_today = now.tm_mday;
+  fseek(m_fp, 0, SEEK_END);
+  m_file_bytes = ftell(m_fp);
+  return true;
+}
+
+void Log::rotate_if_needed(const struct tm& now) {
+  if (now.tm_mday != m_today) {
+    // 新的一天从序号 0 重新开始
+    m_split_index = 0;
+    open_file(now);
+  } else if (m_split_bytes > 0 && m_file_bytes >= m_split_bytes) {
+    ++m_split_index;
+    open_file(now);
+  }
+}
+
+Log::log_ring* Log::local_ring() {
+  static __thread log_ring* t_ring = nullptr;
+  if (t_ring == nullptr) {
+    // 每个线程只在第一次写日志时注册一次
+    // C++11 的 new 不保证 64 字节对齐，手动分配对齐内存
+    void* mem = nullptr;
+    if (posix_memalign(&mem, 64, sizeof(log_ring)) != 0) {
+      abort();
+    }
+    t_ring = new (mem) log_ring(m_ring_size);
+    m_mutex.lock();
+    m_rings.push_back(t_ring);
+    m_mutex.unlock();
+  }
+  return t_ring;
+}
+
+void Log::write_log(int level, const char* format, ...) {
+  log_ring* ring = local_ring();
+  unsigned int head = ring->head.load(std::memory_order_relaxed);
+  unsigned int tail = ring->tail.load(std::memory_order_acquire);
+
+  // 环已满：丢弃并计数，不等待刷盘线程
+  if (head - tail > ring->mask) {
+    m_dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  char* slot = ring->slots + (size_t)(head & ring->mask) * LOG_LINE_SIZE;
+  char* buf = slot + sizeof(unsigned short);
+  const int cap = LOG_LINE_SIZE - sizeof(unsigned short);
+
+  // 秒级时间前缀只在秒数变化时重新格式化
+  struct timeval now;
+  gettimeofday(&now, nullptr);
+  if (now.tv_sec != ring->cached_sec) {
+    struct tm tm_now;
+    localtime_r(&now.tv_sec, &tm_now);
+    strftime(ring->cached_prefix, sizeof(ring->cached_prefix),
+             "%Y-%m-%d %H:%M:%S", &tm_now);
+    ring->cached_sec = now.tv_sec;
+  }
+  if (level < LOG_LEVEL_DEBUG || level > LOG_LEVEL_ERROR) {
+    level = LOG_LEVEL_INFO;
+  }
+  int n = snprintf(buf, cap, "%s.%06ld %s", ring->cached_prefix,
+                   (long)now.tv_usec, level_tag[level]);
+
+  // 预留一个字节给换行符，超长的日志被截断
+  int avail = cap - n - 1;
+  va_list valst;
+  va_start(valst, format);
+  int m = vsnprintf(buf + n, avail + 1, format, valst);
+  va_end(valst);
+  if (m < 0) {
+    m = 0;
+  } else if (m > avail) {
+    m = avail;
+  }
+  buf[n + m] = '\n';
+  *(unsigned short*)slot = (unsigned short)(n + m + 1);
+
+  ring->head.store(head + 1, std::memory_order_release);
+
+  // 环刚好半满时提前唤醒刷盘线程，摊到每条日志上只是一次比较
+  if (head - tail == (ring->mask >> 1)) {
+    m_cond.signal();
+  }
+}
+
+void Log::drain() {
+  if (m_fp == nullptr) {
+    return;
+  }
+  time_t t = time(nullptr);
+  struct tm now;
+  localtime_r(&t, &now);
+  rotate_if_needed(now);
+
+  m_batch.clear();
+  for (size_t i = 0; i < m_rings.size(); i++) {
+    log_ring* ring = m_rings[i];
+    unsigned int head = ring->head.load(std::memory_order_acquire);
+    unsigned int tail = ring->tail.load(std::memory_order_relaxed);
+    while (tail != head) {
+      const char* slot =
+          ring->slots + (size_t)(tail & ring->mask) * LOG_LINE_SIZE;
+      unsigned short len = *(const unsigned short*)slot;
+      m_batch.insert(m_batch.end(), slot + sizeof(unsigned short),
+                     slot + sizeof(unsigned short) + len);
+      ++tail;
+      ++m_written;
+      if (m_batch.size() >= MAX_BATCH_BYTES) {
+        // 先释放已拷贝的槽位，让生产者尽早复用
+        ring->tail.store(tail, std::memory_order_release);
+        fwrite(m_batch.data(), 1, m_batch.size(), m_fp);
+        m_file_bytes += m_batch.size();
+        m_batch.clear();
+      }
+    }
+    ring->tail.store(tail, std::memory_order_release);
+  }
+
+  // 报告上次刷盘以来丢弃的日志条数
+  unsigned long long dropped = m_dropped.load(std::memory_order_relaxed);
+  if (dropped != m_reported_dropped) {
+    char line[128];
+    int n = strftime(line, sizeof(line), "%Y-%m-%d %H:%M:%S ", &now);
+    n += snprintf(line + n, sizeof(line) - n,
+                  "%slog buffer full, dropped %llu messages\n",
+                  level_tag[LOG_LEVEL_WARN], dropped - m_reported_dropped);
+    m_batch.insert(m_batch.end(), line, line + n);
+    m_reported_dropped = dropped;
+  }
+
+  if (!m_batch.empty()) {
+    fwrite(m_batch.data(), 1, m_batch.size(), m_fp);
+    m_file_bytes += m_batch.size();
+  }
+  fflush(m_fp);
+}
+
+void* Log::flush_worker(void* arg) {
+  Log* log = (Log*)arg;
+  log->m_mutex.lock();
+  while (!log->m_stop) {
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    t.tv_sec += log->m_flush_interval_ms / 1000;
+    t.tv_nsec += (long)(log->m_flush_interval_ms % 1000) * 1000000;
+    if (t.tv_nsec >= 1000000000) {
+      t.tv_sec += 1;
+      t.tv_nsec -= 1000000000;
+    }
+    log->m_cond.timewait(log->m_mutex.get(), t);
+    log->drain();
+  }
+  log->m_mutex.unlock();
+  return nullptr;
+}
+
+void Log::flush() {
+  m_mutex.lock();
+  drain();
+  m_mutex.unlock();
+}
+
+void Log::stop() {
+  if (!m_enabled.exchange(false)) {
+    return;
+  }
+
+  m_mutex.lock();
+  m_stop = true;
+  m_cond.signal();
+  m_mutex.unlock();
+  pthread_join(m_thread, nullptr);
+
+  // 刷出后台线程退出后残留的日志
+  m_mutex.lock();
+  drain();
+  if (m_fp) {
+    fclose(m_fp);
+    m_fp = nullptr;
+  }
+  m_mutex.unlock();
+}
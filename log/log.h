@@ -0,0 +1,161 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "../lock/locker.h"
+
+/*
+ * 编译期日志级别：低于 LOG_MIN_LEVEL 的日志宏展开为空语句，
+ * 参数也不会被求值。可通过 -DLOG_MIN_LEVEL=1 等方式在构建时调整。
+ */
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+/**
+ * @class Log
+ * @brief 异步日志
+ *
+ * - 每个写日志的线程拥有一个单生产者/单消费者的无锁环形缓冲区，
+ *   写日志只是格式化到环中的一个槽位，不加锁、不进行系统调用
+ * - 后台刷盘线程定期把所有环中的日志批量写入文件
+ * - 按日期和文件大小滚动日志文件
+ * - 环满时丢弃日志并计数，绝不阻塞事件循环
+ */
+class Log {
+ public:
+  // 单条日志的最大长度(含时间戳和级别前缀)，超出部分被截断
+  static const int LOG_LINE_SIZE = 256;
+
+  static Log* get_instance();
+
+  /**
+   * @brief 初始化日志并启动后台刷盘线程
+   *
+   * @param file_name 日志文件路径，实际文件名会加上日期前缀
+   * @param close_log 为 1 时关闭日志
+   * @param ring_size 每个线程环形缓冲区的槽位数，向上取整为 2 的幂
+   * @param split_bytes 单个日志文件的大小上限，超过后滚动
+   * @param flush_interval_ms 后台线程的刷盘周期
+   * @return bool 是否初始化成功
+   */
+  bool init(const char* file_name, int close_log, int ring_size = 16384,
+            long long split_bytes = 64LL * 1024 * 1024,
+            int flush_interval_ms = 20);
+
+  /**
+   * @brief 写一条日志：格式化到当前线程的环形缓冲区，环满时丢弃
+   */
+  void write_log(int level, const char* format, ...)
+      __attribute__((format(printf, 3, 4)));
+
+  /**
+   * @brief 同步把所有线程缓冲区中的日志写入文件
+   */
+  void flush();
+
+  /**
+   * @brief 停止后台线程并刷出剩余日志
+   */
+  void stop();
+
+  bool enabled() const { return m_enabled.load(std::memory_order_acquire); }
+  // 因缓冲区已满被丢弃的日志条数
+  unsigned long long dropped() const { return m_dropped.load(); }
+  // 写入文件的日志条数
+  unsigned long long written() const { return m_written; }
+
+ private:
+  Log();
+  ~Log();
+
+  // 单生产者/单消费者环形缓冲区，head 与 tail 分占不同缓存行避免伪共享
+  struct log_ring {
+    alignas(64) std::atomic<unsigned int> head;  ///< 生产者写入位置
+    alignas(64) std::atomic<unsigned int> tail;  ///< 消费者读取位置
+    unsigned int mask;
+    char* slots;  ///< 每个槽位 LOG_LINE_SIZE 字节，首 2 字节为长度
+    // 时间戳前缀缓存，同一秒内的日志复用，只由生产者线程访问
+    time_t cached_sec;
+    char cached_prefix[32];
+
+    explicit log_ring(unsigned int size);
+    ~log_ring();
+  };
+
+  static void* flush_worker(void* arg);
+  log_ring* local_ring();
+  // 把所有环中的日志写入文件，调用者需持有 m_mutex
+  void drain();
+  // 检查日期和文件大小，必要时打开新的日志文件，调用者需持有 m_mutex
+  void rotate_if_needed(const struct tm& now);
+  bool open_file(const struct tm& now);
+
+  std::atomic<bool> m_enabled;  ///< 各线程写日志前读取，init/stop 修改
+  bool m_stop;
+  unsigned int m_ring_size;
+  long long m_split_bytes;
+  int m_flush_interval_ms;
+
+  std::string m_dir_name;   ///< 日志目录(含末尾的 '/')
+  std::string m_log_name;   ///< 日志文件名
+  FILE* m_fp;
+  int m_today;              ///< 当前文件对应的日期(tm_mday)
+  int m_split_index;        ///< 同一天内按大小滚动的序号
+  long long m_file_bytes;   ///< 当前文件已写入的字节数
+
+  pthread_t m_thread;
+  locker m_mutex;           ///< 保护文件与环列表，消费端串行化
+  cond m_cond;
+  std::vector<log_ring*> m_rings;
+  std::vector<char> m_batch;  ///< 批量写入的缓冲区
+
+  std::atomic<unsigned long long> m_dropped;
+  unsigned long long m_reported_dropped;
+  unsigned long long m_written;
+};
+
+#define LOG_BASE(level, format, ...)                             \
+  do {                                                           \
+    if (Log::get_instance()->enabled()) {                        \
+      Log::get_instance()->write_log(level, format, ##__VA_ARGS__); \
+    }                                                            \
+  } while (0)
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(format, ...) LOG_BASE(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) do {} while (0)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(format, ...) LOG_BASE(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) do {} while (0)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(format, ...) LOG_BASE(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...) do {} while (0)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(format, ...) LOG_BASE(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(format, ...) do {} while (0)
+#endif
+
+#endif  // !LOG_H
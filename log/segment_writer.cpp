@@ -0,0 +1,165 @@
+#include "segment_writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <exception>
+
+#include "log.h"
+
+static std::atomic<int> s_writer_count(0);
+static __thread segment_writer::segment* t_segments[4] = {nullptr};
+
+segment_writer::segment_writer()
+    : m_id(s_writer_count.fetch_add(1)),
+      m_segment_bytes(0),
+      m_header_bytes(0),
+      m_limit_bytes(0),
+      m_on_open(nullptr),
+      m_on_close(nullptr),
+      m_reserved_bytes(0) {
+  static_assert(sizeof(t_segments) / sizeof(t_segments[0]) == MAX_WRITERS,
+                "t_segments must have MAX_WRITERS entries");
+  if (m_id >= MAX_WRITERS) {
+    throw std::exception();
+  }
+}
+
+segment_writer::~segment_writer() { close(); }
+
+void segment_writer::init(const std::string& dir, const char* prefix,
+                          size_t segment_bytes, size_t header_bytes,
+                          uint64_t limit_bytes, open_hook on_open,
+                          close_hook on_close) {
+  mkdir(dir.c_str(), 0755);
+  m_dir = dir;
+  if (m_dir[m_dir.size() - 1] != '/') {
+    m_dir += '/';
+  }
+  m_prefix = prefix;
+  m_segment_bytes = segment_bytes;
+  m_header_bytes = header_bytes;
+  m_limit_bytes = limit_bytes;
+  m_on_open = on_open;
+  m_on_close = on_close;
+}
+
+bool segment_writer::open_segment(segment* seg) {
+  // 先占用总量，超过上限时本线程停止写入
+  if (m_limit_bytes > 0) {
+    uint64_t reserved = m_reserved_bytes.fetch_add(m_segment_bytes);
+    if (reserved + m_segment_bytes > m_limit_bytes) {
+      m_reserved_bytes.fetch_sub(m_segment_bytes);
+      LOG_WARN("%s: limit reached, thread %d stops writing", m_prefix.c_str(),
+               seg->thread_index);
+      return false;
+    }
+  }
+
+  char name[512];
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  seg->created_us = (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+  struct tm tm_now;
+  localtime_r(&tv.tv_sec, &tm_now);
+  int n = snprintf(name, sizeof(name), "%s%s_", m_dir.c_str(),
+                   m_prefix.c_str());
+  n += strftime(name + n, sizeof(name) - n, "%Y%m%d_%H%M%S", &tm_now);
+  snprintf(name + n, sizeof(name) - n, "_%d_%d.bin", seg->thread_index,
+           seg->seq);
+
+  seg->fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (seg->fd < 0) {
+    LOG_ERROR("%s: open %s failed, errno is:%d", m_prefix.c_str(), name,
+              errno);
+    return false;
+  }
+  if (ftruncate(seg->fd, m_segment_bytes) != 0) {
+    LOG_ERROR("%s: ftruncate %s failed, errno is:%d", m_prefix.c_str(), name,
+              errno);
+    ::close(seg->fd);
+    return false;
+  }
+  void* base = mmap(nullptr, m_segment_bytes, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, seg->fd, 0);
+  if (base == MAP_FAILED) {
+    LOG_ERROR("%s: mmap %s failed, errno is:%d", m_prefix.c_str(), name,
+              errno);
+    ::close(seg->fd);
+    return false;
+  }
+  seg->base = (char*)base;
+  seg->used = m_header_bytes;
+  m_on_open(seg->base, *seg, m_segment_bytes);
+  return true;
+}
+
+void segment_writer::close_segment(segment* seg) {
+  if (seg->base == nullptr) {
+    return;
+  }
+  m_on_close(seg->base, seg->used);
+  munmap(seg->base, m_segment_bytes);
+  seg->base = nullptr;
+  if (ftruncate(seg->fd, seg->used) != 0) {
+    LOG_WARN("%s: truncate segment failed, errno is:%d", m_prefix.c_str(),
+             errno);
+  }
+  ::close(seg->fd);
+  seg->fd = -1;
+}
+
+segment_writer::segment* segment_writer::local() {
+  segment*& slot = t_segments[m_id];
+  if (slot == nullptr) {
+    segment* seg = new segment();
+    seg->fd = -1;
+    seg->base = nullptr;
+    seg->used = 0;
+    seg->seq = 0;
+    seg->created_us = 0;
+    m_mutex.lock();
+    seg->thread_index = (int)m_segments.size();
+    m_segments.push_back(seg);
+    m_mutex.unlock();
+    // 打开失败(已记录日志)后本线程不再写入
+    seg->stopped = !open_segment(seg);
+    slot = seg;
+  }
+  return slot;
+}
+
+char* segment_writer::reserve(segment* seg, size_t size) {
+  if (seg->stopped || size > m_segment_bytes - m_header_bytes) {
+    return nullptr;
+  }
+  if (seg->used + size > m_segment_bytes) {
+    // 当前分段已满，滚动到新文件；只有本线程访问该分段，
+    // 加锁只是为了与 close 互斥
+    m_mutex.lock();
+    close_segment(seg);
+    ++seg->seq;
+    seg->stopped = !open_segment(seg);
+    m_mutex.unlock();
+    if (seg->stopped) {
+      return nullptr;
+    }
+  }
+  return seg->base + seg->used;
+}
+
+void segment_writer::close() {
+  m_mutex.lock();
+  for (size_t i = 0; i < m_segments.size(); i++) {
+    close_segment(m_segments[i]);
+    delete m_segments[i];
+  }
+  m_segments.clear();
+  m_mutex.unlock();
+}
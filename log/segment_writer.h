@@ -0,0 +1,97 @@
+#ifndef SEGMENT_WRITER_H
+#define SEGMENT_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "../lock/locker.h"
+
+/**
+ * @class segment_writer
+ * @brief 按线程写入的 mmap 分段文件，二进制访问日志与流量录制共用
+ *
+ * 每个线程写自己的分段 <dir><prefix>_<时间>_<线程序号>_<分段序号>.bin，
+ * 分段文件创建时预分配 segment_bytes 并整段映射，追加记录只是一次 memcpy；
+ * 写满后滚动到新文件，关闭时把文件截断到实际写入的长度。
+ * 文件头的格式由使用者决定，通过 open_hook/close_hook 填写。
+ */
+class segment_writer {
+ public:
+  struct segment {
+    int fd;
+    char* base;        ///< mmap 起始地址，没有打开的分段时为空
+    size_t used;       ///< 已写入的字节数，含文件头
+    int thread_index;  ///< 写入线程的序号，用于生成文件名
+    int seq;           ///< 该线程的分段序号
+    uint64_t created_us;  ///< 当前分段的创建时间(UNIX 微秒)
+    bool stopped;      ///< 打开失败或达到总量上限，本线程不再写入
+  };
+
+  // 新分段映射之后填写文件头
+  typedef void (*open_hook)(char* base, const segment& seg,
+                            size_t segment_bytes);
+  // 分段关闭之前写入实际长度等信息，used 含文件头
+  typedef void (*close_hook)(char* base, size_t used);
+
+  segment_writer();
+  ~segment_writer();
+
+  /**
+   * @brief 设置分段参数，之后第一次写入时才创建文件
+   *
+   * @param dir 分段文件所在目录，不存在时创建
+   * @param prefix 文件名前缀，如 "access"
+   * @param segment_bytes 单个分段文件的大小
+   * @param header_bytes 文件头长度，记录紧随其后
+   * @param limit_bytes 所有线程的分段总大小上限，0 表示不限制
+   */
+  void init(const std::string& dir, const char* prefix, size_t segment_bytes,
+            size_t header_bytes, uint64_t limit_bytes, open_hook on_open,
+            close_hook on_close);
+
+  /**
+   * @brief 当前线程的分段，第一次调用时打开
+   */
+  segment* local();
+
+  /**
+   * @brief 在当前线程的分段中为 size 字节的记录预留空间
+   * @details 放不下时滚动到新文件。写完记录后调用者把 seg->used 加上 size
+   *
+   * @return char* 写入位置；本线程已停止写入，或记录比一个分段还大时为空
+   */
+  char* reserve(segment* seg, size_t size);
+
+  /**
+   * @brief 关闭所有分段，把文件截断到实际写入的长度
+   */
+  void close();
+
+  size_t segment_bytes() const { return m_segment_bytes; }
+
+ private:
+  // 同时使用的写入器个数上限，每个写入器在线程局部数组中占一项
+  static const int MAX_WRITERS = 4;
+
+  bool open_segment(segment* seg);
+  // 调用者需保证没有线程在写该分段
+  void close_segment(segment* seg);
+
+  int m_id;  ///< 在线程局部数组中的下标
+  std::string m_dir;
+  std::string m_prefix;
+  size_t m_segment_bytes;
+  size_t m_header_bytes;
+  uint64_t m_limit_bytes;
+  open_hook m_on_open;
+  close_hook m_on_close;
+  std::atomic<uint64_t> m_reserved_bytes;  ///< 已经打开的分段总大小
+  locker m_mutex;                          ///< 保护分段列表
+  std::vector<segment*> m_segments;
+};
+
+#endif  // !SEGMENT_WRITER_H
@@ -1,10 +1,23 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "config.h"
 #include "webserver.h"
-int main(){
+int main(int argc, char* argv[]){
+    // 解析命令行与配置文件，选项说明见 Config::parse_arg 与 server.conf
+    Config config;
+    if (!config.parse_arg(argc, argv)) {
+        return 1;
+    }
+
     //创建服务器实例
     WebServer server;
 
-    //初始化端口9006
-    server.init(9006);
+    //初始化配置(默认端口9006)
+    server.init(config);
+    server.set_command_line(argc, argv);
 
     //启动
     server.start();
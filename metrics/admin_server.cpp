@@ -0,0 +1,281 @@
+#include "admin_server.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+
+#include "../coro/task.h"
+#include "../http/http_conn.h"
+#include "../log/log.h"
+
+// 管理请求头的最大长度，超过直接关闭
+static const size_t MAX_ADMIN_REQUEST = 8192;
+
+admin_server::admin_server() : m_epollfd(-1), m_listenfd(-1), m_next_id(0) {}
+
+admin_server::~admin_server() { close_all(); }
+
+bool admin_server::init(int epollfd, const std::string& addr, int port,
+                        int inherited_fd) {
+  if (inherited_fd >= 0) {
+    m_epollfd = epollfd;
+    m_listenfd = inherited_fd;
+    fcntl(m_listenfd, F_SETFL, fcntl(m_listenfd, F_GETFL) | O_NONBLOCK);
+  } else if (port <= 0) {
+    return true;
+  } else if (!listen_on(epollfd, addr, port)) {
+    return false;
+  }
+
+  // 管理端口请求很少，使用 LT 模式即可
+  epoll_event event = {};
+  event.data.fd = m_listenfd;
+  event.events = EPOLLIN;
+  epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_listenfd, &event);
+  LOG_INFO("admin server listening on %s:%d%s", addr.c_str(), port,
+           inherited_fd >= 0 ? " (inherited)" : "");
+  return true;
+}
+
+bool admin_server::listen_on(int epollfd, const std::string& addr,
+                             int port) {
+  m_epollfd = epollfd;
+  m_listenfd = socket(PF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (m_listenfd < 0) {
+    return false;
+  }
+  int opt = 1;
+  setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(port);
+  if (inet_pton(AF_INET, addr.c_str(), &address.sin_addr) != 1) {
+    LOG_ERROR("admin server: invalid address %s", addr.c_str());
+    close(m_listenfd);
+    m_listenfd = -1;
+    return false;
+  }
+  if (bind(m_listenfd, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+      listen(m_listenfd, 16) < 0) {
+    LOG_ERROR("admin server: listen on %s:%d failed, errno is:%d",
+              addr.c_str(), port, errno);
+    close(m_listenfd);
+    m_listenfd = -1;
+    return false;
+  }
+  return true;
+}
+
+void admin_server::add_handler(const std::string& path, const handler& h) {
+  m_handlers[path] = h;
+}
+
+void admin_server::add_async_handler(const std::string& path,
+                                     coro::async_handler h) {
+  m_async_handlers[path] = h;
+}
+
+void admin_server::accept_conn() {
+  while (true) {
+    int connfd = accept4(m_listenfd, nullptr, nullptr, SOCK_NONBLOCK);
+    if (connfd < 0) {
+      break;
+    }
+    if (connfd >= (int)m_owned.size()) {
+      m_owned.resize(connfd + 1, 0);
+    }
+    m_owned[connfd] = 1;
+    conn& c = m_conns[connfd];
+    c = conn();
+    c.id = ++m_next_id;
+
+    epoll_event event = {};
+    event.data.fd = connfd;
+    event.events = EPOLLIN | EPOLLRDHUP;
+    epoll_ctl(m_epollfd, EPOLL_CTL_ADD, connfd, &event);
+  }
+}
+
+void admin_server::close_conn(int fd) {
+  epoll_ctl(m_epollfd, EPOLL_CTL_DEL, fd, 0);
+  close(fd);
+  m_owned[fd] = 0;
+  m_conns.erase(fd);
+}
+
+void admin_server::handle_event(int fd, unsigned int events) {
+  if (fd == m_listenfd) {
+    accept_conn();
+    return;
+  }
+  if (events & (EPOLLHUP | EPOLLERR)) {
+    close_conn(fd);
+    return;
+  }
+
+  conn& c = m_conns[fd];
+  if (!c.response.empty()) {
+    flush(fd, c);
+    return;
+  }
+  if (c.busy) {
+    return;
+  }
+  char buf[1024];
+  while (true) {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n > 0) {
+      c.request.append(buf, n);
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    // 对方关闭或出错
+    close_conn(fd);
+    return;
+  }
+
+  if (c.request.find("\r\n\r\n") != std::string::npos) {
+    dispatch(fd, c);
+  } else if (c.request.size() > MAX_ADMIN_REQUEST) {
+    close_conn(fd);
+  }
+}
+
+// 管理端口用到的状态码
+static const char* status_text(int status) {
+  switch (status) {
+    case 200: return "OK";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+    default: return "Unknown";
+  }
+}
+
+void admin_server::dispatch(int fd, conn& c) {
+  // 请求行形如 "GET /metrics HTTP/1.1"
+  const std::string& request = c.request;
+  std::string target;
+  size_t sp1 = request.find(' ');
+  size_t sp2 = sp1 == std::string::npos ? sp1 : request.find(' ', sp1 + 1);
+  if (sp2 != std::string::npos) {
+    target = request.substr(sp1 + 1, sp2 - sp1 - 1);
+  }
+  std::string path = target.substr(0, target.find('?'));
+
+  if (request.compare(0, 4, "GET ") != 0) {
+    send_response(fd, c, 405, "text/plain", "Allow: GET\r\n", "");
+    return;
+  }
+  std::map<std::string, coro::async_handler>::iterator ait =
+      m_async_handlers.find(path);
+  if (ait != m_async_handlers.end()) {
+    // 处理期间不再读取，只在对方断开时收到 EPOLLHUP
+    c.busy = true;
+    epoll_event event = {};
+    event.data.fd = fd;
+    epoll_ctl(m_epollfd, EPOLL_CTL_MOD, fd, &event);
+    coro::spawn(run_async(fd, c.id, ait->second, target));
+    return;
+  }
+  std::map<std::string, handler>::iterator it = m_handlers.find(path);
+  if (it == m_handlers.end()) {
+    send_response(fd, c, 404, "text/plain", "", "not found\n");
+    return;
+  }
+  std::string content_type = "text/plain; version=0.0.4";
+  std::string body = it->second(path, content_type);
+  send_response(fd, c, 200, content_type, "", body);
+}
+
+coro::task<void> admin_server::run_async(int fd, unsigned long long id,
+                                         coro::async_handler h,
+                                         std::string path) {
+  coro::async_request req;
+  req.method = http_conn::GET;
+  req.path = path;
+  req.status = 200;
+  req.content_type = "text/html";
+  co_await h(req);
+
+  // 处理期间连接可能已关闭，fd 也可能已分给新的连接
+  std::unordered_map<int, conn>::iterator it = m_conns.find(fd);
+  if (it == m_conns.end() || it->second.id != id) {
+    co_return;
+  }
+  if (!req.response_iov.empty()) {
+    // 管理端口不走分段发送，拼成一块
+    std::string body;
+    for (size_t i = 0; i < req.response_iov.size(); i++) {
+      body.append((const char*)req.response_iov[i].iov_base,
+                  req.response_iov[i].iov_len);
+    }
+    req.response.swap(body);
+  }
+  send_response(fd, it->second, req.status, req.content_type, req.headers,
+                req.response);
+}
+
+void admin_server::send_response(int fd, conn& c, int status,
+                                 const std::string& type,
+                                 const std::string& headers,
+                                 const std::string& body) {
+  char header[256];
+  int n = snprintf(header, sizeof(header),
+                   "HTTP/1.1 %d %s\r\nContent-Type: %s\r\n"
+                   "Content-Length: %zu\r\nConnection: close\r\n",
+                   status, status_text(status), type.c_str(), body.size());
+  c.response.assign(header, n);
+  c.response += headers;
+  c.response += "\r\n";
+  c.response += body;
+  c.sent = 0;
+  c.busy = false;
+  flush(fd, c);
+}
+
+void admin_server::flush(int fd, conn& c) {
+  while (c.sent < c.response.size()) {
+    ssize_t ret = send(fd, c.response.data() + c.sent,
+                       c.response.size() - c.sent, MSG_NOSIGNAL);
+    if (ret > 0) {
+      c.sent += ret;
+      continue;
+    }
+    if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // 发送缓冲区已满，等可写时继续
+      epoll_event event = {};
+      event.data.fd = fd;
+      event.events = EPOLLOUT;
+      epoll_ctl(m_epollfd, EPOLL_CTL_MOD, fd, &event);
+      return;
+    }
+    break;
+  }
+  close_conn(fd);
+}
+
+void admin_server::close_all() {
+  for (int fd = 0; fd < (int)m_owned.size(); fd++) {
+    if (m_owned[fd]) {
+      close_conn(fd);
+    }
+  }
+  if (m_listenfd >= 0) {
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, 0);
+    close(m_listenfd);
+    m_listenfd = -1;
+  }
+}
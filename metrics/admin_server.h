@@ -0,0 +1,100 @@
+#ifndef ADMIN_SERVER_H
+#define ADMIN_SERVER_H
+
+#include <functional>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../coro/handler.h"
+
+/**
+ * @class admin_server
+ * @brief 内部管理端口，挂在主事件循环上，按路径分发到注册的处理函数
+ *
+ * 只服务 /metrics 这类低频的内部请求：读到完整请求头后生成响应，发送完即关闭连接。
+ * 响应一次写不完时保存在连接中，等 EPOLLOUT 再继续，不阻塞事件循环。
+ * 需要查询数据库的页面注册为异步处理函数(见 coro/handler.h)，在事件循环中以
+ * 协程运行，结束后再发送响应。
+ */
+class admin_server {
+ public:
+  // 处理函数返回响应体，content_type 可按需修改
+  typedef std::function<std::string(const std::string& path,
+                                    std::string& content_type)>
+      handler;
+
+  admin_server();
+  ~admin_server();
+
+  /**
+   * @brief 监听管理端口并注册到 epoll
+   *
+   * @param epollfd 事件循环的 epoll 实例
+   * @param addr 监听地址，点分 IPv4
+   * @param port 管理端口，0 表示关闭
+   * @param inherited_fd 热升级时从旧进程接收的监听 socket，-1 表示自行创建
+   * @return bool 是否成功
+   */
+  bool init(int epollfd, const std::string& addr, int port,
+            int inherited_fd = -1);
+  // 监听 socket，未开启时为 -1
+  int listen_fd() const { return m_listenfd; }
+  /**
+   * @brief 注册路径处理函数
+   */
+  void add_handler(const std::string& path, const handler& h);
+  /**
+   * @brief 注册异步处理函数，只处理 GET
+   */
+  void add_async_handler(const std::string& path, coro::async_handler h);
+  /**
+   * @brief fd 是否属于管理端口(监听 socket 或其连接)
+   */
+  bool owns(int fd) const {
+    return fd == m_listenfd ||
+           (fd >= 0 && fd < (int)m_owned.size() && m_owned[fd]);
+  }
+  /**
+   * @brief 处理属于管理端口的 epoll 事件
+   */
+  void handle_event(int fd, unsigned int events);
+  /**
+   * @brief 关闭监听 socket 与所有连接
+   */
+  void close_all();
+
+ private:
+  struct conn {
+    std::string request;   ///< 已读到的请求
+    std::string response;  ///< 响应，不为空时正在发送
+    size_t sent;           ///< 已发送的字节数
+    bool busy;             ///< 异步处理函数运行中
+    unsigned long long id; ///< 连接序号，fd 被复用时用来识别旧连接
+
+    conn() : sent(0), busy(false), id(0) {}
+  };
+
+  bool listen_on(int epollfd, const std::string& addr, int port);
+  void accept_conn();
+  void close_conn(int fd);
+  void dispatch(int fd, conn& c);
+  coro::task<void> run_async(int fd, unsigned long long id,
+                             coro::async_handler h, std::string path);
+  // 生成响应并开始发送
+  void send_response(int fd, conn& c, int status, const std::string& type,
+                     const std::string& headers, const std::string& body);
+  // 继续发送，发完或出错时关闭连接
+  void flush(int fd, conn& c);
+
+  int m_epollfd;
+  int m_listenfd;
+  unsigned long long m_next_id;
+  std::vector<char> m_owned;                ///< 按 fd 标记管理连接
+  std::unordered_map<int, conn> m_conns;
+  std::map<std::string, handler> m_handlers;
+  std::map<std::string, coro::async_handler> m_async_handlers;
+};
+
+#endif  // !ADMIN_SERVER_H
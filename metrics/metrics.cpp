@@ -0,0 +1,482 @@
+#include "metrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <new>
+#include <string>
+
+#include "../CGImysql/sql_result_cache.h"
+#include "../log/log.h"
+
+// 导出 Prometheus 直方图时使用的桶边界(秒)
+static const double export_bounds[] = {
+    1e-6,   2.5e-6, 5e-6,   1e-5,   2.5e-5, 5e-5, 1e-4, 2.5e-4,
+    5e-4,   1e-3,   2.5e-3, 5e-3,   1e-2,   2.5e-2, 5e-2, 0.1,
+    0.25,   0.5,    1.0,    2.5,    5.0,    10.0};
+
+static const char* phase_names[PHASE_COUNT] = {"accept", "parse", "lookup",
+                                               "write", "queue"};
+
+// 顺序与 http_conn::conn_stage 一致
+static const char* timeout_stage_names[metrics_shard::TIMEOUT_STAGES] = {
+    "header", "body", "busy", "write", "keepalive"};
+
+static const double export_quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+metrics_histogram::metrics_histogram() : m_count(0), m_sum(0) {
+  for (int i = 0; i < BUCKET_COUNT; i++) {
+    m_buckets[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+uint64_t metrics_histogram::bucket_upper(int idx) {
+  if (idx < SUB_COUNT) {
+    return idx;
+  }
+  int exp = idx / SUB_COUNT + SUB_BITS - 1;
+  int sub = idx % SUB_COUNT;
+  // 最高的桶左移会溢出为 0，减一后恰好是 UINT64_MAX
+  return ((uint64_t)(SUB_COUNT + sub + 1) << (exp - SUB_BITS)) - 1;
+}
+
+void metrics_histogram::merge_into(std::vector<uint64_t>& out,
+                                   uint64_t& count, uint64_t& sum) const {
+  for (int i = 0; i < BUCKET_COUNT; i++) {
+    out[i] += m_buckets[i].load(std::memory_order_relaxed);
+  }
+  count += m_count.load(std::memory_order_relaxed);
+  sum += m_sum.load(std::memory_order_relaxed);
+}
+
+metrics_shard::metrics_shard()
+    : accepted(0),
+      rejected(0),
+      closed(0),
+      shed(0),
+      idle_closed(0),
+      overloaded(0),
+      accept_paused(0),
+      spin_hits(0),
+      spin_misses(0),
+      budget_read(0),
+      budget_write(0),
+      budget_accept(0),
+      ratelimit_conn(0),
+      ratelimit_req(0),
+      ratelimit_evicted(0),
+      half_open_rejected(0),
+      proxy_connects(0),
+      proxy_pooled(0),
+      proxy_errors(0),
+      proxy_upstream_down(0),
+      proxy_spliced(0),
+      asset_identity(0),
+      asset_gzip(0),
+      asset_not_modified(0),
+      asset_miss(0),
+      async_started(0),
+      async_abandoned(0),
+      coro_frame_heap(0),
+      auth_login_ok(0),
+      auth_login_failed(0),
+      auth_register_ok(0),
+      auth_register_failed(0),
+      db_batches(0),
+      db_batch_rows(0),
+      db_batch_retries(0),
+      requests(0),
+      bytes_sent(0) {
+  for (int i = 0; i < STATUS_MAX; i++) {
+    status[i].store(0, std::memory_order_relaxed);
+  }
+  for (int i = 0; i < TIMEOUT_STAGES; i++) {
+    timeouts[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+metrics* metrics::get_instance() {
+  static metrics instance;
+  return &instance;
+}
+
+metrics_shard* metrics::register_shard() {
+  // C++11 的 new 不保证缓存行对齐，手动分配对齐内存
+  void* mem = nullptr;
+  if (posix_memalign(&mem, 64, sizeof(metrics_shard)) != 0) {
+    abort();
+  }
+  metrics_shard* shard = new (mem) metrics_shard();
+  m_mutex.lock();
+  m_shards.push_back(shard);
+  m_mutex.unlock();
+  return shard;
+}
+
+static void append_format(std::string& out, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void append_format(std::string& out, const char* format, ...) {
+  char buf[256];
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  if (n > 0) {
+    out.append(buf, n < (int)sizeof(buf) ? n : (int)sizeof(buf) - 1);
+  }
+}
+
+// 根据细粒度桶估算分位数，取所在桶的上界
+static double quantile_seconds(const std::vector<uint64_t>& buckets,
+                               uint64_t count, double q) {
+  if (count == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)(q * count);
+  if (rank >= count) {
+    rank = count - 1;
+  }
+  uint64_t seen = 0;
+  for (int i = 0; i < metrics_histogram::BUCKET_COUNT; i++) {
+    seen += buckets[i];
+    if (seen > rank) {
+      return metrics_histogram::bucket_upper(i) / 1e9;
+    }
+  }
+  return 0;
+}
+
+std::string metrics::render() {
+  // 复制分片列表后即可释放锁，读取分片本身不需要加锁
+  m_mutex.lock();
+  std::vector<metrics_shard*> shards = m_shards;
+  m_mutex.unlock();
+
+  uint64_t accepted = 0, rejected = 0, closed = 0, requests = 0, bytes = 0;
+  uint64_t shed = 0, idle_closed = 0, overloaded = 0, accept_paused = 0;
+  uint64_t spin_hits = 0, spin_misses = 0;
+  uint64_t budget_read = 0, budget_write = 0, budget_accept = 0;
+  uint64_t ratelimit_conn = 0, ratelimit_req = 0, ratelimit_evicted = 0;
+  uint64_t timeouts[metrics_shard::TIMEOUT_STAGES] = {0};
+  uint64_t half_open_rejected = 0;
+  uint64_t proxy_connects = 0, proxy_pooled = 0, proxy_errors = 0;
+  uint64_t proxy_upstream_down = 0, proxy_spliced = 0;
+  uint64_t asset_identity = 0, asset_gzip = 0, asset_not_modified = 0;
+  uint64_t asset_miss = 0;
+  uint64_t async_started = 0, async_abandoned = 0, coro_frame_heap = 0;
+  uint64_t auth_login_ok = 0, auth_login_failed = 0;
+  uint64_t auth_register_ok = 0, auth_register_failed = 0;
+  uint64_t db_batches = 0, db_batch_rows = 0, db_batch_retries = 0;
+  std::vector<uint64_t> status(metrics_shard::STATUS_MAX, 0);
+  std::vector<std::vector<uint64_t> > phase_buckets(
+      PHASE_COUNT, std::vector<uint64_t>(metrics_histogram::BUCKET_COUNT, 0));
+  uint64_t phase_count[PHASE_COUNT] = {0};
+  uint64_t phase_sum[PHASE_COUNT] = {0};
+
+  for (size_t i = 0; i < shards.size(); i++) {
+    metrics_shard* s = shards[i];
+    accepted += s->accepted.load(std::memory_order_relaxed);
+    rejected += s->rejected.load(std::memory_order_relaxed);
+    closed += s->closed.load(std::memory_order_relaxed);
+    shed += s->shed.load(std::memory_order_relaxed);
+    idle_closed += s->idle_closed.load(std::memory_order_relaxed);
+    overloaded += s->overloaded.load(std::memory_order_relaxed);
+    accept_paused += s->accept_paused.load(std::memory_order_relaxed);
+    spin_hits += s->spin_hits.load(std::memory_order_relaxed);
+    spin_misses += s->spin_misses.load(std::memory_order_relaxed);
+    budget_read += s->budget_read.load(std::memory_order_relaxed);
+    budget_write += s->budget_write.load(std::memory_order_relaxed);
+    budget_accept += s->budget_accept.load(std::memory_order_relaxed);
+    ratelimit_conn += s->ratelimit_conn.load(std::memory_order_relaxed);
+    ratelimit_req += s->ratelimit_req.load(std::memory_order_relaxed);
+    ratelimit_evicted += s->ratelimit_evicted.load(std::memory_order_relaxed);
+    for (int t = 0; t < metrics_shard::TIMEOUT_STAGES; t++) {
+      timeouts[t] += s->timeouts[t].load(std::memory_order_relaxed);
+    }
+    half_open_rejected +=
+        s->half_open_rejected.load(std::memory_order_relaxed);
+    proxy_connects += s->proxy_connects.load(std::memory_order_relaxed);
+    proxy_pooled += s->proxy_pooled.load(std::memory_order_relaxed);
+    proxy_errors += s->proxy_errors.load(std::memory_order_relaxed);
+    proxy_upstream_down +=
+        s->proxy_upstream_down.load(std::memory_order_relaxed);
+    proxy_spliced += s->proxy_spliced.load(std::memory_order_relaxed);
+    asset_identity += s->asset_identity.load(std::memory_order_relaxed);
+    asset_gzip += s->asset_gzip.load(std::memory_order_relaxed);
+    asset_not_modified += s->asset_not_modified.load(std::memory_order_relaxed);
+    asset_miss += s->asset_miss.load(std::memory_order_relaxed);
+    async_started += s->async_started.load(std::memory_order_relaxed);
+    async_abandoned += s->async_abandoned.load(std::memory_order_relaxed);
+    coro_frame_heap += s->coro_frame_heap.load(std::memory_order_relaxed);
+    auth_login_ok += s->auth_login_ok.load(std::memory_order_relaxed);
+    auth_login_failed += s->auth_login_failed.load(std::memory_order_relaxed);
+    auth_register_ok += s->auth_register_ok.load(std::memory_order_relaxed);
+    auth_register_failed +=
+        s->auth_register_failed.load(std::memory_order_relaxed);
+    db_batches += s->db_batches.load(std::memory_order_relaxed);
+    db_batch_rows += s->db_batch_rows.load(std::memory_order_relaxed);
+    db_batch_retries += s->db_batch_retries.load(std::memory_order_relaxed);
+    requests += s->requests.load(std::memory_order_relaxed);
+    bytes += s->bytes_sent.load(std::memory_order_relaxed);
+    for (int c = 0; c < metrics_shard::STATUS_MAX; c++) {
+      status[c] += s->status[c].load(std::memory_order_relaxed);
+    }
+    for (int p = 0; p < PHASE_COUNT; p++) {
+      s->phases[p].merge_into(phase_buckets[p], phase_count[p], phase_sum[p]);
+    }
+  }
+
+  std::string out;
+  out.reserve(8192);
+
+  out += "# HELP mws_connections_accepted_total Accepted client connections.\n";
+  out += "# TYPE mws_connections_accepted_total counter\n";
+  append_format(out, "mws_connections_accepted_total %llu\n",
+                (unsigned long long)accepted);
+  out += "# HELP mws_connections_rejected_total Connections refused because "
+         "the server was full.\n";
+  out += "# TYPE mws_connections_rejected_total counter\n";
+  append_format(out, "mws_connections_rejected_total %llu\n",
+                (unsigned long long)rejected);
+  out += "# HELP mws_connections_active Currently open client connections.\n";
+  out += "# TYPE mws_connections_active gauge\n";
+  append_format(out, "mws_connections_active %lld\n",
+                (long long)(accepted - closed));
+
+  out += "# HELP mws_admission_shed_total Connections and requests answered "
+         "with 503 by admission control.\n";
+  out += "# TYPE mws_admission_shed_total counter\n";
+  append_format(out, "mws_admission_shed_total %llu\n",
+                (unsigned long long)shed);
+  out += "# HELP mws_admission_idle_closed_total Idle keep-alive connections "
+         "closed under overload.\n";
+  out += "# TYPE mws_admission_idle_closed_total counter\n";
+  append_format(out, "mws_admission_idle_closed_total %llu\n",
+                (unsigned long long)idle_closed);
+  out += "# HELP mws_admission_overloaded Event loops currently overloaded.\n";
+  out += "# TYPE mws_admission_overloaded gauge\n";
+  append_format(out, "mws_admission_overloaded %llu\n",
+                (unsigned long long)overloaded);
+  out += "# HELP mws_admission_accept_paused Event loops that stopped "
+         "accepting.\n";
+  out += "# TYPE mws_admission_accept_paused gauge\n";
+  append_format(out, "mws_admission_accept_paused %llu\n",
+                (unsigned long long)accept_paused);
+
+  out += "# HELP mws_spin_polls_total Spin polls before blocking, by whether "
+         "an event arrived within the budget.\n";
+  out += "# TYPE mws_spin_polls_total counter\n";
+  append_format(out, "mws_spin_polls_total{result=\"hit\"} %llu\n",
+                (unsigned long long)spin_hits);
+  append_format(out, "mws_spin_polls_total{result=\"miss\"} %llu\n",
+                (unsigned long long)spin_misses);
+
+  out += "# HELP mws_io_budget_exhausted_total Reads, writes and accept "
+         "loops stopped at the per-iteration budget and resumed next "
+         "iteration.\n";
+  out += "# TYPE mws_io_budget_exhausted_total counter\n";
+  append_format(out, "mws_io_budget_exhausted_total{kind=\"read\"} %llu\n",
+                (unsigned long long)budget_read);
+  append_format(out, "mws_io_budget_exhausted_total{kind=\"write\"} %llu\n",
+                (unsigned long long)budget_write);
+  append_format(out,
+                "mws_io_budget_exhausted_total{kind=\"accept\"} %llu\n",
+                (unsigned long long)budget_accept);
+
+  out += "# HELP mws_ratelimit_rejected_total Connections and requests "
+         "answered with 429 by the per-client rate limit.\n";
+  out += "# TYPE mws_ratelimit_rejected_total counter\n";
+  append_format(out,
+                "mws_ratelimit_rejected_total{stage=\"connection\"} %llu\n",
+                (unsigned long long)ratelimit_conn);
+  append_format(out, "mws_ratelimit_rejected_total{stage=\"request\"} %llu\n",
+                (unsigned long long)ratelimit_req);
+  out += "# HELP mws_ratelimit_evicted_total Live rate limit entries replaced "
+         "because the table was full.\n";
+  out += "# TYPE mws_ratelimit_evicted_total counter\n";
+  append_format(out, "mws_ratelimit_evicted_total %llu\n",
+                (unsigned long long)ratelimit_evicted);
+
+  out += "# HELP mws_timeouts_total Connections closed by a timeout, by the "
+         "stage they were in.\n";
+  out += "# TYPE mws_timeouts_total counter\n";
+  for (int t = 0; t < metrics_shard::TIMEOUT_STAGES; t++) {
+    append_format(out, "mws_timeouts_total{stage=\"%s\"} %llu\n",
+                  timeout_stage_names[t], (unsigned long long)timeouts[t]);
+  }
+  out += "# HELP mws_half_open_rejected_total Connections and requests "
+         "refused because the client IP had too many half-open requests.\n";
+  out += "# TYPE mws_half_open_rejected_total counter\n";
+  append_format(out, "mws_half_open_rejected_total %llu\n",
+                (unsigned long long)half_open_rejected);
+
+  out += "# HELP mws_proxy_upstream_connections_total Upstream connections "
+         "used by the reverse proxy, newly opened or taken from the pool.\n";
+  out += "# TYPE mws_proxy_upstream_connections_total counter\n";
+  append_format(out,
+                "mws_proxy_upstream_connections_total{source=\"new\"} %llu\n",
+                (unsigned long long)proxy_connects);
+  append_format(out,
+                "mws_proxy_upstream_connections_total{source=\"pool\"} %llu\n",
+                (unsigned long long)proxy_pooled);
+  out += "# HELP mws_proxy_errors_total Proxied requests answered with 502 "
+         "or 504.\n";
+  out += "# TYPE mws_proxy_errors_total counter\n";
+  append_format(out, "mws_proxy_errors_total %llu\n",
+                (unsigned long long)proxy_errors);
+  out += "# HELP mws_proxy_upstream_disabled_total Times an upstream was "
+         "taken out of rotation after repeated failures.\n";
+  out += "# TYPE mws_proxy_upstream_disabled_total counter\n";
+  append_format(out, "mws_proxy_upstream_disabled_total %llu\n",
+                (unsigned long long)proxy_upstream_down);
+  out += "# HELP mws_proxy_spliced_bytes_total Body bytes moved between "
+         "sockets with splice.\n";
+  out += "# TYPE mws_proxy_spliced_bytes_total counter\n";
+  append_format(out, "mws_proxy_spliced_bytes_total %llu\n",
+                (unsigned long long)proxy_spliced);
+
+  out += "# HELP mws_asset_snapshot_lookups_total Requests looked up in the "
+         "asset snapshot, by result.\n";
+  out += "# TYPE mws_asset_snapshot_lookups_total counter\n";
+  append_format(out,
+                "mws_asset_snapshot_lookups_total{result=\"identity\"} %llu\n",
+                (unsigned long long)asset_identity);
+  append_format(out,
+                "mws_asset_snapshot_lookups_total{result=\"gzip\"} %llu\n",
+                (unsigned long long)asset_gzip);
+  append_format(
+      out, "mws_asset_snapshot_lookups_total{result=\"not_modified\"} %llu\n",
+      (unsigned long long)asset_not_modified);
+  append_format(out,
+                "mws_asset_snapshot_lookups_total{result=\"miss\"} %llu\n",
+                (unsigned long long)asset_miss);
+
+  out += "# HELP mws_async_requests_total Requests handed to async handlers, "
+         "and those whose client closed before the handler finished.\n";
+  out += "# TYPE mws_async_requests_total counter\n";
+  append_format(out, "mws_async_requests_total{result=\"started\"} %llu\n",
+                (unsigned long long)async_started);
+  append_format(out, "mws_async_requests_total{result=\"abandoned\"} %llu\n",
+                (unsigned long long)async_abandoned);
+  out += "# HELP mws_coro_frame_heap_allocs_total Coroutine frames allocated "
+         "from the heap because the per-loop frame pool was empty.\n";
+  out += "# TYPE mws_coro_frame_heap_allocs_total counter\n";
+  append_format(out, "mws_coro_frame_heap_allocs_total %llu\n",
+                (unsigned long long)coro_frame_heap);
+
+  out += "# HELP mws_auth_logins_total Login attempts by result.\n";
+  out += "# TYPE mws_auth_logins_total counter\n";
+  append_format(out, "mws_auth_logins_total{result=\"ok\"} %llu\n",
+                (unsigned long long)auth_login_ok);
+  append_format(out, "mws_auth_logins_total{result=\"failed\"} %llu\n",
+                (unsigned long long)auth_login_failed);
+  out += "# HELP mws_auth_registrations_total Registrations by result.\n";
+  out += "# TYPE mws_auth_registrations_total counter\n";
+  append_format(out, "mws_auth_registrations_total{result=\"ok\"} %llu\n",
+                (unsigned long long)auth_register_ok);
+  append_format(out,
+                "mws_auth_registrations_total{result=\"failed\"} %llu\n",
+                (unsigned long long)auth_register_failed);
+
+  out += "# HELP mws_db_batches_total Transactions written by the group-commit "
+         "batcher, and those that failed and were retried row by row.\n";
+  out += "# TYPE mws_db_batches_total counter\n";
+  append_format(out, "mws_db_batches_total{result=\"written\"} %llu\n",
+                (unsigned long long)db_batches);
+  append_format(out, "mws_db_batches_total{result=\"retried\"} %llu\n",
+                (unsigned long long)db_batch_retries);
+  out += "# HELP mws_db_batch_rows_total Rows inserted by the group-commit "
+         "batcher.\n";
+  out += "# TYPE mws_db_batch_rows_total counter\n";
+  append_format(out, "mws_db_batch_rows_total %llu\n",
+                (unsigned long long)db_batch_rows);
+
+  out += "# HELP mws_requests_total Completed HTTP responses.\n";
+  out += "# TYPE mws_requests_total counter\n";
+  append_format(out, "mws_requests_total %llu\n", (unsigned long long)requests);
+  out += "# HELP mws_responses_total Completed HTTP responses by status.\n";
+  out += "# TYPE mws_responses_total counter\n";
+  for (int c = 0; c < metrics_shard::STATUS_MAX; c++) {
+    if (status[c]) {
+      append_format(out, "mws_responses_total{code=\"%d\"} %llu\n", c,
+                    (unsigned long long)status[c]);
+    }
+  }
+  out += "# HELP mws_response_bytes_total Bytes of HTTP responses sent.\n";
+  out += "# TYPE mws_response_bytes_total counter\n";
+  append_format(out, "mws_response_bytes_total %llu\n",
+                (unsigned long long)bytes);
+
+  out += "# HELP mws_phase_duration_seconds Time spent in each request "
+         "phase.\n";
+  out += "# TYPE mws_phase_duration_seconds histogram\n";
+  for (int p = 0; p < PHASE_COUNT; p++) {
+    const std::vector<uint64_t>& buckets = phase_buckets[p];
+    uint64_t cumulative = 0;
+    int idx = 0;
+    for (size_t b = 0; b < sizeof(export_bounds) / sizeof(export_bounds[0]);
+         b++) {
+      uint64_t bound_ns = (uint64_t)(export_bounds[b] * 1e9);
+      while (idx < metrics_histogram::BUCKET_COUNT &&
+             metrics_histogram::bucket_upper(idx) <= bound_ns) {
+        cumulative += buckets[idx++];
+      }
+      append_format(out,
+                    "mws_phase_duration_seconds_bucket{phase=\"%s\",le=\"%g\"} "
+                    "%llu\n",
+                    phase_names[p], export_bounds[b],
+                    (unsigned long long)cumulative);
+    }
+    append_format(out,
+                  "mws_phase_duration_seconds_bucket{phase=\"%s\",le=\"+Inf\"} "
+                  "%llu\n",
+                  phase_names[p], (unsigned long long)phase_count[p]);
+    append_format(out, "mws_phase_duration_seconds_sum{phase=\"%s\"} %.9f\n",
+                  phase_names[p], phase_sum[p] / 1e9);
+    append_format(out, "mws_phase_duration_seconds_count{phase=\"%s\"} %llu\n",
+                  phase_names[p], (unsigned long long)phase_count[p]);
+  }
+
+  out += "# HELP mws_phase_duration_quantile_seconds Server-side quantiles of "
+         "request phase durations.\n";
+  out += "# TYPE mws_phase_duration_quantile_seconds gauge\n";
+  for (int p = 0; p < PHASE_COUNT; p++) {
+    for (size_t q = 0;
+         q < sizeof(export_quantiles) / sizeof(export_quantiles[0]); q++) {
+      append_format(out,
+                    "mws_phase_duration_quantile_seconds{phase=\"%s\","
+                    "quantile=\"%g\"} %.9f\n",
+                    phase_names[p], export_quantiles[q],
+                    quantile_seconds(phase_buckets[p], phase_count[p],
+                                     export_quantiles[q]));
+    }
+  }
+
+  out += "# HELP mws_log_dropped_total Log lines dropped because a log ring "
+         "was full.\n";
+  out += "# TYPE mws_log_dropped_total counter\n";
+  append_format(out, "mws_log_dropped_total %llu\n",
+                Log::get_instance()->dropped());
+
+  sql_result_cache_stats cache = sql_result_cache::GetInstance()->GetStats();
+  out += "# HELP mws_sql_cache_lookups_total Query result cache lookups by "
+         "outcome.\n";
+  out += "# TYPE mws_sql_cache_lookups_total counter\n";
+  append_format(out, "mws_sql_cache_lookups_total{result=\"hit\"} %llu\n",
+                cache.hits);
+  append_format(out, "mws_sql_cache_lookups_total{result=\"miss\"} %llu\n",
+                cache.misses);
+  append_format(out, "mws_sql_cache_lookups_total{result=\"coalesced\"} %llu\n",
+                cache.coalesced);
+  out += "# HELP mws_sql_cache_hit_ratio Fraction of lookups served without "
+         "a database query.\n";
+  out += "# TYPE mws_sql_cache_hit_ratio gauge\n";
+  append_format(out, "mws_sql_cache_hit_ratio %.6f\n", cache.HitRatio());
+  out += "# HELP mws_sql_cache_bytes Memory held by the query result cache.\n";
+  out += "# TYPE mws_sql_cache_bytes gauge\n";
+  append_format(out, "mws_sql_cache_bytes %zu\n", cache.bytes);
+
+  return out;
+}
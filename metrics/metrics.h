@@ -0,0 +1,187 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "../lock/locker.h"
+
+/*
+ * 指标子系统
+ * 每个线程拥有一份按缓存行对齐的计数器与直方图，记录时只有本线程写，
+ * 用 relaxed 的 load/store 代替原子 RMW，开销与普通内存自增相同；
+ * 抓取时遍历所有线程的数据求和，整个过程不加锁。
+ */
+
+// 耗时统计的阶段
+enum metrics_phase {
+  PHASE_ACCEPT = 0,  // accept 及连接初始化
+  PHASE_PARSE,       // 解析请求
+  PHASE_LOOKUP,      // do_request 中的文件查找与映射
+  PHASE_WRITE,       // writev 发送响应
+  PHASE_QUEUE,       // 事件就绪到被处理的排队时延，只在开启准入控制时记录
+  PHASE_COUNT
+};
+
+// 单调时钟纳秒，vDSO 实现，不陷入内核
+inline uint64_t metrics_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @class metrics_histogram
+ * @brief HDR 风格的对数-线性直方图
+ *
+ * 每个 2 的幂区间再线性分为 16 个子桶，相对误差不超过 1/16；
+ * 只允许一个线程写入，其他线程可以随时无锁读取。
+ */
+class metrics_histogram {
+ public:
+  static const int SUB_BITS = 4;
+  static const int SUB_COUNT = 1 << SUB_BITS;
+  static const int BUCKET_COUNT = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+  metrics_histogram();
+
+  void record(uint64_t value) {
+    int idx = bucket_index(value);
+    m_buckets[idx].store(m_buckets[idx].load(std::memory_order_relaxed) + 1,
+                         std::memory_order_relaxed);
+    m_count.store(m_count.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+    m_sum.store(m_sum.load(std::memory_order_relaxed) + value,
+                std::memory_order_relaxed);
+  }
+
+  static int bucket_index(uint64_t value) {
+    if (value < (uint64_t)SUB_COUNT) {
+      return (int)value;
+    }
+    int exp = 63 - __builtin_clzll(value);
+    int sub = (int)(value >> (exp - SUB_BITS)) & (SUB_COUNT - 1);
+    return (exp - SUB_BITS + 1) * SUB_COUNT + sub;
+  }
+  // 桶的上界(含)
+  static uint64_t bucket_upper(int idx);
+
+  // 把当前数据累加到 out(长度为 BUCKET_COUNT)
+  void merge_into(std::vector<uint64_t>& out, uint64_t& count,
+                  uint64_t& sum) const;
+
+ private:
+  std::atomic<uint64_t> m_buckets[BUCKET_COUNT];
+  std::atomic<uint64_t> m_count;
+  std::atomic<uint64_t> m_sum;
+};
+
+/**
+ * @struct metrics_shard
+ * @brief 单个线程的全部指标
+ */
+struct alignas(64) metrics_shard {
+  static const int STATUS_MAX = 600;
+  static const int TIMEOUT_STAGES = 5;  ///< 与 http_conn::conn_stage 一致
+
+  std::atomic<uint64_t> accepted;   ///< 接受的连接数
+  std::atomic<uint64_t> rejected;   ///< 因连接数已满被拒绝的连接数
+  std::atomic<uint64_t> closed;     ///< 关闭的连接数
+  std::atomic<uint64_t> shed;       ///< 准入控制返回 503 的连接与请求数
+  std::atomic<uint64_t> idle_closed;    ///< 过载时关闭的空闲长连接数
+  std::atomic<uint64_t> overloaded;     ///< 是否处于过载状态(0/1)
+  std::atomic<uint64_t> accept_paused;  ///< 是否暂停了 accept(0/1)
+  std::atomic<uint64_t> spin_hits;      ///< 轮询期间等到事件的次数
+  std::atomic<uint64_t> spin_misses;    ///< 轮询落空、转为阻塞等待的次数
+  std::atomic<uint64_t> budget_read;    ///< 读到预算上限、留到下一轮继续读的次数
+  std::atomic<uint64_t> budget_write;   ///< 写到预算上限、留到下一轮继续写的次数
+  std::atomic<uint64_t> budget_accept;  ///< accept 到预算上限、留到下一轮继续的次数
+  std::atomic<uint64_t> ratelimit_conn;     ///< 限流拒绝的新连接数
+  std::atomic<uint64_t> ratelimit_req;      ///< 限流拒绝的请求数
+  std::atomic<uint64_t> ratelimit_evicted;  ///< 限流表满时被替换的未过期项数
+  std::atomic<uint64_t> timeouts[TIMEOUT_STAGES];  ///< 超时关闭的连接数，按所处阶段
+  std::atomic<uint64_t> half_open_rejected;  ///< 超过每个 IP 半开上限被拒绝的连接与请求数
+  std::atomic<uint64_t> proxy_connects;       ///< 新建的上游连接数
+  std::atomic<uint64_t> proxy_pooled;         ///< 使用连接池中空闲连接的次数
+  std::atomic<uint64_t> proxy_errors;         ///< 代理返回的 502/504 数
+  std::atomic<uint64_t> proxy_upstream_down;  ///< 上游因连续失败被暂停的次数
+  std::atomic<uint64_t> proxy_spliced;        ///< 经 splice 转发的字节数
+  std::atomic<uint64_t> asset_identity;      ///< 快照命中，发送原始内容
+  std::atomic<uint64_t> asset_gzip;          ///< 快照命中，发送 gzip 内容
+  std::atomic<uint64_t> asset_not_modified;  ///< 快照命中，ETag 未变返回 304
+  std::atomic<uint64_t> asset_miss;          ///< 快照中没有请求的路径
+  std::atomic<uint64_t> async_started;    ///< 交给异步处理函数的请求数
+  std::atomic<uint64_t> async_abandoned;  ///< 处理函数完成前客户端已关闭的请求数
+  std::atomic<uint64_t> coro_frame_heap;  ///< 协程帧池中没有空闲帧、从堆分配的次数
+  std::atomic<uint64_t> auth_login_ok;         ///< 成功的登录数
+  std::atomic<uint64_t> auth_login_failed;     ///< 用户名或口令错误的登录数
+  std::atomic<uint64_t> auth_register_ok;      ///< 成功的注册数
+  std::atomic<uint64_t> auth_register_failed;  ///< 用户名已存在或写入失败的注册数
+  std::atomic<uint64_t> db_batches;        ///< 组提交写入的事务数
+  std::atomic<uint64_t> db_batch_rows;     ///< 组提交写入成功的行数
+  std::atomic<uint64_t> db_batch_retries;  ///< 整批失败后逐行重试的事务数
+  std::atomic<uint64_t> requests;   ///< 完成的请求数
+  std::atomic<uint64_t> bytes_sent; ///< 发送的响应字节数
+  std::atomic<uint64_t> status[STATUS_MAX];  ///< 按状态码计数
+  metrics_histogram phases[PHASE_COUNT];
+
+  metrics_shard();
+};
+
+/**
+ * @class metrics
+ * @brief 指标注册表，负责分配线程分片并导出 Prometheus 文本格式
+ */
+class metrics {
+ public:
+  static metrics* get_instance();
+
+  /**
+   * @brief 当前线程的指标分片，第一次调用时注册
+   */
+  static metrics_shard* local() {
+    static __thread metrics_shard* t_shard = nullptr;
+    if (t_shard == nullptr) {
+      t_shard = get_instance()->register_shard();
+    }
+    return t_shard;
+  }
+
+  // 单线程写入的计数器自增
+  static void inc(std::atomic<uint64_t>& c, uint64_t n = 1) {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  // 记录某个阶段的耗时
+  static void record_phase(metrics_phase phase, uint64_t ns) {
+    local()->phases[phase].record(ns);
+  }
+
+  // 记录一个完成的请求
+  static void record_response(int status, uint64_t bytes) {
+    metrics_shard* s = local();
+    inc(s->requests);
+    inc(s->bytes_sent, bytes);
+    if (status > 0 && status < metrics_shard::STATUS_MAX) {
+      inc(s->status[status]);
+    }
+  }
+
+  /**
+   * @brief 汇总所有线程的数据，生成 Prometheus 文本格式
+   */
+  std::string render();
+
+ private:
+  metrics() {}
+  metrics_shard* register_shard();
+
+  locker m_mutex;  ///< 只在注册新分片时使用
+  std::vector<metrics_shard*> m_shards;
+};
+
+#endif  // !METRICS_H
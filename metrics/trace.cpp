@@ -0,0 +1,144 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "../log/log.h"
+
+bool g_trace_enabled = false;
+
+static const char* phase_names[TRACE_PHASE_COUNT] = {
+    "accept", "wait_read", "read",       "parse",
+    "lookup", "respond",   "wait_write", "write"};
+
+static uint64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+tracer::tracer() : m_capacity(0), m_base_tsc(0), m_ns_per_tick(1.0) {}
+
+tracer* tracer::get_instance() {
+  static tracer instance;
+  return &instance;
+}
+
+void tracer::init(int events_per_thread) {
+  if (events_per_thread <= 0) {
+    return;
+  }
+  m_capacity = 1;
+  while (m_capacity < (uint64_t)events_per_thread) {
+    m_capacity <<= 1;
+  }
+  calibrate();
+  g_trace_enabled = true;
+  LOG_INFO("request tracing enabled, %llu events per thread",
+           (unsigned long long)m_capacity);
+}
+
+// 对照单调时钟测出 TSC 频率，现代 CPU 的 TSC 频率恒定
+void tracer::calibrate() {
+#if defined(__x86_64__) || defined(__i386__)
+  uint64_t ns0 = monotonic_ns();
+  uint64_t tsc0 = now();
+  usleep(20000);
+  uint64_t ns1 = monotonic_ns();
+  uint64_t tsc1 = now();
+  m_ns_per_tick = tsc1 > tsc0 ? (double)(ns1 - ns0) / (tsc1 - tsc0) : 1.0;
+  m_base_tsc = tsc1;
+#else
+  m_ns_per_tick = 1.0;
+  m_base_tsc = now();
+#endif
+}
+
+trace_ring* tracer::register_ring() {
+  trace_ring* ring = new trace_ring;
+  ring->head.store(0, std::memory_order_relaxed);
+  ring->mask = m_capacity - 1;
+  ring->events = new trace_event[m_capacity]();
+  m_mutex.lock();
+  ring->index = (int)m_rings.size();
+  m_rings.push_back(ring);
+  m_mutex.unlock();
+  return ring;
+}
+
+std::string tracer::dump_json() {
+  m_mutex.lock();
+  std::vector<trace_ring*> rings = m_rings;
+  m_mutex.unlock();
+
+  std::string out = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+  bool first = true;
+  char buf[256];
+  std::vector<trace_event> copy;
+  for (size_t r = 0; r < rings.size(); r++) {
+    trace_ring* ring = rings[r];
+    // 先读写入位置再复制，复制完再读一次：
+    // 期间可能被覆盖的记录(下标小于 end - capacity)全部丢弃
+    uint64_t start = ring->head.load(std::memory_order_acquire);
+    uint64_t from = start > m_capacity ? start - m_capacity : 0;
+    copy.clear();
+    for (uint64_t i = from; i < start; i++) {
+      copy.push_back(ring->events[i & ring->mask]);
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t end = ring->head.load(std::memory_order_relaxed);
+    uint64_t valid = end > m_capacity ? end - m_capacity : 0;
+    size_t skip = valid > from ? std::min<uint64_t>(valid - from, copy.size())
+                               : 0;
+
+    int n = snprintf(buf, sizeof(buf),
+                     "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+                     "\"args\":{\"name\":\"thread %d\"}}",
+                     first ? "" : ",", ring->index, ring->index);
+    out.append(buf, n);
+    first = false;
+
+    for (size_t i = skip; i < copy.size(); i++) {
+      const trace_event& e = copy[i];
+      if (e.phase >= TRACE_PHASE_COUNT || e.end < e.begin ||
+          e.begin < m_base_tsc) {
+        continue;
+      }
+      double ts = (e.begin - m_base_tsc) * m_ns_per_tick / 1000.0;
+      double dur = (e.end - e.begin) * m_ns_per_tick / 1000.0;
+      n = snprintf(buf, sizeof(buf),
+                   ",{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\","
+                   "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                   phase_names[e.phase], ts, dur, ring->index, e.fd);
+      out.append(buf, n);
+    }
+  }
+  out += "]}\n";
+  return out;
+}
+
+std::string tracer::dump_file(const std::string& dir) {
+  time_t t = time(nullptr);
+  struct tm tm_val;
+  localtime_r(&t, &tm_val);
+  char name[256];
+  snprintf(name, sizeof(name), "%s/trace_%d_%04d%02d%02d_%02d%02d%02d.json",
+           dir.empty() ? "." : dir.c_str(), (int)getpid(),
+           tm_val.tm_year + 1900, tm_val.tm_mon + 1, tm_val.tm_mday,
+           tm_val.tm_hour, tm_val.tm_min, tm_val.tm_sec);
+
+  std::string json = dump_json();
+  FILE* fp = fopen(name, "w");
+  if (fp == nullptr) {
+    LOG_ERROR("trace dump: cannot open %s", name);
+    return "";
+  }
+  fwrite(json.data(), 1, json.size(), fp);
+  fclose(fp);
+  LOG_INFO("trace dumped to %s", name);
+  return name;
+}
@@ -0,0 +1,133 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "../lock/locker.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+/*
+ * 请求阶段追踪
+ * 每个线程一个固定大小的环形缓冲区，记录 (阶段, fd, 开始, 结束) 的 TSC 时间戳，
+ * 写满后覆盖最旧的记录。只有本线程写入，导出时无锁读取并丢弃可能被覆盖的记录。
+ * 未开启时每个埋点只有一次对 g_trace_enabled 的判断。
+ */
+
+// 追踪的阶段
+enum trace_phase {
+  TRACE_ACCEPT = 0,  // accept 及连接初始化
+  TRACE_WAIT_READ,   // 等待 EPOLLIN：连接建立或上一个响应发完到请求数据到达
+  TRACE_READ,        // read_once
+  TRACE_PARSE,       // process_read，包含文件查找
+  TRACE_LOOKUP,      // do_request 文件查找与映射
+  TRACE_RESPOND,     // process_write 构造响应
+  TRACE_WAIT_WRITE,  // writev 返回 EAGAIN 后等待 EPOLLOUT
+  TRACE_WRITE,       // 单次 writev
+  TRACE_PHASE_COUNT
+};
+
+// 全局开关，只在启动时设置
+extern bool g_trace_enabled;
+
+#define TRACE_ON() __builtin_expect(g_trace_enabled, 0)
+
+// 单条追踪记录
+struct trace_event {
+  uint64_t begin;  ///< 开始时的 TSC
+  uint64_t end;    ///< 结束时的 TSC
+  int32_t fd;      ///< 连接的文件描述符
+  uint32_t phase;  ///< trace_phase
+};
+
+/**
+ * @struct trace_ring
+ * @brief 单个线程的环形缓冲区，容量为 2 的幂
+ */
+struct trace_ring {
+  std::atomic<uint64_t> head;  ///< 已写入的记录总数
+  uint64_t mask;
+  int index;  ///< 线程编号，导出时作为 pid
+  trace_event* events;
+};
+
+/**
+ * @class tracer
+ * @brief 追踪缓冲区的注册表，负责时钟换算与导出 Chrome trace-event 格式
+ */
+class tracer {
+ public:
+  static tracer* get_instance();
+
+  /**
+   * @brief 开启追踪
+   *
+   * @param events_per_thread 每个线程保留的记录数，向上取整为 2 的幂
+   */
+  void init(int events_per_thread);
+
+  // 读取时间戳计数器
+  static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+  }
+
+  // 记录一个阶段，调用方负责先判断 TRACE_ON()
+  static void record(trace_phase phase, int fd, uint64_t begin, uint64_t end) {
+    trace_ring* ring = local();
+    uint64_t h = ring->head.load(std::memory_order_relaxed);
+    trace_event& e = ring->events[h & ring->mask];
+    e.begin = begin;
+    e.end = end;
+    e.fd = fd;
+    e.phase = phase;
+    ring->head.store(h + 1, std::memory_order_release);
+  }
+
+  /**
+   * @brief 导出所有线程的记录，Chrome trace-event JSON 格式
+   * 每个线程为一个 pid，每个连接 fd 为一个 tid
+   */
+  std::string dump_json();
+  /**
+   * @brief 导出到文件
+   *
+   * @param dir 输出目录
+   * @return std::string 生成的文件名，失败时为空
+   */
+  std::string dump_file(const std::string& dir);
+
+ private:
+  tracer();
+
+  static trace_ring* local() {
+    static __thread trace_ring* t_ring = nullptr;
+    if (t_ring == nullptr) {
+      t_ring = get_instance()->register_ring();
+    }
+    return t_ring;
+  }
+  trace_ring* register_ring();
+  void calibrate();
+
+  locker m_mutex;  ///< 只在注册新缓冲区与导出时使用
+  std::vector<trace_ring*> m_rings;
+  uint64_t m_capacity;
+  uint64_t m_base_tsc;     ///< 换算时间的零点
+  double m_ns_per_tick;    ///< 每个 TSC 周期对应的纳秒数
+};
+
+#endif  // !TRACE_H
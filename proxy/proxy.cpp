@@ -0,0 +1,1065 @@
+#include "proxy.h"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include "../log/capture.h"
+#include "../log/log.h"
+#include "../metrics/metrics.h"
+
+// 上游响应头的最大长度
+static const int HEAD_SIZE = 8192;
+// 每次 splice 的最大字节数，与管道的默认容量相同
+static const int SPLICE_CHUNK = 65536;
+
+static const char continue_response[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+// 响应体的边界
+enum body_mode {
+  BODY_NONE,     ///< 没有响应体
+  BODY_LENGTH,   ///< Content-Length
+  BODY_CHUNKED,  ///< Transfer-Encoding: chunked
+  BODY_EOF       ///< 到上游关闭连接为止
+};
+
+// 分块编码的解析状态，只用于找到响应体的结尾，数据原样转发
+enum chunk_state {
+  CH_SIZE,          ///< 块大小(十六进制)
+  CH_EXT,           ///< 块扩展，忽略
+  CH_SIZE_LF,
+  CH_DATA,          ///< 块数据，splice 转发
+  CH_DATA_CR,
+  CH_DATA_LF,
+  CH_TRAILER,       ///< 尾部头部的行首，空行表示结束
+  CH_TRAILER_LINE,
+  CH_TRAILER_LF,
+  CH_END_LF,
+  CH_DONE,
+  CH_ERROR
+};
+
+struct proxy_exchange {
+  enum state {
+    CONNECTING,    ///< 等待非阻塞 connect 完成
+    SEND_REQUEST,  ///< 发送请求头与已缓冲的请求体
+    SEND_BODY,     ///< 从客户端 splice 其余请求体
+    READ_HEAD,     ///< 读取上游响应头
+    RELAY          ///< 向客户端转发响应
+  };
+
+  http_conn* conn;
+  int client_fd;
+  int route;
+  int upstream;  ///< 上游编号，-1 表示未选择
+  int fd;        ///< 上游 socket，-1 表示没有
+  state st;
+  bool reused;        ///< 上游连接来自连接池
+  bool retried;       ///< 已经重试过一次
+  bool replayable;    ///< 请求可以在另一个连接上重发
+  bool client_armed;  ///< 客户端 socket 已注册 EPOLLONESHOT 事件
+  bool head_only;     ///< HEAD 请求，响应没有响应体
+  int64_t deadline_ms;  ///< 等待上游的截止时间，0 表示没有在等待上游
+
+  std::string req;     ///< 发给上游的请求头与已缓冲的请求体
+  size_t req_sent;
+  int body_buffered;   ///< 读缓冲区中属于请求体的字节数
+  int64_t body_left;   ///< 还要从客户端转发的请求体字节数
+
+  char head[HEAD_SIZE];  ///< 上游响应头，之后用作读取分块头的缓冲区
+  int head_len;
+  std::string out;       ///< 发给客户端的用户态数据(响应头、分块头)
+  size_t out_sent;
+
+  body_mode mode;
+  int64_t left;        ///< BODY_LENGTH 的剩余字节数，BODY_CHUNKED 当前块的剩余字节数
+  chunk_state chunk;
+  bool chunk_digits;   ///< 块大小已经读到数字
+  bool upstream_eof;
+  bool upstream_keep;  ///< 响应结束后上游连接可以复用
+  bool client_keep;    ///< 响应结束后客户端连接继续处理下一个请求
+  int status;
+  int64_t bytes;       ///< 发给客户端的字节数
+
+  int pipefd[2];  ///< splice 使用的管道，随对象复用
+  int piped;      ///< 管道中待写出的字节数
+
+  proxy_exchange* prev;
+  proxy_exchange* next;
+};
+
+static int64_t now_ms() { return (int64_t)(metrics_now_ns() / 1000000); }
+
+// 头部名称是否为 name(不区分大小写)，是时返回值的起始位置
+static const char* header_value(const char* line, size_t len,
+                                const char* name) {
+  size_t n = strlen(name);
+  if (len <= n || line[n] != ':' || strncasecmp(line, name, n) != 0) {
+    return nullptr;
+  }
+  const char* v = line + n + 1;
+  while (v < line + len && (*v == ' ' || *v == '\t')) {
+    v++;
+  }
+  return v;
+}
+
+// [v, end) 中是否含有 token(不区分大小写)
+static bool value_has(const char* v, const char* end, const char* token) {
+  size_t n = strlen(token);
+  for (; v + n <= end; v++) {
+    if (strncasecmp(v, token, n) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// 逐跳头部只对一段连接有效，不转发
+static bool hop_by_hop(const char* line, size_t len) {
+  static const char* names[] = {"Connection", "Keep-Alive",
+                                "Proxy-Connection", "TE", "Upgrade"};
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (header_value(line, len, names[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static int hex_digit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+/*
+ * 推进分块编码的解析
+ * 返回属于本响应的字节数，块数据部分按剩余长度整段跳过；
+ * 遇到结尾的空行后停止，格式错误时状态置为 CH_ERROR
+ */
+static int chunk_feed(proxy_exchange* x, const char* p, int n) {
+  int i = 0;
+  while (i < n && x->chunk != CH_DONE && x->chunk != CH_ERROR) {
+    char c = p[i];
+    switch (x->chunk) {
+      case CH_SIZE: {
+        int d = hex_digit(c);
+        if (d >= 0 && x->left < (1LL << 56)) {
+          x->left = x->left * 16 + d;
+          x->chunk_digits = true;
+        } else if (x->chunk_digits && (c == ';' || c == ' ' || c == '\t')) {
+          x->chunk = CH_EXT;
+        } else if (x->chunk_digits && c == '\r') {
+          x->chunk = CH_SIZE_LF;
+        } else {
+          x->chunk = CH_ERROR;
+        }
+        break;
+      }
+      case CH_EXT:
+        if (c == '\r') {
+          x->chunk = CH_SIZE_LF;
+        }
+        break;
+      case CH_SIZE_LF:
+        if (c != '\n') {
+          x->chunk = CH_ERROR;
+        } else {
+          x->chunk = x->left == 0 ? CH_TRAILER : CH_DATA;
+        }
+        break;
+      case CH_DATA: {
+        int take = n - i;
+        if (take > x->left) {
+          take = (int)x->left;
+        }
+        x->left -= take;
+        i += take;
+        if (x->left == 0) {
+          x->chunk = CH_DATA_CR;
+        }
+        continue;
+      }
+      case CH_DATA_CR:
+        x->chunk = c == '\r' ? CH_DATA_LF : CH_ERROR;
+        break;
+      case CH_DATA_LF:
+        if (c == '\n') {
+          x->chunk = CH_SIZE;
+          x->chunk_digits = false;
+        } else {
+          x->chunk = CH_ERROR;
+        }
+        break;
+      case CH_TRAILER:
+        x->chunk = c == '\r' ? CH_END_LF : CH_TRAILER_LINE;
+        break;
+      case CH_TRAILER_LINE:
+        if (c == '\r') {
+          x->chunk = CH_TRAILER_LF;
+        }
+        break;
+      case CH_TRAILER_LF:
+        x->chunk = c == '\n' ? CH_TRAILER : CH_ERROR;
+        break;
+      case CH_END_LF:
+        x->chunk = c == '\n' ? CH_DONE : CH_ERROR;
+        break;
+      default:
+        break;
+    }
+    i++;
+  }
+  return i;
+}
+
+proxy::proxy() : m_epollfd(-1), m_gen(0), m_active(nullptr), m_free(nullptr) {}
+
+proxy::~proxy() {
+  close_idle();
+  while (m_free) {
+    proxy_exchange* next = m_free->next;
+    if (m_free->pipefd[0] >= 0) {
+      close(m_free->pipefd[0]);
+      close(m_free->pipefd[1]);
+    }
+    delete m_free;
+    m_free = next;
+  }
+}
+
+void proxy::init(int epollfd) {
+  m_epollfd = epollfd;
+  m_pool.assign(upstream_table::get_instance()->upstream_count(),
+                std::vector<int>());
+}
+
+proxy_exchange* proxy::alloc_exchange() {
+  proxy_exchange* x = m_free;
+  if (x) {
+    m_free = x->next;
+  } else {
+    x = new proxy_exchange;
+    x->pipefd[0] = x->pipefd[1] = -1;
+  }
+  if (x->pipefd[0] < 0 && pipe2(x->pipefd, O_NONBLOCK | O_CLOEXEC) < 0) {
+    LOG_ERROR("proxy: pipe2 failed, errno %d", errno);
+    x->pipefd[0] = x->pipefd[1] = -1;
+  }
+  x->conn = nullptr;
+  x->client_fd = -1;
+  x->route = -1;
+  x->upstream = -1;
+  x->fd = -1;
+  x->st = proxy_exchange::CONNECTING;
+  x->reused = false;
+  x->retried = false;
+  x->replayable = false;
+  x->client_armed = false;
+  x->head_only = false;
+  x->deadline_ms = 0;
+  x->req.clear();
+  x->req_sent = 0;
+  x->body_buffered = 0;
+  x->body_left = 0;
+  x->head_len = 0;
+  x->out.clear();
+  x->out_sent = 0;
+  x->mode = BODY_NONE;
+  x->left = 0;
+  x->chunk = CH_SIZE;
+  x->chunk_digits = false;
+  x->upstream_eof = false;
+  x->upstream_keep = false;
+  x->client_keep = false;
+  x->status = 0;
+  x->bytes = 0;
+  x->piped = 0;
+  x->prev = nullptr;
+  x->next = nullptr;
+  return x;
+}
+
+void proxy::free_exchange(proxy_exchange* x) {
+  // 管道中残留的数据无法取回，换一个新管道
+  if (x->piped > 0 && x->pipefd[0] >= 0) {
+    close(x->pipefd[0]);
+    close(x->pipefd[1]);
+    x->pipefd[0] = x->pipefd[1] = -1;
+  }
+  x->next = m_free;
+  m_free = x;
+}
+
+/*
+ * 组装发给上游的请求
+ * 请求行与请求头从读缓冲区中复制，去掉逐跳头部并追加 X-Forwarded-For，
+ * 已经读入读缓冲区的请求体随请求头一起发送
+ */
+http_conn::HTTP_CODE proxy::build_request(proxy_exchange* x, http_conn* c) {
+  char* buf = c->m_buf->read_buf;
+
+  // 请求行从读缓冲区开头开始，方法之后的分隔符已被改为 \0
+  std::string& req = x->req;
+  req.append(buf);
+  req += ' ';
+  req += c->m_url;
+  req += " HTTP/1.1\r\n";
+
+  // 逐行复制请求头，parse_line 已把每行末尾的 \r\n 改为 \0\0
+  const char* p = c->m_version + strlen(c->m_version) + 2;
+  const char* end = buf + c->m_checked_idx;
+  std::string forwarded;
+  bool expect_continue = false;
+  while (p < end && *p != '\0') {
+    size_t len = strlen(p);
+    const char* line = p;
+    p += len + 2;
+    const char* v;
+    if (hop_by_hop(line, len)) {
+      continue;
+    } else if (header_value(line, len, "Transfer-Encoding")) {
+      // 解析器只支持 Content-Length 的请求体
+      return http_conn::BAD_REQUEST;
+    } else if ((v = header_value(line, len, "Expect")) != nullptr) {
+      expect_continue = value_has(v, line + len, "100-continue");
+      continue;
+    } else if ((v = header_value(line, len, "X-Forwarded-For")) != nullptr) {
+      forwarded.assign(v, line + len - v);
+      continue;
+    }
+    req.append(line, len);
+    req += "\r\n";
+  }
+  char ip[INET_ADDRSTRLEN];
+  inet_ntop(AF_INET, &c->m_address.sin_addr, ip, sizeof(ip));
+  req += "X-Forwarded-For: ";
+  if (!forwarded.empty()) {
+    req += forwarded;
+    req += ", ";
+  }
+  req += ip;
+  req += "\r\n\r\n";
+
+  int avail = c->m_read_idx - c->m_checked_idx;
+  x->body_buffered = c->m_content_length < avail ? c->m_content_length : avail;
+  req.append(buf + c->m_checked_idx, x->body_buffered);
+  x->body_left = c->m_content_length - x->body_buffered;
+  x->replayable = x->body_left == 0 && c->m_method != http_conn::POST &&
+                  c->m_method != http_conn::PATCH;
+  x->head_only = c->m_method == http_conn::HEAD;
+  if (x->body_left > 0 && capture::get_instance()->enabled()) {
+    // 余下的请求体不经过 read_once，告诉 replay 这个连接无法回放
+    capture::get_instance()->mark_spliced(c->m_capture_session,
+                                          c->m_responses, x->body_left);
+  }
+
+  // 代替上游答复 100 Continue，客户端随后发送请求体
+  if (expect_continue && x->body_left > 0) {
+    send(c->m_sockfd, continue_response, sizeof(continue_response) - 1,
+         MSG_NOSIGNAL);
+  }
+  return http_conn::NO_REQUEST;
+}
+
+bool proxy::start(http_conn* c) {
+  proxy_exchange* x = alloc_exchange();
+  http_conn::HTTP_CODE ret = build_request(x, c);
+  if (ret == http_conn::NO_REQUEST) {
+    x->route = c->m_proxy_route;
+    x->upstream = upstream_table::get_instance()->pick(x->route);
+    if (x->upstream < 0) {
+      LOG_WARN("proxy: no live upstream for %s", c->m_url);
+      metrics::inc(metrics::local()->proxy_errors);
+      ret = http_conn::BAD_GATEWAY;
+    }
+  }
+  if (ret != http_conn::NO_REQUEST) {
+    free_exchange(x);
+    c->proxy_error(ret);
+    return true;
+  }
+
+  x->conn = c;
+  x->client_fd = c->m_sockfd;
+  c->m_exchange = x;
+  x->next = m_active;
+  if (m_active) {
+    m_active->prev = x;
+  }
+  m_active = x;
+
+  if (!connect_upstream(x, true)) {
+    return upstream_error(x, http_conn::BAD_GATEWAY);
+  }
+  return drive(x);
+}
+
+bool proxy::connect_upstream(proxy_exchange* x, bool allow_pool) {
+  x->req_sent = 0;
+  x->head_len = 0;
+  x->reused = false;
+  std::vector<int>& pool = m_pool[x->upstream];
+  if (allow_pool && !pool.empty()) {
+    // 后放回的连接最不可能已被上游关闭
+    int fd = pool.back();
+    pool.pop_back();
+    m_slots[fd].idle_upstream = -1;
+    m_slots[fd].x = x;
+    x->fd = fd;
+    x->reused = true;
+    x->st = proxy_exchange::SEND_REQUEST;
+    metrics::inc(metrics::local()->proxy_pooled);
+    return true;
+  }
+
+  const upstream_table::upstream* u =
+      upstream_table::get_instance()->get(x->upstream);
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    LOG_ERROR("proxy: socket failed, errno %d", errno);
+    return false;
+  }
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  metrics::inc(metrics::local()->proxy_connects);
+  if (connect(fd, (const sockaddr*)&u->addr, sizeof(u->addr)) == 0) {
+    add_upstream_fd(fd, x, 0);
+    x->st = proxy_exchange::SEND_REQUEST;
+    return true;
+  }
+  if (errno != EINPROGRESS) {
+    LOG_WARN("proxy: connect %s failed, errno %d", u->name.c_str(), errno);
+    close(fd);
+    return false;
+  }
+  add_upstream_fd(fd, x, 0);
+  x->st = proxy_exchange::CONNECTING;
+  watch_upstream(x, EPOLLOUT);
+  // connect 超时与响应超时分别设置
+  x->deadline_ms =
+      now_ms() + (int64_t)upstream_table::get_instance()->config().connect_timeout * 1000;
+  return true;
+}
+
+void proxy::add_upstream_fd(int fd, proxy_exchange* x, uint32_t events) {
+  if (fd >= (int)m_slots.size()) {
+    slot empty = {nullptr, -1, 0, 0, false};
+    m_slots.resize(fd + 1, empty);
+  }
+  slot& s = m_slots[fd];
+  s.x = x;
+  s.idle_upstream = -1;
+  s.gen = ++m_gen & 0x7fffffff;
+  s.events = events;
+  s.registered = true;
+  x->fd = fd;
+
+  epoll_event ev;
+  ev.events = events;
+  ev.data.u64 = EVENT_TAG | ((uint64_t)s.gen << 32) | (uint32_t)fd;
+  epoll_ctl(m_epollfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void proxy::set_upstream_events(proxy_exchange* x, uint32_t events) {
+  slot& s = m_slots[x->fd];
+  if (s.registered && s.events == events) {
+    return;
+  }
+  epoll_event ev;
+  ev.events = events;
+  ev.data.u64 = EVENT_TAG | ((uint64_t)s.gen << 32) | (uint32_t)x->fd;
+  epoll_ctl(m_epollfd, s.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, x->fd,
+            &ev);
+  s.events = events;
+  s.registered = true;
+}
+
+void proxy::watch_upstream(proxy_exchange* x, uint32_t events) {
+  set_upstream_events(x, events);
+  x->deadline_ms =
+      now_ms() + (int64_t)upstream_table::get_instance()->config().timeout * 1000;
+  // 等待上游期间仍要发现客户端断开：只关注 EPOLLRDHUP
+  if (!x->client_armed) {
+    x->conn->wait_for(0);
+    x->client_armed = true;
+  }
+}
+
+void proxy::watch_client(proxy_exchange* x, int events) {
+  set_upstream_events(x, 0);
+  x->deadline_ms = 0;
+  x->conn->wait_for(events);
+  x->client_armed = true;
+}
+
+void proxy::close_upstream_fd(int fd) {
+  slot& s = m_slots[fd];
+  if (s.registered) {
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, fd, 0);
+  }
+  close(fd);
+  s.x = nullptr;
+  s.idle_upstream = -1;
+  s.registered = false;
+  s.events = 0;
+}
+
+void proxy::release_upstream(proxy_exchange* x, bool reuse) {
+  if (x->fd < 0) {
+    return;
+  }
+  int fd = x->fd;
+  x->fd = -1;
+  std::vector<int>& pool = m_pool[x->upstream];
+  if (!reuse || http_conn::m_draining ||
+      (int)pool.size() >= upstream_table::get_instance()->config().pool_size) {
+    close_upstream_fd(fd);
+    return;
+  }
+  // 空闲连接上出现任何事件都说明它不能再用
+  slot& s = m_slots[fd];
+  s.x = nullptr;
+  s.idle_upstream = x->upstream;
+  epoll_event ev;
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  ev.data.u64 = EVENT_TAG | ((uint64_t)s.gen << 32) | (uint32_t)fd;
+  epoll_ctl(m_epollfd, s.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
+  s.events = ev.events;
+  s.registered = true;
+  pool.push_back(fd);
+}
+
+void proxy::close_exchange(proxy_exchange* x) {
+  if (x->fd >= 0) {
+    close_upstream_fd(x->fd);
+    x->fd = -1;
+  }
+  if (x->upstream >= 0) {
+    upstream_table::get_instance()->release(x->upstream);
+  }
+  if (x->prev) {
+    x->prev->next = x->next;
+  } else {
+    m_active = x->next;
+  }
+  if (x->next) {
+    x->next->prev = x->prev;
+  }
+  x->conn->m_exchange = nullptr;
+  free_exchange(x);
+}
+
+bool proxy::drive(proxy_exchange* x) {
+  while (true) {
+    step s;
+    switch (x->st) {
+      case proxy_exchange::CONNECTING:
+        s = STEP_WAIT;
+        break;
+      case proxy_exchange::SEND_REQUEST:
+        s = send_request(x);
+        break;
+      case proxy_exchange::SEND_BODY:
+        s = send_body(x);
+        break;
+      case proxy_exchange::READ_HEAD:
+        s = read_head(x);
+        break;
+      default:
+        s = relay(x);
+        break;
+    }
+    switch (s) {
+      case STEP_NEXT:
+        break;
+      case STEP_WAIT:
+        return true;
+      case STEP_UPSTREAM_ERROR:
+        return upstream_error(x, http_conn::BAD_GATEWAY);
+      case STEP_CLIENT_CLOSE:
+        close_exchange(x);
+        return false;
+      case STEP_DONE:
+        return finish(x);
+    }
+  }
+}
+
+proxy::step proxy::send_request(proxy_exchange* x) {
+  while (x->req_sent < x->req.size()) {
+    ssize_t n = send(x->fd, x->req.data() + x->req_sent,
+                     x->req.size() - x->req_sent, MSG_NOSIGNAL);
+    if (n > 0) {
+      x->req_sent += n;
+    } else if (n < 0 && errno == EAGAIN) {
+      watch_upstream(x, EPOLLOUT);
+      return STEP_WAIT;
+    } else {
+      return STEP_UPSTREAM_ERROR;
+    }
+  }
+  x->st = x->body_left > 0 ? proxy_exchange::SEND_BODY
+                           : proxy_exchange::READ_HEAD;
+  return STEP_NEXT;
+}
+
+/*
+ * 转发其余请求体：客户端 socket -> 管道 -> 上游 socket
+ * 管道清空之后才从客户端读下一段
+ */
+proxy::step proxy::send_body(proxy_exchange* x) {
+  while (true) {
+    if (x->piped > 0) {
+      ssize_t n = splice(x->pipefd[0], nullptr, x->fd, nullptr, x->piped,
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n > 0) {
+        x->piped -= n;
+        metrics::inc(metrics::local()->proxy_spliced, n);
+        continue;
+      }
+      if (n < 0 && errno == EAGAIN) {
+        watch_upstream(x, EPOLLOUT);
+        return STEP_WAIT;
+      }
+      return STEP_UPSTREAM_ERROR;
+    }
+    if (x->body_left == 0) {
+      x->st = proxy_exchange::READ_HEAD;
+      return STEP_NEXT;
+    }
+    size_t want = x->body_left < SPLICE_CHUNK ? x->body_left : SPLICE_CHUNK;
+    ssize_t n = splice(x->client_fd, nullptr, x->pipefd[1], nullptr, want,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n > 0) {
+      x->piped = n;
+      x->body_left -= n;
+    } else if (n < 0 && errno == EAGAIN) {
+      watch_client(x, EPOLLIN);
+      return STEP_WAIT;
+    } else {
+      return STEP_CLIENT_CLOSE;
+    }
+  }
+}
+
+// 在 [0, len) 中查找响应头结尾的空行，返回其后的位置
+static int find_head_end(const char* p, int len) {
+  for (int i = 3; i < len; i++) {
+    if (p[i] == '\n' && p[i - 1] == '\r' && p[i - 2] == '\n' &&
+        p[i - 3] == '\r') {
+      return i + 1;
+    }
+  }
+  return -1;
+}
+
+proxy::step proxy::read_head(proxy_exchange* x) {
+  while (true) {
+    int end = find_head_end(x->head, x->head_len);
+    if (end > 0) {
+      if (!parse_head(x, end)) {
+        LOG_WARN("proxy: invalid response head from %s",
+                 upstream_table::get_instance()->get(x->upstream)->name.c_str());
+        return STEP_UPSTREAM_ERROR;
+      }
+      if (x->st == proxy_exchange::RELAY) {
+        return STEP_NEXT;
+      }
+      // 丢弃了 1xx 中间响应，继续查找最终响应
+      continue;
+    }
+    if (x->head_len == HEAD_SIZE) {
+      LOG_WARN("proxy: response head from %s exceeds %d bytes",
+               upstream_table::get_instance()->get(x->upstream)->name.c_str(),
+               HEAD_SIZE);
+      return STEP_UPSTREAM_ERROR;
+    }
+    ssize_t n = recv(x->fd, x->head + x->head_len, HEAD_SIZE - x->head_len, 0);
+    if (n > 0) {
+      x->head_len += n;
+    } else if (n < 0 && errno == EAGAIN) {
+      watch_upstream(x, EPOLLIN);
+      return STEP_WAIT;
+    } else {
+      return STEP_UPSTREAM_ERROR;
+    }
+  }
+}
+
+/*
+ * 解析上游响应头并生成发给客户端的响应头
+ * 状态行与端到端头部原样保留，逐跳头部去掉，Connection 按客户端连接重新填写
+ */
+bool proxy::parse_head(proxy_exchange* x, int head_end) {
+  char* h = x->head;
+  if (head_end < 12 || strncmp(h, "HTTP/1.", 7) != 0 || h[8] != ' ') {
+    return false;
+  }
+  int status = atoi(h + 9);
+  if (status < 100 || status > 999 || status == 101) {
+    return false;
+  }
+  if (status < 200) {
+    // 100 Continue 等中间响应不转发
+    memmove(h, h + head_end, x->head_len - head_end);
+    x->head_len -= head_end;
+    return true;
+  }
+  upstream_table::get_instance()->report_success(x->upstream);
+  x->status = status;
+  x->upstream_keep = h[7] == '1';
+
+  std::string& out = x->out;
+  out.clear();
+  x->out_sent = 0;
+  int64_t length = -1;
+  bool chunked = false;
+  const char* p = h;
+  const char* end = h + head_end - 2;
+  bool status_line = true;
+  while (p < end) {
+    const char* eol = (const char*)memchr(p, '\r', end - p);
+    if (eol == nullptr) {
+      eol = end;
+    }
+    size_t len = eol - p;
+    const char* v;
+    if (status_line) {
+      status_line = false;
+    } else if ((v = header_value(p, len, "Connection")) != nullptr) {
+      if (value_has(v, eol, "close")) {
+        x->upstream_keep = false;
+      }
+      p = eol + 2;
+      continue;
+    } else if (hop_by_hop(p, len)) {
+      p = eol + 2;
+      continue;
+    } else if ((v = header_value(p, len, "Content-Length")) != nullptr) {
+      length = strtoll(v, nullptr, 10);
+    } else if ((v = header_value(p, len, "Transfer-Encoding")) != nullptr) {
+      chunked = value_has(v, eol, "chunked");
+    }
+    out.append(p, len);
+    out += "\r\n";
+    p = eol + 2;
+  }
+
+  if (x->head_only || status == 204 || status == 304) {
+    x->mode = BODY_NONE;
+  } else if (chunked) {
+    x->mode = BODY_CHUNKED;
+    x->chunk = CH_SIZE;
+    x->chunk_digits = false;
+    x->left = 0;
+  } else if (length > 0) {
+    x->mode = BODY_LENGTH;
+    x->left = length;
+  } else if (length == 0) {
+    x->mode = BODY_NONE;
+  } else {
+    // 响应体以上游关闭连接结束，客户端连接也只能随之关闭
+    x->mode = BODY_EOF;
+    x->upstream_keep = false;
+  }
+  x->client_keep =
+      x->conn->m_linger && !http_conn::m_draining && x->mode != BODY_EOF;
+  out += x->client_keep ? "Connection: keep-alive\r\n\r\n"
+                        : "Connection: close\r\n\r\n";
+  x->st = proxy_exchange::RELAY;
+
+  // 与响应头一起读到的部分响应体
+  if (x->head_len > head_end) {
+    feed_body(x, h + head_end, x->head_len - head_end);
+  }
+  return true;
+}
+
+void proxy::feed_body(proxy_exchange* x, const char* data, int len) {
+  int used = 0;
+  switch (x->mode) {
+    case BODY_NONE:
+      break;
+    case BODY_LENGTH:
+      used = len < x->left ? len : (int)x->left;
+      x->left -= used;
+      break;
+    case BODY_CHUNKED:
+      used = chunk_feed(x, data, len);
+      break;
+    case BODY_EOF:
+      used = len;
+      break;
+  }
+  x->out.append(data, used);
+  // 上游在响应结束后还发来数据，连接状态不可信，不再复用
+  if (used < len) {
+    x->upstream_keep = false;
+  }
+}
+
+// 响应体是否已经全部从上游读出
+static bool body_complete(const proxy_exchange* x) {
+  switch (x->mode) {
+    case BODY_LENGTH:
+      return x->left == 0;
+    case BODY_CHUNKED:
+      return x->chunk == CH_DONE;
+    case BODY_EOF:
+      return x->upstream_eof;
+    default:
+      return true;
+  }
+}
+
+/*
+ * 向客户端转发响应
+ * 先写完用户态数据与管道中的数据，再从上游读下一段：
+ * 块数据与定长响应体 splice 进管道，分块头读入用户态解析
+ */
+proxy::step proxy::relay(proxy_exchange* x) {
+  while (true) {
+    if (x->out_sent < x->out.size()) {
+      ssize_t n = send(x->client_fd, x->out.data() + x->out_sent,
+                       x->out.size() - x->out_sent, MSG_NOSIGNAL);
+      if (n > 0) {
+        x->out_sent += n;
+        x->bytes += n;
+        continue;
+      }
+      if (n < 0 && errno == EAGAIN) {
+        watch_client(x, EPOLLOUT);
+        return STEP_WAIT;
+      }
+      return STEP_CLIENT_CLOSE;
+    }
+    if (x->piped > 0) {
+      ssize_t n = splice(x->pipefd[0], nullptr, x->client_fd, nullptr,
+                         x->piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n > 0) {
+        x->piped -= n;
+        x->bytes += n;
+        metrics::inc(metrics::local()->proxy_spliced, n);
+        continue;
+      }
+      if (n < 0 && errno == EAGAIN) {
+        watch_client(x, EPOLLOUT);
+        return STEP_WAIT;
+      }
+      return STEP_CLIENT_CLOSE;
+    }
+    x->out.clear();
+    x->out_sent = 0;
+    if (x->mode == BODY_CHUNKED && x->chunk == CH_ERROR) {
+      LOG_WARN("proxy: invalid chunked body from %s",
+               upstream_table::get_instance()->get(x->upstream)->name.c_str());
+      return STEP_CLIENT_CLOSE;
+    }
+    if (body_complete(x)) {
+      return STEP_DONE;
+    }
+
+    ssize_t n;
+    if (x->mode != BODY_CHUNKED || x->chunk == CH_DATA) {
+      size_t want = SPLICE_CHUNK;
+      if (x->mode != BODY_EOF && x->left < SPLICE_CHUNK) {
+        want = x->left;
+      }
+      n = splice(x->fd, nullptr, x->pipefd[1], nullptr, want,
+                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n > 0) {
+        x->piped = n;
+        if (x->mode != BODY_EOF) {
+          x->left -= n;
+          if (x->mode == BODY_CHUNKED && x->left == 0) {
+            x->chunk = CH_DATA_CR;
+          }
+        }
+        continue;
+      }
+      if (n == 0 && x->mode == BODY_EOF) {
+        x->upstream_eof = true;
+        continue;
+      }
+    } else {
+      n = recv(x->fd, x->head, HEAD_SIZE, 0);
+      if (n > 0) {
+        feed_body(x, x->head, n);
+        continue;
+      }
+    }
+    if (n < 0 && errno == EAGAIN) {
+      watch_upstream(x, EPOLLIN);
+      return STEP_WAIT;
+    }
+    // 响应体不完整，客户端只能通过连接关闭得知
+    LOG_WARN("proxy: response from %s truncated",
+             upstream_table::get_instance()->get(x->upstream)->name.c_str());
+    return STEP_CLIENT_CLOSE;
+  }
+}
+
+/*
+ * 上游在返回响应头之前出错
+ * 可以重放的请求重试一次：复用的连接可能已被上游关闭，换新连接再试同一个上游，
+ * 不计入失败；新建的连接出错则计入失败并换一个上游
+ */
+bool proxy::upstream_error(proxy_exchange* x, http_conn::HTTP_CODE code) {
+  upstream_table* table = upstream_table::get_instance();
+  bool stale = x->reused && x->head_len == 0;
+  if (!stale) {
+    table->report_failure(x->upstream);
+  }
+  if (x->fd >= 0) {
+    close_upstream_fd(x->fd);
+    x->fd = -1;
+  }
+  if (!x->replayable || x->retried || x->head_len != 0) {
+    return fail(x, code);
+  }
+  x->retried = true;
+  if (!stale) {
+    int next = table->pick(x->route, x->upstream);
+    if (next < 0) {
+      return fail(x, code);
+    }
+    table->release(x->upstream);
+    x->upstream = next;
+  }
+  if (!connect_upstream(x, false)) {
+    return upstream_error(x, code);
+  }
+  return drive(x);
+}
+
+bool proxy::fail(proxy_exchange* x, http_conn::HTTP_CODE code) {
+  http_conn* c = x->conn;
+  metrics::inc(metrics::local()->proxy_errors);
+  close_exchange(x);
+  c->proxy_error(code);
+  return true;
+}
+
+bool proxy::finish(proxy_exchange* x) {
+  http_conn* c = x->conn;
+  bool keep = x->client_keep;
+  c->m_status = x->status;
+  c->m_response_bytes = x->bytes > INT_MAX ? INT_MAX : (int)x->bytes;
+  // 跳过读缓冲区中已经转发的请求体，之后是流水线中的下一个请求
+  c->m_checked_idx += x->body_buffered;
+  release_upstream(x, x->upstream_keep);
+  close_exchange(x);
+
+  metrics::record_response(c->m_status, c->m_response_bytes);
+  c->m_responses++;
+  c->log_access();
+  if (!keep) {
+    return false;
+  }
+  return c->keep_alive();
+}
+
+int proxy::handle_event(const epoll_event& ev, bool& keep) {
+  keep = true;
+  int fd = (int)(uint32_t)ev.data.u64;
+  uint32_t gen = (uint32_t)(ev.data.u64 >> 32) & 0x7fffffff;
+  if (fd >= (int)m_slots.size() || m_slots[fd].gen != gen) {
+    return -1;
+  }
+  slot& s = m_slots[fd];
+  if (s.idle_upstream >= 0) {
+    std::vector<int>& pool = m_pool[s.idle_upstream];
+    for (size_t i = 0; i < pool.size(); i++) {
+      if (pool[i] == fd) {
+        pool.erase(pool.begin() + i);
+        break;
+      }
+    }
+    close_upstream_fd(fd);
+    return -1;
+  }
+  proxy_exchange* x = s.x;
+  if (x == nullptr) {
+    return -1;
+  }
+  int client = x->client_fd;
+  if (x->st == proxy_exchange::CONNECTING) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err != 0) {
+      LOG_WARN("proxy: connect %s failed, errno %d",
+               upstream_table::get_instance()->get(x->upstream)->name.c_str(),
+               err);
+      keep = upstream_error(x, http_conn::BAD_GATEWAY);
+      return client;
+    }
+    x->st = proxy_exchange::SEND_REQUEST;
+  } else if (s.events == 0) {
+    // 正在等待客户端时上游关闭或出错：先移出 epoll，需要时再读出剩余数据
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, fd, 0);
+    s.registered = false;
+    return -1;
+  }
+  keep = drive(x);
+  return client;
+}
+
+bool proxy::client_event(http_conn* conn) {
+  proxy_exchange* x = conn->m_exchange;
+  x->client_armed = false;
+  return drive(x);
+}
+
+void proxy::abort(http_conn* conn) {
+  close_exchange(conn->m_exchange);
+}
+
+void proxy::check_timeouts(std::vector<int>& close_fds) {
+  upstream_table* table = upstream_table::get_instance();
+  int64_t now = now_ms();
+  proxy_exchange* x = m_active;
+  while (x) {
+    proxy_exchange* next = x->next;
+    if (x->deadline_ms != 0 && now >= x->deadline_ms) {
+      int client = x->client_fd;
+      LOG_WARN("proxy: upstream %s timed out",
+               table->get(x->upstream)->name.c_str());
+      bool keep;
+      if (x->st == proxy_exchange::CONNECTING) {
+        keep = upstream_error(x, http_conn::GATEWAY_TIMEOUT);
+      } else if (x->st != proxy_exchange::RELAY) {
+        // 请求可能已被处理，不重试
+        table->report_failure(x->upstream);
+        keep = fail(x, http_conn::GATEWAY_TIMEOUT);
+      } else {
+        close_exchange(x);
+        keep = false;
+      }
+      if (!keep) {
+        close_fds.push_back(client);
+      }
+    }
+    x = next;
+  }
+}
+
+void proxy::close_idle() {
+  for (size_t i = 0; i < m_pool.size(); i++) {
+    for (size_t j = 0; j < m_pool[i].size(); j++) {
+      close_upstream_fd(m_pool[i][j]);
+    }
+    m_pool[i].clear();
+  }
+}
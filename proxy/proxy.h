@@ -0,0 +1,157 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#include <vector>
+
+#include "../http/http_conn.h"
+#include "upstream.h"
+
+/*
+ * 反向代理，每个事件循环一个实例
+ * 匹配 proxy_pass 前缀的请求解析完请求头后交给本模块：按路由选择上游，
+ * 从本事件循环的连接池取出空闲长连接，没有时在同一个 epoll 中非阻塞 connect，
+ * 发送重新组装的请求头，再把响应原样转发给客户端。
+ *
+ * 请求体与响应体尽量用 splice 经过一个管道在两个 socket 之间搬运，不拷贝到用户态：
+ *   - 已经读入读缓冲区的请求体随请求头一起发送，其余部分从客户端 splice 到上游
+ *   - 响应头读入用户态，去掉逐跳头部并重写 Connection 后发给客户端
+ *   - Content-Length 响应体整段 splice；chunked 只把分块头读入用户态解析，
+ *     块数据 splice；没有长度的响应 splice 到上游关闭为止，之后关闭客户端连接
+ * 响应完整结束且上游允许长连接时，上游连接回到连接池，池中连接上的任何事件
+ * (上游关闭或发来意外数据)都使其被关闭。
+ *
+ * 在开始向客户端发送响应之前出错时返回 502(超时为 504)，可以重放的请求
+ * (请求体已完整缓冲且方法幂等)在复用连接失效或上游不可用时换一个连接重试一次；
+ * 之后出错只能关闭客户端连接。
+ */
+
+struct proxy_exchange;
+
+/**
+ * @class proxy
+ * @brief 一个事件循环的上游连接池与正在进行的转发
+ */
+class proxy {
+ public:
+  // 上游 socket 的 epoll 事件在 data.u64 中带有这一位与注册序号，
+  // 同一批事件中 fd 被关闭并重新分配时，旧事件不会交给新连接。
+  // 其他 fd 只设置 data.fd，注册时须把 epoll_event 清零，高位才不会误带标记
+  static const uint64_t EVENT_TAG = 1ULL << 63;
+
+  proxy();
+  ~proxy();
+
+  /**
+   * @brief 绑定事件循环的 epoll 实例，在事件循环线程中调用
+   */
+  void init(int epollfd);
+
+  /**
+   * @brief 事件是否属于上游连接
+   */
+  static bool owns_event(const epoll_event& ev) {
+    return (ev.data.u64 & EVENT_TAG) != 0;
+  }
+
+  /**
+   * @brief 开始转发 conn 上已解析完请求头的请求
+   * @details 请求无法转发时(没有可用上游、请求格式不支持)直接在 conn 上返回错误响应
+   *
+   * @param conn 客户端连接，m_proxy_route 为匹配的路由
+   * @return bool 为 false 时调用方需关闭客户端连接
+   */
+  bool start(http_conn* conn);
+
+  /**
+   * @brief 处理上游连接的事件
+   *
+   * @param[out] keep 为 false 时调用方需关闭返回的客户端连接，否则刷新其定时器
+   * @return int 相关的客户端 fd，没有时为 -1
+   */
+  int handle_event(const epoll_event& ev, bool& keep);
+
+  /**
+   * @brief 正在转发的客户端连接上的事件(可写或请求体可读)
+   *
+   * @return bool 为 false 时调用方需关闭客户端连接
+   */
+  bool client_event(http_conn* conn);
+
+  /**
+   * @brief 客户端连接关闭，结束其转发并关闭上游连接
+   */
+  void abort(http_conn* conn);
+
+  /**
+   * @brief 检查等待上游超时的转发，定时器到期时调用
+   *
+   * @param[out] close_fds 需要关闭的客户端 fd(已经开始发送响应、无法再返回 504 的)
+   */
+  void check_timeouts(std::vector<int>& close_fds);
+
+  /**
+   * @brief 关闭连接池中的空闲连接，排空或退出时调用
+   */
+  void close_idle();
+
+ private:
+  // 推进一次转发的结果
+  enum step {
+    STEP_NEXT,            ///< 状态已改变，继续推进
+    STEP_WAIT,            ///< 等待 socket 就绪
+    STEP_UPSTREAM_ERROR,  ///< 上游出错，尚未向客户端发送响应
+    STEP_CLIENT_CLOSE,    ///< 无法继续，关闭客户端连接
+    STEP_DONE             ///< 响应发送完毕
+  };
+
+  // 每个上游 fd 的登记信息，按 fd 索引
+  struct slot {
+    proxy_exchange* x;  ///< 使用该连接的转发，空闲连接为空
+    int idle_upstream;  ///< 空闲连接所属的上游，-1 表示不在池中
+    uint32_t gen;       ///< 注册序号，与事件中的序号一致才有效
+    uint32_t events;    ///< 当前关注的事件
+    bool registered;    ///< 是否在 epoll 中
+  };
+
+  proxy_exchange* alloc_exchange();
+  http_conn::HTTP_CODE build_request(proxy_exchange* x, http_conn* c);
+  void free_exchange(proxy_exchange* x);
+
+  // 为转发取得上游连接：先用池中的空闲连接，再新建
+  bool connect_upstream(proxy_exchange* x, bool allow_pool);
+  void add_upstream_fd(int fd, proxy_exchange* x, uint32_t events);
+  void set_upstream_events(proxy_exchange* x, uint32_t events);
+  // 等待上游就绪，刷新超时时间
+  void watch_upstream(proxy_exchange* x, uint32_t events);
+  // 等待客户端就绪，此时不计上游超时
+  void watch_client(proxy_exchange* x, int events);
+  void close_upstream_fd(int fd);
+  // 转发结束，上游连接放回池中或关闭
+  void release_upstream(proxy_exchange* x, bool reuse);
+
+  bool drive(proxy_exchange* x);
+  step send_request(proxy_exchange* x);
+  step send_body(proxy_exchange* x);
+  step read_head(proxy_exchange* x);
+  step relay(proxy_exchange* x);
+  bool parse_head(proxy_exchange* x, int head_end);
+  // 处理读入用户态的响应体数据，追加到发给客户端的数据中
+  void feed_body(proxy_exchange* x, const char* data, int len);
+
+  bool upstream_error(proxy_exchange* x, http_conn::HTTP_CODE code);
+  bool fail(proxy_exchange* x, http_conn::HTTP_CODE code);
+  bool finish(proxy_exchange* x);
+  void close_exchange(proxy_exchange* x);
+
+  int m_epollfd;
+  uint32_t m_gen;
+  std::vector<slot> m_slots;
+  std::vector<std::vector<int> > m_pool;  ///< 每个上游的空闲连接
+  proxy_exchange* m_active;               ///< 正在进行的转发(双向链表)
+  proxy_exchange* m_free;                 ///< 可复用的转发对象
+};
+
+#endif  // !PROXY_H
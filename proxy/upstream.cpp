@@ -0,0 +1,208 @@
+#include "upstream.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sstream>
+
+#include "../log/log.h"
+#include "../metrics/metrics.h"
+
+bool parse_proxy_route(const std::string& value, proxy_route_config& route,
+                       std::string& error) {
+  std::istringstream in(value);
+  std::string servers, balance, extra;
+  in >> route.prefix >> servers >> balance >> extra;
+  if (route.prefix.empty() || route.prefix[0] != '/' || servers.empty() ||
+      !extra.empty()) {
+    error = "expected '/prefix host:port[,host:port...] "
+            "[round_robin|least_conn]', got '" + value + "'";
+    return false;
+  }
+  if (balance.empty() || balance == "round_robin") {
+    route.balance = BALANCE_ROUND_ROBIN;
+  } else if (balance == "least_conn") {
+    route.balance = BALANCE_LEAST_CONN;
+  } else {
+    error = "unknown balance '" + balance + "'";
+    return false;
+  }
+  route.servers.clear();
+  size_t begin = 0;
+  while (begin <= servers.size()) {
+    size_t end = servers.find(',', begin);
+    if (end == std::string::npos) {
+      end = servers.size();
+    }
+    std::string server = servers.substr(begin, end - begin);
+    size_t colon = server.rfind(':');
+    int port = colon == std::string::npos ? 0 : atoi(server.c_str() + colon + 1);
+    if (colon == 0 || port <= 0 || port > 65535) {
+      error = "bad upstream '" + server + "', expected host:port";
+      return false;
+    }
+    route.servers.push_back(server);
+    begin = end + 1;
+  }
+  return true;
+}
+
+bool resolve_upstream(const std::string& server, sockaddr_in& addr) {
+  size_t colon = server.rfind(':');
+  std::string host = server.substr(0, colon);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(atoi(server.c_str() + colon + 1));
+  if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) == 1) {
+    return true;
+  }
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* res = nullptr;
+  if (getaddrinfo(host.c_str(), nullptr, &hints, &res) != 0 || res == nullptr) {
+    return false;
+  }
+  addr.sin_addr = ((sockaddr_in*)res->ai_addr)->sin_addr;
+  freeaddrinfo(res);
+  return true;
+}
+
+static int64_t now_ms() { return (int64_t)(metrics_now_ns() / 1000000); }
+
+upstream_table* upstream_table::get_instance() {
+  static upstream_table instance;
+  return &instance;
+}
+
+upstream_table::upstream_table() {}
+
+upstream_table::~upstream_table() {
+  for (size_t i = 0; i < m_routes.size(); i++) {
+    delete m_routes[i];
+  }
+  for (size_t i = 0; i < m_upstreams.size(); i++) {
+    delete m_upstreams[i];
+  }
+}
+
+bool upstream_table::init(const proxy_config& config) {
+  m_config = config;
+  for (size_t i = 0; i < config.routes.size(); i++) {
+    const proxy_route_config& rc = config.routes[i];
+    route* r = new route;
+    r->prefix = rc.prefix;
+    r->balance = rc.balance;
+    r->next = 0;
+    m_routes.push_back(r);
+    for (size_t j = 0; j < rc.servers.size(); j++) {
+      // 多条路由指向同一地址时共享健康状态
+      int index = -1;
+      for (size_t k = 0; k < m_upstreams.size(); k++) {
+        if (m_upstreams[k]->name == rc.servers[j]) {
+          index = (int)k;
+          break;
+        }
+      }
+      if (index < 0) {
+        upstream* u = new upstream;
+        u->name = rc.servers[j];
+        u->active = 0;
+        u->fails = 0;
+        u->down_until_ms = 0;
+        if (!resolve_upstream(u->name, u->addr)) {
+          LOG_ERROR("proxy: cannot resolve upstream %s", u->name.c_str());
+          delete u;
+          return false;
+        }
+        index = (int)m_upstreams.size();
+        m_upstreams.push_back(u);
+      }
+      r->upstreams.push_back(index);
+    }
+    LOG_INFO("proxy: %s -> %d upstreams, %s", r->prefix.c_str(),
+             (int)r->upstreams.size(),
+             r->balance == BALANCE_LEAST_CONN ? "least_conn" : "round_robin");
+  }
+  return true;
+}
+
+int upstream_table::match(const char* url) const {
+  for (size_t i = 0; i < m_routes.size(); i++) {
+    const std::string& prefix = m_routes[i]->prefix;
+    if (strncmp(url, prefix.c_str(), prefix.size()) == 0) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+bool upstream_table::available(const upstream* u, int64_t now) const {
+  int64_t until = u->down_until_ms.load(std::memory_order_relaxed);
+  return until == 0 || until <= now;
+}
+
+int upstream_table::pick(int route_index, int exclude) {
+  route* r = m_routes[route_index];
+  int n = (int)r->upstreams.size();
+  int64_t now = now_ms();
+  unsigned int start = r->next.fetch_add(1, std::memory_order_relaxed);
+  int chosen = -1;
+  int chosen_active = 0;
+  for (int i = 0; i < n; i++) {
+    int index = r->upstreams[(start + i) % n];
+    upstream* u = m_upstreams[index];
+    if (index == exclude || !available(u, now)) {
+      continue;
+    }
+    if (r->balance == BALANCE_ROUND_ROBIN) {
+      chosen = index;
+      break;
+    }
+    int active = u->active.load(std::memory_order_relaxed);
+    if (chosen < 0 || active < chosen_active) {
+      chosen = index;
+      chosen_active = active;
+    }
+  }
+  if (chosen >= 0) {
+    m_upstreams[chosen]->active.fetch_add(1, std::memory_order_relaxed);
+  }
+  return chosen;
+}
+
+void upstream_table::release(int index) {
+  m_upstreams[index]->active.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void upstream_table::report_success(int index) {
+  upstream* u = m_upstreams[index];
+  if (u->fails.load(std::memory_order_relaxed) != 0) {
+    u->fails.store(0, std::memory_order_relaxed);
+  }
+  if (u->down_until_ms.load(std::memory_order_relaxed) != 0) {
+    u->down_until_ms.store(0, std::memory_order_relaxed);
+    LOG_INFO("proxy: upstream %s is back", u->name.c_str());
+  }
+}
+
+void upstream_table::report_failure(int index) {
+  upstream* u = m_upstreams[index];
+  int fails = u->fails.fetch_add(1, std::memory_order_relaxed) + 1;
+  // 暂停期满后的请求相当于试探，成功之前再次失败立即重新暂停
+  int64_t until = u->down_until_ms.load(std::memory_order_relaxed);
+  if (fails < m_config.max_fails && until == 0) {
+    return;
+  }
+  u->fails.store(0, std::memory_order_relaxed);
+  u->down_until_ms.store(now_ms() + (int64_t)m_config.fail_timeout * 1000,
+                         std::memory_order_relaxed);
+  if (until == 0) {
+    metrics::inc(metrics::local()->proxy_upstream_down);
+    LOG_WARN("proxy: upstream %s failed %d times, disabled for %ds",
+             u->name.c_str(), fails, m_config.fail_timeout);
+  }
+}
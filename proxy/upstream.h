@@ -0,0 +1,145 @@
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+/*
+ * 反向代理的上游表
+ * 每条路由把一个路径前缀转发到一组上游服务器，按配置顺序取第一个匹配的前缀。
+ * 路由与上游在启动时建立，之后只读；上游的健康状态与活跃请求数由所有事件循环
+ * 共享，用原子变量更新。连接池按事件循环各自保存，见 proxy.h。
+ *
+ * 被动健康检查：连接失败、发送失败或在收到响应头之前出错/超时都算一次失败，
+ * 连续失败 max_fails 次后该上游在 fail_timeout 秒内不再被选中，
+ * 期满后重新参与选择，下一次成功收到响应头时清零失败计数；
+ * 期满后的第一次尝试仍然失败时立即重新暂停，不再等满 max_fails 次。
+ */
+
+/**
+ * @enum proxy_balance
+ * @brief 同一路由内选择上游的方式
+ */
+enum proxy_balance {
+  BALANCE_ROUND_ROBIN = 0,  ///< 轮询
+  BALANCE_LEAST_CONN        ///< 活跃请求最少者优先，相同时轮询
+};
+
+/**
+ * @struct proxy_route_config
+ * @brief 一条 proxy_pass 配置
+ */
+struct proxy_route_config {
+  std::string prefix;                 ///< 路径前缀
+  std::vector<std::string> servers;   ///< 上游地址，host:port
+  proxy_balance balance;
+
+  proxy_route_config() : balance(BALANCE_ROUND_ROBIN) {}
+};
+
+/**
+ * @struct proxy_config
+ * @brief 反向代理参数
+ */
+struct proxy_config {
+  std::vector<proxy_route_config> routes;
+  int pool_size;        ///< 每个事件循环对每个上游保留的空闲长连接数
+  int connect_timeout;  ///< 连接上游的超时(秒)
+  int timeout;          ///< 等待上游响应或数据的超时(秒)
+  int max_fails;        ///< 连续失败多少次后暂停使用该上游
+  int fail_timeout;     ///< 暂停使用的时长(秒)
+
+  proxy_config()
+      : pool_size(32),
+        connect_timeout(3),
+        timeout(10),
+        max_fails(3),
+        fail_timeout(10) {}
+  bool enabled() const { return !routes.empty(); }
+};
+
+/**
+ * @brief 解析 proxy_pass 的值: "<前缀> host:port[,host:port...] [round_robin|least_conn]"
+ *
+ * @param[out] error 失败原因
+ */
+bool parse_proxy_route(const std::string& value, proxy_route_config& route,
+                       std::string& error);
+
+/**
+ * @brief 把 "host:port" 解析为 IPv4 地址，host 可以是主机名
+ */
+bool resolve_upstream(const std::string& server, sockaddr_in& addr);
+
+/**
+ * @class upstream_table
+ * @brief 全局路由与上游表(单例)，各事件循环线程共享
+ */
+class upstream_table {
+ public:
+  // 一个上游服务器
+  struct upstream {
+    std::string name;  ///< 配置中的 host:port
+    sockaddr_in addr;
+    std::atomic<int> active;             ///< 正在进行的请求数
+    std::atomic<int> fails;              ///< 连续失败次数
+    std::atomic<int64_t> down_until_ms;  ///< 暂停使用的截止时间，0 表示可用
+  };
+
+  static upstream_table* get_instance();
+
+  /**
+   * @brief 解析地址并建立路由，只在事件循环启动前调用一次
+   *
+   * @return bool 有地址无法解析时返回 false
+   */
+  bool init(const proxy_config& config);
+  bool enabled() const { return !m_routes.empty(); }
+  const proxy_config& config() const { return m_config; }
+  int upstream_count() const { return (int)m_upstreams.size(); }
+  upstream* get(int index) { return m_upstreams[index]; }
+
+  /**
+   * @brief 按前缀匹配路由
+   *
+   * @return int 路由编号，没有匹配时返回 -1
+   */
+  int match(const char* url) const;
+
+  /**
+   * @brief 为一次请求选择上游，并增加其活跃请求数
+   *
+   * @param exclude 不选择的上游编号(重试时排除刚失败的上游)，-1 表示不排除
+   * @return int 上游编号，路由内的上游都被暂停时返回 -1
+   */
+  int pick(int route, int exclude = -1);
+  // 请求结束，减少活跃请求数
+  void release(int index);
+  // 收到响应头，清零失败计数
+  void report_success(int index);
+  // 一次失败，达到 max_fails 时暂停使用
+  void report_failure(int index);
+
+ private:
+  upstream_table();
+  ~upstream_table();
+
+  struct route {
+    std::string prefix;
+    std::vector<int> upstreams;  ///< 上游编号
+    proxy_balance balance;
+    std::atomic<unsigned int> next;  ///< 轮询位置
+  };
+
+  bool available(const upstream* u, int64_t now_ms) const;
+
+  proxy_config m_config;
+  std::vector<upstream*> m_upstreams;  ///< 相同地址的上游只保存一份
+  std::vector<route*> m_routes;
+};
+
+#endif  // !UPSTREAM_H
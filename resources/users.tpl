@@ -0,0 +1,18 @@
+{{! 管理端口 GET /auth/users 渲染的用户列表，见 auth/auth_routes.cpp }}
+<html>
+  <head>
+    <meta charset="utf-8">
+    <title>{{title}}</title>
+  </head>
+  <body>
+    <h1>{{title}} ({{count}})</h1>
+    <ul>
+{{#users}}
+      <li>{{username}}</li>
+{{/users}}
+    </ul>
+{{^users}}
+    <p>No users yet.</p>
+{{/users}}
+  </body>
+</html>
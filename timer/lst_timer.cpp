@@ -18,6 +18,7 @@
 #include <type_traits>
 
 #include "../http/http_conn.h"
+#include "../metrics/metrics.h"
 
 sort_timer_lst::sort_timer_lst() {
     head = nullptr;
@@ -37,46 +38,22 @@ void sort_timer_lst::add_timer(util_timer* timer) {
     if (!timer) {
         return;
     }
-
-    if (!head) {
-        head = tail = timer;
-        return;
-    }
-    // 如果新的定时器的超时时间小于当前头部,插在头部
-    if (timer->expire < head->expire) {
-        timer->next = head;
-        head->prev = timer;
-        head = timer;
-        return;
-    }
-
-    add_timer(timer, head);
+    timer->prev = nullptr;
+    timer->next = nullptr;
+    insert_from_tail(timer);
 }
 
 void sort_timer_lst::adjust_timer(util_timer* timer) {
     if (!timer) {
         return;
     }
-    util_timer* temp = timer->next;
-
-    // 如果被调整的timer在链表尾部,或者超时时间仍然小于下一个节点,则不要移动
-    if (!temp || (timer->expire < temp->expire)) {
+    // 仍然位于前后两个节点之间,则不要移动
+    if ((!timer->prev || timer->prev->expire <= timer->expire) &&
+        (!timer->next || timer->expire <= timer->next->expire)) {
         return;
     }
-
-    // 如果是头部节点,将其取出,重新插入
-    if (timer == head) {
-        head = head->next;
-        head->prev = nullptr;
-        timer->next = nullptr;
-        add_timer(timer, head);
-    } else {
-        // 既不是头部,又不是尾部,且时间变大了
-        // 先取出来
-        timer->prev->next = timer->next;
-        timer->next->prev = timer->prev;
-        add_timer(timer, timer->next);
-    }
+    unlink(timer);
+    insert_from_tail(timer);
 }
 
 void sort_timer_lst::del_timer(util_timer* timer) {
@@ -126,39 +103,54 @@ void sort_timer_lst::tick() {
         }
 
         // 执行回调函数
+        metrics::inc(metrics::local()->timeouts[temp->user_data->conn->stage()]);
         temp->cb_func(temp->user_data);
         // 删除该节点,继续检查下一个
         head = temp->next;
         if (head) {
             head->prev = nullptr;
+        } else {
+            tail = nullptr;
         }
         delete temp;
         temp = head;
     }
 }
 
-void sort_timer_lst::add_timer(util_timer* timer, util_timer* lst_head) {
-    util_timer* prev = lst_head;
-    util_timer* temp = prev->next;
-
-    // 遍历找到第一个大于 timer->expire 的节点
-    while (temp) {
-        if (timer->expire < temp->expire) {
-            prev->next = timer;
-            timer->next = temp;
-            temp->prev = timer;
-            timer->prev = prev;
-            return;
-        }
-        prev = temp;
-        temp = temp->next;
+void sort_timer_lst::insert_from_tail(util_timer* timer) {
+    // 各阶段的超时时长相近,新的超时时间大多排在末尾附近,从尾部找起
+    util_timer* prev = tail;
+    while (prev && timer->expire < prev->expire) {
+        prev = prev->prev;
     }
-
-    // 如果遍历完都没找到,说明他是最大的,插在尾部
-    prev->next = timer;
     timer->prev = prev;
+    if (prev) {
+        timer->next = prev->next;
+        prev->next = timer;
+    } else {
+        timer->next = head;
+        head = timer;
+    }
+    if (timer->next) {
+        timer->next->prev = timer;
+    } else {
+        tail = timer;
+    }
+}
+
+void sort_timer_lst::unlink(util_timer* timer) {
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        head = timer->next;
+    }
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    } else {
+        tail = timer->prev;
+    }
+    timer->prev = nullptr;
     timer->next = nullptr;
-    tail = timer;
 }
 
 void Utils::init(int timeslot) { m_TIMESLOT = timeslot; }
@@ -171,7 +163,7 @@ int Utils::setnonblocking(int fd) {
 }
 
 void Utils::addfd(int epollfd, int fd, bool one_shot, int TRIGMode) {
-    epoll_event event;
+    epoll_event event = {};
     event.data.fd = fd;
 
     if (1 == TRIGMode) {
@@ -191,7 +183,9 @@ void Utils::addfd(int epollfd, int fd, bool one_shot, int TRIGMode) {
 void Utils::sig_handler(int sig) {
     int save_errno = errno;
     int msg = sig;
-    send(u_pipefd[1], (char*)&msg, 1, 0);
+    for (int i = 0; i < u_pipe_count; i++) {
+        send(u_pipefd[i], (char*)&msg, 1, 0);
+    }
     errno = save_errno;
 }
 
@@ -203,7 +197,10 @@ void Utils::addsig(int sig, void(handler)(int), bool restart) {
         sa.sa_flags |= SA_RESTART;
     }
     sigfillset(&sa.sa_mask);
-    assert(sigaction(sig, &sa, nullptr) != -1);
+    // Release 构建定义了 NDEBUG，sigaction 不能写在 assert 里
+    int ret = sigaction(sig, &sa, nullptr);
+    assert(ret != -1);
+    (void)ret;
 }
 
 void Utils::timer_handler() {
@@ -219,11 +216,14 @@ void Utils::show_error(int connfd, const char* info) {
 }
 
 int* Utils::u_pipefd = 0;
-int Utils::u_epollfd = 0;
+int Utils::u_pipe_count = 0;
+__thread int Utils::u_epollfd = 0;
 
 void cb_func(client_data* user_data) {
     epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
     close(user_data->sockfd);
+    user_data->conn->release_buffers();
     http_conn::m_user_count--;
+    metrics::inc(metrics::local()->closed);
 }
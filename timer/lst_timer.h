@@ -25,12 +25,14 @@
 #include "log/log.h"
 
 class util_timer;
+class http_conn;
 
 // 用户数据结构
 struct client_data {
     sockaddr_in address;
     int sockfd;
     util_timer* timer;
+    http_conn* conn;  // 关闭连接时归还它的请求缓冲区
 };
 
 // 定时器节点类
@@ -60,27 +62,35 @@ public:
 
     // 添加定时器
     void add_timer(util_timer* timer);
-    // 调整定时器 (当某个人物发生时,比如收到了数据,要延长多少时间,需要往后移动)
+    // 调整定时器 (连接进入新的阶段或有了新的活动,超时时间可能变大也可能变小)
     void adjust_timer(util_timer* timer);
     // 删除定时器
     void del_timer(util_timer* timer);
     // 心跳函数
     void tick();
+    // 最早超时的定时器
+    util_timer* front() const { return head; }
 
 private:
     util_timer* head;
     util_timer* tail;
 
     // 私有辅助函数
-    void add_timer(util_timer* timer, util_timer* lst_head);
+    // 从尾部向前找到插入位置
+    void insert_from_tail(util_timer* timer);
+    // 从链表中取出,不释放
+    void unlink(util_timer* timer);
 };
 
 // 工具类
 class Utils {
 public:
+    // 各事件循环信号管道的写端，信号处理函数把信号写入每一个管道
     static int* u_pipefd;
+    static int u_pipe_count;
     sort_timer_lst m_timer_lst;
-    static int u_epollfd;
+    // 当前线程事件循环的 epoll 实例
+    static __thread int u_epollfd;
     int m_TIMESLOT;
 
 public:
@@ -0,0 +1,47 @@
+#!/bin/bash
+# 在本机跑一组可复现的压测场景，每个场景输出一行 JSON
+#
+# 用法: tools/bench.sh [build_dir] [duration_seconds] [scenario...]
+#   build_dir  包含 server 与 loadgen 的构建目录，默认 ./build
+#   duration   每个场景的压测时长，默认 10 秒
+#   scenario   small large 404 churn idle 的任意子集，默认全部
+#
+# 服务器在临时目录中启动，网站根目录为仓库的 resources/ 加上生成的 1mb.bin，
+# 同一台机器上比较不同构建时保持参数一致即可。
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD=$(cd "${1:-$ROOT/build}" && pwd)
+DURATION=${2:-10}
+shift 2 2>/dev/null || shift $#
+SCENARIOS=${*:-small large 404 churn idle}
+PORT=${BENCH_PORT:-9006}
+
+WORK=$(mktemp -d)
+SERVER_PID=
+cleanup() {
+    if [ -n "$SERVER_PID" ]; then
+        kill "$SERVER_PID" 2>/dev/null || true
+        wait "$SERVER_PID" 2>/dev/null || true
+    fi
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+cp -r "$ROOT/resources" "$WORK/resources"
+head -c 1048576 /dev/urandom > "$WORK/resources/1mb.bin"
+
+# 空闲长连接场景需要 5 万以上的文件描述符
+ulimit -n "$(ulimit -Hn)" 2>/dev/null || true
+
+cd "$WORK"
+"$BUILD/server" -p "$PORT" -c 1 &
+SERVER_PID=$!
+sleep 1
+
+for s in $SCENARIOS; do
+    "$BUILD/loadgen" -S "$s" -p "$PORT" -d "$DURATION" -t "$(nproc)"
+    # 等待上一场景的连接关闭，避免影响下一个场景
+    sleep 2
+done
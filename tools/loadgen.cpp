@@ -0,0 +1,656 @@
+/**
+ * @file
+ * @brief HTTP/1.1 压测客户端
+ *
+ * 基于 epoll 的多线程开环(open-loop)压测工具。请求按固定速率排入计划表，
+ * 延迟从"计划发送时间"开始计算，服务器变慢时排队等待的时间也计入延迟，
+ * 不会出现协调遗漏(coordinated omission)。
+ *
+ * 用法: loadgen [-S scenario] [-H host] [-p port] [-u path]... [-t threads]
+ *               [-c conns] [-r rate] [-d seconds] [-k 0|1] [-P depth]
+ *               [-i idle_conns] [-g grace_seconds]
+ *   -S  预置场景: small | large | 404 | churn | idle，其余参数可覆盖预置值
+ *   -u  请求路径，可重复指定，按轮询顺序使用
+ *   -c  发请求的连接总数，平均分给各线程
+ *   -r  总请求速率(req/s)；0 表示闭环模式，每个连接收到响应后立即发下一个
+ *   -k  1 使用长连接(默认)，0 每个请求新建连接
+ *   -P  流水线深度，每个连接最多同时在途的请求数
+ *   -i  额外建立的空闲长连接数，只发一个请求后保持不动，结束时统计仍存活的数量
+ *   -g  压测结束后等待在途请求的时间
+ *
+ * 结果以一行 JSON 输出到标准输出。
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "tool_common.h"
+
+// 每个源地址最多建立的连接数，留出余量避免耗尽临时端口
+static const int CONNS_PER_SOURCE = 20000;
+static const int READ_CHUNK = 65536;
+static const int MAX_EVENTS = 1024;
+static const size_t IDLE_RAMP = 64;
+static const uint64_t IDLE_SETUP_TIMEOUT = 10ull * 1000000000;
+
+struct lg_options {
+  std::string scenario;
+  std::string host;
+  int port;
+  std::vector<std::string> paths;
+  int threads;
+  int conns;
+  double rate;
+  double duration;
+  bool keepalive;
+  int pipeline;
+  int idle;
+  double grace;
+};
+
+// 预置场景，参数均可被命令行覆盖
+struct lg_scenario {
+  const char* name;
+  const char* path;
+  int conns;
+  double rate;
+  bool keepalive;
+  int idle;
+};
+
+static const lg_scenario scenarios[] = {
+    {"small", "/index.html", 64, 20000, true, 0},
+    {"large", "/1mb.bin", 16, 500, true, 0},
+    {"404", "/__loadgen_missing", 64, 20000, true, 0},
+    {"churn", "/index.html", 64, 2000, false, 0},
+    {"idle", "/index.html", 16, 2000, true, 50000},
+};
+
+enum conn_state { CONN_CLOSED = 0, CONN_CONNECTING, CONN_OPEN };
+
+/**
+ * @struct lg_conn
+ * @brief 单个客户端连接，响应按流式解析，响应体只计数不缓存
+ */
+struct lg_conn {
+  int fd;
+  conn_state state;
+  bool idle;      ///< 空闲保活连接
+  int requests;   ///< 本连接已发送的请求数
+  std::string out;
+  size_t out_off;
+  response_parser resp;
+  std::deque<uint64_t> inflight; ///< 在途请求的计划发送时间
+
+  lg_conn()
+      : fd(-1),
+        state(CONN_CLOSED),
+        idle(false),
+        requests(0),
+        out_off(0) {}
+};
+
+/**
+ * @struct lg_worker
+ * @brief 压测线程的全部状态与统计结果
+ */
+struct lg_worker {
+  int id;
+  const lg_options* opt;
+  struct sockaddr_in addr;
+  bool loopback;
+  int epollfd;
+  std::vector<lg_conn> conns;  ///< 前 active 个为压测连接，其后为空闲连接
+  int active;
+  double rate;
+  size_t path_rr;
+
+  std::deque<uint64_t> pending;  ///< 已到计划时间但还没发出的请求
+  uint64_t sent;
+  uint64_t responses;
+  uint64_t errors;
+  uint64_t connects;
+  uint64_t connect_errors;
+  uint64_t bytes;
+  uint64_t unsent;
+  uint64_t idle_open;
+  std::map<int, uint64_t> status;
+  std::vector<uint64_t> latency;  ///< 纳秒
+};
+
+static pthread_barrier_t g_start_barrier;
+
+
+static void close_conn(lg_worker* w, lg_conn& c) {
+  if (c.fd >= 0) {
+    epoll_ctl(w->epollfd, EPOLL_CTL_DEL, c.fd, 0);
+    close(c.fd);
+  }
+  // 连接断开时尚未收到响应的请求记为错误
+  w->errors += c.inflight.size();
+  c.inflight.clear();
+  c.fd = -1;
+  c.state = CONN_CLOSED;
+  c.requests = 0;
+  c.out.clear();
+  c.out_off = 0;
+  c.resp.reset();
+}
+
+static void open_conn(lg_worker* w, lg_conn& c, int index) {
+  // 压测本机时每个源地址的临时端口有限，大量连接分散到不同的 127.x 源地址
+  int source = 0;
+  if (w->loopback) {
+    source = (w->id * (int)w->conns.size() + index) / CONNS_PER_SOURCE;
+  }
+  w->connects++;
+  bool connecting = false;
+  int fd = connect_nonblocking(w->addr, source, &connecting);
+  if (fd < 0) {
+    w->connect_errors++;
+    return;
+  }
+  c.fd = fd;
+  c.state = connecting ? CONN_CONNECTING : CONN_OPEN;
+
+  epoll_event ev;
+  ev.data.u32 = index;
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  epoll_ctl(w->epollfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static void append_request(lg_worker* w, lg_conn& c) {
+  const std::string& path = w->opt->paths[w->path_rr++ % w->opt->paths.size()];
+  c.out += "GET ";
+  c.out += path;
+  c.out += " HTTP/1.1\r\nHost: ";
+  c.out += w->opt->host;
+  c.out += w->opt->keepalive ? "\r\nConnection: keep-alive\r\n\r\n"
+                             : "\r\nConnection: close\r\n\r\n";
+  c.requests++;
+}
+
+static void flush_out(lg_worker* w, lg_conn& c) {
+  while (c.out_off < c.out.size()) {
+    ssize_t n = send(c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off,
+                     MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        close_conn(w, c);
+      }
+      return;
+    }
+    c.out_off += n;
+  }
+  c.out.clear();
+  c.out_off = 0;
+}
+
+// 连接能否再接一个请求
+static bool can_send(const lg_worker* w, const lg_conn& c) {
+  if (c.state != CONN_OPEN || c.idle) {
+    return false;
+  }
+  if (!w->opt->keepalive) {
+    return c.requests == 0;
+  }
+  return (int)c.inflight.size() < w->opt->pipeline;
+}
+
+static void complete_response(lg_worker* w, lg_conn& c, uint64_t now) {
+  uint64_t planned = c.inflight.front();
+  c.inflight.pop_front();
+  // 空闲连接的握手请求不计入统计
+  if (!c.idle) {
+    w->status[c.resp.status]++;
+    w->responses++;
+    w->latency.push_back(now - planned);
+  }
+}
+
+/**
+ * @brief 读取并解析响应
+ * @return false 连接已关闭
+ */
+static bool read_conn(lg_worker* w, lg_conn& c) {
+  char buf[READ_CHUNK];
+  while (true) {
+    ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return true;
+      }
+      close_conn(w, c);
+      return false;
+    }
+    if (n == 0) {
+      close_conn(w, c);
+      return false;
+    }
+    w->bytes += n;
+
+    const char* p = buf;
+    const char* end = buf + n;
+    response_event ev;
+    while ((ev = c.resp.feed(&p, end)) != RESPONSE_MORE) {
+      if (ev == RESPONSE_BAD || c.inflight.empty()) {
+        close_conn(w, c);
+        return false;
+      }
+      if (ev == RESPONSE_DONE) {
+        complete_response(w, c, now_ns());
+        if (c.resp.server_close || !w->opt->keepalive) {
+          close_conn(w, c);
+          return false;
+        }
+      }
+    }
+  }
+}
+
+static void handle_event(lg_worker* w, int index, uint32_t events) {
+  lg_conn& c = w->conns[index];
+  if (c.fd < 0) {
+    return;
+  }
+  if (c.state == CONN_CONNECTING) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err != 0) {
+      w->connect_errors++;
+      close_conn(w, c);
+      return;
+    }
+    if (events & (EPOLLOUT | EPOLLIN)) {
+      c.state = CONN_OPEN;
+    }
+  }
+  if (events & EPOLLIN) {
+    if (!read_conn(w, c)) {
+      return;
+    }
+  }
+  if (events & (EPOLLHUP | EPOLLERR)) {
+    close_conn(w, c);
+    return;
+  }
+  if ((events & EPOLLOUT) && c.out_off < c.out.size()) {
+    flush_out(w, c);
+  }
+}
+
+// 把到期的请求分给有空闲容量的连接
+static void dispatch(lg_worker* w) {
+  for (int i = 0; i < w->active && !w->pending.empty(); i++) {
+    lg_conn& c = w->conns[i];
+    if (c.state == CONN_CLOSED) {
+      open_conn(w, c, i);
+      continue;
+    }
+    bool wrote = false;
+    while (!w->pending.empty() && can_send(w, c)) {
+      c.inflight.push_back(w->pending.front());
+      w->pending.pop_front();
+      append_request(w, c);
+      w->sent++;
+      wrote = true;
+    }
+    if (wrote) {
+      flush_out(w, c);
+    }
+  }
+}
+
+static void poll_events(lg_worker* w, int timeout_ms) {
+  epoll_event events[MAX_EVENTS];
+  int n = epoll_wait(w->epollfd, events, MAX_EVENTS, timeout_ms);
+  for (int i = 0; i < n; i++) {
+    handle_event(w, events[i].data.u32, events[i].events);
+  }
+}
+
+// 建立空闲连接，每个连接发一个请求确认连接可用
+// 同时进行中的握手不超过 IDLE_RAMP 个，避免瞬间打满服务器的 accept 队列
+static void open_idle_conns(lg_worker* w) {
+  size_t next = w->active;
+  size_t first = w->active;  ///< 之前的连接都已完成握手或失败
+  uint64_t deadline = now_ns() + IDLE_SETUP_TIMEOUT;
+  while (first < w->conns.size() && now_ns() < deadline) {
+    size_t waiting = 0;
+    for (size_t i = first; i < next; i++) {
+      lg_conn& c = w->conns[i];
+      if (c.state == CONN_OPEN && c.requests == 0) {
+        c.inflight.push_back(now_ns());
+        append_request(w, c);
+        flush_out(w, c);
+      }
+      if (c.state == CONN_CONNECTING || !c.inflight.empty()) {
+        waiting++;
+      } else if (i == first) {
+        first++;
+      }
+    }
+    while (waiting < IDLE_RAMP && next < w->conns.size()) {
+      w->conns[next].idle = true;
+      open_conn(w, w->conns[next], next);
+      next++;
+      waiting++;
+    }
+    if (waiting == 0) {
+      break;
+    }
+    poll_events(w, 10);
+  }
+  // 超时仍未完成握手的连接放弃，记为连接失败
+  for (size_t i = first; i < w->conns.size(); i++) {
+    lg_conn& c = w->conns[i];
+    if (c.state == CONN_CONNECTING || !c.inflight.empty()) {
+      c.inflight.clear();
+      close_conn(w, c);
+      w->connect_errors++;
+    }
+  }
+}
+
+static void* worker_main(void* arg) {
+  lg_worker* w = (lg_worker*)arg;
+  const lg_options* opt = w->opt;
+  w->epollfd = epoll_create1(0);
+
+  if (w->conns.size() > (size_t)w->active) {
+    open_idle_conns(w);
+  }
+  for (int i = 0; i < w->active; i++) {
+    open_conn(w, w->conns[i], i);
+  }
+
+  // 所有线程的连接都建立后同时开始计时
+  pthread_barrier_wait(&g_start_barrier);
+  uint64_t start = now_ns();
+  uint64_t end = start + (uint64_t)(opt->duration * 1e9);
+  double interval = w->rate > 0 ? 1e9 / w->rate : 0;
+  uint64_t scheduled = 0;
+
+  while (true) {
+    uint64_t now = now_ns();
+    if (now >= end) {
+      break;
+    }
+    uint64_t next = end;
+    if (interval > 0) {
+      // 开环：按计划时间把到期请求排入队列，不管之前的请求是否完成
+      while (true) {
+        uint64_t t = start + (uint64_t)(scheduled * interval);
+        if (t > now) {
+          next = std::min(next, t);
+          break;
+        }
+        w->pending.push_back(t);
+        scheduled++;
+      }
+    } else {
+      // 闭环：每个连接收到响应后立即补发，延迟从实际发送时间算起
+      for (int i = 0; i < w->active; i++) {
+        lg_conn& c = w->conns[i];
+        if (c.state == CONN_CLOSED) {
+          open_conn(w, c, i);
+        }
+        bool wrote = false;
+        while (can_send(w, c)) {
+          c.inflight.push_back(now);
+          append_request(w, c);
+          w->sent++;
+          wrote = true;
+        }
+        if (wrote) {
+          flush_out(w, c);
+        }
+      }
+    }
+    dispatch(w);
+    int timeout = (int)((next - now) / 1000000);
+    poll_events(w, std::min(timeout, 100));
+  }
+
+  // 停止发送新请求，等待在途响应
+  w->unsent = w->pending.size();
+  w->pending.clear();
+  uint64_t grace_end = end + (uint64_t)(opt->grace * 1e9);
+  while (now_ns() < grace_end) {
+    bool busy = false;
+    for (int i = 0; i < w->active; i++) {
+      if (!w->conns[i].inflight.empty()) {
+        busy = true;
+        break;
+      }
+    }
+    if (!busy) {
+      break;
+    }
+    poll_events(w, 10);
+  }
+
+  for (size_t i = 0; i < w->conns.size(); i++) {
+    lg_conn& c = w->conns[i];
+    if (c.idle && c.state == CONN_OPEN) {
+      // 检查对端是否已关闭
+      char probe;
+      ssize_t n = recv(c.fd, &probe, 1, MSG_PEEK | MSG_DONTWAIT);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        w->idle_open++;
+      }
+    }
+    // 此时仍在途的请求都记为错误
+    close_conn(w, c);
+  }
+  close(w->epollfd);
+  return nullptr;
+}
+
+static void apply_scenario(lg_options& opt, const char* name) {
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+    const lg_scenario& s = scenarios[i];
+    if (strcmp(s.name, name) == 0) {
+      opt.scenario = s.name;
+      opt.paths.assign(1, s.path);
+      opt.conns = s.conns;
+      opt.rate = s.rate;
+      opt.keepalive = s.keepalive;
+      opt.idle = s.idle;
+      return;
+    }
+  }
+  fprintf(stderr, "loadgen: unknown scenario %s\n", name);
+  exit(1);
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: loadgen [-S small|large|404|churn|idle] [-H host] [-p port] "
+          "[-u path]...\n"
+          "               [-t threads] [-c conns] [-r rate] [-d seconds] "
+          "[-k 0|1] [-P depth]\n"
+          "               [-i idle_conns] [-g grace_seconds]\n");
+}
+
+static void print_json(const lg_options& opt, std::vector<lg_worker>& workers,
+                       double elapsed) {
+  uint64_t sent = 0, responses = 0, errors = 0, connects = 0;
+  uint64_t connect_errors = 0, bytes = 0, unsent = 0, idle_open = 0;
+  std::map<int, uint64_t> status;
+  std::vector<uint64_t> latency;
+  for (size_t i = 0; i < workers.size(); i++) {
+    lg_worker& w = workers[i];
+    sent += w.sent;
+    responses += w.responses;
+    errors += w.errors;
+    connects += w.connects;
+    connect_errors += w.connect_errors;
+    bytes += w.bytes;
+    unsent += w.unsent;
+    idle_open += w.idle_open;
+    merge_status(status, w.status);
+    latency.insert(latency.end(), w.latency.begin(), w.latency.end());
+  }
+
+  std::string paths;
+  for (size_t i = 0; i < opt.paths.size(); i++) {
+    paths += i ? ",\"" : "\"";
+    paths += opt.paths[i] + "\"";
+  }
+  printf(
+      "{\"scenario\":\"%s\",\"paths\":[%s],\"threads\":%d,\"connections\":%d,"
+      "\"idle_connections\":%d,\"keepalive\":%s,\"pipeline\":%d,"
+      "\"target_rps\":%.0f,\"duration_s\":%.3f,\"sent\":%llu,"
+      "\"responses\":%llu,\"errors\":%llu,\"unsent\":%llu,\"connects\":%llu,"
+      "\"connect_errors\":%llu,\"idle_open\":%llu,\"status\":%s,"
+      "\"throughput_rps\":%.1f,\"rx_bytes_per_s\":%.0f,\"latency_us\":%s}\n",
+      opt.scenario.c_str(), paths.c_str(), opt.threads, opt.conns, opt.idle,
+      opt.keepalive ? "true" : "false", opt.pipeline, opt.rate, elapsed,
+      (unsigned long long)sent, (unsigned long long)responses,
+      (unsigned long long)errors, (unsigned long long)unsent,
+      (unsigned long long)connects, (unsigned long long)connect_errors,
+      (unsigned long long)idle_open, status_json(status).c_str(),
+      responses / elapsed, bytes / elapsed, latency_json(latency).c_str());
+}
+
+int main(int argc, char* argv[]) {
+  lg_options opt;
+  opt.scenario = "custom";
+  opt.host = "127.0.0.1";
+  opt.port = 9006;
+  opt.threads = 1;
+  opt.conns = 16;
+  opt.rate = 1000;
+  opt.duration = 10;
+  opt.keepalive = true;
+  opt.pipeline = 1;
+  opt.idle = 0;
+  opt.grace = 2;
+
+  const char* optstring = "S:H:p:u:t:c:r:d:k:P:i:g:h";
+  // 第一遍只取场景，保证命令行其余参数能覆盖场景预置值
+  int ch;
+  while ((ch = getopt(argc, argv, optstring)) != -1) {
+    if (ch == 'S') {
+      apply_scenario(opt, optarg);
+    }
+  }
+  optind = 1;
+  bool paths_set = false;
+  while ((ch = getopt(argc, argv, optstring)) != -1) {
+    switch (ch) {
+      case 'S':
+        break;
+      case 'H':
+        opt.host = optarg;
+        break;
+      case 'p':
+        opt.port = atoi(optarg);
+        break;
+      case 'u':
+        if (!paths_set) {
+          opt.paths.clear();
+          paths_set = true;
+        }
+        opt.paths.push_back(optarg);
+        break;
+      case 't':
+        opt.threads = std::max(1, atoi(optarg));
+        break;
+      case 'c':
+        opt.conns = std::max(1, atoi(optarg));
+        break;
+      case 'r':
+        opt.rate = atof(optarg);
+        break;
+      case 'd':
+        opt.duration = atof(optarg);
+        break;
+      case 'k':
+        opt.keepalive = atoi(optarg) != 0;
+        break;
+      case 'P':
+        opt.pipeline = std::max(1, atoi(optarg));
+        break;
+      case 'i':
+        opt.idle = std::max(0, atoi(optarg));
+        break;
+      case 'g':
+        opt.grace = atof(optarg);
+        break;
+      default:
+        usage();
+        return 1;
+    }
+  }
+  if (opt.paths.empty()) {
+    opt.paths.push_back("/index.html");
+  }
+  if (opt.threads > opt.conns) {
+    opt.threads = opt.conns;
+  }
+
+  struct sockaddr_in addr;
+  if (!resolve(opt.host, opt.port, &addr)) {
+    fprintf(stderr, "loadgen: cannot resolve %s\n", opt.host.c_str());
+    return 1;
+  }
+
+  // 空闲连接场景需要大量文件描述符
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  std::vector<lg_worker> workers(opt.threads);
+  pthread_barrier_init(&g_start_barrier, nullptr, opt.threads);
+  for (int i = 0; i < opt.threads; i++) {
+    lg_worker& w = workers[i];
+    w.id = i;
+    w.opt = &opt;
+    w.addr = addr;
+    w.loopback = (ntohl(addr.sin_addr.s_addr) >> 24) == 127;
+    w.active = opt.conns / opt.threads + (i < opt.conns % opt.threads ? 1 : 0);
+    int idle = opt.idle / opt.threads + (i < opt.idle % opt.threads ? 1 : 0);
+    w.conns.resize(w.active + idle);
+    w.rate = opt.rate / opt.threads;
+    w.path_rr = i;
+    w.sent = w.responses = w.errors = w.connects = w.connect_errors = 0;
+    w.bytes = w.unsent = w.idle_open = 0;
+    if (w.rate > 0) {
+      w.latency.reserve((size_t)(w.rate * opt.duration * 1.1));
+    }
+  }
+
+  std::vector<pthread_t> tids(opt.threads);
+  for (int i = 0; i < opt.threads; i++) {
+    pthread_create(&tids[i], nullptr, worker_main, &workers[i]);
+  }
+  for (int i = 0; i < opt.threads; i++) {
+    pthread_join(tids[i], nullptr);
+  }
+  pthread_barrier_destroy(&g_start_barrier);
+
+  print_json(opt, workers, opt.duration);
+  return 0;
+}
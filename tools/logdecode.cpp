@@ -0,0 +1,242 @@
+/**
+ * @file
+ * @brief 二进制访问日志离线解码工具
+ *
+ * 用法: logdecode [-f text|csv] [-s] [-r docroot] [-t N] segment...
+ *   -f  输出格式，text(默认) 或 csv
+ *   -s  不逐条输出，只打印汇总：状态码分布与延迟分位数
+ *   -r  网站根目录，用于把路径哈希还原为 URL
+ *   -t  汇总时按请求数列出前 N 个路径的分位数(默认 10)
+ */
+
+#include <arpa/inet.h>
+#include <ftw.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "log/access_log.h"
+#include "tool_common.h"
+
+// 与 http_conn::METHOD 的顺序保持一致
+static const char* method_names[] = {"GET",   "POST",    "HEAD",
+                                     "PUT",   "DELETE",  "TRACE",
+                                     "OPTIONS", "CONNECT", "PATCH"};
+
+static std::unordered_map<uint32_t, std::string> g_paths;
+static size_t g_root_len = 0;
+
+static int collect_path(const char* fpath, const struct stat*, int typeflag,
+                        struct FTW*) {
+  if (typeflag == FTW_F) {
+    const char* url = fpath + g_root_len;
+    g_paths[access_path_hash(url, strlen(url))] = url;
+  }
+  return 0;
+}
+
+// 遍历网站根目录，建立 路径哈希 -> URL 的映射
+static void load_docroot(const char* root) {
+  std::string r(root);
+  while (r.size() > 1 && r[r.size() - 1] == '/') {
+    r.erase(r.size() - 1);
+  }
+  g_root_len = r.size();
+  nftw(r.c_str(), collect_path, 16, FTW_PHYS);
+}
+
+static std::string path_of(uint32_t hash) {
+  std::unordered_map<uint32_t, std::string>::iterator it = g_paths.find(hash);
+  if (it != g_paths.end()) {
+    return it->second;
+  }
+  char buf[16];
+  snprintf(buf, sizeof(buf), "#%08x", hash);
+  return buf;
+}
+
+/**
+ * @brief 读取一个分段文件中的全部记录
+ * 正常关闭的分段以文件头中的 count 为准，异常退出的分段扫描到第一个空槽位为止
+ */
+static bool read_segment(const char* name, std::vector<access_record>& out) {
+  FILE* fp = fopen(name, "rb");
+  if (fp == nullptr) {
+    fprintf(stderr, "logdecode: cannot open %s\n", name);
+    return false;
+  }
+  access_segment_header hdr;
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+      memcmp(hdr.magic, ACCESS_LOG_MAGIC, sizeof(hdr.magic)) != 0 ||
+      hdr.record_size != sizeof(access_record)) {
+    fprintf(stderr, "logdecode: %s is not an access log segment\n", name);
+    fclose(fp);
+    return false;
+  }
+
+  uint64_t limit = hdr.count ? hdr.count : hdr.capacity;
+  access_record rec;
+  for (uint64_t i = 0; i < limit; i++) {
+    if (fread(&rec, sizeof(rec), 1, fp) != 1 || rec.timestamp_us == 0) {
+      break;
+    }
+    out.push_back(rec);
+  }
+  fclose(fp);
+  return true;
+}
+
+static void format_time(uint64_t us, char* buf, size_t len) {
+  time_t sec = us / 1000000;
+  struct tm tm_val;
+  localtime_r(&sec, &tm_val);
+  size_t n = strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm_val);
+  snprintf(buf + n, len - n, ".%06u", (unsigned)(us % 1000000));
+}
+
+static void print_record(const access_record& r, bool csv) {
+  char ts[40];
+  char addr[INET_ADDRSTRLEN];
+  format_time(r.timestamp_us, ts, sizeof(ts));
+  struct in_addr in;
+  in.s_addr = r.client_addr;
+  inet_ntop(AF_INET, &in, addr, sizeof(addr));
+  const char* method = r.method < sizeof(method_names) / sizeof(method_names[0])
+                           ? method_names[r.method]
+                           : "-";
+  std::string path = path_of(r.path_hash);
+  if (csv) {
+    printf("%s,%s,%u,%s,%s,%u,%u,%u\n", ts, addr, ntohs(r.client_port), method,
+           path.c_str(), r.status, r.bytes, r.latency_us);
+  } else {
+    printf("%s %s:%u %s %s %u %uB %uus\n", ts, addr, ntohs(r.client_port),
+           method, path.c_str(), r.status, r.bytes, r.latency_us);
+  }
+}
+
+static void print_latency(const char* label, std::vector<uint32_t>& lat) {
+  std::sort(lat.begin(), lat.end());
+  printf("%-32s n=%-9zu p50=%-8u p90=%-8u p99=%-8u p999=%-8u max=%u (us)\n",
+         label, lat.size(), percentile(lat, 0.50), percentile(lat, 0.90),
+         percentile(lat, 0.99), percentile(lat, 0.999),
+         lat.empty() ? 0 : lat.back());
+}
+
+static void print_summary(const std::vector<access_record>& recs, int top) {
+  std::map<int, size_t> status_count;
+  std::unordered_map<uint32_t, std::vector<uint32_t> > by_path;
+  std::vector<uint32_t> all;
+  uint64_t bytes = 0;
+  uint64_t first = 0, last = 0;
+
+  all.reserve(recs.size());
+  for (size_t i = 0; i < recs.size(); i++) {
+    const access_record& r = recs[i];
+    status_count[r.status]++;
+    by_path[r.path_hash].push_back(r.latency_us);
+    all.push_back(r.latency_us);
+    bytes += r.bytes;
+    if (first == 0 || r.timestamp_us < first) {
+      first = r.timestamp_us;
+    }
+    if (r.timestamp_us > last) {
+      last = r.timestamp_us;
+    }
+  }
+
+  double span = (last - first) / 1e6;
+  printf("requests: %zu  bytes: %llu  span: %.3fs", recs.size(),
+         (unsigned long long)bytes, span);
+  if (span > 0) {
+    printf("  rate: %.1f req/s", recs.size() / span);
+  }
+  printf("\n\nstatus:\n");
+  for (std::map<int, size_t>::iterator it = status_count.begin();
+       it != status_count.end(); ++it) {
+    printf("  %d  %zu\n", it->first, it->second);
+  }
+
+  printf("\nlatency:\n");
+  print_latency("  all", all);
+
+  // 按请求数排序后输出前 top 个路径
+  std::vector<std::pair<size_t, uint32_t> > order;
+  for (std::unordered_map<uint32_t, std::vector<uint32_t> >::iterator it =
+           by_path.begin();
+       it != by_path.end(); ++it) {
+    order.push_back(std::make_pair(it->second.size(), it->first));
+  }
+  std::sort(order.rbegin(), order.rend());
+  for (size_t i = 0; i < order.size() && (int)i < top; i++) {
+    std::string label = "  " + path_of(order[i].second);
+    print_latency(label.c_str(), by_path[order[i].second]);
+  }
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: logdecode [-f text|csv] [-s] [-r docroot] [-t N] "
+          "segment...\n");
+}
+
+int main(int argc, char* argv[]) {
+  bool csv = false;
+  bool summary = false;
+  int top = 10;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "f:sr:t:h")) != -1) {
+    switch (opt) {
+      case 'f':
+        csv = strcmp(optarg, "csv") == 0;
+        break;
+      case 's':
+        summary = true;
+        break;
+      case 'r':
+        load_docroot(optarg);
+        break;
+      case 't':
+        top = atoi(optarg);
+        break;
+      default:
+        usage();
+        return 1;
+    }
+  }
+  if (optind >= argc) {
+    usage();
+    return 1;
+  }
+
+  std::vector<access_record> recs;
+  for (int i = optind; i < argc; i++) {
+    read_segment(argv[i], recs);
+  }
+  // 多个线程的分段交错在一起，按时间排序后输出
+  std::stable_sort(recs.begin(), recs.end(),
+                   [](const access_record& a, const access_record& b) {
+                     return a.timestamp_us < b.timestamp_us;
+                   });
+
+  if (summary) {
+    print_summary(recs, top);
+    return 0;
+  }
+  if (csv) {
+    printf("timestamp,client,port,method,path,status,bytes,latency_us\n");
+  }
+  for (size_t i = 0; i < recs.size(); i++) {
+    print_record(recs[i], csv);
+  }
+  return 0;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file
+ * @brief 把文档根目录打包为资源快照
+ *
+ * 生成的文件通过配置项 asset_snapshot 加载，格式见 http/asset_snapshot.h。
+ * 先写入临时文件再改名，正在使用旧快照的进程不受影响。
+ *
+ * 用法: packassets [-r docroot] [-o output] [-z gzip_min] [-l]
+ *   -r  文档根目录(默认 ./resources)
+ *   -o  输出文件(默认 assets.snap)
+ *   -z  小于该字节数的文件不生成 gzip 版本(默认 256)，-1 表示都不生成
+ *   -l  打包后列出每个路径及其大小
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "http/asset_snapshot.h"
+
+static void usage(const char* prog) {
+  fprintf(stderr, "usage: %s [-r docroot] [-o output] [-z gzip_min] [-l]\n",
+          prog);
+}
+
+static void list_paths(const asset_snapshot& assets,
+                       const std::vector<asset_source>& files) {
+  for (size_t i = 0; i < files.size(); i++) {
+    const asset_entry* e = assets.find(files[i].path.c_str());
+    printf("%-48s %10llu", files[i].path.c_str(),
+           (unsigned long long)e->body_len[0]);
+    if (e->gzip) {
+      printf(" %10llu gzip", (unsigned long long)e->body_len[1]);
+    }
+    printf("\n");
+  }
+}
+
+int main(int argc, char* argv[]) {
+  std::string root = "./resources";
+  std::string output = "assets.snap";
+  int gzip_min = 256;
+  bool list = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "r:o:z:l")) != -1) {
+    switch (opt) {
+      case 'r':
+        root = optarg;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'z':
+        gzip_min = atoi(optarg);
+        break;
+      case 'l':
+        list = true;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  std::vector<asset_source> files;
+  std::string blob, error;
+  asset_pack_stats stats;
+  if (!collect_assets(root, files, error) ||
+      !pack_assets(files, gzip_min, blob, stats, error)) {
+    fprintf(stderr, "packassets: %s\n", error.c_str());
+    return 1;
+  }
+
+  std::string tmp = output + ".tmp";
+  FILE* fp = fopen(tmp.c_str(), "wb");
+  if (fp == nullptr || fwrite(blob.data(), 1, blob.size(), fp) != blob.size() ||
+      fclose(fp) != 0 || rename(tmp.c_str(), output.c_str()) != 0) {
+    fprintf(stderr, "packassets: cannot write %s: %s\n", output.c_str(),
+            strerror(errno));
+    unlink(tmp.c_str());
+    return 1;
+  }
+
+  printf("%s: %u files, %u paths, %llu bytes raw, %u gzipped (%llu bytes), "
+         "snapshot %llu bytes\n",
+         output.c_str(), stats.files, stats.paths,
+         (unsigned long long)stats.raw_bytes, stats.gzipped,
+         (unsigned long long)stats.gzip_bytes, (unsigned long long)stats.size);
+  if (list) {
+    asset_snapshot assets;
+    if (!assets.attach(blob, error)) {
+      fprintf(stderr, "packassets: %s\n", error.c_str());
+      return 1;
+    }
+    list_paths(assets, files);
+  }
+  return 0;
+}
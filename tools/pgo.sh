@@ -0,0 +1,110 @@
+#!/bin/bash
+# PGO 构建流程
+#   1. 构建普通 Release 版本作为对照
+#   2. 构建插桩版本，用 loadgen 在本机回环上跑一组代表性负载收集 profile
+#   3. 使用 profile 重新构建，并与 Release 版本比较吞吐
+#
+# 用法: tools/pgo.sh [out_dir] [train_seconds] [compare_seconds]
+#   out_dir          构建输出目录，默认 ./build-pgo，其下生成 release/ 与 pgo/
+#   train_seconds    每个训练场景的时长，默认 5 秒
+#   compare_seconds  每轮吞吐对比的时长，默认 10 秒
+# 额外的 cmake 参数可以通过环境变量 CMAKE_ARGS 传入，
+# PGO_PORT 指定测试端口(默认 9107)，PGO_ROUNDS 指定对比轮数(默认 5)。
+#
+# 最终的 PGO 版本为 out_dir/pgo/server，对比结果以一行 JSON 输出。
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+OUT=${1:-$ROOT/build-pgo}
+TRAIN=${2:-5}
+COMPARE=${3:-10}
+PORT=${PGO_PORT:-9107}
+ROUNDS=${PGO_ROUNDS:-5}
+JOBS=$(nproc)
+
+mkdir -p "$OUT"
+OUT=$(cd "$OUT" && pwd)
+RELEASE="$OUT/release"
+PGO_DIR="$OUT/pgo"
+PROFILE="$PGO_DIR/pgo-profile"
+
+WORK=$(mktemp -d)
+SERVER_PID=
+stop_server() {
+    if [ -n "$SERVER_PID" ]; then
+        # SIGTERM 让事件循环正常退出，插桩版本在进程退出时写出 profile
+        kill -TERM "$SERVER_PID" 2>/dev/null || true
+        wait "$SERVER_PID" 2>/dev/null || true
+        SERVER_PID=
+    fi
+}
+cleanup() {
+    stop_server
+    rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+start_server() {
+    (cd "$WORK" && exec "$1" -p "$PORT" -c 1) &
+    SERVER_PID=$!
+    sleep 1
+}
+
+cp -r "$ROOT/resources" "$WORK/resources"
+head -c 1048576 /dev/urandom > "$WORK/resources/1mb.bin"
+
+echo "==> Release build" >&2
+cmake -S "$ROOT" -B "$RELEASE" -DCMAKE_BUILD_TYPE=Release $CMAKE_ARGS >&2
+cmake --build "$RELEASE" -j "$JOBS" --target server loadgen >&2
+LOADGEN="$RELEASE/loadgen"
+
+echo "==> Instrumented build" >&2
+rm -rf "$PROFILE"
+cmake -S "$ROOT" -B "$PGO_DIR" -DCMAKE_BUILD_TYPE=Release -DPGO=generate \
+    -DPGO_PROFILE_DIR="$PROFILE" $CMAKE_ARGS >&2
+cmake --build "$PGO_DIR" -j "$JOBS" --target server >&2
+
+# 训练负载：覆盖小文件、404、大文件、短连接与流水线，比例大致对应线上的静态请求
+echo "==> Training" >&2
+start_server "$PGO_DIR/server"
+for s in small 404 large churn; do
+    "$LOADGEN" -S "$s" -p "$PORT" -d "$TRAIN" -r 0 >&2
+done
+"$LOADGEN" -p "$PORT" -d "$TRAIN" -r 0 -c 16 -P 8 -u /index.html -u /missing >&2
+stop_server
+
+# clang 生成 .profraw，需要合并为 .profdata；gcc 的 .gcda 可直接使用
+if ls "$PROFILE"/*.profraw >/dev/null 2>&1; then
+    llvm-profdata merge -o "$PROFILE/server.profdata" "$PROFILE"/*.profraw
+fi
+
+echo "==> Optimized build" >&2
+cmake -S "$ROOT" -B "$PGO_DIR" -DPGO=use $CMAKE_ARGS >&2
+cmake --build "$PGO_DIR" -j "$JOBS" --target server >&2
+
+# 交替运行两个版本各若干轮，取吞吐中位数
+throughput() {
+    start_server "$1"
+    "$LOADGEN" -S small -p "$PORT" -d "$COMPARE" -r 0 -c 32 -P 4 |
+        sed -n 's/.*"throughput_rps":\([0-9.]*\).*/\1/p'
+    stop_server
+}
+median() {
+    printf '%s\n' "$@" | sort -n | sed -n "$((($# + 1) / 2))p"
+}
+
+echo "==> Comparing" >&2
+REL=()
+OPT=()
+for round in $(seq "$ROUNDS"); do
+    REL+=("$(throughput "$RELEASE/server")")
+    OPT+=("$(throughput "$PGO_DIR/server")")
+    echo "round $round: release ${REL[-1]} req/s, pgo ${OPT[-1]} req/s" >&2
+done
+R=$(median "${REL[@]}")
+P=$(median "${OPT[@]}")
+awk -v r="$R" -v p="$P" 'BEGIN {
+    printf "{\"release_rps\":%.1f,\"pgo_rps\":%.1f,\"delta_pct\":%.2f}\n",
+           r, p, (r > 0 ? (p - r) * 100 / r : 0)
+}'
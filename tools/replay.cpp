@@ -0,0 +1,624 @@
+/**
+ * @file
+ * @brief 流量回放工具
+ *
+ * 读取服务器录制的分段文件(配置项 capture_dir)，把每个录制的连接作为一个会话重新发给服务器。
+ * 每次 read_once 读到的数据作为一块，按原来的到达时间发送；录制时这块数据之前已经发送完
+ * 多少个响应，回放时也要先收到同样多的响应才发送它。因此连接的划分、流水线的深度与
+ * "收到响应再发下一个请求"的依赖都与录制时一致，只有两块之间的间隔按速度缩放。
+ *
+ * 请求体由 proxy 直接转发、没有录下来的连接(CAPTURE_SPLICED)无法回放，整个跳过，
+ * 计入 skipped_sessions。
+ *
+ * 延迟从请求的最后一个字节写入 socket 开始，到响应完整收到为止。
+ * 服务器跟不上时数据块会晚于计划时间发送，超出的部分记为 lag，由它判断回放是否按计划进行。
+ *
+ * 用法: replay [-H host] [-p port] [-s speed] [-t threads] [-c conns]
+ *              [-g grace_seconds] segment...
+ *   -s  回放速度，1 为原速(默认)，N 为 N 倍速，0 为不等待计划时间，尽快发送
+ *   -t  线程数，会话按顺序轮流分给各线程
+ *   -c  同时打开的连接数上限，平均分给各线程，会话在有空位时才开始(默认 1024)
+ *   -g  全部数据发送完后等待响应的时间
+ *
+ * 结果以一行 JSON 输出到标准输出。
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "log/capture.h"
+#include "tool_common.h"
+
+static const int READ_CHUNK = 65536;
+static const int MAX_EVENTS = 1024;
+// 回放本机时轮流使用的 127.x 源地址数，会话由客户端先关闭，TIME_WAIT 分散到各地址
+static const int LOOPBACK_SOURCES = 16;
+
+struct rp_options {
+  std::string host;
+  int port;
+  double speed;
+  int threads;
+  int conns;
+  double grace;
+};
+
+/**
+ * @struct rp_chunk
+ * @brief 一次 read_once 读到的数据，在会话数据中的位置
+ */
+struct rp_chunk {
+  uint64_t time_ns;    ///< 录制时的到达时间
+  uint32_t responses;  ///< 发送前需要收到的响应数
+  size_t end;          ///< 在会话数据中的结束位置
+};
+
+/**
+ * @struct rp_session
+ * @brief 一个录制的连接
+ */
+struct rp_session {
+  uint64_t id;
+  uint64_t start_ns;                ///< 连接建立的时间，没有 OPEN 记录时为第一块数据的时间
+  std::string data;                 ///< 全部请求字节
+  std::vector<rp_chunk> chunks;
+  std::vector<size_t> request_ends; ///< 每个完整请求的结束位置
+  std::vector<bool> head;           ///< 请求是 HEAD，响应没有响应体
+  bool spliced;                     ///< 有请求体没有录下来，跳过
+};
+
+/**
+ * @struct rp_conn
+ * @brief 正在回放的会话
+ */
+struct rp_conn {
+  int fd;
+  bool connecting;
+  const rp_session* s;
+  size_t next_chunk;  ///< 下一个待发送的数据块
+  size_t queued;      ///< 已到发送条件的数据结束位置
+  size_t sent;        ///< 已写入 socket 的字节数
+  size_t next_req;    ///< 下一个还没有完整写出的请求
+  size_t responses;   ///< 已收到的响应数
+  std::deque<uint64_t> inflight;  ///< 已写出、等待响应的请求的写出时间
+  response_parser resp;
+};
+
+/**
+ * @struct rp_worker
+ * @brief 回放线程的全部状态与统计结果
+ */
+struct rp_worker {
+  int id;
+  const rp_options* opt;
+  struct sockaddr_in addr;
+  bool loopback;
+  uint64_t t0;  ///< 录制中最早的时间
+  int epollfd;
+  std::vector<const rp_session*> sessions;
+  std::vector<rp_conn> conns;
+  std::vector<int> free_slots;
+
+  uint64_t started;
+  uint64_t requests;
+  uint64_t responses;
+  uint64_t errors;
+  uint64_t connect_errors;
+  uint64_t max_lag_ns;
+  std::map<int, uint64_t> status;
+  std::vector<uint64_t> latency;  ///< 纳秒
+};
+
+static pthread_barrier_t g_start_barrier;
+
+
+/**
+ * @brief 读取一个分段文件中的全部记录，按会话归并
+ * 正常关闭的分段以文件头中的 bytes 为准，异常退出的分段扫描到第一个空记录为止
+ */
+static bool read_segment(const char* name,
+                         std::unordered_map<uint64_t, rp_session>& sessions) {
+  FILE* fp = fopen(name, "rb");
+  if (fp == nullptr) {
+    fprintf(stderr, "replay: cannot open %s\n", name);
+    return false;
+  }
+  std::string buf;
+  char tmp[1 << 16];
+  size_t n;
+  while ((n = fread(tmp, 1, sizeof(tmp), fp)) > 0) {
+    buf.append(tmp, n);
+  }
+  fclose(fp);
+
+  const capture_segment_header* hdr =
+      (const capture_segment_header*)buf.data();
+  if (buf.size() < sizeof(*hdr) ||
+      memcmp(hdr->magic, CAPTURE_MAGIC, sizeof(hdr->magic)) != 0 ||
+      hdr->version != CAPTURE_VERSION) {
+    fprintf(stderr, "replay: %s is not a capture segment\n", name);
+    return false;
+  }
+  size_t end = buf.size();
+  if (hdr->bytes != 0 && hdr->bytes < end) {
+    end = hdr->bytes;
+  }
+  size_t pos = sizeof(*hdr);
+  while (pos + sizeof(capture_record) <= end) {
+    const capture_record* rec = (const capture_record*)(buf.data() + pos);
+    size_t size = capture_record_size(rec->len);
+    if (rec->time_ns == 0 || pos + size > end) {
+      break;
+    }
+    rp_session& s = sessions[rec->session];
+    if (s.chunks.empty() && s.data.empty() && s.start_ns == 0) {
+      s.id = rec->session;
+      s.start_ns = rec->time_ns;
+    }
+    if (rec->kind == CAPTURE_SPLICED) {
+      s.spliced = true;
+    }
+    if (rec->kind == CAPTURE_DATA && rec->len > 0) {
+      s.data.append((const char*)(rec + 1), rec->len);
+      rp_chunk c;
+      c.time_ns = rec->time_ns;
+      c.responses = rec->responses;
+      c.end = s.data.size();
+      s.chunks.push_back(c);
+    }
+    pos += size;
+  }
+  return true;
+}
+
+// 按请求头与 Content-Length 切分会话数据，末尾不完整的请求照常发送但不等待响应
+static void split_requests(rp_session& s) {
+  size_t pos = 0;
+  while (pos < s.data.size()) {
+    size_t blank = s.data.find("\r\n\r\n", pos);
+    if (blank == std::string::npos) {
+      return;
+    }
+    std::string head = s.data.substr(pos, blank + 2 - pos);
+    uint64_t length = 0;
+    size_t line = head.find("\r\n");
+    while (line != std::string::npos && line + 2 < head.size()) {
+      line += 2;
+      if (strncasecmp(head.c_str() + line, "Content-Length:", 15) == 0) {
+        length = strtoull(head.c_str() + line + 15, nullptr, 10);
+      }
+      line = head.find("\r\n", line);
+    }
+    size_t end = blank + 4 + length;
+    if (end > s.data.size()) {
+      return;
+    }
+    s.request_ends.push_back(end);
+    s.head.push_back(head.compare(0, 5, "HEAD ") == 0);
+    pos = end;
+  }
+}
+
+// 会话结束，没有收到响应的请求记为错误
+static void close_conn(rp_worker* w, int slot) {
+  rp_conn& c = w->conns[slot];
+  epoll_ctl(w->epollfd, EPOLL_CTL_DEL, c.fd, 0);
+  close(c.fd);
+  w->errors += c.s->request_ends.size() - c.responses;
+  c.fd = -1;
+  c.s = nullptr;
+  c.inflight.clear();
+  c.resp.reset();
+  w->free_slots.push_back(slot);
+}
+
+static void open_conn(rp_worker* w, const rp_session* s) {
+  int slot = w->free_slots.back();
+  int source = w->loopback ? (int)(w->started % LOOPBACK_SOURCES) : 0;
+  bool connecting = false;
+  int fd = connect_nonblocking(w->addr, source, &connecting);
+  if (fd < 0) {
+    w->connect_errors++;
+    w->errors += s->request_ends.size();
+    return;
+  }
+  w->free_slots.pop_back();
+  rp_conn& c = w->conns[slot];
+  c.fd = fd;
+  c.connecting = connecting;
+  c.s = s;
+  c.next_chunk = 0;
+  c.queued = 0;
+  c.sent = 0;
+  c.next_req = 0;
+  c.responses = 0;
+
+  epoll_event ev;
+  ev.data.u32 = slot;
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  epoll_ctl(w->epollfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// 录制时间 t 在回放中的计划时间
+static uint64_t scheduled(const rp_worker* w, uint64_t start, uint64_t t) {
+  if (w->opt->speed <= 0) {
+    return start;
+  }
+  return start + (uint64_t)((t - w->t0) / w->opt->speed);
+}
+
+/**
+ * @brief 把到期且依赖的响应都已收到的数据块写入 socket
+ * @return uint64_t 下一个数据块的计划时间，没有时为 UINT64_MAX
+ */
+static uint64_t pump(rp_worker* w, int slot, uint64_t start, uint64_t now) {
+  rp_conn& c = w->conns[slot];
+  uint64_t next = UINT64_MAX;
+  const rp_session* s = c.s;
+  while (c.next_chunk < s->chunks.size()) {
+    const rp_chunk& chunk = s->chunks[c.next_chunk];
+    uint64_t due = scheduled(w, start, chunk.time_ns);
+    if (due > now) {
+      next = due;
+      break;
+    }
+    // 等待响应的块在响应到达时再检查
+    if (c.responses < chunk.responses) {
+      break;
+    }
+    if (w->opt->speed > 0 && now - due > w->max_lag_ns) {
+      w->max_lag_ns = now - due;
+    }
+    c.queued = chunk.end;
+    c.next_chunk++;
+  }
+  if (c.connecting) {
+    return next;
+  }
+  while (c.sent < c.queued) {
+    ssize_t n = send(c.fd, s->data.data() + c.sent, c.queued - c.sent,
+                     MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        close_conn(w, slot);
+        return UINT64_MAX;
+      }
+      break;
+    }
+    c.sent += n;
+  }
+  while (c.next_req < s->request_ends.size() &&
+         s->request_ends[c.next_req] <= c.sent) {
+    c.inflight.push_back(now);
+    c.next_req++;
+    w->requests++;
+  }
+  // 全部数据已发出、全部响应已收到
+  if (c.next_chunk == s->chunks.size() && c.sent == s->data.size() &&
+      c.responses == s->request_ends.size()) {
+    close_conn(w, slot);
+    return UINT64_MAX;
+  }
+  return next;
+}
+
+/**
+ * @brief 读取并解析响应
+ * @return false 会话已结束
+ */
+static bool read_conn(rp_worker* w, int slot) {
+  rp_conn& c = w->conns[slot];
+  char buf[READ_CHUNK];
+  while (true) {
+    ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return true;
+      }
+      close_conn(w, slot);
+      return false;
+    }
+    if (n == 0) {
+      close_conn(w, slot);
+      return false;
+    }
+
+    const char* p = buf;
+    const char* end = buf + n;
+    response_event ev;
+    while ((ev = c.resp.feed(&p, end)) != RESPONSE_MORE) {
+      if (ev == RESPONSE_BAD || c.inflight.empty()) {
+        close_conn(w, slot);
+        return false;
+      }
+      if (ev == RESPONSE_HEAD) {
+        // HEAD 请求的响应没有响应体
+        if (c.s->head[c.responses]) {
+          c.resp.body_left = 0;
+        }
+        continue;
+      }
+      w->latency.push_back(now_ns() - c.inflight.front());
+      c.inflight.pop_front();
+      w->status[c.resp.status]++;
+      w->responses++;
+      c.responses++;
+    }
+  }
+}
+
+static void handle_event(rp_worker* w, int slot, uint32_t events,
+                         uint64_t start) {
+  rp_conn& c = w->conns[slot];
+  if (c.fd < 0) {
+    return;
+  }
+  if (c.connecting) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err != 0) {
+      w->connect_errors++;
+      close_conn(w, slot);
+      return;
+    }
+    c.connecting = false;
+  }
+  if ((events & EPOLLIN) && !read_conn(w, slot)) {
+    return;
+  }
+  if (events & (EPOLLHUP | EPOLLERR)) {
+    close_conn(w, slot);
+    return;
+  }
+  pump(w, slot, start, now_ns());
+}
+
+static void* worker_main(void* arg) {
+  rp_worker* w = (rp_worker*)arg;
+  const rp_options* opt = w->opt;
+  w->epollfd = epoll_create1(0);
+  for (int i = (int)w->conns.size() - 1; i >= 0; i--) {
+    w->conns[i].fd = -1;
+    w->conns[i].s = nullptr;
+    w->free_slots.push_back(i);
+  }
+
+  pthread_barrier_wait(&g_start_barrier);
+  uint64_t start = now_ns();
+  size_t next_session = 0;
+  uint64_t drain_end = 0;
+  epoll_event events[MAX_EVENTS];
+
+  while (true) {
+    uint64_t now = now_ns();
+    uint64_t wake = now + 100000000;
+    // 到了开始时间的会话在有空位时打开连接
+    while (next_session < w->sessions.size() && !w->free_slots.empty()) {
+      const rp_session* s = w->sessions[next_session];
+      uint64_t due = scheduled(w, start, s->start_ns);
+      if (due > now) {
+        wake = std::min(wake, due);
+        break;
+      }
+      open_conn(w, s);
+      w->started++;
+      next_session++;
+    }
+    bool active = false;
+    for (size_t i = 0; i < w->conns.size(); i++) {
+      if (w->conns[i].s != nullptr) {
+        wake = std::min(wake, pump(w, i, start, now));
+        active = active || w->conns[i].s != nullptr;
+      }
+    }
+    if (next_session == w->sessions.size()) {
+      if (!active) {
+        break;
+      }
+      // 全部会话都已开始，超过等待时间后放弃剩下的响应
+      if (drain_end == 0) {
+        drain_end = now + (uint64_t)(opt->grace * 1e9);
+      } else if (now >= drain_end) {
+        for (size_t i = 0; i < w->conns.size(); i++) {
+          if (w->conns[i].s != nullptr) {
+            close_conn(w, i);
+          }
+        }
+        break;
+      }
+    }
+
+    int timeout = wake > now ? (int)((wake - now + 999999) / 1000000) : 0;
+    int n = epoll_wait(w->epollfd, events, MAX_EVENTS, timeout);
+    for (int i = 0; i < n; i++) {
+      handle_event(w, events[i].data.u32, events[i].events, start);
+    }
+  }
+  close(w->epollfd);
+  return nullptr;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: replay [-H host] [-p port] [-s speed] [-t threads] "
+          "[-c conns] [-g grace_seconds] segment...\n");
+}
+
+static void print_json(const rp_options& opt, std::vector<rp_worker>& workers,
+                       size_t sessions, size_t skipped, size_t chunks,
+                       double captured, double elapsed) {
+  uint64_t requests = 0, responses = 0, errors = 0, connect_errors = 0;
+  uint64_t max_lag = 0;
+  std::map<int, uint64_t> status;
+  std::vector<uint64_t> latency;
+  for (size_t i = 0; i < workers.size(); i++) {
+    rp_worker& w = workers[i];
+    requests += w.requests;
+    responses += w.responses;
+    errors += w.errors;
+    connect_errors += w.connect_errors;
+    max_lag = std::max(max_lag, w.max_lag_ns);
+    merge_status(status, w.status);
+    latency.insert(latency.end(), w.latency.begin(), w.latency.end());
+  }
+
+  printf(
+      "{\"speed\":%g,\"threads\":%d,\"connections\":%d,\"sessions\":%llu,"
+      "\"skipped_sessions\":%llu,\"chunks\":%llu,\"capture_s\":%.3f,\"duration_s\":%.3f,"
+      "\"requests\":%llu,\"responses\":%llu,\"errors\":%llu,"
+      "\"connect_errors\":%llu,\"status\":%s,\"throughput_rps\":%.1f,"
+      "\"max_lag_us\":%.1f,\"latency_us\":%s}\n",
+      opt.speed, opt.threads, opt.conns, (unsigned long long)sessions,
+      (unsigned long long)skipped, (unsigned long long)chunks, captured, elapsed,
+      (unsigned long long)requests, (unsigned long long)responses,
+      (unsigned long long)errors, (unsigned long long)connect_errors,
+      status_json(status).c_str(), elapsed > 0 ? responses / elapsed : 0,
+      max_lag / 1e3, latency_json(latency).c_str());
+}
+
+int main(int argc, char* argv[]) {
+  rp_options opt;
+  opt.host = "127.0.0.1";
+  opt.port = 9006;
+  opt.speed = 1;
+  opt.threads = 1;
+  opt.conns = 1024;
+  opt.grace = 5;
+
+  int ch;
+  while ((ch = getopt(argc, argv, "H:p:s:t:c:g:h")) != -1) {
+    switch (ch) {
+      case 'H':
+        opt.host = optarg;
+        break;
+      case 'p':
+        opt.port = atoi(optarg);
+        break;
+      case 's':
+        opt.speed = atof(optarg);
+        break;
+      case 't':
+        opt.threads = std::max(1, atoi(optarg));
+        break;
+      case 'c':
+        opt.conns = std::max(1, atoi(optarg));
+        break;
+      case 'g':
+        opt.grace = atof(optarg);
+        break;
+      default:
+        usage();
+        return 1;
+    }
+  }
+  if (optind >= argc) {
+    usage();
+    return 1;
+  }
+  if (opt.threads > opt.conns) {
+    opt.threads = opt.conns;
+  }
+
+  std::unordered_map<uint64_t, rp_session> table;
+  for (int i = optind; i < argc; i++) {
+    if (!read_segment(argv[i], table)) {
+      return 1;
+    }
+  }
+  // 会话按开始时间排序，录制的时间轴从最早的会话开始
+  std::vector<rp_session*> sessions;
+  size_t chunks = 0;
+  size_t skipped = 0;
+  uint64_t first = UINT64_MAX, last = 0;
+  for (std::unordered_map<uint64_t, rp_session>::iterator it = table.begin();
+       it != table.end(); ++it) {
+    rp_session& s = it->second;
+    if (s.spliced) {
+      skipped++;
+      continue;
+    }
+    split_requests(s);
+    sessions.push_back(&s);
+    chunks += s.chunks.size();
+    first = std::min(first, s.start_ns);
+    last = std::max(last, s.chunks.empty() ? s.start_ns
+                                           : s.chunks.back().time_ns);
+  }
+  if (skipped > 0) {
+    fprintf(stderr,
+            "replay: skipped %zu sessions whose request bodies were "
+            "spliced by the proxy\n",
+            skipped);
+  }
+  if (sessions.empty()) {
+    fprintf(stderr, "replay: no sessions in the capture\n");
+    return 1;
+  }
+  std::sort(sessions.begin(), sessions.end(),
+            [](const rp_session* a, const rp_session* b) {
+              return a->start_ns < b->start_ns;
+            });
+
+  struct sockaddr_in addr;
+  if (!resolve(opt.host, opt.port, &addr)) {
+    fprintf(stderr, "replay: cannot resolve %s\n", opt.host.c_str());
+    return 1;
+  }
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  std::vector<rp_worker> workers(opt.threads);
+  pthread_barrier_init(&g_start_barrier, nullptr, opt.threads);
+  for (int i = 0; i < opt.threads; i++) {
+    rp_worker& w = workers[i];
+    w.id = i;
+    w.opt = &opt;
+    w.addr = addr;
+    w.loopback = (ntohl(addr.sin_addr.s_addr) >> 24) == 127;
+    w.t0 = first;
+    w.conns.resize(opt.conns / opt.threads +
+                   (i < opt.conns % opt.threads ? 1 : 0));
+    w.started = w.requests = w.responses = w.errors = w.connect_errors = 0;
+    w.max_lag_ns = 0;
+  }
+  for (size_t i = 0; i < sessions.size(); i++) {
+    workers[i % opt.threads].sessions.push_back(sessions[i]);
+  }
+
+  uint64_t begin = now_ns();
+  std::vector<pthread_t> tids(opt.threads);
+  for (int i = 0; i < opt.threads; i++) {
+    pthread_create(&tids[i], nullptr, worker_main, &workers[i]);
+  }
+  for (int i = 0; i < opt.threads; i++) {
+    pthread_join(tids[i], nullptr);
+  }
+  pthread_barrier_destroy(&g_start_barrier);
+
+  print_json(opt, workers, sessions.size(), skipped, chunks, (last - first) / 1e9,
+             (now_ns() - begin) / 1e9);
+  return 0;
+}
@@ -0,0 +1,182 @@
+#include "tool_common.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void set_nonblocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+bool resolve(const std::string& host, int port, struct sockaddr_in* out) {
+  memset(out, 0, sizeof(*out));
+  out->sin_family = AF_INET;
+  out->sin_port = htons(port);
+  if (inet_pton(AF_INET, host.c_str(), &out->sin_addr) == 1) {
+    return true;
+  }
+  struct addrinfo hints;
+  struct addrinfo* res = nullptr;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), nullptr, &hints, &res) != 0 || res == nullptr) {
+    return false;
+  }
+  out->sin_addr = ((struct sockaddr_in*)res->ai_addr)->sin_addr;
+  freeaddrinfo(res);
+  return true;
+}
+
+int connect_nonblocking(const struct sockaddr_in& addr, int source,
+                        bool* connecting) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  set_nonblocking(fd);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (source > 0) {
+#ifdef IP_BIND_ADDRESS_NO_PORT
+    setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+#endif
+    struct sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(0x7f000001 + source);
+    bind(fd, (struct sockaddr*)&local, sizeof(local));
+  }
+  int ret = connect(fd, (const struct sockaddr*)&addr, sizeof(addr));
+  if (ret < 0 && errno != EINPROGRESS) {
+    close(fd);
+    return -1;
+  }
+  *connecting = ret != 0;
+  return fd;
+}
+
+void response_parser::reset() {
+  head.clear();
+  in_body = false;
+  body_left = 0;
+  status = 0;
+  server_close = false;
+}
+
+// 解析响应头，取出状态码、Content-Length 与 Connection
+bool response_parser::parse_head(size_t head_len) {
+  const char* p = head.c_str();
+  if (strncmp(p, "HTTP/1.", 7) != 0 || head_len < 12) {
+    return false;
+  }
+  status = atoi(p + 9);
+  body_left = 0;
+  server_close = false;
+  const char* end = p + head_len;
+  const char* line = strstr(p, "\r\n");
+  while (line && line + 2 < end) {
+    line += 2;
+    if (strncasecmp(line, "Content-Length:", 15) == 0) {
+      body_left = strtoull(line + 15, nullptr, 10);
+    } else if (strncasecmp(line, "Connection:", 11) == 0) {
+      const char* v = line + 11;
+      v += strspn(v, " \t");
+      server_close = strncasecmp(v, "close", 5) == 0;
+    }
+    line = strstr(line, "\r\n");
+  }
+  if (status == 204 || status == 304) {
+    body_left = 0;
+  }
+  return true;
+}
+
+response_event response_parser::feed(const char** p, const char* end) {
+  while (!in_body) {
+    if (*p == end) {
+      return RESPONSE_MORE;
+    }
+    // 跨包的响应头先拼接，再找空行
+    size_t old = head.size();
+    head.append(*p, end - *p);
+    size_t pos = head.find("\r\n\r\n", old > 3 ? old - 3 : 0);
+    if (pos == std::string::npos) {
+      *p = end;
+      return RESPONSE_MORE;
+    }
+    size_t head_len = pos + 4;
+    *p += head_len - old;
+    if (!parse_head(head_len)) {
+      return RESPONSE_BAD;
+    }
+    head.clear();
+    // 100 Continue 之后还有最终响应
+    if (status >= 100 && status < 200) {
+      continue;
+    }
+    in_body = true;
+    return RESPONSE_HEAD;
+  }
+
+  uint64_t take = std::min<uint64_t>(body_left, end - *p);
+  body_left -= take;
+  *p += take;
+  if (body_left > 0) {
+    return RESPONSE_MORE;
+  }
+  in_body = false;
+  return RESPONSE_DONE;
+}
+
+void merge_status(std::map<int, uint64_t>& into,
+                  const std::map<int, uint64_t>& from) {
+  for (std::map<int, uint64_t>::const_iterator it = from.begin();
+       it != from.end(); ++it) {
+    into[it->first] += it->second;
+  }
+}
+
+std::string status_json(const std::map<int, uint64_t>& status) {
+  std::string out = "{";
+  for (std::map<int, uint64_t>::const_iterator it = status.begin();
+       it != status.end(); ++it) {
+    char buf[48];
+    snprintf(buf, sizeof(buf), "%s\"%d\":%llu", out.size() > 1 ? "," : "",
+             it->first, (unsigned long long)it->second);
+    out += buf;
+  }
+  out += "}";
+  return out;
+}
+
+std::string latency_json(std::vector<uint64_t>& latency_ns) {
+  std::sort(latency_ns.begin(), latency_ns.end());
+  char buf[160];
+  snprintf(buf, sizeof(buf),
+           "{\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"p999\":%.1f,"
+           "\"max\":%.1f}",
+           percentile(latency_ns, 0.50) / 1e3,
+           percentile(latency_ns, 0.90) / 1e3,
+           percentile(latency_ns, 0.99) / 1e3,
+           percentile(latency_ns, 0.999) / 1e3,
+           latency_ns.empty() ? 0 : latency_ns.back() / 1e3);
+  return buf;
+}
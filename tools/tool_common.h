@@ -0,0 +1,90 @@
+#ifndef TOOL_COMMON_H
+#define TOOL_COMMON_H
+
+/**
+ * @file
+ * @brief 离线工具共用的 HTTP 客户端与统计函数
+ *
+ * loadgen 与 replay 链接 tool_common.cpp；logdecode 只用到头文件中的分位数模板。
+ */
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// 单调时钟，纳秒
+uint64_t now_ns();
+
+void set_nonblocking(int fd);
+
+// 主机名或点分地址解析为 IPv4 地址
+bool resolve(const std::string& host, int port, struct sockaddr_in* out);
+
+/**
+ * @brief 建立非阻塞 TCP 连接，开启 TCP_NODELAY
+ *
+ * @param source 大于 0 时绑定源地址 127.0.0.1 + source，压测本机时
+ *               把临时端口与 TIME_WAIT 分散到多个源地址
+ * @param connecting 连接尚未完成时置为 true
+ * @return int 套接字，失败时为 -1
+ */
+int connect_nonblocking(const struct sockaddr_in& addr, int source,
+                        bool* connecting);
+
+enum response_event {
+  RESPONSE_MORE = 0,  ///< 数据已读完，等待更多数据
+  RESPONSE_HEAD,      ///< 解析完一个响应头，调用者可修改 body_left
+  RESPONSE_DONE,      ///< 收到一个完整的响应
+  RESPONSE_BAD        ///< 响应格式错误
+};
+
+/**
+ * @struct response_parser
+ * @brief 流式解析 HTTP/1.1 响应，响应体只计数不缓存
+ *
+ * 调用者对每次 recv 读到的数据反复调用 feed，直到返回 RESPONSE_MORE；
+ * 1xx 临时响应直接跳过，HEAD、204 与 304 之后没有响应体。
+ */
+struct response_parser {
+  std::string head;    ///< 未解析完的响应头
+  bool in_body;
+  uint64_t body_left;  ///< 当前响应剩余的响应体字节
+  int status;          ///< 当前响应的状态码
+  bool server_close;   ///< 当前响应带有 Connection: close
+
+  response_parser() { reset(); }
+  void reset();
+
+  /**
+   * @brief 从 [*p, end) 中解析，*p 前移到已处理的位置
+   */
+  response_event feed(const char** p, const char* end);
+
+ private:
+  bool parse_head(size_t head_len);
+};
+
+// 已排序数组的分位数
+template <typename T>
+T percentile(const std::vector<T>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t idx = (size_t)(p * (sorted.size() - 1) + 0.5);
+  return sorted[idx];
+}
+
+void merge_status(std::map<int, uint64_t>& into,
+                  const std::map<int, uint64_t>& from);
+
+// 状态码计数的 JSON 对象，如 {"200":10,"404":1}
+std::string status_json(const std::map<int, uint64_t>& status);
+
+// 延迟(纳秒)排序后输出微秒分位数的 JSON 对象
+std::string latency_json(std::vector<uint64_t>& latency_ns);
+
+#endif  // !TOOL_COMMON_H
@@ -0,0 +1,245 @@
+/**
+ * @file
+ * @brief 反向代理测试用的上游服务器
+ *
+ * 单线程 epoll 的 HTTP/1.1 服务器，支持长连接与流水线，响应内容由路径决定，
+ * 用来在本机验证 proxy_pass 的转发、连接池、负载均衡与被动健康检查。
+ * 路径中最后一个匹配的片段生效，前面可以带任意前缀(如 /api/bytes/100)：
+ *   .../bytes/N    N 字节的响应体，Content-Length
+ *   .../chunked/N  N 字节的响应体，按 4000 字节分块编码
+ *   .../close/N    N 字节的响应体，没有长度，发送完毕后关闭连接
+ *   .../hang       不响应，用于测试超时
+ *   其他           一行文本：上游名称、方法、路径、X-Forwarded-For
+ * 带请求体的请求把请求体原样返回。每个响应带 X-Upstream 头部。
+ *
+ * 用法: upstream [-p port] [-n name] [-d delay_ms]
+ *   -d  每个响应在解析完请求后延迟发送的毫秒数(阻塞整个进程，只用于测试)
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+
+static const int MAX_EVENTS = 256;
+static const int CHUNK_SIZE = 4000;
+
+struct up_conn {
+  std::string in;
+  std::string out;
+  size_t out_sent;
+  bool close_after;
+  bool hang;
+};
+
+static std::string g_name = "upstream";
+static int g_delay_ms = 0;
+
+static std::string body_of(size_t n) {
+  std::string body(n, 'a');
+  for (size_t i = 0; i < n; i++) {
+    body[i] = (char)('a' + i % 26);
+  }
+  return body;
+}
+
+// 路径中 key 之后的数字，没有时返回 -1
+static long path_number(const std::string& path, const char* key) {
+  size_t pos = path.rfind(key);
+  if (pos == std::string::npos) {
+    return -1;
+  }
+  return atol(path.c_str() + pos + strlen(key));
+}
+
+static std::string header(const std::string& head, const char* name) {
+  size_t n = strlen(name);
+  size_t pos = 0;
+  while ((pos = head.find("\r\n", pos)) != std::string::npos) {
+    pos += 2;
+    if (strncasecmp(head.c_str() + pos, name, n) == 0 &&
+        head[pos + n] == ':') {
+      size_t begin = head.find_first_not_of(" \t", pos + n + 1);
+      size_t end = head.find("\r\n", pos);
+      return head.substr(begin, end - begin);
+    }
+  }
+  return "";
+}
+
+// 解析缓冲区中的一个完整请求并生成响应，请求不完整时返回 false
+static bool handle_request(up_conn& c) {
+  size_t head_end = c.in.find("\r\n\r\n");
+  if (head_end == std::string::npos) {
+    return false;
+  }
+  std::string head = c.in.substr(0, head_end + 2);
+  size_t length = strtoul(header(head, "Content-Length").c_str(), nullptr, 10);
+  if (c.in.size() < head_end + 4 + length) {
+    return false;
+  }
+  std::string body = c.in.substr(head_end + 4, length);
+  c.in.erase(0, head_end + 4 + length);
+
+  size_t sp1 = head.find(' ');
+  size_t sp2 = head.find(' ', sp1 + 1);
+  std::string method = head.substr(0, sp1);
+  std::string path = head.substr(sp1 + 1, sp2 - sp1 - 1);
+  if (strcasecmp(header(head, "Connection").c_str(), "close") == 0) {
+    c.close_after = true;
+  }
+  if (path.find("/hang") != std::string::npos) {
+    c.hang = true;
+    return true;
+  }
+  if (g_delay_ms > 0) {
+    usleep(g_delay_ms * 1000);
+  }
+
+  std::string resp = "HTTP/1.1 200 OK\r\nX-Upstream: " + g_name + "\r\n";
+  char line[128];
+  long n;
+  if ((n = path_number(path, "/chunked/")) >= 0) {
+    resp += "Transfer-Encoding: chunked\r\n\r\n";
+    std::string data = body_of(n);
+    for (size_t i = 0; i < data.size(); i += CHUNK_SIZE) {
+      size_t len = std::min((size_t)CHUNK_SIZE, data.size() - i);
+      snprintf(line, sizeof(line), "%zx\r\n", len);
+      resp += line;
+      resp.append(data, i, len);
+      resp += "\r\n";
+    }
+    resp += "0\r\n\r\n";
+  } else if ((n = path_number(path, "/close/")) >= 0) {
+    resp += "Connection: close\r\n\r\n" + body_of(n);
+    c.close_after = true;
+  } else {
+    if ((n = path_number(path, "/bytes/")) >= 0) {
+      body = body_of(n);
+    } else if (body.empty()) {
+      body = g_name + " " + method + " " + path + " " +
+             header(head, "X-Forwarded-For") + "\n";
+    }
+    snprintf(line, sizeof(line), "Content-Length: %zu\r\n\r\n", body.size());
+    resp += line;
+    if (method != "HEAD") {
+      resp += body;
+    }
+  }
+  c.out += resp;
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  int port = 9100;
+  int ch;
+  while ((ch = getopt(argc, argv, "p:n:d:h")) != -1) {
+    switch (ch) {
+      case 'p':
+        port = atoi(optarg);
+        break;
+      case 'n':
+        g_name = optarg;
+        break;
+      case 'd':
+        g_delay_ms = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-p port] [-n name] [-d delay_ms]\n",
+                argv[0]);
+        return 1;
+    }
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  int listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  int one = 1;
+  setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(port);
+  if (bind(listenfd, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+      listen(listenfd, 1024) < 0) {
+    perror("listen");
+    return 1;
+  }
+  int epfd = epoll_create1(0);
+  epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.fd = listenfd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+  fprintf(stderr, "%s listening on 127.0.0.1:%d\n", g_name.c_str(), port);
+
+  std::map<int, up_conn> conns;
+  epoll_event events[MAX_EVENTS];
+  char buf[65536];
+  while (true) {
+    int num = epoll_wait(epfd, events, MAX_EVENTS, -1);
+    for (int i = 0; i < num; i++) {
+      int fd = events[i].data.fd;
+      if (fd == listenfd) {
+        int connfd;
+        while ((connfd = accept4(listenfd, nullptr, nullptr, SOCK_NONBLOCK)) >=
+               0) {
+          setsockopt(connfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+          up_conn& c = conns[connfd];
+          c.out_sent = 0;
+          c.close_after = false;
+          c.hang = false;
+          ev.events = EPOLLIN;
+          ev.data.fd = connfd;
+          epoll_ctl(epfd, EPOLL_CTL_ADD, connfd, &ev);
+        }
+        continue;
+      }
+      up_conn& c = conns[fd];
+      bool closed = false;
+      if (events[i].events & EPOLLIN) {
+        ssize_t n;
+        while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+          c.in.append(buf, n);
+        }
+        closed = n == 0 || (n < 0 && errno != EAGAIN);
+        while (!c.hang && handle_request(c)) {
+        }
+      }
+      while (!closed && c.out_sent < c.out.size()) {
+        ssize_t n = send(fd, c.out.data() + c.out_sent,
+                         c.out.size() - c.out_sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+          closed = n == 0 || errno != EAGAIN;
+          break;
+        }
+        c.out_sent += n;
+      }
+      bool pending = c.out_sent < c.out.size();
+      if (!pending) {
+        c.out.clear();
+        c.out_sent = 0;
+      }
+      if (closed || (!pending && c.close_after)) {
+        epoll_ctl(epfd, EPOLL_CTL_DEL, fd, 0);
+        close(fd);
+        conns.erase(fd);
+        continue;
+      }
+      ev.events = pending ? EPOLLIN | EPOLLOUT : EPOLLIN;
+      ev.data.fd = fd;
+      epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+    }
+  }
+}
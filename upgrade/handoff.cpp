@@ -0,0 +1,201 @@
+#include "handoff.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+extern char** environ;
+
+// 一次交接最多传递的描述符数
+static const int MAX_HANDOFF_FDS = 72;
+
+static int close_fd_range(unsigned int first, unsigned int last) {
+#ifdef SYS_close_range
+  return (int)syscall(SYS_close_range, first, last, 0);
+#else
+  (void)first;
+  (void)last;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+// getdents64 返回的目录项
+struct dirent64_raw {
+  unsigned long long d_ino;
+  long long d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[1];
+};
+
+/*
+ * 关闭 3 及以上除 keep 之外的所有 fd，在 fork 之后、exec 之前的子进程中调用，
+ * 只用异步信号安全的系统调用。
+ * 优先用 close_range(Linux 5.9 起)；更早的内核只关闭 /proc/self/fd 中列出的 fd，
+ * 连接数上限很大时不必逐个尝试到 max_fd；/proc 不可用时才逐个关闭
+ */
+static void close_inherited_fds(int keep, int max_fd) {
+  if ((keep <= 3 || close_fd_range(3, keep - 1) == 0) &&
+      close_fd_range(keep + 1, ~0U) == 0) {
+    return;
+  }
+  int dir = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir < 0) {
+    for (int fd = 3; fd < max_fd; fd++) {
+      if (fd != keep) {
+        close(fd);
+      }
+    }
+    return;
+  }
+  char buf[4096];
+  long n;
+  while ((n = syscall(SYS_getdents64, dir, buf, sizeof(buf))) > 0) {
+    for (long off = 0; off < n;) {
+      struct dirent64_raw* d = (struct dirent64_raw*)(buf + off);
+      off += d->d_reclen;
+      int fd = 0;
+      const char* p = d->d_name;
+      if (*p < '0' || *p > '9') {
+        continue;  // . 与 ..
+      }
+      for (; *p >= '0' && *p <= '9'; p++) {
+        fd = fd * 10 + (*p - '0');
+      }
+      if (fd >= 3 && fd != keep && fd != dir) {
+        close(fd);
+      }
+    }
+  }
+  close(dir);
+}
+
+bool handoff_send(int sock, const std::vector<int>& fds,
+                  const std::string& roles) {
+  if (fds.empty() || fds.size() > (size_t)MAX_HANDOFF_FDS ||
+      fds.size() != roles.size()) {
+    return false;
+  }
+  // 正文为角色字符串，控制消息携带描述符
+  struct iovec iov;
+  iov.iov_base = (void*)roles.data();
+  iov.iov_len = roles.size();
+
+  char control[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_FDS)];
+  memset(control, 0, sizeof(control));
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+  memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fds.size());
+
+  ssize_t n;
+  do {
+    n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+  } while (n < 0 && errno == EINTR);
+  return n == (ssize_t)roles.size();
+}
+
+bool handoff_recv(int sock, std::vector<int>& fds, std::string& roles) {
+  char buf[MAX_HANDOFF_FDS];
+  struct iovec iov;
+  iov.iov_base = buf;
+  iov.iov_len = sizeof(buf);
+
+  char control[CMSG_SPACE(sizeof(int) * MAX_HANDOFF_FDS)];
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t n;
+  do {
+    n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) {
+    return false;
+  }
+
+  fds.clear();
+  for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      const int* data = (const int*)CMSG_DATA(cmsg);
+      fds.assign(data, data + count);
+    }
+  }
+  if ((msg.msg_flags & MSG_CTRUNC) || fds.size() != (size_t)n) {
+    for (size_t i = 0; i < fds.size(); i++) {
+      close(fds[i]);
+    }
+    fds.clear();
+    return false;
+  }
+  roles.assign(buf, n);
+  return true;
+}
+
+pid_t handoff_spawn(const std::vector<std::string>& argv, int& sock) {
+  int pair[2];
+  if (argv.empty() ||
+      socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) < 0) {
+    return -1;
+  }
+
+  // fork 之后到 exec 之前只能调用异步信号安全的函数，参数与环境变量提前准备好
+  char fd_env[64];
+  snprintf(fd_env, sizeof(fd_env), "%s=%d", UPGRADE_FD_ENV, pair[1]);
+  std::vector<char*> args;
+  for (size_t i = 0; i < argv.size(); i++) {
+    args.push_back(const_cast<char*>(argv[i].c_str()));
+  }
+  args.push_back(nullptr);
+  std::vector<char*> envs;
+  size_t prefix = strlen(UPGRADE_FD_ENV) + 1;
+  for (char** e = environ; *e != nullptr; e++) {
+    if (strncmp(*e, fd_env, prefix) != 0) {
+      envs.push_back(*e);
+    }
+  }
+  envs.push_back(fd_env);
+  envs.push_back(nullptr);
+
+  struct rlimit rl;
+  int max_fd = getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY
+                   ? (int)rl.rlim_cur
+                   : 65536;
+
+  pid_t pid = fork();
+  if (pid < 0) {
+    close(pair[0]);
+    close(pair[1]);
+    return -1;
+  }
+  if (pid == 0) {
+    close_inherited_fds(pair[1], max_fd);
+    // 子进程的一端需要跨过 exec
+    fcntl(pair[1], F_SETFD, 0);
+    execve(args[0], args.data(), envs.data());
+    _exit(127);
+  }
+
+  close(pair[1]);
+  sock = pair[0];
+  return pid;
+}
@@ -0,0 +1,61 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+/*
+ * 热升级时的监听 socket 交接
+ * 旧进程创建一对 Unix socket，fork 后在子进程中 exec 新的可执行文件，
+ * 子进程通过环境变量 MWS_UPGRADE_FD 得知自己那一端的描述符。
+ * 旧进程用 SCM_RIGHTS 把监听 socket 发给新进程，新进程开始监听后回复一个字节，
+ * 旧进程收到后停止 accept 并进入排空流程；新进程启动失败时旧进程会读到 EOF，继续服务。
+ */
+
+// 新进程中保存交接 socket 描述符的环境变量
+#define UPGRADE_FD_ENV "MWS_UPGRADE_FD"
+
+// 交接的监听 socket 角色，与描述符按顺序一一对应
+enum handoff_role {
+  HANDOFF_HTTP = 'H',   // 对外服务端口
+  HANDOFF_ADMIN = 'A',  // 内部管理端口
+};
+
+// 新进程就绪后回复的字节
+const char HANDOFF_READY = 'R';
+
+/**
+ * @brief 通过 Unix socket 发送一组描述符
+ *
+ * @param sock Unix socket
+ * @param fds 描述符
+ * @param roles 每个描述符的角色，长度与 fds 相同
+ * @return bool 是否成功
+ */
+bool handoff_send(int sock, const std::vector<int>& fds,
+                  const std::string& roles);
+
+/**
+ * @brief 接收 handoff_send 发送的描述符，阻塞直到收到
+ *
+ * @param sock Unix socket
+ * @param[out] fds 收到的描述符
+ * @param[out] roles 对应的角色
+ * @return bool 是否成功
+ */
+bool handoff_recv(int sock, std::vector<int>& fds, std::string& roles);
+
+/**
+ * @brief fork 并 exec 新的可执行文件，子进程继承交接 socket 的一端
+ * 子进程中除标准输入输出与交接 socket 外的描述符全部关闭，
+ * 避免新进程持有旧进程的连接
+ *
+ * @param argv 完整的命令行，argv[0] 为可执行文件路径
+ * @param[out] sock 旧进程一端的交接 socket
+ * @return pid_t 子进程 pid，失败时为 -1
+ */
+pid_t handoff_spawn(const std::vector<std::string>& argv, int& sock);
+
+#endif  // !HANDOFF_H
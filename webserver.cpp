@@ -7,12 +7,17 @@
 
 #include <asm-generic/socket.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <netinet/in.h>
 #include <strings.h>
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <csignal>
@@ -23,18 +28,63 @@
 #include <iostream>
 #include <system_error>
 
+#include "CGImysql/sql_connection_pool.h"
+#include "CGImysql/sql_result_cache.h"
+#include "CGImysql/sql_write_batcher.h"
+#include "auth/auth_routes.h"
+#include "auth/credential_store.h"
+#include "auth/password.h"
+#include "coro/handler.h"
+#include "http/asset_snapshot.h"
+#include "http/half_open.h"
 #include "http/http_conn.h"
+#include "http/page_template.h"
+#include "http/rate_limit.h"
+#include "log/access_log.h"
+#include "log/capture.h"
+#include "log/log.h"
+#include "metrics/metrics.h"
+#include "metrics/trace.h"
 #include "timer/lst_timer.h"
+#include "upgrade/handoff.h"
+
+// 0 号事件循环通过信号管道通知其余事件循环开始排空，与信号编号不冲突
+static const char DRAIN_REQUEST = 'D';
+
+// epoll 实例的 busy poll 参数，Linux 6.9 加入，较早的头文件中没有
+#ifndef EPIOCSPARAMS
+struct epoll_params {
+  uint32_t busy_poll_usecs;
+  uint16_t busy_poll_budget;
+  uint8_t prefer_busy_poll;
+  uint8_t __pad;
+};
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
 
 WebServer::WebServer() {
   // 初始化变量
-  m_port = 0;
+  m_accept_paused = false;
+  m_last_poll_ns = 0;
+  m_spin_ns = 0;
+  m_wait_ms = -1;
+  m_accept_pending = false;
+  m_draining = false;
+  m_drain_requested = false;
+  m_drain_deadline = 0;
+  m_handoff_fd = -1;
+  m_upgrade_pid = -1;
   m_epollfd = -1;
   m_listenfd = -1;
-  // 预分配http_conn对象
-  users = new http_conn[MAX_FD];
-  users_timer = new client_data[MAX_FD];
-  m_TIMESLOT = TIMESLOT;
+  m_pipefd[0] = -1;
+  m_pipefd[1] = -1;
+  m_index = 0;
+  m_primary = this;
+  m_cpu = -1;
+  m_max_fd = MAX_FD;
+  // 连接表在事件循环绑核之后由 run 分配
+  users = nullptr;
+  users_timer = nullptr;
 }
 
 WebServer::~WebServer() {
@@ -46,69 +96,375 @@ WebServer::~WebServer() {
   delete[] users_timer;
 }
 
-void WebServer::init(int port) { m_port = port; }
+void WebServer::init(const Config& config) {
+  m_conf = config;
+  m_config = config.get();
+  http_conn::m_read_buffer_size = m_config.read_buffer;
+  http_conn::m_write_buffer_size = m_config.write_buffer;
+  struct rlimit rl;
+  m_max_fd = getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)MAX_FD
+                 ? (int)rl.rlim_cur
+                 : MAX_FD;
+}
+
+void WebServer::init_reactor(WebServer* primary, int index, int listenfd) {
+  m_conf = primary->m_conf;
+  m_config = primary->m_config;
+  m_max_fd = primary->m_max_fd;
+  m_index = index;
+  m_primary = primary;
+  m_listenfd = listenfd;
+}
+
+void WebServer::set_command_line(int argc, char* argv[]) {
+  m_argv.assign(argv, argv + argc);
+  if (m_argv.empty()) {
+    return;
+  }
+  // 通过 PATH 启动时 argv[0] 不是路径，换成启动时的绝对路径：
+  // 部署时替换同一路径下的文件，升级时执行的就是新版本
+  char path[PATH_MAX];
+  if (strchr(argv[0], '/') != nullptr && realpath(argv[0], path) != nullptr) {
+    m_argv[0] = path;
+  } else {
+    ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    if (n > 0) {
+      path[n] = '\0';
+      m_argv[0] = path;
+    }
+  }
+}
+
+/**
+ * @brief 初始化异步日志、二进制访问日志与流量录制
+ */
+void WebServer::log_write() {
+  if (0 == m_config.close_log) {
+    Log::get_instance()->init("./ServerLog", m_config.close_log,
+                              m_config.log_ring);
+  }
+  if (!m_config.access_log_dir.empty()) {
+    access_log::get_instance()->init(m_config.access_log_dir);
+  }
+  if (!m_config.capture_dir.empty()) {
+    capture::get_instance()->init(m_config.capture_dir,
+                                  (uint64_t)m_config.capture_limit_mb << 20);
+  }
+  tracer::get_instance()->init(m_config.trace_events);
+}
 
 /**
- * @brief 初始化网络监听端口以及 Epoll 配置
- * @details 该函数执行服务器启动前的所有网络准备工作,具体步骤如下
- * 1. 创建 TCP/IPv4 socket
- * 2. 设定端口复用,允许服务器重启后立即使用同一端口
+ * @brief 创建一个监听 socket
+ * @details 1. 创建 TCP/IPv4 socket
+ * 2. 设定端口复用,允许服务器重启后立即使用同一端口；
+ *    多个事件循环时再设置 SO_REUSEPORT，各自的监听 socket 绑定同一端口
  * 3. 绑定服务器地址和端口
  * 4. 开启监听
- * 5. 创建epoll实例并注册监听套接字
- * 6. 创建全双工管道用于统一信号处理
- * 7, 设置信号处理回调及定时器
+ *
+ * @param reuseport 是否设置 SO_REUSEPORT
+ * @return int 监听 socket，失败返回 -1 并保留 errno
  */
-void WebServer::eventListen() {
+int WebServer::open_listener(bool reuseport) {
   // 1. 创建 socket (TCP/Ipv4)
-  m_listenfd = socket(PF_INET, SOCK_STREAM, 0);
-  assert(m_listenfd >= 0);
+  int fd = socket(PF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
 
   // 2. 设置端口复用
   // 作用：即使服务器崩溃重启，处于TIME_WAIT状态的端口也能被立即再次使用
-  int ret = 0;
   int opt = 1;
-  setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+  if (reuseport) {
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+  }
 
   // 3. 绑定地址和端口
   struct sockaddr_in address;
   bzero(&address, sizeof(address));
   address.sin_family = AF_INET;
   address.sin_addr.s_addr = htonl(INADDR_ANY);  // 监听所有网卡
-  address.sin_port = htons(m_port);
+  address.sin_port = htons(m_config.port);
+
+  // 4. 开启监听，队列长度见配置项 backlog
+  if (bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+      listen(fd, m_config.backlog) < 0) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return -1;
+  }
+  return fd;
+}
 
-  ret = bind(m_listenfd, (struct sockaddr*)&address, sizeof(address));
-  assert(ret >= 0);
+/**
+ * @brief 准备监听 socket 并创建其余事件循环
+ * @details 热升级启动时先接收旧进程的监听 socket，数量不足 threads 时再创建；
+ * 旧进程交来的比 threads 多时按交来的数量运行，避免丢下某个监听队列中的连接。
+ * 由 threads = 1 的进程交来的监听 socket 没有设置 SO_REUSEPORT，
+ * 无法再绑定同一端口，此时只运行一个事件循环，需要重启才能生效
+ *
+ * @param[out] admin_fd 旧进程交来的管理端口监听 socket，没有时为 -1
+ */
+void WebServer::setup_listeners(int& admin_fd) {
+  std::vector<int> fds;
+  int threads = m_config.threads;
+  if (inherit_listeners(fds, admin_fd) && (int)fds.size() > threads) {
+    LOG_WARN("upgrade: inherited %d listen sockets, running %d event loops "
+             "instead of %d",
+             (int)fds.size(), (int)fds.size(), threads);
+    threads = (int)fds.size();
+  }
+  while ((int)fds.size() < threads) {
+    int fd = open_listener(threads > 1);
+    if (fd >= 0) {
+      fds.push_back(fd);
+      continue;
+    }
+    if (fds.empty()) {
+      LOG_ERROR("listen on port %d failed, errno is:%d", m_config.port, errno);
+      Log::get_instance()->stop();
+      exit(1);
+    }
+    LOG_WARN("listen: extra socket on port %d failed, errno is:%d, "
+             "running %d event loops",
+             m_config.port, errno, (int)fds.size());
+    break;
+  }
 
-  // 4. 开启监听(blacklog = 5)
-  ret = listen(m_listenfd, 5);
-  assert(ret >= 0);
+  m_listenfd = fds[0];
+  m_reactors.push_back(this);
+  for (size_t i = 1; i < fds.size(); i++) {
+    WebServer* reactor = new WebServer;
+    reactor->init_reactor(this, (int)i, fds[i]);
+    m_reactors.push_back(reactor);
+  }
+}
 
-  // 5. 创建epoll对象
+/**
+ * @brief 生成或加载资源快照
+ * @details 快照在事件循环启动前准备好，之后只读，所有事件循环共享；
+ * 启用后文件查找完全由快照完成，文档根目录之后的变化不会生效
+ */
+bool WebServer::load_assets() {
+  const std::string& source = m_config.asset_snapshot;
+  if (source.empty()) {
+    return true;
+  }
+  asset_snapshot* assets = asset_snapshot::get_instance();
+  std::string error;
+  bool ok = source == "build"
+                ? assets->build(doc_root, m_config.asset_gzip_min, error)
+                : assets->load(source, error);
+  if (!ok) {
+    LOG_ERROR("asset snapshot: %s", error.c_str());
+    return false;
+  }
+  LOG_INFO("asset snapshot: %u paths, %llu bytes, from %s", assets->count(),
+           (unsigned long long)assets->size(),
+           source == "build" ? doc_root : source.c_str());
+  return true;
+}
+
+/**
+ * @brief 初始化数据库连接池与登录接口
+ * @details 用户表在事件循环启动前整体读入内存，之后登录不再访问数据库；
+ * 连接失败时连接池直接退出进程
+ */
+bool WebServer::init_auth() {
+  if (m_config.db_conns == 0) {
+    return true;
+  }
+  connection_poll* pool = connection_poll::GetInstance();
+  pool->init(m_config.db_host, m_config.db_user, m_config.db_password,
+             m_config.db_name, m_config.db_port, m_config.db_conns,
+             m_config.close_log);
+  if (!credential_store::get_instance()->load(pool) ||
+      !password_hasher::get_instance()->init(m_config.auth_hash_threads,
+                                              m_config.auth_hash_iterations) ||
+      !sql_write_batcher::GetInstance()->init(pool, m_config.db_batch_rows,
+                                              m_config.db_batch_delay_ms)) {
+    return false;
+  }
+  if (m_config.db_cache_mb > 0) {
+    sql_result_cache::GetInstance()->init(pool,
+                                          (size_t)m_config.db_cache_mb << 20);
+  }
+  register_auth_routes();
+  LOG_INFO("auth: %zu users, %d db connections, %d hash threads",
+           credential_store::get_instance()->size(), pool->GetMaxConn(),
+           m_config.auth_hash_threads);
+  return true;
+}
+
+/**
+ * @brief 为各事件循环选择 CPU 并输出拓扑
+ * @details incoming_cpu 打开时把事件循环的 CPU 设置为其监听 socket 的
+ * SO_INCOMING_CPU，Linux 6.2 起内核在 SO_REUSEPORT 组中优先选择与收包 CPU
+ * 相同的监听 socket；要起作用，网卡各队列的中断也要分布在这些 CPU 上
+ */
+void WebServer::place_reactors() {
+  cpu_topology topo;
+  if (!topology_load(topo)) {
+    LOG_WARN("affinity: read cpu topology failed, errno is:%d", errno);
+  }
+  m_allowed_cpus = topo.cpus;
+  std::vector<int> list;
+  parse_cpu_list(m_config.cpu_list, list);
+  std::vector<int> plan = affinity_plan(m_config.cpu_affinity, list, topo,
+                                        (int)m_reactors.size());
+  if (m_config.incoming_cpu && m_config.cpu_affinity == AFFINITY_NONE) {
+    LOG_WARN("%s", "affinity: incoming_cpu needs cpu_affinity, ignored");
+  }
+
+  LOG_INFO("topology: %d cpus on %d numa nodes, %d event loops, "
+           "cpu_affinity %s",
+           (int)topo.cpus.size(), topo.nodes, (int)m_reactors.size(),
+           affinity_policy_name(m_config.cpu_affinity));
+  char buf[128];
+  snprintf(buf, sizeof(buf),
+           "{\"cpus\":%d,\"nodes\":%d,\"policy\":\"%s\",\"incoming_cpu\":%d,"
+           "\"loops\":[",
+           (int)topo.cpus.size(), topo.nodes,
+           affinity_policy_name(m_config.cpu_affinity), m_config.incoming_cpu);
+  m_topology = buf;
+  for (size_t i = 0; i < m_reactors.size(); i++) {
+    WebServer* reactor = m_reactors[i];
+    reactor->m_cpu = plan[i];
+    if (m_config.cpu_affinity == AFFINITY_LIST && plan[i] < 0) {
+      LOG_WARN("affinity: cpu %d is not available, event loop %d not pinned",
+               list[i % list.size()], (int)i);
+    }
+    if (m_config.incoming_cpu && plan[i] >= 0 &&
+        setsockopt(reactor->m_listenfd, SOL_SOCKET, SO_INCOMING_CPU, &plan[i],
+                   sizeof(plan[i])) != 0) {
+      LOG_WARN("affinity: SO_INCOMING_CPU failed, errno is:%d", errno);
+    }
+    LOG_INFO("topology: event loop %d on cpu %d node %d, listen fd %d", (int)i,
+             plan[i], topo.node(plan[i]), reactor->m_listenfd);
+    snprintf(buf, sizeof(buf), "%s{\"loop\":%d,\"cpu\":%d,\"node\":%d}",
+             i == 0 ? "" : ",", (int)i, plan[i], topo.node(plan[i]));
+    m_topology += buf;
+  }
+  m_topology += "]}\n";
+}
+
+// 各阶段的超时按线程保存，半开上限由各线程共享
+static void apply_timeouts(const server_config& c) {
+  http_conn::timeouts t;
+  t.header = c.header_timeout;
+  t.body = c.body_timeout;
+  t.body_rate = c.body_min_rate;
+  t.keepalive = c.keepalive_timeout;
+  t.write = c.write_timeout;
+  t.busy = c.conn_timeout;
+  http_conn::m_timeouts = t;
+  half_open_table::get_instance()->set_limit(c.half_open_per_ip);
+}
+
+/**
+ * @brief 运行一个事件循环
+ * @details 先绑核，再分配并初始化本线程使用的连接表、缓冲区池、指标分片与日志环形缓冲区
+ * (后几项在第一次使用时分配)，内核按 first-touch 把这些页放在本地 NUMA 节点上
+ *
+ * @param admin_fd 旧进程交来的管理端口监听 socket，只有 0 号使用
+ */
+void WebServer::run(int admin_fd) {
+  if (m_cpu >= 0 && !affinity_pin(m_cpu)) {
+    LOG_WARN("affinity: pin event loop %d to cpu %d failed", m_index, m_cpu);
+  }
+  // 预分配http_conn对象，按 fd 索引
+  // http_conn 只含连接的常驻字段，请求缓冲区在处理请求时才挂载，
+  // 表项在对应 fd 第一次使用时才占用物理内存
+  users = new http_conn[m_max_fd];
+  users_timer = new client_data[m_max_fd];
+  http_conn::m_conn_trig = m_config.conn_trig;
+  http_conn::m_buffer_pool_limit = m_config.buffer_pool;
+  http_conn::m_read_budget = m_config.io_read_budget;
+  http_conn::m_write_budget = m_config.io_write_budget;
+  apply_timeouts(m_config);
+
+  eventListen(admin_fd);
+  eventLoop();
+  m_proxy.close_idle();
+  http_conn::free_buffer_pool();
+  coro::async_call::free_pool();
+  coro::frame_pool_trim();
+}
+
+void* WebServer::reactor_worker(void* arg) {
+  WebServer* reactor = (WebServer*)arg;
+  reactor->run(-1);
+  return nullptr;
+}
+
+/**
+ * @brief 初始化本事件循环的 Epoll
+ * @details 1. 创建epoll实例并注册监听套接字
+ * 2. 注册信号管道的读端，管道与信号处理函数在 start 中统一设置
+ * 3. 0 号事件循环另外打开管理端口，热升级启动时通知旧进程
+ */
+void WebServer::eventListen(int admin_fd) {
+  // 定时器周期，timer_handler 用它重新设定闹钟
+  utils.init(m_config.timeslot);
+
+  // 1. 创建epoll对象
   m_epollfd = epoll_create(5);
   assert(m_epollfd != -1);
   http_conn::m_epollfd = m_epollfd;
   Utils::u_epollfd = m_epollfd;
 
-  // 6. 将监听socket(listenfd)加入Epoll
-  utils.addfd(m_epollfd, m_listenfd, false, 1);
-  // 7. 创建管道
-  ret = socketpair(PF_UNIX, SOCK_STREAM, 0, m_pipefd);
-  assert(ret != -1);
-  Utils::u_pipefd = m_pipefd;
-  // 8. 设置管道写端为非阻塞
-  utils.setnonblocking(m_pipefd[1]);
+  // 将监听socket(listenfd)加入Epoll
+  utils.addfd(m_epollfd, m_listenfd, false, m_config.listen_trig);
 
-  // 9. 设置读端为 LT 非阻塞,并加入epoll监听
+  // 2. 管道读端为 LT 非阻塞,并加入epoll监听
   utils.addfd(m_epollfd, m_pipefd[0], false, 0);
 
-  // 10. 设置信号处理函数
-  utils.addsig(SIGPIPE, SIG_IGN);
-  utils.addsig(SIGALRM, utils.sig_handler, false);
-  utils.addsig(SIGTERM, utils.sig_handler, false);
+  // 准入控制
+  m_admission.init(m_config.admission);
+
+  // 低时延轮询
+  m_spin_ns = (uint64_t)m_config.spin_us * 1000;
+  apply_busy_poll();
+
+  // 上游连接与客户端连接注册在同一个 epoll 中
+  m_proxy.init(m_epollfd);
+  http_conn::m_proxy = &m_proxy;
+  // 协程等待的 fd 与定时器也由本事件循环处理
+  m_coro.init(m_epollfd);
+
+  if (m_index != 0) {
+    return;
+  }
 
-  // 11. 启动第一次定时闹钟
-  alarm(m_TIMESLOT);
+  // 3. 内部管理端口，导出 Prometheus 指标
+  m_admin.add_handler(m_config.metrics_path,
+                      [](const std::string&, std::string&) {
+                        return metrics::get_instance()->render();
+                      });
+  m_admin.add_handler("/debug/trace",
+                      [](const std::string&, std::string& content_type) {
+                        content_type = "application/json";
+                        return tracer::get_instance()->dump_json();
+                      });
+  std::string topology = m_topology;
+  m_admin.add_handler("/debug/topology",
+                      [topology](const std::string&, std::string& content_type) {
+                        content_type = "application/json";
+                        return topology;
+                      });
+  if (m_config.db_conns > 0) {
+    m_admin.add_async_handler("/auth/users", handle_user_page);
+  }
+  m_admin.init(m_epollfd, m_config.admin_addr, m_config.admin_port, admin_fd);
+
+  // 热升级启动：已经开始监听，通知旧进程停止 accept
+  if (m_handoff_fd >= 0) {
+    char ready = HANDOFF_READY;
+    send(m_handoff_fd, &ready, 1, MSG_NOSIGNAL);
+    close(m_handoff_fd);
+    m_handoff_fd = -1;
+  }
 }
 
 /**
@@ -116,22 +472,24 @@ void WebServer::eventListen() {
  *
  * @param connfd 连接文件
  * @param client_address 客户端接口
+ * @param half_open accept 时已计入半开计数
  */
-void WebServer::timer(int connfd, struct sockaddr_in client_address) {
-  users[connfd].init(connfd, client_address);
+void WebServer::timer(int connfd, struct sockaddr_in client_address,
+                      bool half_open) {
+  users[connfd].init(connfd, client_address, half_open);
 
   // 初始化定时器数据
   users_timer[connfd].address = client_address;
   users_timer[connfd].sockfd = connfd;
+  users_timer[connfd].conn = &users[connfd];
 
   // 创建定时器节点
   util_timer* timer = new util_timer;
   timer->user_data = &users_timer[connfd];
   timer->cb_func = cb_func;
 
-  // 设置绝对超时时间
-  time_t cur = time(nullptr);
-  timer->expire = cur + 3 * m_TIMESLOT;
+  // 设置绝对超时时间，新连接处于等待请求头的阶段
+  timer->expire = users[connfd].deadline(time(nullptr));
   users_timer[connfd].timer = timer;
 
   // 加入链表
@@ -139,8 +497,7 @@ void WebServer::timer(int connfd, struct sockaddr_in client_address) {
 }
 
 void WebServer::adjust_timer(util_timer* timer) {
-  time_t cur = time(nullptr);
-  timer->expire = cur + 3 * m_TIMESLOT;
+  timer->expire = timer->user_data->conn->deadline(time(nullptr));
   utils.m_timer_lst.adjust_timer(timer);
 }
 
@@ -162,6 +519,8 @@ void WebServer::deal_timer(util_timer* timer, int sockfd) {
 
 /**
  * @brief 处理新的客户端连接请求
+ * @details ET 模式循环 accept 直到队列为空；LT 模式每个事件只 accept 一个，
+ * 队列中剩下的连接会再次触发事件
  *
  * @return true 成功处理所有挂起的连接请求
  * @return false 过程中发生严重错误
@@ -169,32 +528,662 @@ void WebServer::deal_timer(util_timer* timer, int sockfd) {
 bool WebServer::deal_client_data() {
   struct sockaddr_in client_address;
   socklen_t client_addrlength = sizeof(client_address);
+  int accepted = 0;
+  m_accept_pending = false;
 
-  while (true) {
+  do {
+    // ET 模式下 accept 风暴不能占满一轮，剩下的连接留在监听队列中，下一轮继续
+    if (m_config.accept_budget > 0 && accepted++ >= m_config.accept_budget) {
+      m_accept_pending = true;
+      metrics::inc(metrics::local()->budget_accept);
+      break;
+    }
+    uint64_t start_ns = metrics_now_ns();
+    uint64_t trace_begin = TRACE_ON() ? tracer::now() : 0;
     int connfd = accept(m_listenfd, (struct sockaddr*)&client_address,
                         &client_addrlength);
     if (connfd < 0) {
       if (errno == EAGAIN || errno == EWOULDBLOCK) {
         break;
       }
+      LOG_ERROR("%s:errno is:%d", "accept error", errno);
       return false;
     }
 
-    if (http_conn::m_user_count >= MAX_FD) {
-      utils.show_error(connfd, "Internal server busy");
-      close(connfd);
+    if (connfd >= m_max_fd) {
+      reject_connection(connfd, m_admission.busy_response(),
+                        m_admission.busy_response_len());
+      LOG_ERROR("%s", "Internal server busy");
+      metrics::inc(metrics::local()->rejected);
+      continue;
+    }
+    // 过载时新连接不再进入事件循环，直接返回 503
+    if (m_admission.overloaded()) {
+      reject_connection(connfd, m_admission.busy_response(),
+                        m_admission.busy_response_len());
+      metrics::inc(metrics::local()->shed);
+      continue;
+    }
+    // 超过限流的客户端在占用连接表项之前拒绝
+    rate_limiter* limiter = rate_limiter::get_instance();
+    if (limiter->conn_limited() &&
+        !limiter->allow_connection(client_address.sin_addr.s_addr)) {
+      reject_connection(connfd, limiter->response(), limiter->response_len());
+      metrics::inc(metrics::local()->ratelimit_conn);
       continue;
     }
-    timer(connfd, client_address);
+    // 新连接从 accept 起就是半开的，同一 IP 的半开请求过多时同样返回 429
+    half_open_table* half_open = half_open_table::get_instance();
+    bool counted = false;
+    if (half_open->enabled()) {
+      if (!half_open->acquire(client_address.sin_addr.s_addr)) {
+        reject_connection(connfd, limiter->response(),
+                          limiter->response_len());
+        metrics::inc(metrics::local()->half_open_rejected);
+        continue;
+      }
+      counted = true;
+    }
+    timer(connfd, client_address, counted);
+    metrics::inc(metrics::local()->accepted);
+    metrics::record_phase(PHASE_ACCEPT, metrics_now_ns() - start_ns);
+    if (TRACE_ON()) {
+      tracer::record(TRACE_ACCEPT, connfd, trace_begin, tracer::now());
+    }
+  } while (m_config.listen_trig == 1);
+  return true;
+}
+
+/**
+ * @brief 处理连接的读事件
+ * @details 读入数据后解析请求，排队太久时按准入控制拒绝；
+ * 读到预算上限且请求还不完整时，连接进入就绪列表，下一轮继续读
+ *
+ * @param sockfd 连接
+ * @param delay_ns 事件的排队时延，从就绪列表恢复时为 0
+ */
+void WebServer::deal_read(int sockfd, uint64_t delay_ns) {
+  util_timer* timer = users_timer[sockfd].timer;
+
+  // 读一次数据
+  if (!users[sockfd].read_once()) {
+    deal_timer(timer, sockfd);
+  } else if (m_admission.enabled() && !m_admission.admit(delay_ns)) {
+    // 排队太久的请求直接返回 503，发送完毕后关闭连接
+    metrics::inc(metrics::local()->shed);
+    if (!users[sockfd].shed(m_admission.busy_response(),
+                            m_admission.busy_response_len())) {
+      deal_timer(timer, sockfd);
+    }
+  } else if (!users[sockfd].process()) {
+    deal_timer(timer, sockfd);
+  } else if (timer) {
+    // 处理之后连接可能进入了新的阶段
+    adjust_timer(timer);
+  }
+  // 关闭的连接 resume_events 为 0
+  if (users[sockfd].resume_events() != 0) {
+    m_ready.push_back(sockfd);
+  }
+}
+
+/**
+ * @brief 处理连接的写事件
+ * @details 发送到预算上限仍没有发完时，连接进入就绪列表，下一轮继续发送
+ *
+ * @param sockfd 连接
+ */
+void WebServer::deal_write(int sockfd) {
+  util_timer* timer = users_timer[sockfd].timer;
+
+  // 写一次数据
+  if (users[sockfd].write()) {
+    if (timer) {
+      adjust_timer(timer);
+    }
+  } else {
+    deal_timer(timer, sockfd);
+  }
+  if (users[sockfd].resume_events() != 0) {
+    m_ready.push_back(sockfd);
+  }
+}
+
+/**
+ * @brief 继续上一轮用完预算的连接与 accept
+ * @details 这些连接的 EPOLLONESHOT 没有重置，epoll 不会再报告它们，只能从就绪列表恢复。
+ * 它们排在本轮的新事件之后，小请求不必等大块的读写。
+ * 连接在本轮被关闭或 fd 被新连接复用时 resume_events 为 0，直接跳过
+ *
+ * @param accept_resume 上一轮 accept 到预算上限，本轮还没有处理过监听 socket
+ */
+void WebServer::resume_ready(bool accept_resume) {
+  for (size_t i = 0; i < m_resume.size(); i++) {
+    int sockfd = m_resume[i];
+    int ev = users[sockfd].resume_events();
+    if (ev == EPOLLIN) {
+      deal_read(sockfd, 0);
+    } else if (ev == EPOLLOUT) {
+      deal_write(sockfd);
+    }
+  }
+  m_resume.clear();
+  // 暂停或关闭了监听 socket 时不再继续，恢复 accept 时 epoll_ctl 会重新报告已有的连接
+  if (accept_resume && m_listenfd >= 0 && !m_accept_paused) {
+    deal_client_data();
+  }
+}
+
+/**
+ * @brief 用预先生成的响应拒绝连接
+ * @details 先读掉已经到达的请求数据，否则关闭时接收缓冲区非空，
+ * 内核会发送 RST，客户端可能收不到响应
+ *
+ * @param connfd 刚 accept 的连接
+ * @param response 响应
+ * @param len 响应长度
+ */
+void WebServer::reject_connection(int connfd, const char* response, int len) {
+  char buf[1024];
+  for (int i = 0; i < 4; i++) {
+    if (recv(connfd, buf, sizeof(buf), MSG_DONTWAIT) <= 0) {
+      break;
+    }
+  }
+  send(connfd, response, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+  close(connfd);
+}
+
+/**
+ * @brief 等待就绪事件
+ * @details 开启准入控制或轮询时先不阻塞地取一次：取到事件说明它们在上一轮处理期间
+ * 就已就绪，最早可能从上一次 epoll_wait 返回时开始排队；
+ * 取不到说明队列已排空，此时退出过载状态，轮询一段时间后再阻塞等待。
+ * 就绪列表非空时只取一次，不轮询也不阻塞
+ *
+ * @param[out] ready_ns 这批事件最早可能开始排队的时间
+ * @return int 就绪事件数
+ */
+int WebServer::wait_events(uint64_t& ready_ns) {
+  // 阻塞等待不超过协程最近的定时器；上一轮有没用完的读写或 accept 时不阻塞
+  bool pending = !m_ready.empty() || m_accept_pending;
+  int wait_ms = pending ? 0 : m_coro.next_timeout(m_wait_ms);
+  if (!m_admission.enabled() && m_config.spin_us == 0) {
+    return epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, wait_ms);
+  }
+  uint64_t now = metrics_now_ns();
+  int num = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, 0);
+  if (num == 0 && pending) {
+    // 就绪列表中还有工作，不算排空，也不轮询
+    ready_ns = now;
+  } else if (num == 0) {
+    if (m_admission.enabled()) {
+      m_admission.drained(now);
+      sync_admission();
+    }
+    num = spin_events(now);
+    if (num == 0) {
+      num = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, wait_ms);
+      // 阻塞之后等到了事件，流量可能已经恢复，逐步加长轮询
+      if (num > 0 && m_spin_ns < (uint64_t)m_config.spin_us * 1000) {
+        m_spin_ns = std::min((uint64_t)m_config.spin_us * 1000,
+                             std::max(m_spin_ns * 2, (uint64_t)1000));
+      }
+    }
+    now = metrics_now_ns();
+    ready_ns = now;
+  } else {
+    ready_ns = m_last_poll_ns;
+  }
+  m_last_poll_ns = now;
+  return num;
+}
+
+/**
+ * @brief 阻塞等待之前不阻塞地轮询 epoll
+ * @details 事件在轮询期间到达时省去一次线程睡眠与唤醒。轮询时长自适应：
+ * 等到事件时恢复为 spin_us，落空时减半，空闲时很快不再轮询，
+ * 阻塞等到事件后再逐步加长，见 wait_events
+ *
+ * @param start_ns 开始轮询的时间
+ * @return int 就绪事件数，时长用完仍没有事件时返回 0
+ */
+int WebServer::spin_events(uint64_t start_ns) {
+  if (m_spin_ns == 0) {
+    return 0;
+  }
+  uint64_t deadline = start_ns + m_spin_ns;
+  do {
+    int num = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, 0);
+    if (num != 0) {
+      if (num > 0) {
+        m_spin_ns = (uint64_t)m_config.spin_us * 1000;
+        metrics::inc(metrics::local()->spin_hits);
+      }
+      return num;
+    }
+  } while (metrics_now_ns() < deadline);
+  m_spin_ns /= 2;
+  metrics::inc(metrics::local()->spin_misses);
+  return 0;
+}
+
+/**
+ * @brief 设置内核的 busy poll
+ * @details 连接继承监听 socket 的 SO_BUSY_POLL 与 SO_PREFER_BUSY_POLL，
+ * 修改后只对新连接生效；epoll 的 busy poll 用 EPIOCSPARAMS(Linux 6.9 起)按实例设置，
+ * 更早的内核只能通过 sysctl net.core.busy_poll 全局打开。
+ * busy poll 只对支持 NAPI 的网卡有效，回环连接上没有作用
+ */
+void WebServer::apply_busy_poll() {
+  int usecs = m_config.busy_poll_us;
+  int prefer = m_config.prefer_busy_poll;
+  if (m_listenfd >= 0 &&
+      (setsockopt(m_listenfd, SOL_SOCKET, SO_BUSY_POLL, &usecs,
+                  sizeof(usecs)) != 0 ||
+       setsockopt(m_listenfd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &prefer,
+                  sizeof(prefer)) != 0) &&
+      (usecs > 0 || prefer > 0)) {
+    LOG_WARN("busy poll: setsockopt failed, errno is:%d", errno);
+  }
+  struct epoll_params params;
+  memset(&params, 0, sizeof(params));
+  params.busy_poll_usecs = usecs;
+  params.prefer_busy_poll = prefer;
+  if (ioctl(m_epollfd, EPIOCSPARAMS, &params) != 0 &&
+      (usecs > 0 || prefer > 0)) {
+    LOG_WARN("busy poll: EPIOCSPARAMS failed, errno is:%d", errno);
+  }
+}
+
+/**
+ * @brief 根据准入控制的状态暂停或恢复 accept，过载时关闭空闲长连接
+ * @details 暂停 accept 时把监听 socket 的事件清空，新连接留在内核的监听队列中；
+ * 恢复时重新设置 EPOLLIN，epoll_ctl 会检查当前状态，已有的连接会立即触发事件
+ */
+void WebServer::sync_admission() {
+  metrics_shard* shard = metrics::local();
+  shard->overloaded.store(m_admission.overloaded(), std::memory_order_relaxed);
+
+  bool pause = m_admission.stop_accepting();
+  if (pause != m_accept_paused && m_listenfd >= 0) {
+    epoll_event event = {};
+    event.data.fd = m_listenfd;
+    event.events = pause ? 0 : listen_events();
+    epoll_ctl(m_epollfd, EPOLL_CTL_MOD, m_listenfd, &event);
+    m_accept_paused = pause;
+    shard->accept_paused.store(pause, std::memory_order_relaxed);
+    LOG_WARN("admission: %s accepting", pause ? "stop" : "resume");
+  }
+
+  if (m_admission.overloaded()) {
+    int batch = m_admission.idle_close_batch();
+    close_idle_connections(batch, batch * 4);
+  }
+}
+
+/**
+ * @brief 关闭空闲连接
+ * @details 定时器链表按超时时间排序，从表头开始找空闲的连接，
+ * 过载时只关闭一批并限制扫描长度，避免遍历整个链表；排空时全部关闭
+ *
+ * @param limit 最多关闭的连接数
+ * @param scan 最多检查的连接数
+ */
+void WebServer::close_idle_connections(int limit, int scan) {
+  util_timer* timer = utils.m_timer_lst.front();
+  while (timer != nullptr && limit > 0 && scan-- > 0) {
+    util_timer* next = timer->next;
+    int sockfd = timer->user_data->sockfd;
+    if (users[sockfd].idle()) {
+      deal_timer(timer, sockfd);
+      limit--;
+      if (!m_draining) {
+        metrics::inc(metrics::local()->idle_closed);
+      }
+    }
+    timer = next;
+  }
+}
+
+/**
+ * @brief 从旧进程接收监听 socket
+ * @details 环境变量 MWS_UPGRADE_FD 存在说明本进程由旧进程热升级启动，
+ * 交接失败时直接退出，旧进程会读到 EOF 并继续服务
+ *
+ * @param[out] listen_fds 对外服务端口的监听 socket，旧进程每个事件循环一个
+ * @param[out] admin_fd 管理端口的监听 socket，没有时为 -1
+ * @return true 监听 socket 来自旧进程
+ */
+bool WebServer::inherit_listeners(std::vector<int>& listen_fds,
+                                  int& admin_fd) {
+  const char* env = getenv(UPGRADE_FD_ENV);
+  if (env == nullptr) {
+    return false;
+  }
+  m_handoff_fd = atoi(env);
+  unsetenv(UPGRADE_FD_ENV);
+  fcntl(m_handoff_fd, F_SETFD, FD_CLOEXEC);
+
+  std::vector<int> fds;
+  std::string roles;
+  if (!handoff_recv(m_handoff_fd, fds, roles)) {
+    LOG_ERROR("upgrade: receive listen sockets failed, errno is:%d", errno);
+    Log::get_instance()->stop();
+    exit(1);
+  }
+  for (size_t i = 0; i < fds.size(); i++) {
+    if (roles[i] == HANDOFF_HTTP) {
+      listen_fds.push_back(fds[i]);
+    } else if (roles[i] == HANDOFF_ADMIN) {
+      admin_fd = fds[i];
+    } else {
+      close(fds[i]);
+    }
+  }
+  if (listen_fds.empty()) {
+    LOG_ERROR("%s", "upgrade: no http listen socket received");
+    Log::get_instance()->stop();
+    exit(1);
   }
+  LOG_INFO("upgrade: inherited %d listen sockets from pid %d",
+           (int)fds.size(), (int)getppid());
   return true;
 }
 
+/**
+ * @brief 开始热升级
+ * @details 用启动时的命令行 exec 新进程并交出监听 socket，
+ * 在新进程回复就绪之前本进程照常 accept，两个进程共享同一组监听队列，
+ * 不会丢失连接。各事件循环的监听 socket 都交出去，发送期间持有 m_listen_lock，
+ * 防止其他事件循环同时关闭它们
+ */
+void WebServer::start_upgrade() {
+  if (m_handoff_fd >= 0 || m_draining || m_listenfd < 0 || m_argv.empty()) {
+    LOG_WARN("%s", "upgrade: ignored, upgrade or drain already in progress");
+    return;
+  }
+  int sock = -1;
+  // 新进程继承本线程的绑核设置，fork 前恢复为进程原本可用的 CPU
+  if (m_cpu >= 0) {
+    affinity_set(m_allowed_cpus);
+  }
+  pid_t pid = handoff_spawn(m_argv, sock);
+  if (m_cpu >= 0) {
+    affinity_pin(m_cpu);
+  }
+  if (pid < 0) {
+    LOG_ERROR("upgrade: spawn %s failed, errno is:%d", m_argv[0].c_str(),
+              errno);
+    return;
+  }
+
+  std::vector<int> fds;
+  std::string roles;
+  m_listen_lock.lock();
+  for (size_t i = 0; i < m_reactors.size(); i++) {
+    if (m_reactors[i]->m_listenfd >= 0) {
+      fds.push_back(m_reactors[i]->m_listenfd);
+      roles.push_back((char)HANDOFF_HTTP);
+    }
+  }
+  if (m_admin.listen_fd() >= 0) {
+    fds.push_back(m_admin.listen_fd());
+    roles.push_back((char)HANDOFF_ADMIN);
+  }
+  bool sent = handoff_send(sock, fds, roles);
+  m_listen_lock.unlock();
+  if (!sent) {
+    LOG_ERROR("upgrade: send listen sockets failed, errno is:%d", errno);
+    close(sock);
+    return;
+  }
+
+  m_handoff_fd = sock;
+  m_upgrade_pid = pid;
+  epoll_event event = {};
+  event.data.fd = m_handoff_fd;
+  event.events = EPOLLIN | EPOLLRDHUP;
+  epoll_ctl(m_epollfd, EPOLL_CTL_ADD, m_handoff_fd, &event);
+  LOG_INFO("upgrade: started %s as pid %d", m_argv[0].c_str(), (int)pid);
+}
+
+/**
+ * @brief 新进程回复就绪则所有事件循环开始排空，读到 EOF 说明新进程启动失败
+ */
+void WebServer::finish_upgrade() {
+  char reply = 0;
+  ssize_t n = recv(m_handoff_fd, &reply, 1, 0);
+  epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_handoff_fd, 0);
+  close(m_handoff_fd);
+  m_handoff_fd = -1;
+
+  if (n == 1 && reply == HANDOFF_READY) {
+    LOG_INFO("upgrade: pid %d is serving, draining", (int)m_upgrade_pid);
+    m_drain_requested = true;
+    for (size_t i = 1; i < m_reactors.size(); i++) {
+      send(m_reactors[i]->m_pipefd[1], &DRAIN_REQUEST, 1, 0);
+    }
+  } else {
+    LOG_ERROR("upgrade: pid %d failed to start, keep serving",
+              (int)m_upgrade_pid);
+    // 交接 socket 只会在新进程退出时关闭，这里不会阻塞
+    waitpid(m_upgrade_pid, nullptr, 0);
+  }
+  m_upgrade_pid = -1;
+}
+
+/**
+ * @brief 开始排空
+ * @details 关闭监听 socket(热升级时关闭的只是本进程的引用)，
+ * 空闲的长连接立即关闭，正在处理的请求发送完响应后关闭，
+ * 连接全部关闭或超过 drain_timeout 后事件循环退出；
+ * 每个事件循环各自排空，管理端口由 0 号关闭
+ */
+void WebServer::begin_drain() {
+  if (m_draining) {
+    return;
+  }
+  m_draining = true;
+  http_conn::m_draining = true;
+  m_drain_deadline = time(nullptr) + m_config.drain_timeout;
+  m_wait_ms = 100;
+
+  if (m_listenfd >= 0) {
+    m_primary->m_listen_lock.lock();
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, 0);
+    close(m_listenfd);
+    m_listenfd = -1;
+    m_primary->m_listen_lock.unlock();
+  }
+  if (m_index == 0) {
+    m_admin.close_all();
+  }
+  m_proxy.close_idle();
+  close_idle_connections(m_max_fd, m_max_fd);
+  LOG_INFO("draining %d connections, deadline %ds", http_conn::m_user_count,
+           m_config.drain_timeout);
+}
+
+// 限流规则在启动时换算并由各线程共享，修改需要重启或热升级
+static bool ratelimit_changed(const rate_limit_config& a,
+                              const rate_limit_config& b) {
+  if (a.conn.rate != b.conn.rate || a.conn.burst != b.conn.burst ||
+      a.request.rate != b.request.rate || a.request.burst != b.request.burst ||
+      a.entries != b.entries || a.retry_after_s != b.retry_after_s ||
+      a.paths.size() != b.paths.size()) {
+    return true;
+  }
+  for (size_t i = 0; i < a.paths.size(); i++) {
+    if (a.paths[i].prefix != b.paths[i].prefix ||
+        a.paths[i].rate != b.paths[i].rate ||
+        a.paths[i].burst != b.paths[i].burst) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// 上游表在启动时解析并由各线程共享，修改需要重启或热升级
+static bool proxy_changed(const proxy_config& a, const proxy_config& b) {
+  if (a.pool_size != b.pool_size || a.connect_timeout != b.connect_timeout ||
+      a.timeout != b.timeout || a.max_fails != b.max_fails ||
+      a.fail_timeout != b.fail_timeout || a.routes.size() != b.routes.size()) {
+    return true;
+  }
+  for (size_t i = 0; i < a.routes.size(); i++) {
+    if (a.routes[i].prefix != b.routes[i].prefix ||
+        a.routes[i].servers != b.routes[i].servers ||
+        a.routes[i].balance != b.routes[i].balance) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @brief 重新加载配置
+ * @details 配置文件读取或校验失败时保持原配置。端口、缓冲区大小、日志与追踪
+ * 只在启动时生效，修改后需要重启或热升级(SIGUSR2，新进程会重新读取配置文件)；
+ * 其余各项立即生效，已有连接不受影响：
+ * 连接的触发模式在下一次重置 EPOLLONESHOT 时切换，超时时间在下一次活动时生效。
+ * 每个事件循环收到 SIGHUP 后各自重新加载，只有 0 号输出日志
+ */
+void WebServer::reload_config() {
+  server_config next;
+  std::string error;
+  if (!m_conf.reload(next, error)) {
+    if (m_index == 0) {
+      LOG_ERROR("reload: %s, keep current configuration", error.c_str());
+    }
+    return;
+  }
+
+  const server_config& cur = m_config;
+  const char* restart_only[] = {
+      next.threads != cur.threads ? "threads" : nullptr,
+      next.cpu_affinity != cur.cpu_affinity ? "cpu_affinity" : nullptr,
+      next.cpu_list != cur.cpu_list ? "cpu_list" : nullptr,
+      next.incoming_cpu != cur.incoming_cpu ? "incoming_cpu" : nullptr,
+      ratelimit_changed(next.ratelimit, cur.ratelimit) ? "ratelimit" : nullptr,
+      proxy_changed(next.proxy, cur.proxy) ? "proxy" : nullptr,
+      next.asset_snapshot != cur.asset_snapshot ? "asset_snapshot" : nullptr,
+      next.asset_gzip_min != cur.asset_gzip_min ? "asset_gzip_min" : nullptr,
+      next.port != cur.port ? "port" : nullptr,
+      next.admin_port != cur.admin_port ? "admin_port" : nullptr,
+      next.admin_addr != cur.admin_addr ? "admin_addr" : nullptr,
+      next.metrics_path != cur.metrics_path ? "metrics_path" : nullptr,
+      next.read_buffer != cur.read_buffer ? "read_buffer" : nullptr,
+      next.write_buffer != cur.write_buffer ? "write_buffer" : nullptr,
+      next.close_log != cur.close_log ? "close_log" : nullptr,
+      next.log_ring != cur.log_ring ? "log_ring" : nullptr,
+      next.access_log_dir != cur.access_log_dir ? "access_log_dir" : nullptr,
+      next.capture_dir != cur.capture_dir ? "capture_dir" : nullptr,
+      next.capture_limit_mb != cur.capture_limit_mb ? "capture_limit_mb"
+                                                     : nullptr,
+      next.trace_events != cur.trace_events ? "trace_events" : nullptr,
+      next.db_host != cur.db_host ? "db_host" : nullptr,
+      next.db_port != cur.db_port ? "db_port" : nullptr,
+      next.db_user != cur.db_user ? "db_user" : nullptr,
+      next.db_password != cur.db_password ? "db_password" : nullptr,
+      next.db_name != cur.db_name ? "db_name" : nullptr,
+      next.db_conns != cur.db_conns ? "db_conns" : nullptr,
+      next.db_cache_mb != cur.db_cache_mb ? "db_cache_mb" : nullptr,
+      next.db_batch_rows != cur.db_batch_rows ? "db_batch_rows" : nullptr,
+      next.db_batch_delay_ms != cur.db_batch_delay_ms ? "db_batch_delay_ms"
+                                                       : nullptr,
+      next.auth_hash_threads != cur.auth_hash_threads ? "auth_hash_threads"
+                                                       : nullptr,
+  };
+  for (size_t i = 0; i < sizeof(restart_only) / sizeof(restart_only[0]); i++) {
+    if (m_index == 0 && restart_only[i] != nullptr) {
+      LOG_WARN("reload: %s changed, takes effect after restart or upgrade",
+               restart_only[i]);
+    }
+  }
+
+  if (m_listenfd >= 0 && next.backlog != cur.backlog) {
+    // 对已经在监听的 socket 再次调用 listen 只会修改队列长度
+    listen(m_listenfd, next.backlog);
+  }
+  m_config.backlog = next.backlog;
+  if (next.listen_trig != cur.listen_trig) {
+    m_config.listen_trig = next.listen_trig;
+    if (m_listenfd >= 0 && !m_accept_paused) {
+      epoll_event event = {};
+      event.data.fd = m_listenfd;
+      event.events = listen_events();
+      epoll_ctl(m_epollfd, EPOLL_CTL_MOD, m_listenfd, &event);
+    }
+  }
+  m_config.conn_trig = next.conn_trig;
+  http_conn::m_conn_trig = next.conn_trig;
+  m_config.buffer_pool = next.buffer_pool;
+  http_conn::m_buffer_pool_limit = next.buffer_pool;
+  m_config.io_read_budget = next.io_read_budget;
+  http_conn::m_read_budget = next.io_read_budget;
+  m_config.io_write_budget = next.io_write_budget;
+  http_conn::m_write_budget = next.io_write_budget;
+  m_config.accept_budget = next.accept_budget;
+  m_config.timeslot = next.timeslot;
+  utils.init(next.timeslot);
+  m_config.conn_timeout = next.conn_timeout;
+  m_config.header_timeout = next.header_timeout;
+  m_config.body_timeout = next.body_timeout;
+  m_config.body_min_rate = next.body_min_rate;
+  m_config.keepalive_timeout = next.keepalive_timeout;
+  m_config.write_timeout = next.write_timeout;
+  m_config.half_open_per_ip = next.half_open_per_ip;
+  apply_timeouts(m_config);
+  m_config.drain_timeout = next.drain_timeout;
+  m_config.spin_us = next.spin_us;
+  m_spin_ns = (uint64_t)next.spin_us * 1000;
+  if (next.busy_poll_us != cur.busy_poll_us ||
+      next.prefer_busy_poll != cur.prefer_busy_poll) {
+    m_config.busy_poll_us = next.busy_poll_us;
+    m_config.prefer_busy_poll = next.prefer_busy_poll;
+    apply_busy_poll();
+  }
+
+  // 准入控制重新开始观察，之前的过载状态与暂停 accept 一并解除
+  m_config.admission = next.admission;
+  m_admission = admission();
+  m_admission.init(m_config.admission);
+  sync_admission();
+
+  if (m_index != 0) {
+    return;
+  }
+  if (password_hasher::get_instance()->set_iterations(
+          next.auth_hash_iterations)) {
+    m_config.auth_hash_iterations = next.auth_hash_iterations;
+  } else {
+    LOG_ERROR("reload: auth_hash_iterations unchanged, no random source");
+  }
+  // 重新扫描文档根目录，加入新增的模板
+  template_cache::get_instance()->load(doc_root);
+  LOG_INFO("reload: configuration reloaded from %s, trigger %s/%s",
+           m_conf.file().empty() ? "command line" : m_conf.file().c_str(),
+           m_config.listen_trig ? "ET" : "LT",
+           m_config.conn_trig ? "ET" : "LT");
+}
+
+uint32_t WebServer::listen_events() const {
+  uint32_t events = EPOLLIN | EPOLLRDHUP;
+  if (m_config.listen_trig == 1) {
+    events |= EPOLLET;
+  }
+  return events;
+}
+
 /**
  * @brief 处理从信号管道接收到的信号
  *
  * @param[out] timeout 如果收到 SIGALRM,此值将被置为 true
- * @param[out] stop_server 如果收到 SIGTERM,此值将被置为 true
+ * @param[out] stop_server 需要立即退出时置为 true
+ * 收到 SIGTERM 时先排空已有连接，排空期间再次收到或 drain_timeout 为 0 时立即退出；
+ * 收到 SIGUSR1 时导出请求追踪记录，收到 SIGUSR2 时热升级(这两项只由 0 号处理)，
+ * 收到 SIGHUP 时重新加载配置，收到 DRAIN_REQUEST 时开始排空
  * @return false 读取管道失败或管道为空
  */
 bool WebServer::deal_signal(bool& timeout, bool& stop_server) {
@@ -213,7 +1202,32 @@ bool WebServer::deal_signal(bool& timeout, bool& stop_server) {
           break;
         }
         case SIGTERM: {
-          stop_server = true;
+          if (m_draining || m_config.drain_timeout <= 0) {
+            stop_server = true;
+          } else {
+            m_drain_requested = true;
+          }
+          break;
+        }
+        case SIGUSR2: {
+          if (m_index == 0) {
+            start_upgrade();
+          }
+          break;
+        }
+        case SIGHUP: {
+          reload_config();
+          break;
+        }
+        case SIGUSR1: {
+          // 导出请求追踪记录到当前目录
+          if (m_index == 0 && g_trace_enabled) {
+            tracer::get_instance()->dump_file(".");
+          }
+          break;
+        }
+        case DRAIN_REQUEST: {
+          m_drain_requested = true;
           break;
         }
       }
@@ -227,19 +1241,59 @@ bool WebServer::deal_signal(bool& timeout, bool& stop_server) {
 void WebServer::eventLoop() {
   bool timeout = false;
   bool stop_server = false;
+  bool admission_window = false;
+  uint64_t ready_ns = 0;
+  m_last_poll_ns = metrics_now_ns();
 
   while (!stop_server) {
-    int num = epoll_wait(m_epollfd, events, MAX_EVENT_NUMBER, -1);
+    int num = wait_events(ready_ns);
 
     if (num < 0 && errno != EINTR) {
       break;
     }
+    // 本轮要继续的连接与 accept，本轮再用完预算的留到下一轮
+    m_resume.swap(m_ready);
+    bool accept_resume = m_accept_pending;
+    m_accept_pending = false;
 
     for (int i = 0; i < num; i++) {
       int sockfd = events[i].data.fd;
 
+      // 事件的排队时延，只在开启准入控制时测量
+      uint64_t delay_ns = 0;
+      if (m_admission.enabled()) {
+        uint64_t now = metrics_now_ns();
+        delay_ns = now - ready_ns;
+        metrics::record_phase(PHASE_QUEUE, delay_ns);
+        if (m_admission.observe(delay_ns, now)) {
+          admission_window = true;
+        }
+      }
+
+      // 上游连接的事件带有标记，先于按 fd 的分发检查
+      if (proxy::owns_event(events[i])) {
+        bool keep = true;
+        int client = m_proxy.handle_event(events[i], keep);
+        if (client >= 0) {
+          util_timer* timer = users_timer[client].timer;
+          if (!keep) {
+            deal_timer(timer, client);
+          } else if (timer) {
+            adjust_timer(timer);
+          }
+        }
+      }
+      // 协程等待的 fd，在事件循环中直接恢复协程
+      else if (coro::scheduler::owns_event(events[i])) {
+        m_coro.handle_event(events[i]);
+      }
       // 1. 新连接到来
-      if (sockfd == m_listenfd) {
+      else if (sockfd == m_listenfd) {
+        // 已暂停 accept，忽略暂停前已经取到的事件
+        if (m_accept_paused) {
+          continue;
+        }
+        accept_resume = false;
         bool flag = deal_client_data();
         if (false == flag) {
           continue;
@@ -249,48 +1303,152 @@ void WebServer::eventLoop() {
       else if ((sockfd == m_pipefd[0]) && (events[i].events & EPOLLIN)) {
         bool flag = deal_signal(timeout, stop_server);
         if (false == flag) {
-          printf("deal signal failure\n");
+          LOG_ERROR("%s", "deal signal failure");
         }
+      }
+      // 3. 热升级中新进程的回复
+      else if (sockfd == m_handoff_fd) {
+        finish_upgrade();
+      }
+      // 内部管理端口
+      else if (m_admin.owns(sockfd)) {
+        m_admin.handle_event(sockfd, events[i].events);
       } else if (events[i].events & (EPOLLRDHUP | EPOLLHUP)) {
         util_timer* timer = users_timer[sockfd].timer;
         deal_timer(timer, sockfd);
       }
-      // 4. 处理读事件
-      else if (events[i].events & EPOLLIN) {
+      // 正在转发的请求：客户端可写，或者还有请求体要读
+      else if (users[sockfd].proxying()) {
         util_timer* timer = users_timer[sockfd].timer;
-
-        // 读一次数据
-        if (users[sockfd].read_once()) {
-          if (timer) {
-            adjust_timer(timer);
-          }
-          users[sockfd].process();
-        } else {
+        if (!m_proxy.client_event(&users[sockfd])) {
           deal_timer(timer, sockfd);
+        } else if (timer) {
+          adjust_timer(timer);
         }
       }
+      // 4. 处理读事件
+      else if (events[i].events & EPOLLIN) {
+        deal_read(sockfd, delay_ns);
+      }
       // 处理写事件
       else if (events[i].events & EPOLLOUT) {
-        util_timer* timer = users_timer[sockfd].timer;
-
-        // 写一次数据
-        if (users[sockfd].write()) {
-          if (timer) {
-            adjust_timer(timer);
-          }
-        } else {
-          deal_timer(timer, sockfd);
-        }
+        deal_write(sockfd);
       }
     }
+    // 新事件处理完之后，继续上一轮没有读写完的连接
+    resume_ready(accept_resume);
+    // 恢复定时器到期的协程，协程可能在本批事件中设定了新的定时器
+    m_coro.run_timers();
     if (timeout) {
-      utils.timer_handler();
+      // 闹钟是进程级的，只由 0 号重新设定
+      if (m_index == 0) {
+        utils.timer_handler();
+        // 限流表由各事件循环共享，0 号每次扫描八分之一
+        rate_limiter::get_instance()->evict_stale(m_config.ratelimit.entries /
+                                                  8);
+        // 模板由各事件循环共享，0 号检查文件是否有变化
+        template_cache::get_instance()->refresh();
+      } else {
+        utils.m_timer_lst.tick();
+      }
+      if (upstream_table::get_instance()->enabled()) {
+        std::vector<int> expired;
+        m_proxy.check_timeouts(expired);
+        for (size_t i = 0; i < expired.size(); i++) {
+          deal_timer(users_timer[expired[i]].timer, expired[i]);
+        }
+      }
       timeout = false;
     }
+    // 在一批事件处理完之后关闭连接，避免本批中还有它们的事件
+    if (admission_window) {
+      sync_admission();
+      admission_window = false;
+    }
+    // 与关闭空闲连接一样，排空要等本批事件处理完再开始
+    if (m_drain_requested) {
+      begin_drain();
+      m_drain_requested = false;
+    }
+    if (m_draining && (http_conn::m_user_count <= 0 ||
+                       time(nullptr) >= m_drain_deadline)) {
+      LOG_INFO("drain finished, %d connections left",
+               http_conn::m_user_count);
+      stop_server = true;
+    }
   }
 }
 
+/**
+ * @brief 启动服务器
+ * @details 1. 准备监听 socket 与各事件循环
+ * 2. 为每个事件循环创建信号管道，设置信号处理函数及定时器
+ * 3. 选择 CPU，启动其余事件循环的线程，0 号在当前线程运行
+ */
 void WebServer::start() {
-  eventListen();
-  eventLoop();
+  log_write();
+  int admin_fd = -1;
+  setup_listeners(admin_fd);
+
+  // 每个事件循环一个信号管道，信号处理函数把信号写入每一个管道
+  for (size_t i = 0; i < m_reactors.size(); i++) {
+    WebServer* reactor = m_reactors[i];
+    if (socketpair(PF_UNIX, SOCK_STREAM, 0, reactor->m_pipefd) != 0) {
+      LOG_ERROR("signal pipe for event loop %d failed, errno is:%d", (int)i,
+                errno);
+      Log::get_instance()->stop();
+      exit(1);
+    }
+    // 设置管道写端为非阻塞
+    utils.setnonblocking(reactor->m_pipefd[1]);
+    m_signal_fds.push_back(reactor->m_pipefd[1]);
+  }
+  Utils::u_pipefd = m_signal_fds.data();
+  Utils::u_pipe_count = (int)m_signal_fds.size();
+
+  // 设置信号处理函数
+  utils.addsig(SIGPIPE, SIG_IGN);
+  utils.addsig(SIGALRM, utils.sig_handler, false);
+  utils.addsig(SIGTERM, utils.sig_handler, false);
+  utils.addsig(SIGUSR1, utils.sig_handler, false);
+  utils.addsig(SIGUSR2, utils.sig_handler, false);
+  utils.addsig(SIGHUP, utils.sig_handler, false);
+
+  // 启动第一次定时闹钟
+  alarm(m_config.timeslot);
+
+  rate_limiter::get_instance()->init(m_config.ratelimit);
+  if (!upstream_table::get_instance()->init(m_config.proxy) ||
+      !load_assets() || !init_auth()) {
+    Log::get_instance()->stop();
+    exit(1);
+  }
+  template_cache::get_instance()->load(doc_root);
+
+  place_reactors();
+  for (size_t i = 1; i < m_reactors.size(); i++) {
+    int ret = pthread_create(&m_reactors[i]->m_thread, nullptr,
+                             reactor_worker, m_reactors[i]);
+    if (ret != 0) {
+      LOG_ERROR("start event loop %d failed, errno is:%d", (int)i, ret);
+      Log::get_instance()->stop();
+      exit(1);
+    }
+  }
+  run(admin_fd);
+
+  for (size_t i = 1; i < m_reactors.size(); i++) {
+    pthread_join(m_reactors[i]->m_thread, nullptr);
+  }
+  // 其余事件循环的管道随对象关闭，之后到达的信号不再写入
+  Utils::u_pipe_count = 1;
+  for (size_t i = 1; i < m_reactors.size(); i++) {
+    delete m_reactors[i];
+  }
+  m_admin.close_all();
+  access_log::get_instance()->close();
+  capture::get_instance()->close();
+  sql_write_batcher::GetInstance()->Stop();
+  password_hasher::get_instance()->stop();
+  Log::get_instance()->stop();
 }
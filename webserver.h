@@ -5,6 +5,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/epoll.h>
@@ -12,65 +13,169 @@
 #include <unistd.h>
 
 #include <cassert>
+#include <string>
+#include <vector>
 
+#include "config.h"
+#include "coro/scheduler.h"
+#include "http/admission.h"
 #include "http/http_conn.h"
 #include "lock/locker.h"
+#include "metrics/admin_server.h"
+#include "proxy/proxy.h"
 #include "timer/lst_timer.h"
-// 最大文件描述符数量
-const int MAX_FD = 65536;
+// 连接表大小上限，实际按 RLIMIT_NOFILE 分配
+const int MAX_FD = 1048576;
 // 最大事件数
 const int MAX_EVENT_NUMBER = 10000;
-const int TIMESLOT = 5;
 
 /**
  * @class WebServer
  * @brief WebServer类用于封装所有操作
- *
+ * @details 每个对象是一个事件循环(reactor)：自己的监听 socket、epoll、
+ * 信号管道、连接表与定时器链表，连接从 accept 到关闭都在同一个线程中处理。
+ * main 创建的对象是 0 号事件循环，在主线程运行，另外负责管理端口、热升级与闹钟；
+ * threads 大于 1 时由它创建其余事件循环并各自启动一个线程，
+ * 各监听 socket 以 SO_REUSEPORT 绑定同一端口，由内核分配新连接
  */
 class WebServer {
  public:
   WebServer();
   ~WebServer();
 
-  // 初始化服务器配置（端口，数据库等）
-  void init(int port);
+  // 初始化服务器配置，保留配置来源以便 SIGHUP 时重新加载
+  void init(const Config& config);
+  // 保存命令行，热升级时用同样的参数启动新进程
+  void set_command_line(int argc, char* argv[]);
 
-  // 启动服务器
+  // 启动服务器，所有事件循环退出后返回
   void start();
 
   // 用于存储所有连接的客户端信息
   http_conn* users;
 
  private:
-  // 初始化网络通信（socket, bind, listen)
-  void eventListen();
+  // 初始化日志
+  void log_write();
+  // 创建或继承监听 socket，决定事件循环数量，没有可用的监听 socket 时退出
+  void setup_listeners(int& admin_fd);
+  // 创建一个监听 socket，reuseport 为 true 时设置 SO_REUSEPORT，失败返回 -1
+  int open_listener(bool reuseport);
+  // 其余事件循环从 0 号复制配置
+  void init_reactor(WebServer* primary, int index, int listenfd);
+  // 按绑核策略为各事件循环选择 CPU，记录并输出拓扑
+  void place_reactors();
+  // 生成或加载资源快照，失败返回 false
+  bool load_assets();
+  // 连接数据库、读入用户并注册登录接口，db_conns 为 0 时什么都不做，失败返回 false
+  bool init_auth();
+  // 绑核、分配连接表并运行事件循环，在事件循环自己的线程中调用
+  void run(int admin_fd);
+  static void* reactor_worker(void* arg);
+  // 初始化 epoll 与信号管道
+  void eventListen(int admin_fd);
   // 启动事件循环
   void eventLoop();
   // 初始化新连接的定时器
-  void timer(int connfd, struct sockaddr_in client_address);
-  // 如果有数据传输,延长定时器
+  void timer(int connfd, struct sockaddr_in client_address, bool half_open);
+  // 连接进入新的阶段或有了新的活动,按阶段重新计算超时时间
   void adjust_timer(util_timer* timer);
   // 删除定时器并关闭连接
   void deal_timer(util_timer* timer, int sockfd);
   // 处理客户端新连接
   bool deal_client_data();
+  // 连接可读：读入数据并处理请求，delay_ns 为事件的排队时延
+  void deal_read(int sockfd, uint64_t delay_ns);
+  // 连接可写：发送响应
+  void deal_write(int sockfd);
+  // 继续上一轮用完预算的连接与 accept
+  void resume_ready(bool accept_resume);
   // 处理信号
   bool deal_signal(bool& timeout, bool& stop_server);
+  // 等待就绪事件，ready_ns 返回这批事件最早可能开始排队的时间
+  int wait_events(uint64_t& ready_ns);
+  // 阻塞等待之前轮询 epoll，时长用完仍没有事件时返回 0
+  int spin_events(uint64_t start_ns);
+  // 设置监听 socket 与 epoll 实例的内核 busy poll
+  void apply_busy_poll();
+  // 准入控制窗口结束或队列排空后，同步 accept 状态与指标
+  void sync_admission();
+  // 用预先生成的响应(503/429)拒绝刚 accept 的连接
+  void reject_connection(int connfd, const char* response, int len);
+  // 按最近活动时间从旧到新关闭空闲连接，最多关闭 limit 个、检查 scan 个
+  void close_idle_connections(int limit, int scan);
+
+  // 热升级：从旧进程接收监听 socket，没有交接时返回 false
+  bool inherit_listeners(std::vector<int>& listen_fds, int& admin_fd);
+  // 热升级：启动新进程并交出监听 socket
+  void start_upgrade();
+  // 热升级：新进程回复就绪或退出
+  void finish_upgrade();
+  // 停止 accept，等待已有连接处理完毕
+  void begin_drain();
+  // SIGHUP：重新加载配置，只套用运行期间可以安全修改的部分
+  void reload_config();
+  // 监听 socket 关注的事件，与 listen_trig 对应
+  uint32_t listen_events() const;
 
  public:
   // 基础属性
-  int m_port;
+  Config m_conf;           // 配置来源，SIGHUP 时重新加载
+  server_config m_config;  // 当前生效的配置
+
+  // 事件循环
+  int m_index;             // 事件循环编号，0 号在主线程运行
+  WebServer* m_primary;    // 0 号事件循环
+  std::vector<WebServer*> m_reactors;  // 全部事件循环，只在 0 号中保存
+  pthread_t m_thread;      // 运行本事件循环的线程
+  int m_cpu;               // 绑定的 CPU，-1 表示不绑核
+  std::string m_topology;  // 启动时选择的拓扑(JSON)，/debug/topology 导出
+  std::vector<int> m_allowed_cpus;  // 进程原本可用的 CPU，热升级 fork 前恢复
+  std::vector<int> m_signal_fds;  // 各事件循环信号管道的写端，只在 0 号中保存
+  locker m_listen_lock;    // 保护各事件循环的 m_listenfd，只使用 0 号的
+
+  // 准入控制
+  admission m_admission;
+  bool m_accept_paused;    // 是否已暂停 accept
+  uint64_t m_last_poll_ns; // 上一次 epoll_wait 返回的时间
+  int m_wait_ms;           // epoll_wait 的超时，排空时需要定期检查截止时间
+  uint64_t m_spin_ns;      // 当前的轮询时长，随轮询是否落空自适应调整
+
+  // 读写与 accept 预算
+  std::vector<int> m_ready;   // 本轮用完预算、下一轮继续的连接
+  std::vector<int> m_resume;  // 本轮要继续的连接，与 m_ready 交替使用
+  bool m_accept_pending;      // accept 到预算上限，监听队列中可能还有连接
+
+  // 热升级与优雅退出
+  std::vector<std::string> m_argv;  // 启动新进程的命令行
+  bool m_draining;         // 是否正在排空
+  bool m_drain_requested;  // 本批事件处理完后开始排空
+  time_t m_drain_deadline; // 排空截止时间
+  int m_handoff_fd;        // 与新进程/旧进程交接的 Unix socket，-1 表示没有
+  pid_t m_upgrade_pid;     // 升级中的新进程
+
+  // 内部管理端口(/metrics 等)
+  admin_server m_admin;
+
+  // 反向代理：本事件循环的上游连接池与正在进行的转发
+  proxy m_proxy;
+
+  // 本事件循环中协程的 fd 等待与定时器
+  coro::scheduler m_coro;
 
   // Epoll相关
   int m_epollfd;
   int m_listenfd;
   epoll_event events[MAX_EVENT_NUMBER];
 
+  // 连接表(users/users_timer)的大小，能 accept 到的 fd 都小于它；
+  // fd 在进程内共享，每个事件循环的连接表都按这个大小分配，只有用到的表项占用物理内存
+  int m_max_fd;
+
   // 定时器资源
   client_data* users_timer;
   Utils utils;
   int m_pipefd[2];
   // int m_listenfd;
-  int m_TIMESLOT;
 };
 #endif